@@ -0,0 +1,380 @@
+#include <stdio.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include <time.h>
+
+#include "core/types.h"
+#include "core/debug.h"
+#include "core/io.h"
+#include "core/memory.h"
+#include "core/wire.h"
+
+#include "cpu/i8087.h"
+#include "cpu/i8086.h"
+#include "cpu/i8086jit.h"
+#include "cpu/i8086batch.h"
+#include "cpu/i8086diag.h"
+
+#include "device/ram.h"
+
+
+#if defined(I8086_JIT)
+#define BENCH_CORE  "jit"
+#elif defined(I8086_THREADED)
+#define BENCH_CORE  "threaded"
+#else
+#define BENCH_CORE  "table"
+#endif
+
+
+enum {
+
+	BENCH_CODE = 0x1000,  // 0100:0000
+	BENCH_DATA = 0x20000, // 2000:0000
+
+	BENCH_INSTANCES = 256,  // Most CPUs run round-robin
+	BENCH_SLICE     = 1000, // Instructions per turn in round-robin runs
+	BENCH_LANES     = 256,  // Most CPUs in a lockstep batch
+	BENCH_PROFILE   = 4,    // Profiler bucket size, log2 bytes
+	BENCH_HOTSPOTS  = 8     // Hot spots reported per program
+
+};
+
+
+struct bench {
+
+	const char *name;
+
+	const u8 *code;
+	uint      length;
+
+};
+
+
+
+static const u8 bench_alu[] = {
+
+	0x31, 0xf6,               //     xor  si, si
+	0xb9, 0x00, 0x10,         //     mov  cx, 4096
+	0x03, 0x40, 0x04,         // l:  add  ax, [bx + si + 4]
+	0x31, 0xc2,               //     xor  dx, ax
+	0x46,                     //     inc  si
+	0x89, 0x11,               //     mov  [bx + di], dx
+	0x80, 0xfa, 0x10,         //     cmp  dl, 16
+	0x72, 0x01,               //     jb   n
+	0x90,                     //     nop
+	0xe2, 0xf0,               // n:  loop l
+	0xeb, 0xe9                //     jmp  0
+
+};
+
+
+static const u8 bench_memory[] = {
+
+	0x31, 0xf6,               //     xor  si, si
+	0xb9, 0x00, 0x10,         //     mov  cx, 4096
+	0x8b, 0x80, 0x34, 0x12,   // l:  mov  ax, [bx + si + 0x1234]
+	0x8b, 0x91, 0x00, 0x02,   //     mov  dx, [bx + di + 0x0200]
+	0x88, 0x47, 0x10,         //     mov  [bx + 0x10], al
+	0x89, 0x87, 0x00, 0x30,   //     mov  [bx + 0x3000], ax
+	0x03, 0x40, 0x04,         //     add  ax, [bx + si + 4]
+	0x31, 0xc2,               //     xor  dx, ax
+	0x46,                     //     inc  si
+	0x89, 0x11,               //     mov  [bx + di], dx
+	0x80, 0xfa, 0x10,         //     cmp  dl, 16
+	0x72, 0x01,               //     jb   n
+	0x90,                     //     nop
+	0xe2, 0xe1,               // n:  loop l
+	0xeb, 0xda                //     jmp  0
+
+};
+
+
+static const u8 bench_branch[] = {
+
+	0x31, 0xf6,               //     xor  si, si
+	0xb9, 0x00, 0x10,         //     mov  cx, 4096
+	0xac,                     // l:  lodsb
+	0x0a, 0xc0,               //     or   al, al
+	0x74, 0x01,               //     jz   n
+	0x40,                     //     inc  ax
+	0xa8, 0x01,               // n:  test al, 1
+	0x75, 0x01,               //     jnz  m
+	0x43,                     //     inc  bx
+	0x3c, 0x80,               // m:  cmp  al, 0x80
+	0x73, 0x01,               //     jae  k
+	0x42,                     //     inc  dx
+	0x49,                     // k:  dec  cx
+	0x75, 0xed,               //     jnz  l
+	0xeb, 0xe6                //     jmp  0
+
+};
+
+
+// Registers only, for the batch engine to run in lockstep
+static const u8 bench_lanes[] = {
+
+	0xb9, 0x00, 0x10,         //     mov  cx, 4096
+	0x01, 0xd8,               // l:  add  ax, bx
+	0x31, 0xc2,               //     xor  dx, ax
+	0x01, 0xd3,               //     add  bx, dx
+	0x3c, 0x40,               //     cmp  al, 0x40
+	0x72, 0x01,               //     jb   n
+	0x46,                     //     inc  si
+	0x09, 0xd2,               // n:  or   dx, dx
+	0x74, 0x01,               //     jz   m
+	0x4f,                     //     dec  di
+	0x49,                     // m:  dec  cx
+	0x75, 0xed,               //     jnz  l
+	0xeb, 0xe8                //     jmp  0
+
+};
+
+
+static const struct bench benches[] = {
+
+	{ "alu",    bench_alu,    sizeof(bench_alu)    },
+	{ "memory", bench_memory, sizeof(bench_memory) },
+	{ "branch", bench_branch, sizeof(bench_branch) },
+	{ "lanes",  bench_lanes,  sizeof(bench_lanes)  }
+
+};
+
+
+
+double bench_time()
+{
+
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+
+}
+
+
+
+void bench_setup(i8086 *cpu, const struct bench *b)
+{
+
+	for (uint n=0; n < 65536; n++)
+		cpu->memory.mem.base[BENCH_DATA + n] = n * 7 + (n >> 8);
+
+	memcpy(&cpu->memory.mem.base[BENCH_CODE], b->code, b->length);
+
+	i8086_reset(cpu);
+
+	i8086_reg_set(cpu, REG_CS, BENCH_CODE >> 4);
+	i8086_reg_set(cpu, REG_DS, BENCH_DATA >> 4);
+	i8086_reg_set(cpu, REG_ES, BENCH_DATA >> 4);
+	i8086_reg_set(cpu, REG_SS, BENCH_DATA >> 4);
+	i8086_reg_set(cpu, REG_IP, 0);
+
+	cpu->regs.scs = BENCH_CODE >> 4;
+	cpu->regs.sip = 0;
+
+}
+
+
+
+double bench_run(i8086 *cpu, const struct bench *b, uint count, uint rounds, u64 *cycles, u64 *fused)
+{
+
+	double best = 0.0;
+
+	for (uint n=0; n < rounds; n++) {
+
+		bench_setup(cpu, b);
+
+		const u64    base  = cpu->cycles;
+		const u64    pairs = cpu->fused;
+		const double start = bench_time();
+		i8086_run(cpu, count);
+		const double time = bench_time() - start;
+
+		*cycles = cpu->cycles - base;
+		*fused  = cpu->fused - pairs;
+
+		if (n == 0 || time < best)
+			best = time;
+
+	}
+
+	return best;
+
+}
+
+
+
+// Copies of one CPU sharing its memory take turns running short slices, so
+// that each has to bring its own state back into the cache. The slowdown with
+// the number of instances shows the cache footprint of a CPU
+double bench_instances(i8086 *cpus, uint instances, const struct bench *b, uint count)
+{
+
+	bench_setup(&cpus[0], b);
+
+	for (uint n=1; n < instances; n++)
+		memcpy(&cpus[n], &cpus[0], sizeof(i8086));
+
+	const double start = bench_time();
+
+	for (uint left=count; left > 0;)
+		for (uint n=0; n < instances && left > 0; n++) {
+
+			const uint slice = (left < BENCH_SLICE)? left: BENCH_SLICE;
+
+			i8086_run(&cpus[n], slice);
+			left -= slice;
+
+		}
+
+	return bench_time() - start;
+
+}
+
+
+
+// The lanes program on CPUs sharing memory but each with its own registers, run
+// one after the other or stepped in lockstep by the batch engine
+double bench_batch(i8086 *cpus, uint lanes, uint count, bool lockstep, double *vector)
+{
+
+	struct i8086_batch batch;
+
+	bench_setup(&cpus[0], &benches[3]);
+
+	for (uint n=0; n < lanes; n++) {
+
+		if (n > 0)
+			memcpy(&cpus[n], &cpus[0], sizeof(i8086));
+
+		i8086_reg_set(&cpus[n], REG_AX, n * 0x9e37);
+		i8086_reg_set(&cpus[n], REG_BX, n * 0x7f4b + 1);
+		i8086_reg_set(&cpus[n], REG_DX, n);
+
+	}
+
+	const uint steps = count / lanes;
+	double     start = bench_time();
+
+	if (!lockstep) {
+
+		for (uint n=0; n < lanes; n++)
+			i8086_run(&cpus[n], steps);
+
+		*vector = 0.0;
+		return bench_time() - start;
+
+	}
+
+	if (!i8086_batch_init(&batch, cpus, lanes))
+		return 0.0;
+
+	start = bench_time();
+	i8086_batch_run(&batch, steps);
+
+	const double time = bench_time() - start;
+
+	*vector = 100.0 * batch.vector / (batch.vector + batch.scalar);
+	i8086_batch_free(&batch);
+
+	return time;
+
+}
+
+
+
+int main(int argc, char **argv)
+{
+
+	RAM ram;
+	i8086 *cpus = aligned_alloc(64, BENCH_INSTANCES * sizeof(i8086));
+	i8086 *cpu  = &cpus[0];
+
+	const uint count  = (argc > 1)? strtoul(argv[1], NULL, 0): 100000000;
+	const uint rounds = (argc > 2)? strtoul(argv[2], NULL, 0): 3;
+
+	ram_alloc(&ram, 1*1024*1024);
+	memset(ram.base, 0, ram.length);
+
+	i8086_init(cpu);
+
+	cpu->memory.mem = ram;
+	memory_a20gate(&cpu->memory.mem, false); // A20 gate disable
+
+#ifdef I8086_JIT
+	i8086_jit_init(cpu, I8086_JIT_THRESHOLD, I8086_JIT_LIMIT);
+#endif
+
+	printf("Core: %s, %u instructions, best of %u\n\n", BENCH_CORE, count, rounds);
+
+	for (int n=0; n < sizeof(benches) / sizeof(benches[0]); n++) {
+
+		u64          cycles, fused;
+		const double time = bench_run(cpu, &benches[n], count, rounds, &cycles, &fused);
+
+		printf("%-12s %8.3f s  %8.1f Minsn/s  %8.1f MHz  %5.1f%% fused\n", benches[n].name, time, count / time * 1e-6, cycles / time * 1e-6, 200.0 * fused / count);
+
+	}
+
+	printf("\nCPU state: %zu bytes, %zu hot, round-robin in slices of %u\n\n",
+		sizeof(i8086), offsetof(i8086, iob), BENCH_SLICE);
+
+	for (uint instances=1; instances <= BENCH_INSTANCES; instances *= 16)
+		for (int n=0; n < sizeof(benches) / sizeof(benches[0]); n++) {
+
+			char         name[32];
+			const double time = bench_instances(cpus, instances, &benches[n], count);
+
+			snprintf(name, sizeof(name), "%s x%u", benches[n].name, instances);
+			printf("%-12s %8.3f s  %8.1f Minsn/s\n", name, time, count / time * 1e-6);
+
+		}
+
+	printf("\nLockstep batch of the lanes program, at least %u lanes at an instruction to vectorize\n\n", I8086_BATCH_MIN);
+
+	for (uint lanes=16; lanes <= BENCH_LANES; lanes *= 4)
+		for (int lockstep=0; lockstep < 2; lockstep++) {
+
+			char         name[32];
+			double       vector;
+			const double time = bench_batch(cpus, lanes, count, lockstep, &vector);
+
+			snprintf(name, sizeof(name), "%s x%u", lockstep? "batch": "serial", lanes);
+			printf("%-12s %8.3f s  %8.1f Minsn/s  %5.1f%% vector\n", name, time, count / time * 1e-6, vector);
+
+		}
+
+
+	printf("\nProfiled, by buckets of %u bytes\n\n", 1u << BENCH_PROFILE);
+
+	struct i8086_profile prof;
+
+	if (!i8086_profile_init(&prof, BENCH_PROFILE))
+		return 1;
+
+	for (int n=0; n < sizeof(benches) / sizeof(benches[0]); n++) {
+
+		bench_setup(cpu, &benches[n]);
+		i8086_profile_reset(&prof);
+		i8086_profile_start(&prof, cpu);
+
+		const double start = bench_time();
+		i8086_run(cpu, count);
+		const double time = bench_time() - start;
+
+		i8086_profile_stop(&prof, cpu);
+
+		printf("%-12s %8.3f s  %8.1f Minsn/s\n\n", benches[n].name, time, count / time * 1e-6);
+		i8086_profile_report(&prof, cpu, BENCH_HOTSPOTS);
+
+	}
+
+	i8086_profile_free(&prof);
+
+}
@@ -25,11 +25,16 @@ enum {
 
 typedef void (io_fn)(void *data, u16 port, uint mode, uint *value);
 
+// Block transfer of count elements between port and buf, for string I/O. Returns
+// how many were moved, the rest go through rd or wr one at a time
+typedef uint (io_str_fn)(void *data, u16 port, uint mode, void *buf, uint count);
+
 
 struct io {
 
-	io_fn *rd;
-	io_fn *wr;
+	io_fn     *rd;
+	io_fn     *wr;
+	io_str_fn *str;  // NULL if the port has no block transfer
 
 	void *data;
 
@@ -42,6 +47,7 @@ static void io_nop(void *data, u16 port, uint mode, uint *v) {}
 static inline void io_init(struct io *io) {
 	io->rd = &io_nop;
 	io->wr = &io_nop;
+	io->str = NULL;
 	io->data = NULL;
 }
 
@@ -57,5 +63,26 @@ static void io_writeb(struct io *io, u16 port, uint v) { io->wr(io->data, port,
 static void io_writew(struct io *io, u16 port, uint v) { io->wr(io->data, port, IO_WR16, &v); }
 
 
+// String I/O of count bytes or words, as mode says, in a single call when the port
+// can take it. Words in buf are little-endian and need not be aligned
+static void io_reads(struct io *io, u16 port, uint mode, void *buf, uint count) {
+	u8  *p = buf;
+	uint n = (io->str != NULL)? io->str(io->data, port, mode, buf, count): 0;
+	for (; n < count; n++) {
+		uint v=0; io->rd(io->data, port, mode, &v);
+		if (IO_RD16(mode)) { p[2*n] = v; p[2*n+1] = v >> 8; } else p[n] = v;
+	}
+}
+
+static void io_writes(struct io *io, u16 port, uint mode, const void *buf, uint count) {
+	const u8 *p = buf;
+	uint      n = (io->str != NULL)? io->str(io->data, port, mode, (void*)buf, count): 0;
+	for (; n < count; n++) {
+		uint v = (IO_WR16(mode))? p[2*n] | p[2*n+1] << 8: p[n];
+		io->wr(io->data, port, mode, &v);
+	}
+}
+
+
 #endif
 
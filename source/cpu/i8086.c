@@ -1,5 +1,6 @@
 
 
+#include <stdio.h>
 #include <stddef.h>
 #include <stdbool.h>
 #include <stdint.h>
@@ -13,7 +14,18 @@
 #include "core/wire.h"
 
 
+#include "cpu/i8087.h"
 #include "cpu/i8086.h"
+#include "cpu/i8086jit.h"
+
+#include "util/memscan.h"
+
+
+// The translator falls back to single steps between blocks, so it has no use
+// for the threaded core
+#if defined(I8086_THREADED) && defined(I8086_JIT)
+#error "I8086_THREADED and I8086_JIT are exclusive"
+#endif
 
 
 typedef u32 ureg;
@@ -27,7 +39,7 @@ enum {
 	OP_W16   = 1 << 9,  // Is 16-bit operation
 	OP_RSEG  = 1 << 10, // REG in MODRM is segment register
 	OP_GROUP = 1 << 11, // Group opcode, REG field of MODRM is operation
-	OP_OVRD  = 1 << 12, // Opcode is override, keep flags
+	OP_OVRD  = 1 << 12, // Opcode is a prefix, folded into the next one
 	OP_R02   = 1 << 13, // Lowest 3 bits of opcode is register
 
 	OP_RMB  = OP_MODRM | OP_W8,
@@ -48,6 +60,10 @@ enum {
 	OP_G9  =  9 | OP_RMW | OP_GROUP,
 	OP_G10 = 10 | OP_RMB | OP_GROUP,
 	OP_G11 = 11 | OP_RMW | OP_GROUP,
+	OP_G12 = 12 | OP_RMB | OP_GROUP,
+	OP_G13 = 13 | OP_RMW | OP_GROUP,
+	OP_G14 = 14 | OP_RMB | OP_GROUP,
+	OP_G15 = 15 | OP_RMW | OP_GROUP,
 
 
 	OP_MODRM_REG_AX_AL = 0 << 0,
@@ -93,13 +109,61 @@ enum {
 };
 
 
+enum {
+
+	LAZY_NONE = 0,  // All arithmetic flags are held in cpu->flags
+	LAZY_PZS,       // P, Z, S follow the result, C, A, V are held in cpu->flags
+	LAZY_LOG,       // P, Z, S follow the result, C, A, V are clear
+	LAZY_INC,       // All but C follow the operation, C is held in cpu->flags
+	LAZY_ADD        // All arithmetic flags follow the operation
+
+};
+
+
+enum {
+
+	REP_CHUNK = 4096  // Most elements a bulk REP string operation moves between interrupt checks
+
+};
+
+
+enum {
+
+	CYCLES_INTR = 81  // Hardware interrupt, NMI or single-step trap
+
+};
+
+
+// Cycles a taken conditional branch adds to the not taken cost, by model
+static const u8 branchcycles[I8086_MODEL_COUNT] = {
+	[I8086_MODEL_8088]  = 12,  // Jcc 16 taken, 4 not
+	[I8086_MODEL_80186] = 9    // Jcc 13 taken, 4 not
+};
+
+
+enum {
+	DECODE_PREFIXES = 15,      // Longest run of prefixes folded into one instruction
+	OPCODE_COUNT    = I8086_OPCODES,     // Entries of the opcode table
+	OPCODE_BREAK    = 0x192,             // Stop at a breakpoint, no opcode decodes to it
+	OPCODE_MEM      = OPCODE_COUNT,      // Dispatch index of the memory forms of ModRM handlers
+	OPCODE_FUSED    = 2 * OPCODE_COUNT   // Dispatch index of the fused instruction pairs
+};
+
+
 #define CPU  i8086 *cpu
 
 #define SEGMENT(s)  (cpu->memory.selector[(s)])
 
 #define UNDEF(x)   do { if (!(x)) return op_undef(cpu); } while (0)
-#define REGONLY()  UNDEF(!cpu->insn.op_memory)
-#define MEMONLY()  UNDEF(cpu->insn.op_memory)
+#define REGONLY()  UNDEF(!mem)
+#define MEMONLY()  UNDEF(mem)
+
+#define CYCLES(n)  do { cpu->cycles += (n); } while (0)
+#define BRANCH(x)  do { cpu->regs.ip += (x); CYCLES(branchcycles[cpu->model]); } while (0)
+
+// String operations cost once cycles on their own, or each cycles per element
+// on top of the REP prefix
+#define STRCYCLES(once, each)  CYCLES((cpu->insn.repeat_eq || cpu->insn.repeat_ne)? (each): (once))
 
 #define ADVSP(x)  do { cpu->regs.sp.w += (x); } while (0)
 
@@ -108,22 +172,34 @@ enum {
 #define ADVSIW()  do { cpu->regs.si.w += (cpu->flags.d)? -2: +2; } while (0)
 #define ADVDIW()  do { cpu->regs.di.w += (cpu->flags.d)? -2: +2; } while (0)
 
-#define LOCKR0MB()  u8  *ptr = ((cpu->insn.op_memory)? (u8*) memlock(cpu, cpu->insn.segment, cpu->insn.addr, 1): cpu->insn.reg0b)
-#define LOCKR1MB()  u8  *ptr = ((cpu->insn.op_memory)? (u8*) memlock(cpu, cpu->insn.segment, cpu->insn.addr, 1): cpu->insn.reg1b)
-#define LOCKR0MW()  u16 *ptr = ((cpu->insn.op_memory)? (u16*)memlock(cpu, cpu->insn.segment, cpu->insn.addr, 2): cpu->insn.reg0w)
-#define LOCKR1MW()  u16 *ptr = ((cpu->insn.op_memory)? (u16*)memlock(cpu, cpu->insn.segment, cpu->insn.addr, 2): cpu->insn.reg1w)
+// Register operands are offsets into regs rather than pointers, so that the CPU
+// state can be copied around freely
+#define REGOFS(r)  (offsetof(i8086, regs.r) - offsetof(i8086, regs))
+#define REGB(ofs)  (*(u8*) ((u8*)&cpu->regs + (ofs)))
+#define REGW(ofs)  (*(u16*)((u8*)&cpu->regs + (ofs)))
+
+#define REG0B  REGB(cpu->insn.reg0b)
+#define REG1B  REGB(cpu->insn.reg1b)
+#define REG0W  REGW(cpu->insn.reg0w)
+#define REG1W  REGW(cpu->insn.reg1w)
+
+#define LOCKR0MB()  u8  *ptr = ((mem)? (u8*) memlock(cpu, cpu->insn.segment, cpu->insn.addr, 1): &REG0B)
+#define LOCKR1MB()  u8  *ptr = ((mem)? (u8*) memlock(cpu, cpu->insn.segment, cpu->insn.addr, 1): &REG1B)
+#define LOCKR0MW()  u16 *ptr = ((mem)? (u16*)memlock(cpu, cpu->insn.segment, cpu->insn.addr, 2): &REG0W)
+#define LOCKR1MW()  u16 *ptr = ((mem)? (u16*)memlock(cpu, cpu->insn.segment, cpu->insn.addr, 2): &REG1W)
 
 #define LDLCKM()   (*ptr)
-#define STLCKM(x)  do { *ptr = (x); } while (0)
+#define STLCKM(x)  do { *ptr = (x); if (mem) memunlock(cpu, ptr); } while (0)
 
-#define LDMB(seg, ofs)  (*(u8*) memlock(cpu, (seg), (ofs), 1))
-#define LDMW(seg, ofs)  (*(u16*)memlock(cpu, (seg), (ofs), 2))
+#define LDMB(seg, ofs)  (memloadb(cpu, (seg), (ofs), false))
+#define LDMW(seg, ofs)  (memload( cpu, (seg), (ofs), false))
 
-#define STMB(seg, ofs, v)  do { *(u8*) memlock(cpu, (seg), ofs, 1) = (v); } while (0)
-#define STMW(seg, ofs, v)  do { *(u16*)memlock(cpu, (seg), ofs, 2) = (v); } while (0)
+#define STMB(seg, ofs, v)  do { memstoreb(cpu, (seg), (ofs), (v)); } while (0)
+#define STMW(seg, ofs, v)  do { memstore( cpu, (seg), (ofs), (v)); } while (0)
 
-#define LDIPUB()  (cpu->regs.ip += 1, LDMB(REG_CS, cpu->regs.ip - 1))
-#define LDIPUW()  (cpu->regs.ip += 2, LDMW(REG_CS, cpu->regs.ip - 2))
+// Code bytes, never seen by the memory hook
+#define LDIPUB()  (cpu->regs.ip += 1, memloadb(cpu, REG_CS, cpu->regs.ip - 1, true))
+#define LDIPUW()  (cpu->regs.ip += 2, memload( cpu, REG_CS, cpu->regs.ip - 2, true))
 #define LDIPSB()   (i8)LDIPUB()
 #define LDIPSW()  (i16)LDIPUW()
 
@@ -132,15 +208,24 @@ enum {
 #define STEAMB(x, v)  do { STMB(cpu->insn.segment, cpu->insn.addr + (x), (v)); } while (0)
 #define STEAMW(x, v)  do { STMW(cpu->insn.segment, cpu->insn.addr + (x), (v)); } while (0)
 
-#define LDEAR0MB()  ((cpu->insn.op_memory)? LDEAMB(0): *cpu->insn.reg0b)
-#define LDEAR1MB()  ((cpu->insn.op_memory)? LDEAMB(0): *cpu->insn.reg1b)
-#define LDEAR0MW()  ((cpu->insn.op_memory)? LDEAMW(0): *cpu->insn.reg0w)
-#define LDEAR1MW()  ((cpu->insn.op_memory)? LDEAMW(0): *cpu->insn.reg1w)
-
-#define STEAR0MB(x)  do { if (cpu->insn.op_memory) STEAMB(0, (x)); else *cpu->insn.reg0b = (x); } while (0)
-#define STEAR1MB(x)  do { if (cpu->insn.op_memory) STEAMB(0, (x)); else *cpu->insn.reg1b = (x); } while (0)
-#define STEAR0MW(x)  do { if (cpu->insn.op_memory) STEAMW(0, (x)); else *cpu->insn.reg0w = (x); } while (0)
-#define STEAR1MW(x)  do { if (cpu->insn.op_memory) STEAMW(0, (x)); else *cpu->insn.reg1w = (x); } while (0)
+#define LDEAR0MB()  ((mem)? LDEAMB(0): REG0B)
+#define LDEAR1MB()  ((mem)? LDEAMB(0): REG1B)
+#define LDEAR0MW()  ((mem)? LDEAMW(0): REG0W)
+#define LDEAR1MW()  ((mem)? LDEAMW(0): REG1W)
+
+#define STEAR0MB(x)  do { if (mem) STEAMB(0, (x)); else REG0B = (x); } while (0)
+#define STEAR1MB(x)  do { if (mem) STEAMB(0, (x)); else REG1B = (x); } while (0)
+#define STEAR0MW(x)  do { if (mem) STEAMW(0, (x)); else REG0W = (x); } while (0)
+#define STEAR1MW(x)  do { if (mem) STEAMW(0, (x)); else REG1W = (x); } while (0)
+
+// ModRM handlers are written once against mem and built twice: the plain name
+// takes register operands and name_m memory operands, so neither of them has to
+// check the operand kind when it runs
+#define RMHANDLER(fn) \
+	[[gnu::always_inline]] static inline void fn##_rm(CPU, const bool mem); \
+	static void fn(CPU)     { fn##_rm(cpu, false); } \
+	static void fn##_m(CPU) { fn##_rm(cpu, true);  } \
+	static inline void fn##_rm(CPU, const bool mem)
 
 #define LDSPB(n)  LDMB(REG_SS, cpu->regs.sp.w + (n))
 #define LDSPW(n)  LDMW(REG_SS, cpu->regs.sp.w + (n))
@@ -162,7 +247,58 @@ static inline bool parity(ureg x) {
 	return !(x & 1);
 }
 
+static inline bool getf_c(CPU) {
+	switch (cpu->lazy.op) {
+		case LAZY_ADD: return carry(cpu->lazy.x, cpu->lazy.n);
+		case LAZY_LOG: return false;
+		default:       return cpu->flags.c;
+	}
+}
+
+static inline bool getf_p(CPU) {
+	return (cpu->lazy.op != LAZY_NONE)? parity(cpu->lazy.x): cpu->flags.p;
+}
+
+static inline bool getf_a(CPU) {
+	switch (cpu->lazy.op) {
+		case LAZY_ADD:
+		case LAZY_INC: return sign(cpu->lazy.x ^ cpu->lazy.a ^ cpu->lazy.b, 5) != cpu->lazy.d;
+		case LAZY_LOG: return false;
+		default:       return cpu->flags.a;
+	}
+}
+
+static inline bool getf_z(CPU) {
+	return (cpu->lazy.op != LAZY_NONE)? zero(cpu->lazy.x, cpu->lazy.n): cpu->flags.z;
+}
+
+static inline bool getf_s(CPU) {
+	return (cpu->lazy.op != LAZY_NONE)? sign(cpu->lazy.x, cpu->lazy.n): cpu->flags.s;
+}
+
+static inline bool getf_v(CPU) {
+	switch (cpu->lazy.op) {
+		case LAZY_ADD:
+		case LAZY_INC: return vflow(cpu->lazy.x, cpu->lazy.a, cpu->lazy.b, cpu->lazy.n);
+		case LAZY_LOG: return false;
+		default:       return cpu->flags.v;
+	}
+}
+
+static inline void setf_sync(CPU) {
+	if (cpu->lazy.op == LAZY_NONE)
+		return;
+	cpu->flags.c = getf_c(cpu);
+	cpu->flags.p = getf_p(cpu);
+	cpu->flags.a = getf_a(cpu);
+	cpu->flags.z = getf_z(cpu);
+	cpu->flags.s = getf_s(cpu);
+	cpu->flags.v = getf_v(cpu);
+	cpu->lazy.op = LAZY_NONE;
+}
+
 static inline ureg getf_w(CPU) {
+	setf_sync(cpu);
 	ureg flags = 0xf002;
 	if (cpu->flags.c) flags |= 1 <<  0;
 	if (cpu->flags.p) flags |= 1 <<  2;
@@ -177,6 +313,7 @@ static inline ureg getf_w(CPU) {
 }
 
 static inline void setf_lb(CPU, ureg flags) {
+	setf_sync(cpu);
 	cpu->flags.c = bit(flags,  0);
 	cpu->flags.p = bit(flags,  2);
 	cpu->flags.a = bit(flags,  4);
@@ -190,34 +327,36 @@ static inline void setf_w(CPU, ureg flags) {
 	cpu->flags.i = bit(flags,  9);
 	cpu->flags.d = bit(flags, 10);
 	cpu->flags.v = bit(flags, 11);
+	cpu->interrupt.pending = true;  // T or I may have been raised
+}
+
+static inline void setf_lazy(CPU, uint op, uint n, ureg x, ureg a, ureg b, bool d) {
+	cpu->lazy.op = op;
+	cpu->lazy.n  = n;
+	cpu->lazy.x  = x;
+	cpu->lazy.a  = a;
+	cpu->lazy.b  = b;
+	cpu->lazy.d  = d;
 }
 
 static inline void setf_pzs(CPU, uint n, ureg x) {
-	cpu->flags.p = parity(x);
-	cpu->flags.z = zero(x, n);
-	cpu->flags.s = sign(x, n);
+	setf_sync(cpu);
+	setf_lazy(cpu, LAZY_PZS, n, x, 0, 0, false);
 }
 
 static inline ureg setf_add(CPU, uint n, ureg x, ureg a, ureg b, bool d) {
-	cpu->flags.c = carry(x, n);
-	cpu->flags.v = vflow(x, a, b, n);
-	cpu->flags.a = sign(x ^ a ^ b, 5) != d;
-	setf_pzs(cpu, n, x);
+	setf_lazy(cpu, LAZY_ADD, n, x, a, b, d);
 	return x;
 }
 
 static inline ureg setf_inc(CPU, uint n, ureg x, ureg a, ureg b, bool d) {
-	cpu->flags.v = vflow(x, a, b, n);
-	cpu->flags.a = sign(x ^ a ^ b, 5) != d;
-	setf_pzs(cpu, n, x);
+	cpu->flags.c = getf_c(cpu);
+	setf_lazy(cpu, LAZY_INC, n, x, a, b, d);
 	return x;
 }
 
 static inline ureg setf_log(CPU, uint n, ureg x) {
-	cpu->flags.c = false;
-	cpu->flags.v = false;
-	cpu->flags.a = false;
-	setf_pzs(cpu, n, x);
+	setf_lazy(cpu, LAZY_LOG, n, x, 0, 0, false);
 	return x;
 }
 
@@ -227,13 +366,13 @@ static inline void setf_vxt(CPU, uint n, ureg x) { cpu->flags.v = bit(x, n - 1)
 
 static inline ureg add8( CPU, ureg a, ureg b) { return setf_add(cpu,  8, a + b,                a, b, false); }
 static inline ureg add16(CPU, ureg a, ureg b) { return setf_add(cpu, 16, a + b,                a, b, false); }
-static inline ureg adc8( CPU, ureg a, ureg b) { return setf_add(cpu,  8, a + b + cpu->flags.c, a, b, false); }
-static inline ureg adc16(CPU, ureg a, ureg b) { return setf_add(cpu, 16, a + b + cpu->flags.c, a, b, false); }
+static inline ureg adc8( CPU, ureg a, ureg b) { return setf_add(cpu,  8, a + b + getf_c(cpu),  a, b, false); }
+static inline ureg adc16(CPU, ureg a, ureg b) { return setf_add(cpu, 16, a + b + getf_c(cpu),  a, b, false); }
 
 static inline ureg sub8( CPU, ureg a, ureg b) { return setf_add(cpu,  8, a - b,                a, ~b, true); }
 static inline ureg sub16(CPU, ureg a, ureg b) { return setf_add(cpu, 16, a - b,                a, ~b, true); }
-static inline ureg sbb8( CPU, ureg a, ureg b) { return setf_add(cpu,  8, a - b - cpu->flags.c, a, ~b, true); }
-static inline ureg sbb16(CPU, ureg a, ureg b) { return setf_add(cpu, 16, a - b - cpu->flags.c, a, ~b, true); }
+static inline ureg sbb8( CPU, ureg a, ureg b) { return setf_add(cpu,  8, a - b - getf_c(cpu),  a, ~b, true); }
+static inline ureg sbb16(CPU, ureg a, ureg b) { return setf_add(cpu, 16, a - b - getf_c(cpu),  a, ~b, true); }
 
 static inline ureg inc8( CPU, ureg a) { return setf_inc(cpu,  8, a + 1, a,  1, false); }
 static inline ureg inc16(CPU, ureg a) { return setf_inc(cpu, 16, a + 1, a,  1, false); }
@@ -248,31 +387,22 @@ static inline ureg and16(CPU, ureg a, u16 b) { return setf_log(cpu, 16, a & b);
 static inline ureg ior16(CPU, ureg a, u16 b) { return setf_log(cpu, 16, a | b); }
 static inline ureg xor16(CPU, ureg a, u16 b) { return setf_log(cpu, 16, a ^ b); }
 
-static inline u8 shrb(u8 a)         { return a >> 1; }
-static inline u8 shlb(u8 a)         { return a << 1; }
-static inline u8 sarb(u8 a)         { return (i8)a >> 1; }
-static inline u8 salb(u8 a)         { return (i8)a << 1; }
-static inline u8 rorb(u8 a)         { return (a >> 1) | (a << 7); }
-static inline u8 rolb(u8 a)         { return (a << 1) | (a >> 7); }
-static inline u8 rcrb(u8 a, bool c) { return (a >> 1) | (a << 8) | (c << 7); }
-static inline u8 rclb(u8 a, bool c) { return (a << 1) | (a >> 8) | c; }
-
-static inline ureg shrw(u16 a)         { return a >> 1; }
-static inline ureg shlw(u16 a)         { return a << 1; }
-static inline ureg sarw(u16 a)         { return (i16)a >> 1; }
-static inline ureg salw(u16 a)         { return (i16)a << 1; }
-static inline ureg rorw(u16 a)         { return (a >> 1) | (a << 15); }
-static inline ureg rolw(u16 a)         { return (a << 1) | (a >> 15); }
-static inline ureg rcrw(u16 a, bool c) { return (a >> 1) | (a << 16) | (c << 15); }
-static inline ureg rclw(u16 a, bool c) { return (a << 1) | (a >> 16) | c; }
 
 
+// Shifts and rotates in closed form, in constant time for any count. The flags
+// come out as if the 8088 stepped one bit at a time: shifts by the width or more
+// leave CF alone, and OF follows the result even for a count of zero
 
 static ureg rol8(CPU, ureg a, uint b)
 {
 
-	while (b >= 8)            { cpu->flags.c = bit(a, 0); b -= 8; }
-	for (int n=0; n < b; n++) { cpu->flags.c = bit(a, 7); a = rolb(a); }
+	setf_sync(cpu);
+
+	if (b > 0) {
+		const ureg x = (u8)a;
+		a = (u8)(x << (b & 7) | x >> (8 - (b & 7)));
+		cpu->flags.c = bit(a, 0);
+	}
 
 	setf_vxc(cpu, 8, a);
 	return a;
@@ -284,8 +414,13 @@ static ureg rol8(CPU, ureg a, uint b)
 static ureg ror8(CPU, ureg a, uint b)
 {
 
-	while (b >= 8)            { cpu->flags.c = bit(a, 7); b -= 8; }
-	for (int n=0; n < b; n++) { cpu->flags.c = bit(a, 0); a = rorb(a); }
+	setf_sync(cpu);
+
+	if (b > 0) {
+		const ureg x = (u8)a;
+		a = (u8)(x >> (b & 7) | x << (8 - (b & 7)));
+		cpu->flags.c = bit(a, 7);
+	}
 
 	setf_vxt(cpu, 8, a);
 	return a;
@@ -297,8 +432,13 @@ static ureg ror8(CPU, ureg a, uint b)
 static ureg rol16(CPU, ureg a, uint b)
 {
 
-	while (b >= 16)           { cpu->flags.c = bit(a,  0); b -= 16; }
-	for (int n=0; n < b; n++) { cpu->flags.c = bit(a, 15); a = rolw(a); }
+	setf_sync(cpu);
+
+	if (b > 0) {
+		const ureg x = (u16)a;
+		a = (u16)(x << (b & 15) | x >> (16 - (b & 15)));
+		cpu->flags.c = bit(a, 0);
+	}
 
 	setf_vxc(cpu, 16, a);
 	return a;
@@ -310,8 +450,13 @@ static ureg rol16(CPU, ureg a, uint b)
 static ureg ror16(CPU, ureg a, uint b)
 {
 
-	while (b >= 16)           { cpu->flags.c = bit(a, 15); b -= 16; }
-	for (int n=0; n < b; n++) { cpu->flags.c = bit(a,  0); a = rorw(a); }
+	setf_sync(cpu);
+
+	if (b > 0) {
+		const ureg x = (u16)a;
+		a = (u16)(x >> (b & 15) | x << (16 - (b & 15)));
+		cpu->flags.c = bit(a, 15);
+	}
 
 	setf_vxt(cpu, 16, a);
 	return a;
@@ -320,13 +465,20 @@ static ureg ror16(CPU, ureg a, uint b)
 
 
 
+// Rotates through carry turn the 9 or 17 bits of CF:a, so only the count
+// modulo that matters
+
 static ureg rcl8(CPU, ureg a, uint b)
 {
 
-	bool c = cpu->flags.c;
+	setf_sync(cpu);
 
-	while (b >= 9)            { b -= 9; }
-	for (int n=0; n < b; n++) { cpu->flags.c = bit(a, 7); a = rclb(a, c); c = cpu->flags.c; }
+	if ((b %= 9) > 0) {
+		const ureg x = cpu->flags.c << 8 | (u8)a;
+		const ureg y = x << b | x >> (9 - b);
+		a = (u8)y;
+		cpu->flags.c = bit(y, 8);
+	}
 
 	setf_vxc(cpu, 8, a);
 	return a;
@@ -338,10 +490,14 @@ static ureg rcl8(CPU, ureg a, uint b)
 static ureg rcr8(CPU, ureg a, uint b)
 {
 
-	bool c = cpu->flags.c;
+	setf_sync(cpu);
 
-	while (b >= 9)            { b -= 9; }
-	for (int n=0; n < b; n++) { cpu->flags.c = bit(a, 0); a = rcrb(a, c); c = cpu->flags.c; }
+	if ((b %= 9) > 0) {
+		const ureg x = cpu->flags.c << 8 | (u8)a;
+		const ureg y = x >> b | x << (9 - b);
+		a = (u8)y;
+		cpu->flags.c = bit(y, 8);
+	}
 
 	setf_vxt(cpu, 8, a);
 	return a;
@@ -353,10 +509,14 @@ static ureg rcr8(CPU, ureg a, uint b)
 static ureg rcl16(CPU, ureg a, uint b)
 {
 
-	bool c = cpu->flags.c;
+	setf_sync(cpu);
 
-	while (b >= 17)           { b -= 17; }
-	for (int n=0; n < b; n++) { cpu->flags.c = bit(a, 15); a = rclw(a, c); c = cpu->flags.c; }
+	if ((b %= 17) > 0) {
+		const ureg x = cpu->flags.c << 16 | (u16)a;
+		const ureg y = x << b | x >> (17 - b);
+		a = (u16)y;
+		cpu->flags.c = bit(y, 16);
+	}
 
 	setf_vxc(cpu, 16, a);
 	return a;
@@ -368,10 +528,14 @@ static ureg rcl16(CPU, ureg a, uint b)
 static ureg rcr16(CPU, ureg a, uint b)
 {
 
-	bool c = cpu->flags.c;
+	setf_sync(cpu);
 
-	while (b >= 17)           { b -= 17; }
-	for (int n=0; n < b; n++) { cpu->flags.c = bit(a, 0); a = rcrw(a, c); c = cpu->flags.c; }
+	if ((b %= 17) > 0) {
+		const ureg x = cpu->flags.c << 16 | (u16)a;
+		const ureg y = x >> b | x << (17 - b);
+		a = (u16)y;
+		cpu->flags.c = bit(y, 16);
+	}
 
 	setf_vxt(cpu, 16, a);
 	return a;
@@ -383,8 +547,15 @@ static ureg rcr16(CPU, ureg a, uint b)
 static ureg shl8(CPU, ureg a, uint b)
 {
 
-	if (b < 8) for (int n=0; n < b; n++) { cpu->flags.c = bit(a, 7); a = shlb(a); }
-	else       a = 0;
+	setf_sync(cpu);
+
+	if (b >= 8)
+		a = 0;
+
+	else if (b > 0) {
+		cpu->flags.c = bit(a, 8 - b);
+		a = (u8)(a << b);
+	}
 
 	if (b > 0)
 		setf_pzs(cpu, 8, a);
@@ -399,8 +570,15 @@ static ureg shl8(CPU, ureg a, uint b)
 static ureg shr8(CPU, ureg a, uint b)
 {
 
-	if (b < 8) for (int n=0; n < b; n++) { cpu->flags.c = bit(a, 0); a = shrb(a); }
-	else       a = 0;
+	setf_sync(cpu);
+
+	if (b >= 8)
+		a = 0;
+
+	else if (b > 0) {
+		cpu->flags.c = bit(a, b - 1);
+		a = (u8)a >> b;
+	}
 
 	if (b > 0)
 		setf_pzs(cpu, 8, a);
@@ -415,8 +593,15 @@ static ureg shr8(CPU, ureg a, uint b)
 static ureg shl16(CPU, ureg a, uint b)
 {
 
-	if (b < 16) for (int n=0; n < b; n++) { cpu->flags.c = bit(a, 15); a = shlw(a); }
-	else        a = 0;
+	setf_sync(cpu);
+
+	if (b >= 16)
+		a = 0;
+
+	else if (b > 0) {
+		cpu->flags.c = bit(a, 16 - b);
+		a = (u16)(a << b);
+	}
 
 	if (b > 0)
 		setf_pzs(cpu, 16, a);
@@ -431,8 +616,15 @@ static ureg shl16(CPU, ureg a, uint b)
 static ureg shr16(CPU, ureg a, uint b)
 {
 
-	if (b < 16) for (int n=0; n < b; n++) { cpu->flags.c = bit(a, 0); a = shrw(a); }
-	else       a = 0;
+	setf_sync(cpu);
+
+	if (b >= 16)
+		a = 0;
+
+	else if (b > 0) {
+		cpu->flags.c = bit(a, b - 1);
+		a = (u16)a >> b;
+	}
 
 	if (b > 0)
 		setf_pzs(cpu, 16, a);
@@ -444,429 +636,849 @@ static ureg shr16(CPU, ureg a, uint b)
 
 
 
-static ureg sal8(CPU, ureg a, uint b)
+static ureg sal8( CPU, ureg a, uint b) { return shl8( cpu, a, b); }
+static ureg sal16(CPU, ureg a, uint b) { return shl16(cpu, a, b); }
+
+
+
+static ureg sar8(CPU, ureg a, uint b)
 {
 
-	if (b < 8) for (int n=0; n < b; n++) { cpu->flags.c = bit(a, 7); a = salb(a); }
-	else       a = 0;
+	setf_sync(cpu);
+
+	if (b >= 8)
+		a = sign(a, 8)? 0xff: 0;
+
+	else if (b > 0) {
+		cpu->flags.c = bit(a, b - 1);
+		a = (u8)((i8)a >> b);
+	}
 
 	if (b > 0)
 		setf_pzs(cpu, 8, a);
 
-	setf_vxc(cpu, 8, a);
+	setf_vxt(cpu, 8, a);
 	return a;
 
 }
 
 
 
-static ureg sar8(CPU, ureg a, uint b)
+static ureg sar16(CPU, ureg a, uint b)
 {
 
-	if (b < 8) for (int n=0; n < b; n++) { cpu->flags.c = bit(a, 0); a = sarb(a); }
-	else       a = sign(a, 8)? 0xff: 0;
+	setf_sync(cpu);
+
+	if (b >= 16)
+		a = sign(a, 16)? 0xffff: 0;
+
+	else if (b > 0) {
+		cpu->flags.c = bit(a, b - 1);
+		a = (u16)((i16)a >> b);
+	}
 
 	if (b > 0)
-		setf_pzs(cpu, 8, a);
+		setf_pzs(cpu, 16, a);
 
-	setf_vxt(cpu, 8, a);
+	setf_vxt(cpu, 16, a);
 	return a;
 
 }
 
 
 
-static ureg sal16(CPU, ureg a, uint b)
+// Memory accesses come in two tiers. The inlined fast path covers everything
+// that lies inside the contiguous part of the segment, the out-of-line slow
+// path wraps offsets within the segment and physical addresses at the A20 or 1MB
+// boundary byte by byte. Bytes past the end of memory read as open bus and
+// drop writes. While a memory hook is attached the descriptors cover nothing,
+// and with watchpoints they stop at the first page that holds one, so those
+// accesses take the slow path and are checked there
+
+// Physical address of the byte at seg:ofs, or ~0u past the end of memory
+static inline u32 memphys(CPU, uint seg, u16 ofs)
 {
 
-	if (b < 16) for (int n=0; n < b; n++) { cpu->flags.c = bit(a, 15); a = salw(a); }
-	else        a = 0;
+	const u32 phys = (SEGMENT(seg) * 16 + ofs) & cpu->memory.mem.mask;
+	return (phys < cpu->memory.mem.length)? phys: ~0u;
 
-	if (b > 0)
-		setf_pzs(cpu, 16, a);
+}
 
-	setf_vxc(cpu, 16, a);
-	return a;
 
-}
+static u8 *membyte(CPU, uint seg, u16 ofs)
+{
 
+	const u32 phys = memphys(cpu, seg, ofs);
 
+	if (phys == ~0u) {
+		cpu->memory.open = 0xff;
+		return &cpu->memory.open;
+	}
 
-static ureg sar16(CPU, ureg a, uint b)
+	return cpu->memory.mem.base + phys;
+
+}
+
+
+static inline bool pagewatched(CPU, u32 phys)
 {
 
-	if (b < 16) for (int n=0; n < b; n++) { cpu->flags.c = bit(a, 0); a = sarw(a); }
-	else       a = sign(a, 16)? 0xffff: 0;
+	const uint page = (phys >> 12) % I8086_PAGES;
+	return (cpu->debug.pages[page / 64] >> (page % 64)) & 1;
 
-	if (b > 0)
-		setf_pzs(cpu, 16, a);
+}
 
-	setf_vxt(cpu, 16, a);
-	return a;
+
+// Bytes of the length from phys that come before the first page with a point
+static u32 memwatched(CPU, u32 phys, u32 length)
+{
+
+	for (u32 at = phys; at < phys + length; at = (at & ~0xfffu) + 0x1000)
+		if (pagewatched(cpu, at))
+			return at - phys;
+
+	return length;
 
 }
 
 
+// Accesses are seen one at a time, by a memory hook or by watchpoints
+static inline bool memtraced(CPU)
+{
+
+	return cpu->memory.limit == 0 || cpu->debug.count != 0;
 
-static inline void *memlock(CPU, uint seg, u16 ofs, uint len) {
-	//return cpu->memory.descriptor[seg].base + ofs;
-	return cpu->memory.mem.base + ((SEGMENT(seg) * 16 + ofs) & cpu->memory.mem.mask);
 }
 
 
+// Stops the run loop at the end of the instruction
+static void debugstop(CPU, uint stop, uint point, u32 addr, uint mode)
+{
+
+	cpu->debug.stop = stop;
+	cpu->debug.hit  = point;
+	cpu->debug.addr = addr;
+	cpu->debug.mode = mode;
 
-static void memselect(CPU, uint seg, u16 selector)
+	cpu->interrupt.pending = true;
+
+}
+
+
+static void memwatch(CPU, u32 addr, uint mode)
 {
 
-	auto md = &cpu->memory.descriptor[seg];
+	const u32  size = (IO_16BIT(mode))? 2: 1;
+	const uint kind = (IO_RD(mode))? I8086_POINT_READ: I8086_POINT_WRITE;
 
-	cpu->memory.selector[seg] = selector;
+	if (!pagewatched(cpu, addr) && !pagewatched(cpu, addr + size - 1))
+		return;
+
+	for (uint n=0; n < I8086_POINTS; n++) {
 
-	md->base   = cpu->memory.mem.base + ((selector * 16) & cpu->memory.mem.mask);
-	md->limit  = cpu->memory.mem.limit;
-	md->length = 65536;
-	md->mask   = 65535;
+		const auto pt = &cpu->debug.point[n];
+
+		if ((pt->kind & kind) && addr < pt->addr + pt->length && pt->addr < addr + size) {
+			debugstop(cpu, I8086_STOP_WATCH, n, addr, mode);
+			return;
+		}
+
+	}
 
 }
 
 
-static void interrupt(CPU, uint irq, uint rcs, uint rip)
+// Data access off the fast path, for the memory hook and the watchpoints. Mode
+// is one of IO_RD8 ... IO_WR16
+static void memhook(CPU, uint seg, u16 ofs, uint mode, uint value)
 {
 
-	ADVSP(-6);
-	STSPW(4, getf_w(cpu));
-	STSPW(2, rcs);
-	STSPW(0, rip);
+	const u32  addr  = (SEGMENT(seg) * 16 + ofs) & cpu->memory.mem.mask;
+	const auto hooks = cpu->hooks;
 
-	cpu->flags.i = false;
-	cpu->flags.t = false;
+	if (hooks != NULL && hooks->memory != NULL)
+		hooks->memory(hooks->data, cpu, addr, mode, value);
 
-	cpu->regs.ip = LDMW(REG_ZERO, 4 * (u8)irq + 0);
-	memselect(cpu, REG_CS, LDMW(REG_ZERO, 4 * (u8)irq + 2));
+	if (cpu->debug.count != 0)
+		memwatch(cpu, addr, mode);
 
 }
 
 
+// A word split by a wrap is staged in memory.bounce, memunlock() writes it back.
+// When accesses are traced every locked operand is staged, so that the write is seen
+[[gnu::noinline, gnu::cold]]
+static void *memwrap(CPU, uint seg, u16 ofs, uint len)
+{
 
-static void op_undef(CPU) { cpu->undef(cpu); }   // Invalid opcode
-static void op_nop(CPU)   { }
+	const bool traced = memtraced(cpu);
 
-static void op_addaib(CPU) { const u8 imm = LDIPUB(); cpu->regs.ax.l = add8(cpu, cpu->regs.ax.l, imm); }
-static void op_ioraib(CPU) { const u8 imm = LDIPUB(); cpu->regs.ax.l = ior8(cpu, cpu->regs.ax.l, imm); }
-static void op_adcaib(CPU) { const u8 imm = LDIPUB(); cpu->regs.ax.l = adc8(cpu, cpu->regs.ax.l, imm); }
-static void op_sbbaib(CPU) { const u8 imm = LDIPUB(); cpu->regs.ax.l = sbb8(cpu, cpu->regs.ax.l, imm); }
-static void op_andaib(CPU) { const u8 imm = LDIPUB(); cpu->regs.ax.l = and8(cpu, cpu->regs.ax.l, imm); }
-static void op_subaib(CPU) { const u8 imm = LDIPUB(); cpu->regs.ax.l = sub8(cpu, cpu->regs.ax.l, imm); }
-static void op_xoraib(CPU) { const u8 imm = LDIPUB(); cpu->regs.ax.l = xor8(cpu, cpu->regs.ax.l, imm); }
-static void op_cmpaib(CPU) { const u8 imm = LDIPUB();                  sub8(cpu, cpu->regs.ax.l, imm); }
+	if (len == 1 && !traced)
+		return membyte(cpu, seg, ofs);
 
-static void op_addaiw(CPU) { const u16 imm = LDIPUW(); cpu->regs.ax.w = add16(cpu, cpu->regs.ax.w, imm); }
-static void op_ioraiw(CPU) { const u16 imm = LDIPUW(); cpu->regs.ax.w = ior16(cpu, cpu->regs.ax.w, imm); }
-static void op_adcaiw(CPU) { const u16 imm = LDIPUW(); cpu->regs.ax.w = adc16(cpu, cpu->regs.ax.w, imm); }
-static void op_sbbaiw(CPU) { const u16 imm = LDIPUW(); cpu->regs.ax.w = sbb16(cpu, cpu->regs.ax.w, imm); }
-static void op_andaiw(CPU) { const u16 imm = LDIPUW(); cpu->regs.ax.w = and16(cpu, cpu->regs.ax.w, imm); }
-static void op_subaiw(CPU) { const u16 imm = LDIPUW(); cpu->regs.ax.w = sub16(cpu, cpu->regs.ax.w, imm); }
-static void op_xoraiw(CPU) { const u16 imm = LDIPUW(); cpu->regs.ax.w = xor16(cpu, cpu->regs.ax.w, imm); }
-static void op_cmpaiw(CPU) { const u16 imm = LDIPUW();                  sub16(cpu, cpu->regs.ax.w, imm); }
+	const u32 lo = memphys(cpu, seg, ofs);
+	const u32 hi = (len == 2)? memphys(cpu, seg, ofs + 1): ~0u;
 
-static void op_addrmbib(CPU) { LOCKR1MB(); const u8 imm = LDIPUB(); STLCKM(add8(cpu, LDLCKM(), imm)); }
-static void op_iorrmbib(CPU) { LOCKR1MB(); const u8 imm = LDIPUB(); STLCKM(ior8(cpu, LDLCKM(), imm)); }
-static void op_adcrmbib(CPU) { LOCKR1MB(); const u8 imm = LDIPUB(); STLCKM(adc8(cpu, LDLCKM(), imm)); }
-static void op_sbbrmbib(CPU) { LOCKR1MB(); const u8 imm = LDIPUB(); STLCKM(sbb8(cpu, LDLCKM(), imm)); }
-static void op_andrmbib(CPU) { LOCKR1MB(); const u8 imm = LDIPUB(); STLCKM(and8(cpu, LDLCKM(), imm)); }
-static void op_subrmbib(CPU) { LOCKR1MB(); const u8 imm = LDIPUB(); STLCKM(sub8(cpu, LDLCKM(), imm)); }
-static void op_xorrmbib(CPU) { LOCKR1MB(); const u8 imm = LDIPUB(); STLCKM(xor8(cpu, LDLCKM(), imm)); }
-static void op_cmprmbib(CPU) { LOCKR1MB(); const u8 imm = LDIPUB();        sub8(cpu, LDLCKM(), imm);  }
-
-static void op_addrmwiw(CPU) { LOCKR1MW(); const u16 imm = LDIPUW(); STLCKM(add16(cpu, LDLCKM(), imm)); }
-static void op_iorrmwiw(CPU) { LOCKR1MW(); const u16 imm = LDIPUW(); STLCKM(ior16(cpu, LDLCKM(), imm)); }
-static void op_adcrmwiw(CPU) { LOCKR1MW(); const u16 imm = LDIPUW(); STLCKM(adc16(cpu, LDLCKM(), imm)); }
-static void op_sbbrmwiw(CPU) { LOCKR1MW(); const u16 imm = LDIPUW(); STLCKM(sbb16(cpu, LDLCKM(), imm)); }
-static void op_andrmwiw(CPU) { LOCKR1MW(); const u16 imm = LDIPUW(); STLCKM(and16(cpu, LDLCKM(), imm)); }
-static void op_subrmwiw(CPU) { LOCKR1MW(); const u16 imm = LDIPUW(); STLCKM(sub16(cpu, LDLCKM(), imm)); }
-static void op_xorrmwiw(CPU) { LOCKR1MW(); const u16 imm = LDIPUW(); STLCKM(xor16(cpu, LDLCKM(), imm)); }
-static void op_cmprmwiw(CPU) { LOCKR1MW(); const u16 imm = LDIPUW();        sub16(cpu, LDLCKM(), imm);  }
-
-static void op_addrmwib(CPU) { LOCKR1MW(); const u16 imm = LDIPSB(); STLCKM(add16(cpu, LDLCKM(), imm)); }
-static void op_iorrmwib(CPU) { LOCKR1MW(); const u16 imm = LDIPSB(); STLCKM(ior16(cpu, LDLCKM(), imm)); }
-static void op_adcrmwib(CPU) { LOCKR1MW(); const u16 imm = LDIPSB(); STLCKM(adc16(cpu, LDLCKM(), imm)); }
-static void op_sbbrmwib(CPU) { LOCKR1MW(); const u16 imm = LDIPSB(); STLCKM(sbb16(cpu, LDLCKM(), imm)); }
-static void op_andrmwib(CPU) { LOCKR1MW(); const u16 imm = LDIPSB(); STLCKM(and16(cpu, LDLCKM(), imm)); }
-static void op_subrmwib(CPU) { LOCKR1MW(); const u16 imm = LDIPSB(); STLCKM(sub16(cpu, LDLCKM(), imm)); }
-static void op_xorrmwib(CPU) { LOCKR1MW(); const u16 imm = LDIPSB(); STLCKM(xor16(cpu, LDLCKM(), imm)); }
-static void op_cmprmwib(CPU) { LOCKR1MW(); const u16 imm = LDIPSB();        sub16(cpu, LDLCKM(), imm);  }
-
-static void op_addrmbf(CPU) { LOCKR1MB(); *cpu->insn.reg0b = add8(cpu, *cpu->insn.reg0b, LDLCKM()); }
-static void op_iorrmbf(CPU) { LOCKR1MB(); *cpu->insn.reg0b = ior8(cpu, *cpu->insn.reg0b, LDLCKM()); }
-static void op_adcrmbf(CPU) { LOCKR1MB(); *cpu->insn.reg0b = adc8(cpu, *cpu->insn.reg0b, LDLCKM()); }
-static void op_sbbrmbf(CPU) { LOCKR1MB(); *cpu->insn.reg0b = sbb8(cpu, *cpu->insn.reg0b, LDLCKM()); }
-static void op_andrmbf(CPU) { LOCKR1MB(); *cpu->insn.reg0b = and8(cpu, *cpu->insn.reg0b, LDLCKM()); }
-static void op_subrmbf(CPU) { LOCKR1MB(); *cpu->insn.reg0b = sub8(cpu, *cpu->insn.reg0b, LDLCKM()); }
-static void op_xorrmbf(CPU) { LOCKR1MB(); *cpu->insn.reg0b = xor8(cpu, *cpu->insn.reg0b, LDLCKM()); }
-static void op_cmprmbf(CPU) { LOCKR1MB();                    sub8(cpu, *cpu->insn.reg0b, LDLCKM()); }
-
-static void op_addrmwf(CPU) { LOCKR1MW(); *cpu->insn.reg0w = add16(cpu, *cpu->insn.reg0w, LDLCKM()); }
-static void op_iorrmwf(CPU) { LOCKR1MW(); *cpu->insn.reg0w = ior16(cpu, *cpu->insn.reg0w, LDLCKM()); }
-static void op_adcrmwf(CPU) { LOCKR1MW(); *cpu->insn.reg0w = adc16(cpu, *cpu->insn.reg0w, LDLCKM()); }
-static void op_sbbrmwf(CPU) { LOCKR1MW(); *cpu->insn.reg0w = sbb16(cpu, *cpu->insn.reg0w, LDLCKM()); }
-static void op_andrmwf(CPU) { LOCKR1MW(); *cpu->insn.reg0w = and16(cpu, *cpu->insn.reg0w, LDLCKM()); }
-static void op_subrmwf(CPU) { LOCKR1MW(); *cpu->insn.reg0w = sub16(cpu, *cpu->insn.reg0w, LDLCKM()); }
-static void op_xorrmwf(CPU) { LOCKR1MW(); *cpu->insn.reg0w = xor16(cpu, *cpu->insn.reg0w, LDLCKM()); }
-static void op_cmprmwf(CPU) { LOCKR1MW();                    sub16(cpu, *cpu->insn.reg0w, LDLCKM()); }
-
-static void op_addrmbr(CPU) { LOCKR1MB(); STLCKM(add8(cpu, LDLCKM(), *cpu->insn.reg0b)); }
-static void op_iorrmbr(CPU) { LOCKR1MB(); STLCKM(ior8(cpu, LDLCKM(), *cpu->insn.reg0b)); }
-static void op_adcrmbr(CPU) { LOCKR1MB(); STLCKM(adc8(cpu, LDLCKM(), *cpu->insn.reg0b)); }
-static void op_sbbrmbr(CPU) { LOCKR1MB(); STLCKM(sbb8(cpu, LDLCKM(), *cpu->insn.reg0b)); }
-static void op_andrmbr(CPU) { LOCKR1MB(); STLCKM(and8(cpu, LDLCKM(), *cpu->insn.reg0b)); }
-static void op_subrmbr(CPU) { LOCKR1MB(); STLCKM(sub8(cpu, LDLCKM(), *cpu->insn.reg0b)); }
-static void op_xorrmbr(CPU) { LOCKR1MB(); STLCKM(xor8(cpu, LDLCKM(), *cpu->insn.reg0b)); }
-static void op_cmprmbr(CPU) { LOCKR1MB();        sub8(cpu, LDLCKM(), *cpu->insn.reg0b);  }
-
-static void op_addrmwr(CPU) { LOCKR1MW(); STLCKM(add16(cpu, LDLCKM(), *cpu->insn.reg0w)); }
-static void op_iorrmwr(CPU) { LOCKR1MW(); STLCKM(ior16(cpu, LDLCKM(), *cpu->insn.reg0w)); }
-static void op_adcrmwr(CPU) { LOCKR1MW(); STLCKM(adc16(cpu, LDLCKM(), *cpu->insn.reg0w)); }
-static void op_sbbrmwr(CPU) { LOCKR1MW(); STLCKM(sbb16(cpu, LDLCKM(), *cpu->insn.reg0w)); }
-static void op_andrmwr(CPU) { LOCKR1MW(); STLCKM(and16(cpu, LDLCKM(), *cpu->insn.reg0w)); }
-static void op_subrmwr(CPU) { LOCKR1MW(); STLCKM(sub16(cpu, LDLCKM(), *cpu->insn.reg0w)); }
-static void op_xorrmwr(CPU) { LOCKR1MW(); STLCKM(xor16(cpu, LDLCKM(), *cpu->insn.reg0w)); }
-static void op_cmprmwr(CPU) { LOCKR1MW();        sub16(cpu, LDLCKM(), *cpu->insn.reg0w);  }
-
-static void op_decrmb(CPU) { LOCKR1MB(); STLCKM(dec8(cpu, LDLCKM())); }
-static void op_incrmb(CPU) { LOCKR1MB(); STLCKM(inc8(cpu, LDLCKM())); }
-
-static void op_decrmw(CPU) { LOCKR1MW(); STLCKM(dec16(cpu, LDLCKM())); }
-static void op_incrmw(CPU) { LOCKR1MW(); STLCKM(inc16(cpu, LDLCKM())); }
-
-static void op_decrw(CPU) { *cpu->insn.reg0w = dec16(cpu, *cpu->insn.reg0w); }
-static void op_incrw(CPU) { *cpu->insn.reg0w = inc16(cpu, *cpu->insn.reg0w); }
-
-static void op_negrmb(CPU) { LOCKR1MB(); STLCKM(sub8( cpu, 0, LDLCKM())); }
-static void op_negrmw(CPU) { LOCKR1MW(); STLCKM(sub16(cpu, 0, LDLCKM())); }
-
-static void op_notrmb(CPU) { LOCKR1MB(); STLCKM(~LDLCKM()); }
-static void op_notrmw(CPU) { LOCKR1MW(); STLCKM(~LDLCKM()); }
-
-static void op_rolb1(CPU) { LOCKR1MB(); STLCKM(rol8(cpu, LDLCKM(), 1)); }
-static void op_rorb1(CPU) { LOCKR1MB(); STLCKM(ror8(cpu, LDLCKM(), 1)); }
-static void op_rclb1(CPU) { LOCKR1MB(); STLCKM(rcl8(cpu, LDLCKM(), 1)); }
-static void op_rcrb1(CPU) { LOCKR1MB(); STLCKM(rcr8(cpu, LDLCKM(), 1)); }
-static void op_shlb1(CPU) { LOCKR1MB(); STLCKM(shl8(cpu, LDLCKM(), 1)); }
-static void op_shrb1(CPU) { LOCKR1MB(); STLCKM(shr8(cpu, LDLCKM(), 1)); }
-static void op_salb1(CPU) { LOCKR1MB(); STLCKM(sal8(cpu, LDLCKM(), 1)); }
-static void op_sarb1(CPU) { LOCKR1MB(); STLCKM(sar8(cpu, LDLCKM(), 1)); }
-
-static void op_rolw1(CPU) { LOCKR1MW(); STLCKM(rol16(cpu, LDLCKM(), 1)); }
-static void op_rorw1(CPU) { LOCKR1MW(); STLCKM(ror16(cpu, LDLCKM(), 1)); }
-static void op_rclw1(CPU) { LOCKR1MW(); STLCKM(rcl16(cpu, LDLCKM(), 1)); }
-static void op_rcrw1(CPU) { LOCKR1MW(); STLCKM(rcr16(cpu, LDLCKM(), 1)); }
-static void op_shlw1(CPU) { LOCKR1MW(); STLCKM(shl16(cpu, LDLCKM(), 1)); }
-static void op_shrw1(CPU) { LOCKR1MW(); STLCKM(shr16(cpu, LDLCKM(), 1)); }
-static void op_salw1(CPU) { LOCKR1MW(); STLCKM(sal16(cpu, LDLCKM(), 1)); }
-static void op_sarw1(CPU) { LOCKR1MW(); STLCKM(sar16(cpu, LDLCKM(), 1)); }
-
-static void op_rolbr(CPU) { LOCKR1MB(); STLCKM(rol8(cpu, LDLCKM(), cpu->regs.cx.l)); }
-static void op_rorbr(CPU) { LOCKR1MB(); STLCKM(ror8(cpu, LDLCKM(), cpu->regs.cx.l)); }
-static void op_rclbr(CPU) { LOCKR1MB(); STLCKM(rcl8(cpu, LDLCKM(), cpu->regs.cx.l)); }
-static void op_rcrbr(CPU) { LOCKR1MB(); STLCKM(rcr8(cpu, LDLCKM(), cpu->regs.cx.l)); }
-static void op_shlbr(CPU) { LOCKR1MB(); STLCKM(shl8(cpu, LDLCKM(), cpu->regs.cx.l)); }
-static void op_shrbr(CPU) { LOCKR1MB(); STLCKM(shr8(cpu, LDLCKM(), cpu->regs.cx.l)); }
-static void op_salbr(CPU) { LOCKR1MB(); STLCKM(sal8(cpu, LDLCKM(), cpu->regs.cx.l)); }
-static void op_sarbr(CPU) { LOCKR1MB(); STLCKM(sar8(cpu, LDLCKM(), cpu->regs.cx.l)); }
-
-static void op_rolwr(CPU) { LOCKR1MW(); STLCKM(rol16(cpu, LDLCKM(), cpu->regs.cx.l)); }
-static void op_rorwr(CPU) { LOCKR1MW(); STLCKM(ror16(cpu, LDLCKM(), cpu->regs.cx.l)); }
-static void op_rclwr(CPU) { LOCKR1MW(); STLCKM(rcl16(cpu, LDLCKM(), cpu->regs.cx.l)); }
-static void op_rcrwr(CPU) { LOCKR1MW(); STLCKM(rcr16(cpu, LDLCKM(), cpu->regs.cx.l)); }
-static void op_shlwr(CPU) { LOCKR1MW(); STLCKM(shl16(cpu, LDLCKM(), cpu->regs.cx.l)); }
-static void op_shrwr(CPU) { LOCKR1MW(); STLCKM(shr16(cpu, LDLCKM(), cpu->regs.cx.l)); }
-static void op_salwr(CPU) { LOCKR1MW(); STLCKM(sal16(cpu, LDLCKM(), cpu->regs.cx.l)); }
-static void op_sarwr(CPU) { LOCKR1MW(); STLCKM(sar16(cpu, LDLCKM(), cpu->regs.cx.l)); }
+	if (lo != ~0u && hi == lo + 1 && !traced)
+		return cpu->memory.mem.base + lo;
 
-static void op_movambf(CPU) { cpu->insn.addr += LDIPUW(); cpu->regs.ax.l = LDEAMB(0); }
-static void op_movamwf(CPU) { cpu->insn.addr += LDIPUW(); cpu->regs.ax.w = LDEAMW(0); }
+	cpu->memory.split[0] = lo;
+	cpu->memory.split[1] = hi;
+	cpu->memory.bounce   = *membyte(cpu, seg, ofs) | ((len == 2)? *membyte(cpu, seg, ofs + 1) << 8: 0);
+	cpu->memory.seg      = seg;
+	cpu->memory.ofs      = ofs;
+	cpu->memory.len      = len;
 
-static void op_movambr(CPU) { cpu->insn.addr += LDIPUW(); STMB(cpu->insn.segment, cpu->insn.addr, cpu->regs.ax.l); }
-static void op_movamwr(CPU) { cpu->insn.addr += LDIPUW(); STMW(cpu->insn.segment, cpu->insn.addr, cpu->regs.ax.w); }
+	memhook(cpu, seg, ofs, (len == 2)? IO_RD16: IO_RD8, cpu->memory.bounce);
 
-static void op_movrib(CPU)  { *cpu->insn.reg0b = LDIPUB(); }
-static void op_movriw(CPU)  { *cpu->insn.reg0w = LDIPUW(); }
+	return &cpu->memory.bounce;
 
-static void op_movrmib(CPU) { const u8  imm = LDIPUB(); STEAR1MB(imm); }
-static void op_movrmiw(CPU) { const u16 imm = LDIPUW(); STEAR1MW(imm); }
+}
 
-static void op_movrrmbf(CPU) { *cpu->insn.reg0b = LDEAR1MB(); }
-static void op_movrrmwf(CPU) { *cpu->insn.reg0w = LDEAR1MW(); }
 
-static void op_movsrmwf(CPU) { memselect(cpu, (uint)cpu->insn.reg0w, LDEAR1MW()); cpu->interrupt.delay = true; }
+[[gnu::noinline, gnu::cold]]
+static void memspill(CPU)
+{
 
-static void op_movrrmbr(CPU) { STEAR1MB(*cpu->insn.reg0b); }
-static void op_movrrmwr(CPU) { STEAR1MW(*cpu->insn.reg0w); }
+	if (cpu->memory.split[0] != ~0u) cpu->memory.mem.base[cpu->memory.split[0]] = cpu->memory.bounce;
+	if (cpu->memory.split[1] != ~0u) cpu->memory.mem.base[cpu->memory.split[1]] = cpu->memory.bounce >> 8;
 
-static void op_movsrmwr(CPU) { STEAR1MW(SEGMENT((uint)cpu->insn.reg0w)); }
+	if (cpu->memory.len == 2) memhook(cpu, cpu->memory.seg, cpu->memory.ofs, IO_WR16, cpu->memory.bounce);
+	else                      memhook(cpu, cpu->memory.seg, cpu->memory.ofs, IO_WR8,  cpu->memory.bounce & 0xff);
 
-static void op_cbw(CPU) { cpu->regs.ax.w = (i8)cpu->regs.ax.l; }
-static void op_cwd(CPU) { cpu->regs.dx.w = sign(cpu->regs.ax.w, 16)? 0xffff: 0x0000; }
+}
 
-static void op_lahf(CPU) { cpu->regs.ax.h = getf_w(cpu); }
-static void op_sahf(CPU) { setf_lb(cpu, cpu->regs.ax.h); }
 
-static void op_xcharw(CPU) { ureg tmp = cpu->regs.ax.w; cpu->regs.ax.w = *cpu->insn.reg0w; *cpu->insn.reg0w = tmp; }
+[[gnu::noinline, gnu::cold]]
+static u8 memloadb_wrap(CPU, uint seg, u16 ofs, bool code)
+{
 
-static void op_xchrmb(CPU) { LOCKR1MB(); ureg tmp = LDLCKM(); STLCKM(*cpu->insn.reg0b); *cpu->insn.reg0b = tmp; }
-static void op_xchrmw(CPU) { LOCKR1MW(); ureg tmp = LDLCKM(); STLCKM(*cpu->insn.reg0w); *cpu->insn.reg0w = tmp; }
+	const u8 value = *membyte(cpu, seg, ofs);
 
-static void op_tstaib(CPU) { const u8  imm = LDIPUB(); and8( cpu, cpu->regs.ax.l, imm); }
-static void op_tstaiw(CPU) { const u16 imm = LDIPUW(); and16(cpu, cpu->regs.ax.w, imm); }
+	if (!code)
+		memhook(cpu, seg, ofs, IO_RD8, value);
 
-static void op_tstrib(CPU) { const u8  imm = LDIPUB(); ureg tmp = LDEAR1MB(); and8( cpu, tmp, imm); }
-static void op_tstriw(CPU) { const u16 imm = LDIPUW(); ureg tmp = LDEAR1MW(); and16(cpu, tmp, imm); }
+	return value;
 
-static void op_tstrmb(CPU) { ureg tmp = LDEAR1MB(); and8( cpu, tmp, *cpu->insn.reg0b); }
-static void op_tstrmw(CPU) { ureg tmp = LDEAR1MW(); and16(cpu, tmp, *cpu->insn.reg0w); }
+}
 
-static void op_ldsr(CPU) { MEMONLY(); *cpu->insn.reg0w = LDEAMW(0); memselect(cpu, REG_DS, LDEAMW(2)); }
-static void op_lesr(CPU) { MEMONLY(); *cpu->insn.reg0w = LDEAMW(0); memselect(cpu, REG_ES, LDEAMW(2)); }
-static void op_lear(CPU) { MEMONLY(); *cpu->insn.reg0w = cpu->insn.addr; }
 
-static void op_xlatab(CPU) { cpu->regs.ax.l = LDMB(cpu->insn.segment, cpu->regs.bx.w + cpu->regs.ax.l); }
+[[gnu::noinline, gnu::cold]]
+static u16 memload_wrap(CPU, uint seg, u16 ofs, bool code)
+{
 
-static void op_popcs( CPU) { ADVSP(+2); memselect(cpu, REG_CS, LDSPW(-2)); }
-static void op_popds( CPU) { ADVSP(+2); memselect(cpu, REG_DS, LDSPW(-2)); }
-static void op_popes( CPU) { ADVSP(+2); memselect(cpu, REG_ES, LDSPW(-2)); }
-static void op_popss( CPU) { ADVSP(+2); memselect(cpu, REG_SS, LDSPW(-2)); cpu->interrupt.delay = true; }
-static void op_poprw( CPU) { ADVSP(+2); *cpu->insn.reg0w = LDSPW(-2); }
-static void op_popfw( CPU) { ADVSP(+2); setf_w(cpu, LDSPW(-2)); }
+	const u16 value = *membyte(cpu, seg, ofs) | *membyte(cpu, seg, ofs + 1) << 8;
 
-static void op_pushcs(CPU) { ADVSP(-2); STSPW(0, SEGMENT(REG_CS)); }
-static void op_pushds(CPU) { ADVSP(-2); STSPW(0, SEGMENT(REG_DS)); }
-static void op_pushes(CPU) { ADVSP(-2); STSPW(0, SEGMENT(REG_ES)); }
-static void op_pushss(CPU) { ADVSP(-2); STSPW(0, SEGMENT(REG_SS)); }
-static void op_pushsp(CPU) { ADVSP(-2); STSPW(0, cpu->regs.sp.w); }
-static void op_pushrw(CPU) { ADVSP(-2); STSPW(0, *cpu->insn.reg0w); }
-static void op_pushfw(CPU) { ADVSP(-2); STSPW(0, getf_w(cpu)); }
+	if (!code)
+		memhook(cpu, seg, ofs, IO_RD16, value);
 
-static void op_poprmw(CPU)  { ADVSP(+2); ureg tmp = LDSPW(-2);  STEAR1MW(tmp); }
-static void op_pushrmw(CPU) { ADVSP(-2); ureg tmp = LDEAR1MW(); STSPW(0, tmp); }
+	return value;
 
-static void op_callf(CPU) { const u16 tip = LDIPUW(), tcs = LDIPUW(); ADVSP(-4); STSPW(2, SEGMENT(REG_CS)); STSPW(0, cpu->regs.ip); cpu->regs.ip  = tip; SEGMENT(REG_CS) = tcs; }
-static void op_calln(CPU) { const i16 imm = LDIPSW();                 ADVSP(-2); STSPW(0, cpu->regs.ip);                         cpu->regs.ip += imm; }
-static void op_callfrm(CPU) { MEMONLY(); ureg tip = LDEAMW(0); ureg tcs = LDEAMW(2); ADVSP(-4); STSPW(2, SEGMENT(REG_CS)); STSPW(0, cpu->regs.ip); cpu->regs.ip = tip; SEGMENT(REG_CS) = tcs; }
-static void op_callnrm(CPU) { ureg tmp = LDEAR1MW(); ADVSP(-2); STSPW(0, cpu->regs.ip); cpu->regs.ip = tmp; }
+}
 
-static void op_int3(CPU)  {                          interrupt(cpu, I8086_VECTOR_BREAK, SEGMENT(REG_CS), cpu->regs.ip); }
-static void op_into(CPU)  { if (cpu->flags.v)        interrupt(cpu, I8086_VECTOR_VFLOW, SEGMENT(REG_CS), cpu->regs.ip); }
-static void op_intib(CPU) { const u8 imm = LDIPUB(); interrupt(cpu, imm, SEGMENT(REG_CS), cpu->regs.ip); }
-static void op_iret(CPU)  { ADVSP(+4); cpu->regs.ip = LDSPW(-4); memselect(cpu, REG_CS, LDSPW(-2)); op_popfw(cpu); cpu->interrupt.delay = true; }
 
-static void op_jcbe(CPU) { const i8 imm = LDIPSB(); if (cpu->flags.c                 || cpu->flags.z) cpu->regs.ip += imm; }
-static void op_jcle(CPU) { const i8 imm = LDIPSB(); if (cpu->flags.s != cpu->flags.v || cpu->flags.z) cpu->regs.ip += imm; }
-static void op_jcl(CPU)  { const i8 imm = LDIPSB(); if (cpu->flags.s != cpu->flags.v)                 cpu->regs.ip += imm; }
+[[gnu::noinline, gnu::cold]]
+static void memstoreb_wrap(CPU, uint seg, u16 ofs, u8 value)
+{
 
-static void op_jcc(CPU) { const i8 imm = LDIPSB(); if (cpu->flags.c) cpu->regs.ip += imm; }
-static void op_jco(CPU) { const i8 imm = LDIPSB(); if (cpu->flags.v) cpu->regs.ip += imm; }
-static void op_jcp(CPU) { const i8 imm = LDIPSB(); if (cpu->flags.p) cpu->regs.ip += imm; }
-static void op_jcs(CPU) { const i8 imm = LDIPSB(); if (cpu->flags.s) cpu->regs.ip += imm; }
-static void op_jcz(CPU) { const i8 imm = LDIPSB(); if (cpu->flags.z) cpu->regs.ip += imm; }
+	*membyte(cpu, seg, ofs) = value;
+	memhook(cpu, seg, ofs, IO_WR8, value);
 
-static void op_jcnbe(CPU) { const i8 imm = LDIPSB(); if (!cpu->flags.c                && !cpu->flags.z) cpu->regs.ip += imm; }
-static void op_jcnle(CPU) { const i8 imm = LDIPSB(); if (cpu->flags.s == cpu->flags.v && !cpu->flags.z) cpu->regs.ip += imm; }
-static void op_jcnl(CPU)  { const i8 imm = LDIPSB(); if (cpu->flags.s == cpu->flags.v)                  cpu->regs.ip += imm; }
+}
 
-static void op_jcnc(CPU) { const i8 imm = LDIPSB(); if (!cpu->flags.c) cpu->regs.ip += imm; }
-static void op_jcno(CPU) { const i8 imm = LDIPSB(); if (!cpu->flags.v) cpu->regs.ip += imm; }
-static void op_jcnp(CPU) { const i8 imm = LDIPSB(); if (!cpu->flags.p) cpu->regs.ip += imm; }
-static void op_jcns(CPU) { const i8 imm = LDIPSB(); if (!cpu->flags.s) cpu->regs.ip += imm; }
-static void op_jcnz(CPU) { const i8 imm = LDIPSB(); if (!cpu->flags.z) cpu->regs.ip += imm; }
 
-static void op_jcxzr(CPU) { const i8 imm = LDIPSB(); if (!cpu->regs.cx.w)  cpu->regs.ip += imm; }
+[[gnu::noinline, gnu::cold]]
+static void memstore_wrap(CPU, uint seg, u16 ofs, u16 value)
+{
 
-static void op_jmpf(CPU)  { const u16 tip = LDIPUW(); memselect(cpu, REG_CS, LDIPUW()); cpu->regs.ip = tip; }
-static void op_jmpnw(CPU) { const i16 imm = LDIPSW(); cpu->regs.ip += imm; }
-static void op_jmpnb(CPU) { const i8  imm = LDIPSB(); cpu->regs.ip += imm; }
-static void op_jmpfrm(CPU) { MEMONLY(); cpu->regs.ip = LDEAMW(0); memselect(cpu, REG_CS, LDEAMW(2)); }
-static void op_jmpnrm(CPU) { cpu->regs.ip = LDEAR1MW(); }
+	*membyte(cpu, seg, ofs)     = value;
+	*membyte(cpu, seg, ofs + 1) = value >> 8;
+	memhook(cpu, seg, ofs, IO_WR16, value);
 
-static void op_loopnzr(CPU) { const i8 imm = LDIPSB(); if (--cpu->regs.cx.w && !cpu->flags.z) cpu->regs.ip += imm; }
-static void op_loopzr(CPU)  { const i8 imm = LDIPSB(); if (--cpu->regs.cx.w && cpu->flags.z)  cpu->regs.ip += imm; }
-static void op_loopr(CPU)   { const i8 imm = LDIPSB(); if (--cpu->regs.cx.w)                  cpu->regs.ip += imm; }
+}
 
-static void op_retf0(CPU) { ADVSP(+4); cpu->regs.ip = LDSPW(-4); memselect(cpu, REG_CS, LDSPW(-2)); }
-static void op_retn0(CPU) {                           ADVSP(+2); cpu->regs.ip = LDSPW(-2); }
 
-static void op_retfw(CPU) { const u16 imm = LDIPUW(); op_retf0(cpu); ADVSP(imm); }
-static void op_retnw(CPU) { const u16 imm = LDIPUW(); op_retn0(cpu); ADVSP(imm); }
 
-static void op_inib(CPU) { const u8 imm = LDIPUB(); cpu->regs.ax.l = io_readb(&cpu->iob, imm); }
-static void op_iniw(CPU) { const u8 imm = LDIPUB(); cpu->regs.ax.w = io_readw(&cpu->iow, imm); }
-static void op_inrb(CPU) { cpu->regs.ax.l = io_readb(&cpu->iob, cpu->regs.dx.w); }
-static void op_inrw(CPU) { cpu->regs.ax.w = io_readw(&cpu->iow, cpu->regs.dx.w); }
+// Host pointer to len bytes at seg:ofs for a read-modify-write, to be released
+// with memunlock() if the bytes are written. Plain loads and stores never touch
+// the bounce, so they can run while a locked operand is held
+static inline void *memlock(CPU, uint seg, u16 ofs, uint len)
+{
 
-static void op_outib(CPU) { const u8 imm = LDIPUB(); io_writeb(&cpu->iob, imm, cpu->regs.ax.l); }
-static void op_outiw(CPU) { const u8 imm = LDIPUB(); io_writew(&cpu->iow, imm, cpu->regs.ax.w); }
-static void op_outrb(CPU) { io_writeb(&cpu->iob, cpu->regs.dx.w, cpu->regs.ax.l); }
-static void op_outrw(CPU) { io_writew(&cpu->iow, cpu->regs.dx.w, cpu->regs.ax.w); }
+	const auto md = &cpu->memory.descriptor[seg];
 
-static void op_seges(CPU) { cpu->insn.segment = REG_ES; }
-static void op_segcs(CPU) { cpu->insn.segment = REG_CS; }
-static void op_segss(CPU) { cpu->insn.segment = REG_SS; }
-static void op_segds(CPU) { cpu->insn.segment = REG_DS; }
-static void op_repne(CPU) { cpu->insn.repeat_eq = false; cpu->insn.repeat_ne = true;  }
-static void op_repeq(CPU) { cpu->insn.repeat_eq = true;  cpu->insn.repeat_ne = false; }
+	if (__builtin_expect(ofs + len <= md->length, 1))
+		return cpu->memory.mem.base + md->base + ofs;
 
-static void op_lock(CPU) { /* FIXME: Not implemented */ }
-static void op_wait(CPU) { /* FIXME: Not implemented */ }
+	return memwrap(cpu, seg, ofs, len);
 
-static void op_clc(CPU) { cpu->flags.c = false; }
-static void op_stc(CPU) { cpu->flags.c = true;  }
-static void op_cli(CPU) { cpu->flags.i = false; }
-static void op_cmc(CPU) { cpu->flags.c = !cpu->flags.c; }
-static void op_sti(CPU) { cpu->flags.i = true;  }
-static void op_cld(CPU) { cpu->flags.d = false; }
-static void op_std(CPU) { cpu->flags.d = true;  }
+}
 
-static void op_divrmb(CPU);
-static void op_divrmw(CPU);
-static void op_mulrmb(CPU);
-static void op_mulrmw(CPU);
 
-static void op_idivrmb(CPU);
-static void op_idivrmw(CPU);
-static void op_imulrmb(CPU);
-static void op_imulrmw(CPU);
+static inline void memunlock(CPU, void *ptr)
+{
 
-static void op_aaa(CPU);      // BCD
-static void op_aad(CPU);
-static void op_aas(CPU);
-static void op_aam(CPU);
-static void op_daa(CPU);
-static void op_das(CPU);
+	if (__builtin_expect(ptr == &cpu->memory.bounce, 0))
+		memspill(cpu);
 
-static void op_cmpsb(CPU);   // String
-static void op_cmpsw(CPU);
-static void op_lodsb(CPU);
-static void op_lodsw(CPU);
-static void op_movsb(CPU);
-static void op_movsw(CPU);
-static void op_scasb(CPU);
-static void op_scasw(CPU);
-static void op_stosb(CPU);
-static void op_stosw(CPU);
+}
 
 
-static const i8086_opcode opcodes[352] = {
+// Code fetches pass code, so that the memory hook skips them
+static inline u8 memloadb(CPU, uint seg, u16 ofs, const bool code)
+{
 
-// Main opcodes
-// 0x00
-	&op_addrmbr,  &op_addrmwr,  &op_addrmbf,  &op_addrmwf,  &op_addaib,   &op_addaiw,  &op_pushes,   &op_popes,
-	&op_iorrmbr,  &op_iorrmwr,  &op_iorrmbf,  &op_iorrmwf,  &op_ioraib,   &op_ioraiw,  &op_pushcs,   &op_popcs,
-	&op_adcrmbr,  &op_adcrmwr,  &op_adcrmbf,  &op_adcrmwf,  &op_adcaib,   &op_adcaiw,  &op_pushss,   &op_popss,
-	&op_sbbrmbr,  &op_sbbrmwr,  &op_sbbrmbf,  &op_sbbrmwf,  &op_sbbaib,   &op_sbbaiw,  &op_pushds,   &op_popds,
+	const auto md = &cpu->memory.descriptor[seg];
+
+	if (__builtin_expect(ofs + 1 <= md->length, 1))
+		return cpu->memory.mem.base[md->base + ofs];
+
+	return memloadb_wrap(cpu, seg, ofs, code);
+
+}
+
+
+static inline u16 memload(CPU, uint seg, u16 ofs, const bool code)
+{
+
+	const auto md = &cpu->memory.descriptor[seg];
+
+	if (__builtin_expect(ofs + 2 <= md->length, 1))
+		return *(u16*)(cpu->memory.mem.base + md->base + ofs);
+
+	return memload_wrap(cpu, seg, ofs, code);
+
+}
+
+
+static inline void memstoreb(CPU, uint seg, u16 ofs, u8 value)
+{
+
+	const auto md = &cpu->memory.descriptor[seg];
+
+	if (__builtin_expect(ofs + 1 <= md->length, 1))
+		cpu->memory.mem.base[md->base + ofs] = value;
+	else
+		memstoreb_wrap(cpu, seg, ofs, value);
+
+}
+
+
+static inline void memstore(CPU, uint seg, u16 ofs, u16 value)
+{
+
+	const auto md = &cpu->memory.descriptor[seg];
+
+	if (__builtin_expect(ofs + 2 <= md->length, 1))
+		*(u16*)(cpu->memory.mem.base + md->base + ofs) = value;
+	else
+		memstore_wrap(cpu, seg, ofs, value);
+
+}
+
+
+
+// Host pointer to the lowest byte of count elements stepping from seg:ofs in
+// the direction of DF, or NULL if they wrap the segment or the end of memory,
+// or if a memory hook or a watchpoint has to see them one by one
+static u8 *memspan(CPU, uint seg, u16 ofs, uint count, uint size)
+{
+
+	const uint bytes = count * size;
+	const int  low   = (cpu->flags.d)? (int)(ofs + size) - (int)bytes: ofs;
+
+	if (low < 0 || low + bytes > 65536 || cpu->memory.limit == 0)
+		return NULL;
+
+	const u32 linear = SEGMENT(seg) * 16 + low;
+	const u32 phys   = linear & cpu->memory.mem.mask;
+
+	if (((linear + bytes - 1) & cpu->memory.mem.mask) != phys + bytes - 1 || phys + bytes > cpu->memory.mem.length)
+		return NULL;
+
+	if (cpu->debug.count != 0 && memwatched(cpu, phys, bytes) < bytes)
+		return NULL;
+
+	return cpu->memory.mem.base + phys;
+
+}
+
+
+
+static void memselect(CPU, uint seg, u16 selector)
+{
+
+	auto md = &cpu->memory.descriptor[seg];
+
+	const u32 base = (selector * 16) & cpu->memory.mem.mask;
+	const u32 wrap = cpu->memory.mem.mask - base + 1;  // Bytes up to the A20 or 1MB wrap
+	const u32 end  = (base < cpu->memory.mem.length)? cpu->memory.mem.length - base: 0;
+
+	cpu->memory.selector[seg] = selector;
+
+	md->base   = base;
+	md->length = (wrap < end)? wrap: end;
+
+	if (md->length > cpu->memory.limit)
+		md->length = cpu->memory.limit;
+
+	if (cpu->debug.count != 0)
+		md->length = memwatched(cpu, base, md->length);
+
+}
+
+
+// Rebuilds the descriptors when memory or the A20 gate changed under the CPU
+static inline void memsync(CPU)
+{
+
+	if (cpu->memory.mask != cpu->memory.mem.mask || cpu->memory.length != cpu->memory.mem.length) {
+
+		cpu->memory.mask   = cpu->memory.mem.mask;
+		cpu->memory.length = cpu->memory.mem.length;
+
+		for (int seg=0; seg < 5; seg++)
+			memselect(cpu, seg, cpu->memory.selector[seg]);
+
+	}
+
+}
+
+
+static void interrupt(CPU, uint irq, uint rcs, uint rip)
+{
+
+	ADVSP(-6);
+	STSPW(4, getf_w(cpu));
+	STSPW(2, rcs);
+	STSPW(0, rip);
+
+	cpu->flags.i = false;
+	cpu->flags.t = false;
+
+	cpu->interrupt.halt = false;  // Any interrupt taken resumes a HLT
+
+	if (cpu->hooks != NULL && cpu->hooks->interrupt != NULL)
+		cpu->hooks->interrupt(cpu->hooks->data, cpu, (u8)irq);
+
+	cpu->regs.ip = LDMW(REG_ZERO, 4 * (u8)irq + 0);
+	memselect(cpu, REG_CS, LDMW(REG_ZERO, 4 * (u8)irq + 2));
+
+}
+
+
+
+static void op_undef(CPU) { cpu->undef(cpu); }   // Invalid opcode
+static void op_nop(CPU)   { }
+
+static void op_addaib(CPU) { const u8 imm = LDIPUB(); cpu->regs.ax.l = add8(cpu, cpu->regs.ax.l, imm); }
+static void op_ioraib(CPU) { const u8 imm = LDIPUB(); cpu->regs.ax.l = ior8(cpu, cpu->regs.ax.l, imm); }
+static void op_adcaib(CPU) { const u8 imm = LDIPUB(); cpu->regs.ax.l = adc8(cpu, cpu->regs.ax.l, imm); }
+static void op_sbbaib(CPU) { const u8 imm = LDIPUB(); cpu->regs.ax.l = sbb8(cpu, cpu->regs.ax.l, imm); }
+static void op_andaib(CPU) { const u8 imm = LDIPUB(); cpu->regs.ax.l = and8(cpu, cpu->regs.ax.l, imm); }
+static void op_subaib(CPU) { const u8 imm = LDIPUB(); cpu->regs.ax.l = sub8(cpu, cpu->regs.ax.l, imm); }
+static void op_xoraib(CPU) { const u8 imm = LDIPUB(); cpu->regs.ax.l = xor8(cpu, cpu->regs.ax.l, imm); }
+static void op_cmpaib(CPU) { const u8 imm = LDIPUB();                  sub8(cpu, cpu->regs.ax.l, imm); }
+
+static void op_addaiw(CPU) { const u16 imm = LDIPUW(); cpu->regs.ax.w = add16(cpu, cpu->regs.ax.w, imm); }
+static void op_ioraiw(CPU) { const u16 imm = LDIPUW(); cpu->regs.ax.w = ior16(cpu, cpu->regs.ax.w, imm); }
+static void op_adcaiw(CPU) { const u16 imm = LDIPUW(); cpu->regs.ax.w = adc16(cpu, cpu->regs.ax.w, imm); }
+static void op_sbbaiw(CPU) { const u16 imm = LDIPUW(); cpu->regs.ax.w = sbb16(cpu, cpu->regs.ax.w, imm); }
+static void op_andaiw(CPU) { const u16 imm = LDIPUW(); cpu->regs.ax.w = and16(cpu, cpu->regs.ax.w, imm); }
+static void op_subaiw(CPU) { const u16 imm = LDIPUW(); cpu->regs.ax.w = sub16(cpu, cpu->regs.ax.w, imm); }
+static void op_xoraiw(CPU) { const u16 imm = LDIPUW(); cpu->regs.ax.w = xor16(cpu, cpu->regs.ax.w, imm); }
+static void op_cmpaiw(CPU) { const u16 imm = LDIPUW();                  sub16(cpu, cpu->regs.ax.w, imm); }
+
+RMHANDLER(op_addrmbib) { LOCKR1MB(); const u8 imm = LDIPUB(); STLCKM(add8(cpu, LDLCKM(), imm)); }
+RMHANDLER(op_iorrmbib) { LOCKR1MB(); const u8 imm = LDIPUB(); STLCKM(ior8(cpu, LDLCKM(), imm)); }
+RMHANDLER(op_adcrmbib) { LOCKR1MB(); const u8 imm = LDIPUB(); STLCKM(adc8(cpu, LDLCKM(), imm)); }
+RMHANDLER(op_sbbrmbib) { LOCKR1MB(); const u8 imm = LDIPUB(); STLCKM(sbb8(cpu, LDLCKM(), imm)); }
+RMHANDLER(op_andrmbib) { LOCKR1MB(); const u8 imm = LDIPUB(); STLCKM(and8(cpu, LDLCKM(), imm)); }
+RMHANDLER(op_subrmbib) { LOCKR1MB(); const u8 imm = LDIPUB(); STLCKM(sub8(cpu, LDLCKM(), imm)); }
+RMHANDLER(op_xorrmbib) { LOCKR1MB(); const u8 imm = LDIPUB(); STLCKM(xor8(cpu, LDLCKM(), imm)); }
+RMHANDLER(op_cmprmbib) { LOCKR1MB(); const u8 imm = LDIPUB();        sub8(cpu, LDLCKM(), imm);  }
+
+RMHANDLER(op_addrmwiw) { LOCKR1MW(); const u16 imm = LDIPUW(); STLCKM(add16(cpu, LDLCKM(), imm)); }
+RMHANDLER(op_iorrmwiw) { LOCKR1MW(); const u16 imm = LDIPUW(); STLCKM(ior16(cpu, LDLCKM(), imm)); }
+RMHANDLER(op_adcrmwiw) { LOCKR1MW(); const u16 imm = LDIPUW(); STLCKM(adc16(cpu, LDLCKM(), imm)); }
+RMHANDLER(op_sbbrmwiw) { LOCKR1MW(); const u16 imm = LDIPUW(); STLCKM(sbb16(cpu, LDLCKM(), imm)); }
+RMHANDLER(op_andrmwiw) { LOCKR1MW(); const u16 imm = LDIPUW(); STLCKM(and16(cpu, LDLCKM(), imm)); }
+RMHANDLER(op_subrmwiw) { LOCKR1MW(); const u16 imm = LDIPUW(); STLCKM(sub16(cpu, LDLCKM(), imm)); }
+RMHANDLER(op_xorrmwiw) { LOCKR1MW(); const u16 imm = LDIPUW(); STLCKM(xor16(cpu, LDLCKM(), imm)); }
+RMHANDLER(op_cmprmwiw) { LOCKR1MW(); const u16 imm = LDIPUW();        sub16(cpu, LDLCKM(), imm);  }
+
+RMHANDLER(op_addrmwib) { LOCKR1MW(); const u16 imm = LDIPSB(); STLCKM(add16(cpu, LDLCKM(), imm)); }
+RMHANDLER(op_iorrmwib) { LOCKR1MW(); const u16 imm = LDIPSB(); STLCKM(ior16(cpu, LDLCKM(), imm)); }
+RMHANDLER(op_adcrmwib) { LOCKR1MW(); const u16 imm = LDIPSB(); STLCKM(adc16(cpu, LDLCKM(), imm)); }
+RMHANDLER(op_sbbrmwib) { LOCKR1MW(); const u16 imm = LDIPSB(); STLCKM(sbb16(cpu, LDLCKM(), imm)); }
+RMHANDLER(op_andrmwib) { LOCKR1MW(); const u16 imm = LDIPSB(); STLCKM(and16(cpu, LDLCKM(), imm)); }
+RMHANDLER(op_subrmwib) { LOCKR1MW(); const u16 imm = LDIPSB(); STLCKM(sub16(cpu, LDLCKM(), imm)); }
+RMHANDLER(op_xorrmwib) { LOCKR1MW(); const u16 imm = LDIPSB(); STLCKM(xor16(cpu, LDLCKM(), imm)); }
+RMHANDLER(op_cmprmwib) { LOCKR1MW(); const u16 imm = LDIPSB();        sub16(cpu, LDLCKM(), imm);  }
+
+RMHANDLER(op_addrmbf) { LOCKR1MB(); REG0B = add8(cpu, REG0B, LDLCKM()); }
+RMHANDLER(op_iorrmbf) { LOCKR1MB(); REG0B = ior8(cpu, REG0B, LDLCKM()); }
+RMHANDLER(op_adcrmbf) { LOCKR1MB(); REG0B = adc8(cpu, REG0B, LDLCKM()); }
+RMHANDLER(op_sbbrmbf) { LOCKR1MB(); REG0B = sbb8(cpu, REG0B, LDLCKM()); }
+RMHANDLER(op_andrmbf) { LOCKR1MB(); REG0B = and8(cpu, REG0B, LDLCKM()); }
+RMHANDLER(op_subrmbf) { LOCKR1MB(); REG0B = sub8(cpu, REG0B, LDLCKM()); }
+RMHANDLER(op_xorrmbf) { LOCKR1MB(); REG0B = xor8(cpu, REG0B, LDLCKM()); }
+RMHANDLER(op_cmprmbf) { LOCKR1MB();         sub8(cpu, REG0B, LDLCKM()); }
+
+RMHANDLER(op_addrmwf) { LOCKR1MW(); REG0W = add16(cpu, REG0W, LDLCKM()); }
+RMHANDLER(op_iorrmwf) { LOCKR1MW(); REG0W = ior16(cpu, REG0W, LDLCKM()); }
+RMHANDLER(op_adcrmwf) { LOCKR1MW(); REG0W = adc16(cpu, REG0W, LDLCKM()); }
+RMHANDLER(op_sbbrmwf) { LOCKR1MW(); REG0W = sbb16(cpu, REG0W, LDLCKM()); }
+RMHANDLER(op_andrmwf) { LOCKR1MW(); REG0W = and16(cpu, REG0W, LDLCKM()); }
+RMHANDLER(op_subrmwf) { LOCKR1MW(); REG0W = sub16(cpu, REG0W, LDLCKM()); }
+RMHANDLER(op_xorrmwf) { LOCKR1MW(); REG0W = xor16(cpu, REG0W, LDLCKM()); }
+RMHANDLER(op_cmprmwf) { LOCKR1MW();         sub16(cpu, REG0W, LDLCKM()); }
+
+RMHANDLER(op_addrmbr) { LOCKR1MB(); STLCKM(add8(cpu, LDLCKM(), REG0B)); }
+RMHANDLER(op_iorrmbr) { LOCKR1MB(); STLCKM(ior8(cpu, LDLCKM(), REG0B)); }
+RMHANDLER(op_adcrmbr) { LOCKR1MB(); STLCKM(adc8(cpu, LDLCKM(), REG0B)); }
+RMHANDLER(op_sbbrmbr) { LOCKR1MB(); STLCKM(sbb8(cpu, LDLCKM(), REG0B)); }
+RMHANDLER(op_andrmbr) { LOCKR1MB(); STLCKM(and8(cpu, LDLCKM(), REG0B)); }
+RMHANDLER(op_subrmbr) { LOCKR1MB(); STLCKM(sub8(cpu, LDLCKM(), REG0B)); }
+RMHANDLER(op_xorrmbr) { LOCKR1MB(); STLCKM(xor8(cpu, LDLCKM(), REG0B)); }
+RMHANDLER(op_cmprmbr) { LOCKR1MB();        sub8(cpu, LDLCKM(), REG0B);  }
+
+RMHANDLER(op_addrmwr) { LOCKR1MW(); STLCKM(add16(cpu, LDLCKM(), REG0W)); }
+RMHANDLER(op_iorrmwr) { LOCKR1MW(); STLCKM(ior16(cpu, LDLCKM(), REG0W)); }
+RMHANDLER(op_adcrmwr) { LOCKR1MW(); STLCKM(adc16(cpu, LDLCKM(), REG0W)); }
+RMHANDLER(op_sbbrmwr) { LOCKR1MW(); STLCKM(sbb16(cpu, LDLCKM(), REG0W)); }
+RMHANDLER(op_andrmwr) { LOCKR1MW(); STLCKM(and16(cpu, LDLCKM(), REG0W)); }
+RMHANDLER(op_subrmwr) { LOCKR1MW(); STLCKM(sub16(cpu, LDLCKM(), REG0W)); }
+RMHANDLER(op_xorrmwr) { LOCKR1MW(); STLCKM(xor16(cpu, LDLCKM(), REG0W)); }
+RMHANDLER(op_cmprmwr) { LOCKR1MW();        sub16(cpu, LDLCKM(), REG0W);  }
+
+RMHANDLER(op_decrmb) { LOCKR1MB(); STLCKM(dec8(cpu, LDLCKM())); }
+RMHANDLER(op_incrmb) { LOCKR1MB(); STLCKM(inc8(cpu, LDLCKM())); }
+
+RMHANDLER(op_decrmw) { LOCKR1MW(); STLCKM(dec16(cpu, LDLCKM())); }
+RMHANDLER(op_incrmw) { LOCKR1MW(); STLCKM(inc16(cpu, LDLCKM())); }
+
+static void op_decrw(CPU) { REG0W = dec16(cpu, REG0W); }
+static void op_incrw(CPU) { REG0W = inc16(cpu, REG0W); }
+
+RMHANDLER(op_negrmb) { LOCKR1MB(); STLCKM(sub8( cpu, 0, LDLCKM())); }
+RMHANDLER(op_negrmw) { LOCKR1MW(); STLCKM(sub16(cpu, 0, LDLCKM())); }
+
+RMHANDLER(op_notrmb) { LOCKR1MB(); STLCKM(~LDLCKM()); }
+RMHANDLER(op_notrmw) { LOCKR1MW(); STLCKM(~LDLCKM()); }
+
+RMHANDLER(op_rolb1) { LOCKR1MB(); STLCKM(rol8(cpu, LDLCKM(), 1)); }
+RMHANDLER(op_rorb1) { LOCKR1MB(); STLCKM(ror8(cpu, LDLCKM(), 1)); }
+RMHANDLER(op_rclb1) { LOCKR1MB(); STLCKM(rcl8(cpu, LDLCKM(), 1)); }
+RMHANDLER(op_rcrb1) { LOCKR1MB(); STLCKM(rcr8(cpu, LDLCKM(), 1)); }
+RMHANDLER(op_shlb1) { LOCKR1MB(); STLCKM(shl8(cpu, LDLCKM(), 1)); }
+RMHANDLER(op_shrb1) { LOCKR1MB(); STLCKM(shr8(cpu, LDLCKM(), 1)); }
+RMHANDLER(op_salb1) { LOCKR1MB(); STLCKM(sal8(cpu, LDLCKM(), 1)); }
+RMHANDLER(op_sarb1) { LOCKR1MB(); STLCKM(sar8(cpu, LDLCKM(), 1)); }
+
+RMHANDLER(op_rolw1) { LOCKR1MW(); STLCKM(rol16(cpu, LDLCKM(), 1)); }
+RMHANDLER(op_rorw1) { LOCKR1MW(); STLCKM(ror16(cpu, LDLCKM(), 1)); }
+RMHANDLER(op_rclw1) { LOCKR1MW(); STLCKM(rcl16(cpu, LDLCKM(), 1)); }
+RMHANDLER(op_rcrw1) { LOCKR1MW(); STLCKM(rcr16(cpu, LDLCKM(), 1)); }
+RMHANDLER(op_shlw1) { LOCKR1MW(); STLCKM(shl16(cpu, LDLCKM(), 1)); }
+RMHANDLER(op_shrw1) { LOCKR1MW(); STLCKM(shr16(cpu, LDLCKM(), 1)); }
+RMHANDLER(op_salw1) { LOCKR1MW(); STLCKM(sal16(cpu, LDLCKM(), 1)); }
+RMHANDLER(op_sarw1) { LOCKR1MW(); STLCKM(sar16(cpu, LDLCKM(), 1)); }
+
+RMHANDLER(op_rolbr) { LOCKR1MB(); const u8 n = cpu->regs.cx.l; STLCKM(rol8(cpu, LDLCKM(), n)); CYCLES(4 * n); }
+RMHANDLER(op_rorbr) { LOCKR1MB(); const u8 n = cpu->regs.cx.l; STLCKM(ror8(cpu, LDLCKM(), n)); CYCLES(4 * n); }
+RMHANDLER(op_rclbr) { LOCKR1MB(); const u8 n = cpu->regs.cx.l; STLCKM(rcl8(cpu, LDLCKM(), n)); CYCLES(4 * n); }
+RMHANDLER(op_rcrbr) { LOCKR1MB(); const u8 n = cpu->regs.cx.l; STLCKM(rcr8(cpu, LDLCKM(), n)); CYCLES(4 * n); }
+RMHANDLER(op_shlbr) { LOCKR1MB(); const u8 n = cpu->regs.cx.l; STLCKM(shl8(cpu, LDLCKM(), n)); CYCLES(4 * n); }
+RMHANDLER(op_shrbr) { LOCKR1MB(); const u8 n = cpu->regs.cx.l; STLCKM(shr8(cpu, LDLCKM(), n)); CYCLES(4 * n); }
+RMHANDLER(op_salbr) { LOCKR1MB(); const u8 n = cpu->regs.cx.l; STLCKM(sal8(cpu, LDLCKM(), n)); CYCLES(4 * n); }
+RMHANDLER(op_sarbr) { LOCKR1MB(); const u8 n = cpu->regs.cx.l; STLCKM(sar8(cpu, LDLCKM(), n)); CYCLES(4 * n); }
+
+RMHANDLER(op_rolwr) { LOCKR1MW(); const u8 n = cpu->regs.cx.l; STLCKM(rol16(cpu, LDLCKM(), n)); CYCLES(4 * n); }
+RMHANDLER(op_rorwr) { LOCKR1MW(); const u8 n = cpu->regs.cx.l; STLCKM(ror16(cpu, LDLCKM(), n)); CYCLES(4 * n); }
+RMHANDLER(op_rclwr) { LOCKR1MW(); const u8 n = cpu->regs.cx.l; STLCKM(rcl16(cpu, LDLCKM(), n)); CYCLES(4 * n); }
+RMHANDLER(op_rcrwr) { LOCKR1MW(); const u8 n = cpu->regs.cx.l; STLCKM(rcr16(cpu, LDLCKM(), n)); CYCLES(4 * n); }
+RMHANDLER(op_shlwr) { LOCKR1MW(); const u8 n = cpu->regs.cx.l; STLCKM(shl16(cpu, LDLCKM(), n)); CYCLES(4 * n); }
+RMHANDLER(op_shrwr) { LOCKR1MW(); const u8 n = cpu->regs.cx.l; STLCKM(shr16(cpu, LDLCKM(), n)); CYCLES(4 * n); }
+RMHANDLER(op_salwr) { LOCKR1MW(); const u8 n = cpu->regs.cx.l; STLCKM(sal16(cpu, LDLCKM(), n)); CYCLES(4 * n); }
+RMHANDLER(op_sarwr) { LOCKR1MW(); const u8 n = cpu->regs.cx.l; STLCKM(sar16(cpu, LDLCKM(), n)); CYCLES(4 * n); }
+
+// 80186 shifts, by an immediate or by CL, take the count mod 32
+RMHANDLER(op_rolbib) { LOCKR1MB(); const u8 imm = LDIPUB() & 31; STLCKM(rol8(cpu, LDLCKM(), imm));  CYCLES(imm); }
+RMHANDLER(op_rorbib) { LOCKR1MB(); const u8 imm = LDIPUB() & 31; STLCKM(ror8(cpu, LDLCKM(), imm));  CYCLES(imm); }
+RMHANDLER(op_rclbib) { LOCKR1MB(); const u8 imm = LDIPUB() & 31; STLCKM(rcl8(cpu, LDLCKM(), imm));  CYCLES(imm); }
+RMHANDLER(op_rcrbib) { LOCKR1MB(); const u8 imm = LDIPUB() & 31; STLCKM(rcr8(cpu, LDLCKM(), imm));  CYCLES(imm); }
+RMHANDLER(op_shlbib) { LOCKR1MB(); const u8 imm = LDIPUB() & 31; STLCKM(shl8(cpu, LDLCKM(), imm));  CYCLES(imm); }
+RMHANDLER(op_shrbib) { LOCKR1MB(); const u8 imm = LDIPUB() & 31; STLCKM(shr8(cpu, LDLCKM(), imm));  CYCLES(imm); }
+RMHANDLER(op_salbib) { LOCKR1MB(); const u8 imm = LDIPUB() & 31; STLCKM(sal8(cpu, LDLCKM(), imm));  CYCLES(imm); }
+RMHANDLER(op_sarbib) { LOCKR1MB(); const u8 imm = LDIPUB() & 31; STLCKM(sar8(cpu, LDLCKM(), imm));  CYCLES(imm); }
+
+RMHANDLER(op_rolwib) { LOCKR1MW(); const u8 imm = LDIPUB() & 31; STLCKM(rol16(cpu, LDLCKM(), imm)); CYCLES(imm); }
+RMHANDLER(op_rorwib) { LOCKR1MW(); const u8 imm = LDIPUB() & 31; STLCKM(ror16(cpu, LDLCKM(), imm)); CYCLES(imm); }
+RMHANDLER(op_rclwib) { LOCKR1MW(); const u8 imm = LDIPUB() & 31; STLCKM(rcl16(cpu, LDLCKM(), imm)); CYCLES(imm); }
+RMHANDLER(op_rcrwib) { LOCKR1MW(); const u8 imm = LDIPUB() & 31; STLCKM(rcr16(cpu, LDLCKM(), imm)); CYCLES(imm); }
+RMHANDLER(op_shlwib) { LOCKR1MW(); const u8 imm = LDIPUB() & 31; STLCKM(shl16(cpu, LDLCKM(), imm)); CYCLES(imm); }
+RMHANDLER(op_shrwib) { LOCKR1MW(); const u8 imm = LDIPUB() & 31; STLCKM(shr16(cpu, LDLCKM(), imm)); CYCLES(imm); }
+RMHANDLER(op_salwib) { LOCKR1MW(); const u8 imm = LDIPUB() & 31; STLCKM(sal16(cpu, LDLCKM(), imm)); CYCLES(imm); }
+RMHANDLER(op_sarwib) { LOCKR1MW(); const u8 imm = LDIPUB() & 31; STLCKM(sar16(cpu, LDLCKM(), imm)); CYCLES(imm); }
+
+RMHANDLER(op_rolbc) { LOCKR1MB(); const u8 n = cpu->regs.cx.l & 31; STLCKM(rol8(cpu, LDLCKM(), n));  CYCLES(n); }
+RMHANDLER(op_rorbc) { LOCKR1MB(); const u8 n = cpu->regs.cx.l & 31; STLCKM(ror8(cpu, LDLCKM(), n));  CYCLES(n); }
+RMHANDLER(op_rclbc) { LOCKR1MB(); const u8 n = cpu->regs.cx.l & 31; STLCKM(rcl8(cpu, LDLCKM(), n));  CYCLES(n); }
+RMHANDLER(op_rcrbc) { LOCKR1MB(); const u8 n = cpu->regs.cx.l & 31; STLCKM(rcr8(cpu, LDLCKM(), n));  CYCLES(n); }
+RMHANDLER(op_shlbc) { LOCKR1MB(); const u8 n = cpu->regs.cx.l & 31; STLCKM(shl8(cpu, LDLCKM(), n));  CYCLES(n); }
+RMHANDLER(op_shrbc) { LOCKR1MB(); const u8 n = cpu->regs.cx.l & 31; STLCKM(shr8(cpu, LDLCKM(), n));  CYCLES(n); }
+RMHANDLER(op_salbc) { LOCKR1MB(); const u8 n = cpu->regs.cx.l & 31; STLCKM(sal8(cpu, LDLCKM(), n));  CYCLES(n); }
+RMHANDLER(op_sarbc) { LOCKR1MB(); const u8 n = cpu->regs.cx.l & 31; STLCKM(sar8(cpu, LDLCKM(), n));  CYCLES(n); }
+
+RMHANDLER(op_rolwc) { LOCKR1MW(); const u8 n = cpu->regs.cx.l & 31; STLCKM(rol16(cpu, LDLCKM(), n)); CYCLES(n); }
+RMHANDLER(op_rorwc) { LOCKR1MW(); const u8 n = cpu->regs.cx.l & 31; STLCKM(ror16(cpu, LDLCKM(), n)); CYCLES(n); }
+RMHANDLER(op_rclwc) { LOCKR1MW(); const u8 n = cpu->regs.cx.l & 31; STLCKM(rcl16(cpu, LDLCKM(), n)); CYCLES(n); }
+RMHANDLER(op_rcrwc) { LOCKR1MW(); const u8 n = cpu->regs.cx.l & 31; STLCKM(rcr16(cpu, LDLCKM(), n)); CYCLES(n); }
+RMHANDLER(op_shlwc) { LOCKR1MW(); const u8 n = cpu->regs.cx.l & 31; STLCKM(shl16(cpu, LDLCKM(), n)); CYCLES(n); }
+RMHANDLER(op_shrwc) { LOCKR1MW(); const u8 n = cpu->regs.cx.l & 31; STLCKM(shr16(cpu, LDLCKM(), n)); CYCLES(n); }
+RMHANDLER(op_salwc) { LOCKR1MW(); const u8 n = cpu->regs.cx.l & 31; STLCKM(sal16(cpu, LDLCKM(), n)); CYCLES(n); }
+RMHANDLER(op_sarwc) { LOCKR1MW(); const u8 n = cpu->regs.cx.l & 31; STLCKM(sar16(cpu, LDLCKM(), n)); CYCLES(n); }
+
+static void op_movambf(CPU) { cpu->insn.addr += LDIPUW(); cpu->regs.ax.l = LDEAMB(0); }
+static void op_movamwf(CPU) { cpu->insn.addr += LDIPUW(); cpu->regs.ax.w = LDEAMW(0); }
+
+static void op_movambr(CPU) { cpu->insn.addr += LDIPUW(); STMB(cpu->insn.segment, cpu->insn.addr, cpu->regs.ax.l); }
+static void op_movamwr(CPU) { cpu->insn.addr += LDIPUW(); STMW(cpu->insn.segment, cpu->insn.addr, cpu->regs.ax.w); }
+
+static void op_movrib(CPU)  { REG0B = LDIPUB(); }
+static void op_movriw(CPU)  { REG0W = LDIPUW(); }
+
+RMHANDLER(op_movrmib) { const u8  imm = LDIPUB(); STEAR1MB(imm); }
+RMHANDLER(op_movrmiw) { const u16 imm = LDIPUW(); STEAR1MW(imm); }
+
+RMHANDLER(op_movrrmbf) { REG0B = LDEAR1MB(); }
+RMHANDLER(op_movrrmwf) { REG0W = LDEAR1MW(); }
+
+RMHANDLER(op_movsrmwf) { memselect(cpu, cpu->insn.reg0w, LDEAR1MW()); cpu->interrupt.delay = cpu->interrupt.pending = true; }
+
+RMHANDLER(op_movrrmbr) { STEAR1MB(REG0B); }
+RMHANDLER(op_movrrmwr) { STEAR1MW(REG0W); }
+
+RMHANDLER(op_movsrmwr) { STEAR1MW(SEGMENT(cpu->insn.reg0w)); }
+
+static void op_cbw(CPU) { cpu->regs.ax.w = (i8)cpu->regs.ax.l; }
+static void op_cwd(CPU) { cpu->regs.dx.w = sign(cpu->regs.ax.w, 16)? 0xffff: 0x0000; }
+
+static void op_lahf(CPU) { cpu->regs.ax.h = getf_w(cpu); }
+static void op_sahf(CPU) { setf_lb(cpu, cpu->regs.ax.h); }
+
+static void op_xcharw(CPU) { ureg tmp = cpu->regs.ax.w; cpu->regs.ax.w = REG0W; REG0W = tmp; }
+
+RMHANDLER(op_xchrmb) { LOCKR1MB(); ureg tmp = LDLCKM(); STLCKM(REG0B); REG0B = tmp; }
+RMHANDLER(op_xchrmw) { LOCKR1MW(); ureg tmp = LDLCKM(); STLCKM(REG0W); REG0W = tmp; }
+
+static void op_tstaib(CPU) { const u8  imm = LDIPUB(); and8( cpu, cpu->regs.ax.l, imm); }
+static void op_tstaiw(CPU) { const u16 imm = LDIPUW(); and16(cpu, cpu->regs.ax.w, imm); }
+
+RMHANDLER(op_tstrib) { const u8  imm = LDIPUB(); ureg tmp = LDEAR1MB(); and8( cpu, tmp, imm); }
+RMHANDLER(op_tstriw) { const u16 imm = LDIPUW(); ureg tmp = LDEAR1MW(); and16(cpu, tmp, imm); }
+
+RMHANDLER(op_tstrmb) { ureg tmp = LDEAR1MB(); and8( cpu, tmp, REG0B); }
+RMHANDLER(op_tstrmw) { ureg tmp = LDEAR1MW(); and16(cpu, tmp, REG0W); }
+
+RMHANDLER(op_ldsr) { MEMONLY(); REG0W = LDEAMW(0); memselect(cpu, REG_DS, LDEAMW(2)); }
+RMHANDLER(op_lesr) { MEMONLY(); REG0W = LDEAMW(0); memselect(cpu, REG_ES, LDEAMW(2)); }
+RMHANDLER(op_lear) { MEMONLY(); REG0W = cpu->insn.addr; }
+
+static void op_xlatab(CPU) { cpu->regs.ax.l = LDMB(cpu->insn.segment, cpu->regs.bx.w + cpu->regs.ax.l); }
+
+static void op_popcs( CPU) { ADVSP(+2); memselect(cpu, REG_CS, LDSPW(-2)); }
+static void op_popds( CPU) { ADVSP(+2); memselect(cpu, REG_DS, LDSPW(-2)); }
+static void op_popes( CPU) { ADVSP(+2); memselect(cpu, REG_ES, LDSPW(-2)); }
+static void op_popss( CPU) { ADVSP(+2); memselect(cpu, REG_SS, LDSPW(-2)); cpu->interrupt.delay = cpu->interrupt.pending = true; }
+static void op_poprw( CPU) { ADVSP(+2); REG0W = LDSPW(-2); }
+static void op_popfw( CPU) { ADVSP(+2); setf_w(cpu, LDSPW(-2)); }
+
+static void op_pushcs(CPU) { ADVSP(-2); STSPW(0, SEGMENT(REG_CS)); }
+static void op_pushds(CPU) { ADVSP(-2); STSPW(0, SEGMENT(REG_DS)); }
+static void op_pushes(CPU) { ADVSP(-2); STSPW(0, SEGMENT(REG_ES)); }
+static void op_pushss(CPU) { ADVSP(-2); STSPW(0, SEGMENT(REG_SS)); }
+static void op_pushsp(CPU) { ADVSP(-2); STSPW(0, cpu->regs.sp.w); }
+static void op_pushrw(CPU) { ADVSP(-2); STSPW(0, REG0W); }
+static void op_pushfw(CPU) { ADVSP(-2); STSPW(0, getf_w(cpu)); }
+static void op_pushib(CPU) { const u16 imm = LDIPSB(); ADVSP(-2); STSPW(0, imm); }
+static void op_pushiw(CPU) { const u16 imm = LDIPUW(); ADVSP(-2); STSPW(0, imm); }
+
+RMHANDLER(op_poprmw)  { ADVSP(+2); ureg tmp = LDSPW(-2);  STEAR1MW(tmp); }
+RMHANDLER(op_pushrmw) { ADVSP(-2); ureg tmp = LDEAR1MW(); STSPW(0, tmp); }
+
+static void op_callf(CPU) { const u16 tip = LDIPUW(), tcs = LDIPUW(); ADVSP(-4); STSPW(2, SEGMENT(REG_CS)); STSPW(0, cpu->regs.ip); cpu->regs.ip  = tip; memselect(cpu, REG_CS, tcs); }
+static void op_calln(CPU) { const i16 imm = LDIPSW();                 ADVSP(-2); STSPW(0, cpu->regs.ip);                         cpu->regs.ip += imm; }
+RMHANDLER(op_callfrm) { MEMONLY(); ureg tip = LDEAMW(0); ureg tcs = LDEAMW(2); ADVSP(-4); STSPW(2, SEGMENT(REG_CS)); STSPW(0, cpu->regs.ip); cpu->regs.ip = tip; memselect(cpu, REG_CS, tcs); }
+RMHANDLER(op_callnrm) { ureg tmp = LDEAR1MW(); ADVSP(-2); STSPW(0, cpu->regs.ip); cpu->regs.ip = tmp; }
+
+static void op_int3(CPU)  {                          interrupt(cpu, I8086_VECTOR_BREAK, SEGMENT(REG_CS), cpu->regs.ip); }
+static void op_into(CPU)  { if (getf_v(cpu)) { CYCLES(69); interrupt(cpu, I8086_VECTOR_VFLOW, SEGMENT(REG_CS), cpu->regs.ip); } }
+static void op_intib(CPU) { const u8 imm = LDIPUB(); interrupt(cpu, imm, SEGMENT(REG_CS), cpu->regs.ip); }
+static void op_iret(CPU)  { ADVSP(+4); cpu->regs.ip = LDSPW(-4); memselect(cpu, REG_CS, LDSPW(-2)); op_popfw(cpu); cpu->interrupt.delay = cpu->interrupt.pending = true; }
+
+static void op_jcbe(CPU) { const i8 imm = LDIPSB(); if (getf_c(cpu)                || getf_z(cpu)) BRANCH(imm); }
+static void op_jcle(CPU) { const i8 imm = LDIPSB(); if (getf_s(cpu) != getf_v(cpu) || getf_z(cpu)) BRANCH(imm); }
+static void op_jcl(CPU)  { const i8 imm = LDIPSB(); if (getf_s(cpu) != getf_v(cpu))                BRANCH(imm); }
+
+static void op_jcc(CPU) { const i8 imm = LDIPSB(); if (getf_c(cpu)) BRANCH(imm); }
+static void op_jco(CPU) { const i8 imm = LDIPSB(); if (getf_v(cpu)) BRANCH(imm); }
+static void op_jcp(CPU) { const i8 imm = LDIPSB(); if (getf_p(cpu)) BRANCH(imm); }
+static void op_jcs(CPU) { const i8 imm = LDIPSB(); if (getf_s(cpu)) BRANCH(imm); }
+static void op_jcz(CPU) { const i8 imm = LDIPSB(); if (getf_z(cpu)) BRANCH(imm); }
+
+static void op_jcnbe(CPU) { const i8 imm = LDIPSB(); if (!getf_c(cpu)               && !getf_z(cpu)) BRANCH(imm); }
+static void op_jcnle(CPU) { const i8 imm = LDIPSB(); if (getf_s(cpu) == getf_v(cpu) && !getf_z(cpu)) BRANCH(imm); }
+static void op_jcnl(CPU)  { const i8 imm = LDIPSB(); if (getf_s(cpu) == getf_v(cpu))                 BRANCH(imm); }
+
+static void op_jcnc(CPU) { const i8 imm = LDIPSB(); if (!getf_c(cpu)) BRANCH(imm); }
+static void op_jcno(CPU) { const i8 imm = LDIPSB(); if (!getf_v(cpu)) BRANCH(imm); }
+static void op_jcnp(CPU) { const i8 imm = LDIPSB(); if (!getf_p(cpu)) BRANCH(imm); }
+static void op_jcns(CPU) { const i8 imm = LDIPSB(); if (!getf_s(cpu)) BRANCH(imm); }
+static void op_jcnz(CPU) { const i8 imm = LDIPSB(); if (!getf_z(cpu)) BRANCH(imm); }
+
+static void op_jcxzr(CPU) { const i8 imm = LDIPSB(); if (!cpu->regs.cx.w)  BRANCH(imm); }
+
+static void op_jmpf(CPU)  { const u16 tip = LDIPUW(); memselect(cpu, REG_CS, LDIPUW()); cpu->regs.ip = tip; }
+static void op_jmpnw(CPU) { const i16 imm = LDIPSW(); cpu->regs.ip += imm; }
+static void op_jmpnb(CPU) { const i8  imm = LDIPSB(); cpu->regs.ip += imm; }
+RMHANDLER(op_jmpfrm) { MEMONLY(); cpu->regs.ip = LDEAMW(0); memselect(cpu, REG_CS, LDEAMW(2)); }
+RMHANDLER(op_jmpnrm) { cpu->regs.ip = LDEAR1MW(); }
+
+static void op_loopnzr(CPU) { const i8 imm = LDIPSB(); if (--cpu->regs.cx.w && !getf_z(cpu)) { BRANCH(imm); CYCLES(2); } }
+static void op_loopzr(CPU)  { const i8 imm = LDIPSB(); if (--cpu->regs.cx.w && getf_z(cpu))  BRANCH(imm); }
+static void op_loopr(CPU)   { const i8 imm = LDIPSB(); if (--cpu->regs.cx.w)                  BRANCH(imm); }
+
+static void op_retf0(CPU) { ADVSP(+4); cpu->regs.ip = LDSPW(-4); memselect(cpu, REG_CS, LDSPW(-2)); }
+static void op_retn0(CPU) {                           ADVSP(+2); cpu->regs.ip = LDSPW(-2); }
+
+static void op_retfw(CPU) { const u16 imm = LDIPUW(); op_retf0(cpu); ADVSP(imm); }
+static void op_retnw(CPU) { const u16 imm = LDIPUW(); op_retn0(cpu); ADVSP(imm); }
+
+static void op_leave(CPU) { cpu->regs.sp.w = cpu->regs.bp.w; ADVSP(+2); cpu->regs.bp.w = LDSPW(-2); }
+
+static void op_inib(CPU) { const u8 imm = LDIPUB(); cpu->regs.ax.l = io_readb(&cpu->iob, imm); }
+static void op_iniw(CPU) { const u8 imm = LDIPUB(); cpu->regs.ax.w = io_readw(&cpu->iow, imm); }
+static void op_inrb(CPU) { cpu->regs.ax.l = io_readb(&cpu->iob, cpu->regs.dx.w); }
+static void op_inrw(CPU) { cpu->regs.ax.w = io_readw(&cpu->iow, cpu->regs.dx.w); }
+
+static void op_outib(CPU) { const u8 imm = LDIPUB(); io_writeb(&cpu->iob, imm, cpu->regs.ax.l); }
+static void op_outiw(CPU) { const u8 imm = LDIPUB(); io_writew(&cpu->iow, imm, cpu->regs.ax.w); }
+static void op_outrb(CPU) { io_writeb(&cpu->iob, cpu->regs.dx.w, cpu->regs.ax.l); }
+static void op_outrw(CPU) { io_writew(&cpu->iow, cpu->regs.dx.w, cpu->regs.ax.w); }
+
+// Prefixes are folded into the instruction that follows by decode(), this only
+// runs for the last of a run too long to fold, which is then lost
+static void op_prefix(CPU) { }
+
+// Stands in for the instruction at a breakpoint, which is left to run later
+static void op_break(CPU) { }
+
+static void op_hlt( CPU) { cpu->interrupt.halt = cpu->interrupt.pending = true; }
+// The 8087 runs each ESC instruction to the end before the next one, so there
+// is never anything to wait for
+static void op_wait(CPU) { }
+
+// ESC hands the instruction to the 8087, if there is one. The CPU moves the
+// memory operand in and out for it, byte by byte so that it wraps as the bus does
+[[gnu::always_inline]] static inline void esc(CPU, uint n, const bool mem)
+{
+
+	if (!cpu->fpu.present)
+		return;
+
+	const uint modrm = cpu->insn.modrm;
+	const uint op    = i8087_operand(n, modrm);
+	const uint size  = op & I8087_SIZE;
+
+	u8 buf[I8087_STATE];
+
+	if (mem && (op & I8087_LOAD))
+		for (uint k=0; k < size; k++)
+			buf[k] = LDEAMB(k);
+
+	const u32 ip = cpu->regs.scs * 16 + cpu->regs.sip;
+	const u32 dp = (mem)? SEGMENT(cpu->insn.segment) * 16 + cpu->insn.addr: 0;
+
+	i8087_exec(&cpu->fpu, n, modrm, buf, ip, dp);
+
+	if (mem && (op & I8087_STORE))
+		for (uint k=0; k < size; k++)
+			STEAMB(k, buf[k]);
+
+}
+
+RMHANDLER(op_esc0) { esc(cpu, 0, mem); }
+RMHANDLER(op_esc1) { esc(cpu, 1, mem); }
+RMHANDLER(op_esc2) { esc(cpu, 2, mem); }
+RMHANDLER(op_esc3) { esc(cpu, 3, mem); }
+RMHANDLER(op_esc4) { esc(cpu, 4, mem); }
+RMHANDLER(op_esc5) { esc(cpu, 5, mem); }
+RMHANDLER(op_esc6) { esc(cpu, 6, mem); }
+RMHANDLER(op_esc7) { esc(cpu, 7, mem); }
+
+static void op_clc(CPU) { setf_sync(cpu); cpu->flags.c = false; }
+static void op_stc(CPU) { setf_sync(cpu); cpu->flags.c = true;  }
+static void op_cli(CPU) { cpu->flags.i = false; }
+static void op_cmc(CPU) { setf_sync(cpu); cpu->flags.c = !cpu->flags.c; }
+static void op_sti(CPU) { cpu->flags.i = cpu->interrupt.pending = true; }
+static void op_cld(CPU) { cpu->flags.d = false; }
+static void op_std(CPU) { cpu->flags.d = true;  }
+
+static void op_divrmb(CPU);
+static void op_divrmw(CPU);
+static void op_mulrmb(CPU);
+static void op_mulrmw(CPU);
+
+static void op_idivrmb(CPU);
+static void op_idivrmw(CPU);
+static void op_imulrmb(CPU);
+static void op_imulrmw(CPU);
+static void op_imulrmib(CPU);
+static void op_imulrmiw(CPU);
+
+static void op_aaa(CPU);      // BCD
+static void op_aad(CPU);
+static void op_aas(CPU);
+static void op_aam(CPU);
+static void op_daa(CPU);
+static void op_das(CPU);
+
+static void op_bound(CPU);    // 80186 stack frames and bounds
+static void op_enter(CPU);
+static void op_pusha(CPU);
+static void op_popa(CPU);
+
+static void op_cmpsb(CPU);   // String
+static void op_cmpsw(CPU);
+static void op_insb(CPU);
+static void op_insw(CPU);
+static void op_lodsb(CPU);
+static void op_lodsw(CPU);
+static void op_movsb(CPU);
+static void op_movsw(CPU);
+static void op_outsb(CPU);
+static void op_outsw(CPU);
+static void op_scasb(CPU);
+static void op_scasw(CPU);
+static void op_stosb(CPU);
+static void op_stosw(CPU);
+
+
+static const i8086_opcode opcodes[OPCODE_COUNT] = {
+
+// Main opcodes
+// 0x00
+	&op_addrmbr,  &op_addrmwr,  &op_addrmbf,  &op_addrmwf,  &op_addaib,   &op_addaiw,  &op_pushes,   &op_popes,
+	&op_iorrmbr,  &op_iorrmwr,  &op_iorrmbf,  &op_iorrmwf,  &op_ioraib,   &op_ioraiw,  &op_pushcs,   &op_popcs,
+	&op_adcrmbr,  &op_adcrmwr,  &op_adcrmbf,  &op_adcrmwf,  &op_adcaib,   &op_adcaiw,  &op_pushss,   &op_popss,
+	&op_sbbrmbr,  &op_sbbrmwr,  &op_sbbrmbf,  &op_sbbrmwf,  &op_sbbaib,   &op_sbbaiw,  &op_pushds,   &op_popds,
 // 0x20
-	&op_andrmbr,  &op_andrmwr,  &op_andrmbf,  &op_andrmwf,  &op_andaib,   &op_andaiw,  &op_seges,    &op_daa,
-	&op_subrmbr,  &op_subrmwr,  &op_subrmbf,  &op_subrmwf,  &op_subaib,   &op_subaiw,  &op_segcs,    &op_das,
-	&op_xorrmbr,  &op_xorrmwr,  &op_xorrmbf,  &op_xorrmwf,  &op_xoraib,   &op_xoraiw,  &op_segss,    &op_aaa,
-	&op_cmprmbr,  &op_cmprmwr,  &op_cmprmbf,  &op_cmprmwf,  &op_cmpaib,   &op_cmpaiw,  &op_segds,    &op_aas,
+	&op_andrmbr,  &op_andrmwr,  &op_andrmbf,  &op_andrmwf,  &op_andaib,   &op_andaiw,  &op_prefix,   &op_daa,
+	&op_subrmbr,  &op_subrmwr,  &op_subrmbf,  &op_subrmwf,  &op_subaib,   &op_subaiw,  &op_prefix,   &op_das,
+	&op_xorrmbr,  &op_xorrmwr,  &op_xorrmbf,  &op_xorrmwf,  &op_xoraib,   &op_xoraiw,  &op_prefix,   &op_aaa,
+	&op_cmprmbr,  &op_cmprmwr,  &op_cmprmbf,  &op_cmprmwf,  &op_cmpaib,   &op_cmpaiw,  &op_prefix,   &op_aas,
 // 0x40
 	&op_incrw,    &op_incrw,    &op_incrw,    &op_incrw,    &op_incrw,    &op_incrw,   &op_incrw,    &op_incrw,
 	&op_decrw,    &op_decrw,    &op_decrw,    &op_decrw,    &op_decrw,    &op_decrw,   &op_decrw,    &op_decrw,
@@ -891,11 +1503,11 @@ static const i8086_opcode opcodes[352] = {
 	&op_undef,    &op_undef,    &op_retnw,    &op_retn0,    &op_lesr,     &op_ldsr,    &op_movrmib,  &op_movrmiw,
 	&op_undef,    &op_undef,    &op_retfw,    &op_retf0,    &op_int3,     &op_intib,   &op_into,     &op_iret,
 	&op_nop,      &op_nop,      &op_nop,      &op_nop,      &op_aam,      &op_aad,     &op_undef,    &op_xlatab,
-	&op_nop,      &op_nop,      &op_nop,      &op_nop,      &op_nop,      &op_nop,     &op_nop,      &op_nop,
+	&op_esc0,     &op_esc1,     &op_esc2,     &op_esc3,     &op_esc4,     &op_esc5,    &op_esc6,     &op_esc7,
 // 0xe0
 	&op_loopnzr,  &op_loopzr,   &op_loopr,    &op_jcxzr,    &op_inib,     &op_iniw,    &op_outib,    &op_outiw,
 	&op_calln,    &op_jmpnw,    &op_jmpf,     &op_jmpnb,    &op_inrb,     &op_inrw,    &op_outrb,    &op_outrw,
-	&op_lock,     &op_undef,    &op_repne,    &op_repeq,    &op_nop,      &op_cmc,     &op_nop,      &op_nop,
+	&op_prefix,   &op_undef,    &op_prefix,   &op_prefix,    &op_hlt,      &op_cmc,     &op_nop,      &op_nop,
 	&op_clc,      &op_stc,      &op_cli,      &op_sti,      &op_cld,      &op_std,     &op_nop,      &op_nop,
 
 // Group opcodes
@@ -913,12 +1525,143 @@ static const i8086_opcode opcodes[352] = {
 	&op_tstrib,  &op_tstrib,  &op_notrmb,  &op_negrmb,  &op_mulrmb,  &op_imulrmb, &op_divrmb,  &op_idivrmb,  // 8:  0xf6
 	&op_tstriw,  &op_tstriw,  &op_notrmw,  &op_negrmw,  &op_mulrmw,  &op_imulrmw, &op_divrmw,  &op_idivrmw,  // 9:  0xf7
 	&op_incrmb,  &op_decrmb,  &op_undef,   &op_undef,   &op_undef,   &op_undef,   &op_undef,   &op_undef,    // 10: 0xfe
-	&op_incrmw,  &op_decrmw,  &op_callnrm, &op_callfrm, &op_jmpnrm,  &op_jmpfrm,  &op_pushrmw, &op_pushrmw   // 11: 0xff
+	&op_incrmw,  &op_decrmw,  &op_callnrm, &op_callfrm, &op_jmpnrm,  &op_jmpfrm,  &op_pushrmw, &op_pushrmw,  // 11: 0xff
+// 0x160
+	&op_rolbib,  &op_rorbib,  &op_rclbib,  &op_rcrbib,  &op_shlbib,  &op_shrbib,  &op_salbib,  &op_sarbib,   // 12: 0xc0, 80186
+	&op_rolwib,  &op_rorwib,  &op_rclwib,  &op_rcrwib,  &op_shlwib,  &op_shrwib,  &op_salwib,  &op_sarwib,   // 13: 0xc1, 80186
+	&op_rolbc,   &op_rorbc,   &op_rclbc,   &op_rcrbc,   &op_shlbc,   &op_shrbc,   &op_salbc,   &op_sarbc,    // 14: 0xd2, 80186
+	&op_rolwc,   &op_rorwc,   &op_rclwc,   &op_rcrwc,   &op_shlwc,   &op_shrwc,   &op_salwc,   &op_sarwc,    // 15: 0xd3, 80186
+
+// 80186 opcodes, in place of the 8088 ones by models[]
+// 0x180
+	&op_pusha,    &op_popa,     &op_bound,    &op_undef,    &op_undef,    &op_undef,   &op_undef,    &op_undef,    // 0x60
+	&op_pushiw,   &op_imulrmiw, &op_pushib,   &op_imulrmib, &op_insb,     &op_insw,    &op_outsb,    &op_outsw,    // 0x68
+	&op_enter,    &op_leave,    &op_break,    &op_undef,    &op_undef,    &op_undef,   &op_undef,    &op_undef     // 0xc8, breakpoint
 
 };
 
 
-static const uint opflags[352] = {
+// Every distinct opcode handler, for cores that expand them in place
+#define HANDLERS(X) \
+	X(op_addrmbr)   X(op_addrmwr)   X(op_addrmbf)   X(op_addrmwf)   X(op_addaib)    X(op_addaiw) \
+	X(op_pushes)    X(op_popes)     X(op_iorrmbr)   X(op_iorrmwr)   X(op_iorrmbf)   X(op_iorrmwf) \
+	X(op_ioraib)    X(op_ioraiw)    X(op_pushcs)    X(op_popcs)     X(op_adcrmbr)   X(op_adcrmwr) \
+	X(op_adcrmbf)   X(op_adcrmwf)   X(op_adcaib)    X(op_adcaiw)    X(op_pushss)    X(op_popss) \
+	X(op_sbbrmbr)   X(op_sbbrmwr)   X(op_sbbrmbf)   X(op_sbbrmwf)   X(op_sbbaib)    X(op_sbbaiw) \
+	X(op_pushds)    X(op_popds)     X(op_andrmbr)   X(op_andrmwr)   X(op_andrmbf)   X(op_andrmwf) \
+	X(op_andaib)    X(op_andaiw)    X(op_prefix)    X(op_daa)       X(op_subrmbr)   X(op_subrmwr) \
+	X(op_subrmbf)   X(op_subrmwf)   X(op_subaib)    X(op_subaiw)    X(op_das)       X(op_xorrmbr) \
+	X(op_xorrmwr)   X(op_xorrmbf)   X(op_xorrmwf)   X(op_xoraib)    X(op_xoraiw)    X(op_aaa) \
+	X(op_cmprmbr)   X(op_cmprmwr)   X(op_cmprmbf)   X(op_cmprmwf)   X(op_cmpaib)    X(op_cmpaiw) \
+	X(op_aas)       X(op_incrw)     X(op_decrw)     X(op_pushrw)    X(op_pushsp)    X(op_poprw) \
+	X(op_jco)       X(op_jcno)      X(op_jcc)       X(op_jcnc)      X(op_jcz)       X(op_jcnz) \
+	X(op_jcbe)      X(op_jcnbe)     X(op_jcs)       X(op_jcns)      X(op_jcp)       X(op_jcnp) \
+	X(op_jcl)       X(op_jcnl)      X(op_jcle)      X(op_jcnle)     X(op_nop)       X(op_tstrmb) \
+	X(op_tstrmw)    X(op_xchrmb)    X(op_xchrmw)    X(op_movrrmbr)  X(op_movrrmwr)  X(op_movrrmbf) \
+	X(op_movrrmwf)  X(op_movsrmwr)  X(op_lear)      X(op_movsrmwf)  X(op_poprmw)    X(op_xcharw) \
+	X(op_cbw)       X(op_cwd)       X(op_callf)     X(op_wait)      X(op_pushfw)    X(op_popfw) \
+	X(op_sahf)      X(op_lahf)      X(op_movambf)   X(op_movamwf)   X(op_movambr)   X(op_movamwr) \
+	X(op_movsb)     X(op_movsw)     X(op_cmpsb)     X(op_cmpsw)     X(op_tstaib)    X(op_tstaiw) \
+	X(op_stosb)     X(op_stosw)     X(op_lodsb)     X(op_lodsw)     X(op_scasb)     X(op_scasw) \
+	X(op_movrib)    X(op_movriw)    X(op_undef)     X(op_retnw)     X(op_retn0)     X(op_lesr) \
+	X(op_ldsr)      X(op_movrmib)   X(op_movrmiw)   X(op_retfw)     X(op_retf0)     X(op_int3) \
+	X(op_intib)     X(op_into)      X(op_iret)      X(op_aam)       X(op_aad)       X(op_xlatab) \
+	X(op_loopnzr)   X(op_loopzr)    X(op_loopr)     X(op_jcxzr)     X(op_inib)      X(op_iniw) \
+	X(op_outib)     X(op_outiw)     X(op_calln)     X(op_jmpnw)     X(op_jmpf)      X(op_jmpnb) \
+	X(op_inrb)      X(op_inrw)      X(op_outrb)     X(op_outrw)     X(op_hlt)       X(op_cmc) \
+	X(op_clc)       X(op_stc)       X(op_cli)       X(op_sti)       X(op_cld)       X(op_std) \
+	X(op_addrmbib)  X(op_iorrmbib)  X(op_adcrmbib)  X(op_sbbrmbib)  X(op_andrmbib)  X(op_subrmbib) \
+	X(op_xorrmbib)  X(op_cmprmbib)  X(op_addrmwiw)  X(op_iorrmwiw)  X(op_adcrmwiw)  X(op_sbbrmwiw) \
+	X(op_andrmwiw)  X(op_subrmwiw)  X(op_xorrmwiw)  X(op_cmprmwiw)  X(op_addrmwib)  X(op_iorrmwib) \
+	X(op_adcrmwib)  X(op_sbbrmwib)  X(op_andrmwib)  X(op_subrmwib)  X(op_xorrmwib)  X(op_cmprmwib) \
+	X(op_rolb1)     X(op_rorb1)     X(op_rclb1)     X(op_rcrb1)     X(op_shlb1)     X(op_shrb1) \
+	X(op_salb1)     X(op_sarb1)     X(op_rolw1)     X(op_rorw1)     X(op_rclw1)     X(op_rcrw1) \
+	X(op_shlw1)     X(op_shrw1)     X(op_salw1)     X(op_sarw1)     X(op_rolbr)     X(op_rorbr) \
+	X(op_rclbr)     X(op_rcrbr)     X(op_shlbr)     X(op_shrbr)     X(op_salbr)     X(op_sarbr) \
+	X(op_rolwr)     X(op_rorwr)     X(op_rclwr)     X(op_rcrwr)     X(op_shlwr)     X(op_shrwr) \
+	X(op_salwr)     X(op_sarwr)     X(op_tstrib)    X(op_notrmb)    X(op_negrmb)    X(op_mulrmb) \
+	X(op_imulrmb)   X(op_divrmb)    X(op_idivrmb)   X(op_tstriw)    X(op_notrmw)    X(op_negrmw) \
+	X(op_mulrmw)    X(op_imulrmw)   X(op_divrmw)    X(op_idivrmw)   X(op_incrmb)    X(op_decrmb) \
+	X(op_incrmw)    X(op_decrmw)    X(op_callnrm)   X(op_callfrm)   X(op_jmpnrm)    X(op_jmpfrm) \
+	X(op_pushrmw)   X(op_rolbib)    X(op_rorbib)    X(op_rclbib)    X(op_rcrbib)    X(op_shlbib) \
+	X(op_shrbib)    X(op_salbib)    X(op_sarbib)    X(op_rolwib)    X(op_rorwib)    X(op_rclwib) \
+	X(op_rcrwib)    X(op_shlwib)    X(op_shrwib)    X(op_salwib)    X(op_sarwib)    X(op_rolbc) \
+	X(op_rorbc)     X(op_rclbc)     X(op_rcrbc)     X(op_shlbc)     X(op_shrbc)     X(op_salbc) \
+	X(op_sarbc)     X(op_rolwc)     X(op_rorwc)     X(op_rclwc)     X(op_rcrwc)     X(op_shlwc) \
+	X(op_shrwc)     X(op_salwc)     X(op_sarwc)     X(op_pusha)     X(op_popa)      X(op_bound) \
+	X(op_pushiw)    X(op_imulrmiw)  X(op_pushib)    X(op_imulrmib)  X(op_insb)      X(op_insw) \
+	X(op_outsb)     X(op_outsw)     X(op_enter)     X(op_leave)     X(op_esc0)      X(op_esc1) \
+	X(op_esc2)      X(op_esc3)      X(op_esc4)      X(op_esc5)      X(op_esc6)      X(op_esc7) \
+	X(op_break)
+
+
+// Handlers built by RMHANDLER, the memory forms are in handlers[] after the opcode
+// table, at OPCODE_MEM
+#define RMHANDLERS(X) \
+	X(op_addrmbib)  X(op_iorrmbib)  X(op_adcrmbib)  X(op_sbbrmbib)  X(op_andrmbib)  X(op_subrmbib) \
+	X(op_xorrmbib)  X(op_cmprmbib)  X(op_addrmwiw)  X(op_iorrmwiw)  X(op_adcrmwiw)  X(op_sbbrmwiw) \
+	X(op_andrmwiw)  X(op_subrmwiw)  X(op_xorrmwiw)  X(op_cmprmwiw)  X(op_addrmwib)  X(op_iorrmwib) \
+	X(op_adcrmwib)  X(op_sbbrmwib)  X(op_andrmwib)  X(op_subrmwib)  X(op_xorrmwib)  X(op_cmprmwib) \
+	X(op_addrmbf)   X(op_iorrmbf)   X(op_adcrmbf)   X(op_sbbrmbf)   X(op_andrmbf)   X(op_subrmbf) \
+	X(op_xorrmbf)   X(op_cmprmbf)   X(op_addrmwf)   X(op_iorrmwf)   X(op_adcrmwf)   X(op_sbbrmwf) \
+	X(op_andrmwf)   X(op_subrmwf)   X(op_xorrmwf)   X(op_cmprmwf)   X(op_addrmbr)   X(op_iorrmbr) \
+	X(op_adcrmbr)   X(op_sbbrmbr)   X(op_andrmbr)   X(op_subrmbr)   X(op_xorrmbr)   X(op_cmprmbr) \
+	X(op_addrmwr)   X(op_iorrmwr)   X(op_adcrmwr)   X(op_sbbrmwr)   X(op_andrmwr)   X(op_subrmwr) \
+	X(op_xorrmwr)   X(op_cmprmwr)   X(op_decrmb)    X(op_incrmb)    X(op_decrmw)    X(op_incrmw) \
+	X(op_negrmb)    X(op_negrmw)    X(op_notrmb)    X(op_notrmw)    X(op_rolb1)     X(op_rorb1) \
+	X(op_rclb1)     X(op_rcrb1)     X(op_shlb1)     X(op_shrb1)     X(op_salb1)     X(op_sarb1) \
+	X(op_rolw1)     X(op_rorw1)     X(op_rclw1)     X(op_rcrw1)     X(op_shlw1)     X(op_shrw1) \
+	X(op_salw1)     X(op_sarw1)     X(op_rolbr)     X(op_rorbr)     X(op_rclbr)     X(op_rcrbr) \
+	X(op_shlbr)     X(op_shrbr)     X(op_salbr)     X(op_sarbr)     X(op_rolwr)     X(op_rorwr) \
+	X(op_rclwr)     X(op_rcrwr)     X(op_shlwr)     X(op_shrwr)     X(op_salwr)     X(op_sarwr) \
+	X(op_movrmib)   X(op_movrmiw)   X(op_movrrmbf)  X(op_movrrmwf)  X(op_movsrmwf)  X(op_movrrmbr) \
+	X(op_movrrmwr)  X(op_movsrmwr)  X(op_xchrmb)    X(op_xchrmw)    X(op_tstrib)    X(op_tstriw) \
+	X(op_tstrmb)    X(op_tstrmw)    X(op_ldsr)      X(op_lesr)      X(op_lear)      X(op_poprmw) \
+	X(op_pushrmw)   X(op_callfrm)   X(op_callnrm)   X(op_jmpfrm)    X(op_jmpnrm)    X(op_divrmb) \
+	X(op_divrmw)    X(op_mulrmb)    X(op_mulrmw)    X(op_idivrmb)   X(op_idivrmw)   X(op_imulrmb) \
+	X(op_imulrmw)   X(op_rolbib)    X(op_rorbib)    X(op_rclbib)    X(op_rcrbib)    X(op_shlbib) \
+	X(op_shrbib)    X(op_salbib)    X(op_sarbib)    X(op_rolwib)    X(op_rorwib)    X(op_rclwib) \
+	X(op_rcrwib)    X(op_shlwib)    X(op_shrwib)    X(op_salwib)    X(op_sarwib)    X(op_rolbc) \
+	X(op_rorbc)     X(op_rclbc)     X(op_rcrbc)     X(op_shlbc)     X(op_shrbc)     X(op_salbc) \
+	X(op_sarbc)     X(op_rolwc)     X(op_rorwc)     X(op_rclwc)     X(op_rcrwc)     X(op_shlwc) \
+	X(op_shrwc)     X(op_salwc)     X(op_sarwc)     X(op_imulrmib)  X(op_imulrmiw)  X(op_bound) \
+	X(op_esc0)      X(op_esc1)      X(op_esc2)      X(op_esc3)      X(op_esc4)      X(op_esc5) \
+	X(op_esc6)      X(op_esc7)
+
+#define RMHANDLER_DECLARE(fn)  static void fn##_m(CPU);
+
+RMHANDLERS(RMHANDLER_DECLARE)
+
+
+// Flag-setting instructions that run fused with a Jcc right after them, and the
+// bytes of immediate between the two. The fused handlers are in handlers[] at
+// OPCODE_FUSED, in this order
+#define FUSIONS(X) \
+	X(op_cmprmbr,   0)  X(op_cmprmbr_m,   0)  X(op_cmprmwr,   0)  X(op_cmprmwr_m,   0) \
+	X(op_cmprmbf,   0)  X(op_cmprmbf_m,   0)  X(op_cmprmwf,   0)  X(op_cmprmwf_m,   0) \
+	X(op_cmprmbib,  1)  X(op_cmprmbib_m,  1)  X(op_cmprmwiw,  2)  X(op_cmprmwiw_m,  2) \
+	X(op_cmprmwib,  1)  X(op_cmprmwib_m,  1)  X(op_cmpaib,    1)  X(op_cmpaiw,      2) \
+	X(op_tstrmb,    0)  X(op_tstrmb_m,    0)  X(op_tstrmw,    0)  X(op_tstrmw_m,    0) \
+	X(op_tstrib,    1)  X(op_tstrib_m,    1)  X(op_tstriw,    2)  X(op_tstriw_m,    2) \
+	X(op_tstaib,    1)  X(op_tstaiw,      2)  X(op_iorrmbr,   0)  X(op_iorrmwr,     0) \
+	X(op_iorrmbf,   0)  X(op_iorrmwf,     0)  X(op_decrw,     0)
+
+#define FUSION_INDEX(fn, imm)  FUSED_##fn,
+
+enum { FUSIONS(FUSION_INDEX) FUSIONS_COUNT };
+
+#undef FUSION_INDEX
+
+static i8086_opcode handlers[2 * OPCODE_COUNT + FUSIONS_COUNT];
+
+// Fused pair by dispatch index of its first instruction, opcode 0 if it has none
+static struct {
+	u16 opcode;
+	u8  imm;
+} fusions[2 * OPCODE_COUNT];
+
+
+static const uint opflags[256] = {
 
 // Main opcodes
 // 0x00
@@ -960,324 +1703,1344 @@ static const uint opflags[352] = {
 	0,        0,        0,        0,        OP_W8,    OP_W16,   OP_W8,    OP_W16,
 	0,        0,        0,        0,        OP_W8,    OP_W16,   OP_W8,    OP_W16,
 	OP_OVRD,  0,        OP_OVRD,  OP_OVRD,  0,        0,        OP_G8,    OP_G9,
-	0,        0,        0,        0,        0,        0,        OP_G10,   OP_G11,
+	0,        0,        0,        0,        0,        0,        OP_G10,   OP_G11
 
-// Group opcodes
-// 0x100
-	0,        0,        0,        0,        0,        0,        0,        0,
-	0,        0,        0,        0,        0,        0,        0,        0,
-	0,        0,        0,        0,        0,        0,        0,        0,
-	0,        0,        0,        0,        0,        0,        0,        0,
-// 0x120
-	0,        0,        0,        0,        0,        0,        0,        0,
-	0,        0,        0,        0,        0,        0,        0,        0,
-	0,        0,        0,        0,        0,        0,        0,        0,
-	0,        0,        0,        0,        0,        0,        0,        0,
-// 0x140
-	0,        0,        0,        0,        0,        0,        0,        0,
-	0,        0,        0,        0,        0,        0,        0,        0,
-	0,        0,        0,        0,        0,        0,        0,        0,
-	0,        0,        0,        0,        0,        0,        0,        0
+};
+
+
+// Changes the 80186 makes to the 8088 decode: opcode byte, dispatch index and flags
+static const struct { u8 op; u16 opcode; uint flags; } decode80186[] = {
+
+	{ 0x0f, 0x183, 0      },  // POP CS is gone
+
+	{ 0x60, 0x180, 0      }, { 0x61, 0x181, 0      }, { 0x62, 0x182, OP_RMW }, { 0x63, 0x183, 0      },
+	{ 0x64, 0x184, 0      }, { 0x65, 0x185, 0      }, { 0x66, 0x186, 0      }, { 0x67, 0x187, 0      },
+	{ 0x68, 0x188, 0      }, { 0x69, 0x189, OP_RMW }, { 0x6a, 0x18a, 0      }, { 0x6b, 0x18b, OP_RMW },
+	{ 0x6c, 0x18c, OP_W8  }, { 0x6d, 0x18d, OP_W16 }, { 0x6e, 0x18e, OP_W8  }, { 0x6f, 0x18f, OP_W16 },
+
+	{ 0xc0, 0x0c0, OP_G12 }, { 0xc1, 0x0c1, OP_G13 }, { 0xc8, 0x190, 0      }, { 0xc9, 0x191, 0      },
+	{ 0xd2, 0x0d2, OP_G14 }, { 0xd3, 0x0d3, OP_G15 }
+
+};
+
+
+// Opcode byte to dispatch index and flags, for each model. Filled in by
+// tables(), so that decode picks the model with a single lookup
+static struct {
+	u16  opcode[256];
+	uint flags[256];
+} models[I8086_MODEL_COUNT];
+
+
+static const uint demodrm[32] = {
+
+	OP_MODRM_MEMORY | OP_MODRM_SEG_DS | OP_MODRM_EA_R0_BX | OP_MODRM_EA_R1_SI,  // 00: [BX + SI]
+	OP_MODRM_MEMORY | OP_MODRM_SEG_DS | OP_MODRM_EA_R0_BX | OP_MODRM_EA_R1_DI,  // 01: [BX + DI]
+	OP_MODRM_MEMORY | OP_MODRM_SEG_SS | OP_MODRM_EA_R0_BP | OP_MODRM_EA_R1_SI,  // 02: [BP + SI]
+	OP_MODRM_MEMORY | OP_MODRM_SEG_SS | OP_MODRM_EA_R0_BP | OP_MODRM_EA_R1_DI,  // 03: [BP + DI]
+	OP_MODRM_MEMORY | OP_MODRM_SEG_DS | OP_MODRM_EA_R0_SI,                      // 04: [SI]
+	OP_MODRM_MEMORY | OP_MODRM_SEG_DS | OP_MODRM_EA_R0_DI,                      // 05: [DI]
+	OP_MODRM_MEMORY | OP_MODRM_SEG_DS | OP_MODRM_EA_DISP16,                     // 06: [DISP16]
+	OP_MODRM_MEMORY | OP_MODRM_SEG_DS | OP_MODRM_EA_R0_BX,                      // 07: [BX]
+
+	OP_MODRM_MEMORY | OP_MODRM_SEG_DS | OP_MODRM_EA_R0_BX | OP_MODRM_EA_R1_SI | OP_MODRM_EA_DISP8,   // 40: [BX + SI + DISP8]
+	OP_MODRM_MEMORY | OP_MODRM_SEG_DS | OP_MODRM_EA_R0_BX | OP_MODRM_EA_R1_DI | OP_MODRM_EA_DISP8,   // 41: [BX + DI + DISP8]
+	OP_MODRM_MEMORY | OP_MODRM_SEG_SS | OP_MODRM_EA_R0_BP | OP_MODRM_EA_R1_SI | OP_MODRM_EA_DISP8,   // 42: [BP + SI + DISP8]
+	OP_MODRM_MEMORY | OP_MODRM_SEG_SS | OP_MODRM_EA_R0_BP | OP_MODRM_EA_R1_DI | OP_MODRM_EA_DISP8,   // 43: [BP + DI + DISP8]
+	OP_MODRM_MEMORY | OP_MODRM_SEG_DS | OP_MODRM_EA_R0_SI                     | OP_MODRM_EA_DISP8,   // 44: [SI + DISP8]
+	OP_MODRM_MEMORY | OP_MODRM_SEG_DS | OP_MODRM_EA_R0_DI                     | OP_MODRM_EA_DISP8,   // 45: [DI + DISP8]
+	OP_MODRM_MEMORY | OP_MODRM_SEG_SS | OP_MODRM_EA_R0_BP                     | OP_MODRM_EA_DISP8,   // 46: [BP + DISP8]
+	OP_MODRM_MEMORY | OP_MODRM_SEG_DS | OP_MODRM_EA_R0_BX                     | OP_MODRM_EA_DISP8,   // 47: [BX + DISP8]
+
+	OP_MODRM_MEMORY | OP_MODRM_SEG_DS | OP_MODRM_EA_R0_BX | OP_MODRM_EA_R1_SI | OP_MODRM_EA_DISP16,  // 80: [BX + SI + DISP16]
+	OP_MODRM_MEMORY | OP_MODRM_SEG_DS | OP_MODRM_EA_R0_BX | OP_MODRM_EA_R1_DI | OP_MODRM_EA_DISP16,  // 81: [BX + DI + DISP16]
+	OP_MODRM_MEMORY | OP_MODRM_SEG_SS | OP_MODRM_EA_R0_BP | OP_MODRM_EA_R1_SI | OP_MODRM_EA_DISP16,  // 82: [BP + SI + DISP16]
+	OP_MODRM_MEMORY | OP_MODRM_SEG_SS | OP_MODRM_EA_R0_BP | OP_MODRM_EA_R1_DI | OP_MODRM_EA_DISP16,  // 83: [BP + DI + DISP16]
+	OP_MODRM_MEMORY | OP_MODRM_SEG_DS | OP_MODRM_EA_R0_SI                     | OP_MODRM_EA_DISP16,  // 84: [SI + DISP16]
+	OP_MODRM_MEMORY | OP_MODRM_SEG_DS | OP_MODRM_EA_R0_DI                     | OP_MODRM_EA_DISP16,  // 85: [DI + DISP16]
+	OP_MODRM_MEMORY | OP_MODRM_SEG_SS | OP_MODRM_EA_R0_BP                     | OP_MODRM_EA_DISP16,  // 86: [BP + DISP16]
+	OP_MODRM_MEMORY | OP_MODRM_SEG_DS | OP_MODRM_EA_R0_BX                     | OP_MODRM_EA_DISP16,  // 87: [BX + DISP16]
+
+	OP_MODRM_REGISTER | OP_MODRM_REG_AX_AL | OP_MODRM_REG_ES,  // C0: AX AL ES
+	OP_MODRM_REGISTER | OP_MODRM_REG_CX_CL | OP_MODRM_REG_CS,  // C1: CX CL CS
+	OP_MODRM_REGISTER | OP_MODRM_REG_DX_DL | OP_MODRM_REG_SS,  // C2: DX DL SS
+	OP_MODRM_REGISTER | OP_MODRM_REG_BX_BL | OP_MODRM_REG_DS,  // C3: BX BL DS
+	OP_MODRM_REGISTER | OP_MODRM_REG_SP_AH | OP_MODRM_REG_ES,  // C4: SP AH ES
+	OP_MODRM_REGISTER | OP_MODRM_REG_BP_CH | OP_MODRM_REG_CS,  // C5: BP CH CS
+	OP_MODRM_REGISTER | OP_MODRM_REG_SI_DH | OP_MODRM_REG_SS,  // C6: SI DH SS
+	OP_MODRM_REGISTER | OP_MODRM_REG_DI_BH | OP_MODRM_REG_DS   // C7: DI BH DS
+
+};
+
+
+// 8088 clock cycles by dispatch index, { register form, memory form }. Memory forms
+// exclude the EA calculation, string operations are charged per element and
+// taken branches add the branch cycles of the model in their handlers
+static const u8 opcycles[OPCODE_COUNT][2] = {
+
+// Main opcodes
+// 0x00
+	{   3,  16 }, {   3,  24 }, {   3,   9 }, {   3,  13 }, {   4,   4 }, {   4,   4 }, {  14,  14 }, {  12,  12 },
+	{   3,  16 }, {   3,  24 }, {   3,   9 }, {   3,  13 }, {   4,   4 }, {   4,   4 }, {  14,  14 }, {  12,  12 },
+	{   3,  16 }, {   3,  24 }, {   3,   9 }, {   3,  13 }, {   4,   4 }, {   4,   4 }, {  14,  14 }, {  12,  12 },
+	{   3,  16 }, {   3,  24 }, {   3,   9 }, {   3,  13 }, {   4,   4 }, {   4,   4 }, {  14,  14 }, {  12,  12 },
+// 0x20
+	{   3,  16 }, {   3,  24 }, {   3,   9 }, {   3,  13 }, {   4,   4 }, {   4,   4 }, {   2,   2 }, {   4,   4 },
+	{   3,  16 }, {   3,  24 }, {   3,   9 }, {   3,  13 }, {   4,   4 }, {   4,   4 }, {   2,   2 }, {   4,   4 },
+	{   3,  16 }, {   3,  24 }, {   3,   9 }, {   3,  13 }, {   4,   4 }, {   4,   4 }, {   2,   2 }, {   4,   4 },
+	{   3,   9 }, {   3,  13 }, {   3,   9 }, {   3,  13 }, {   4,   4 }, {   4,   4 }, {   2,   2 }, {   4,   4 },
+// 0x40
+	{   2,   2 }, {   2,   2 }, {   2,   2 }, {   2,   2 }, {   2,   2 }, {   2,   2 }, {   2,   2 }, {   2,   2 },
+	{   2,   2 }, {   2,   2 }, {   2,   2 }, {   2,   2 }, {   2,   2 }, {   2,   2 }, {   2,   2 }, {   2,   2 },
+	{  15,  15 }, {  15,  15 }, {  15,  15 }, {  15,  15 }, {  15,  15 }, {  15,  15 }, {  15,  15 }, {  15,  15 },
+	{  12,  12 }, {  12,  12 }, {  12,  12 }, {  12,  12 }, {  12,  12 }, {  12,  12 }, {  12,  12 }, {  12,  12 },
+// 0x60
+	{   4,   4 }, {   4,   4 }, {   4,   4 }, {   4,   4 }, {   4,   4 }, {   4,   4 }, {   4,   4 }, {   4,   4 },
+	{   4,   4 }, {   4,   4 }, {   4,   4 }, {   4,   4 }, {   4,   4 }, {   4,   4 }, {   4,   4 }, {   4,   4 },
+	{   4,   4 }, {   4,   4 }, {   4,   4 }, {   4,   4 }, {   4,   4 }, {   4,   4 }, {   4,   4 }, {   4,   4 },
+	{   4,   4 }, {   4,   4 }, {   4,   4 }, {   4,   4 }, {   4,   4 }, {   4,   4 }, {   4,   4 }, {   4,   4 },
+// 0x80
+	{   0,   0 }, {   0,   0 }, {   0,   0 }, {   0,   0 }, {   3,   9 }, {   3,  13 }, {   4,  17 }, {   4,  25 },
+	{   2,   9 }, {   2,  13 }, {   2,   8 }, {   2,  12 }, {   2,  13 }, {   2,   2 }, {   2,  12 }, {  12,  25 },
+	{   3,   3 }, {   3,   3 }, {   3,   3 }, {   3,   3 }, {   3,   3 }, {   3,   3 }, {   3,   3 }, {   3,   3 },
+	{   2,   2 }, {   5,   5 }, {  36,  36 }, {   3,   3 }, {  14,  14 }, {  12,  12 }, {   4,   4 }, {   4,   4 },
+// 0xa0
+	{  10,  10 }, {  14,  14 }, {  10,  10 }, {  14,  14 }, {   0,   0 }, {   0,   0 }, {   0,   0 }, {   0,   0 },
+	{   4,   4 }, {   4,   4 }, {   0,   0 }, {   0,   0 }, {   0,   0 }, {   0,   0 }, {   0,   0 }, {   0,   0 },
+	{   4,   4 }, {   4,   4 }, {   4,   4 }, {   4,   4 }, {   4,   4 }, {   4,   4 }, {   4,   4 }, {   4,   4 },
+	{   4,   4 }, {   4,   4 }, {   4,   4 }, {   4,   4 }, {   4,   4 }, {   4,   4 }, {   4,   4 }, {   4,   4 },
+// 0xc0
+	{   0,   0 }, {   0,   0 }, {  16,  16 }, {  12,  12 }, {  24,  24 }, {  24,  24 }, {   4,  10 }, {   4,  14 },
+	{   0,   0 }, {   0,   0 }, {  25,  25 }, {  26,  26 }, {  72,  72 }, {  71,  71 }, {   4,   4 }, {  36,  36 },
+	{   0,   0 }, {   0,   0 }, {   0,   0 }, {   0,   0 }, {  83,  83 }, {  60,  60 }, {   0,   0 }, {  11,  11 },
+	{   2,  12 }, {   2,  12 }, {   2,  12 }, {   2,  12 }, {   2,  12 }, {   2,  12 }, {   2,  12 }, {   2,  12 },
+// 0xe0
+	{   5,   5 }, {   6,   6 }, {   5,   5 }, {   6,   6 }, {  10,  10 }, {  14,  14 }, {  10,  10 }, {  14,  14 },
+	{  23,  23 }, {  15,  15 }, {  15,  15 }, {  15,  15 }, {   8,   8 }, {  12,  12 }, {   8,   8 }, {  12,  12 },
+	{   2,   2 }, {   0,   0 }, {   9,   9 }, {   9,   9 }, {   2,   2 }, {   2,   2 }, {   0,   0 }, {   0,   0 },
+	{   2,   2 }, {   2,   2 }, {   2,   2 }, {   2,   2 }, {   2,   2 }, {   2,   2 }, {   0,   0 }, {   0,   0 },
+
+// Group opcodes
+// 0x100
+	{   4,  17 }, {   4,  17 }, {   4,  17 }, {   4,  17 }, {   4,  17 }, {   4,  17 }, {   4,  17 }, {   4,  10 },
+	{   4,  25 }, {   4,  25 }, {   4,  25 }, {   4,  25 }, {   4,  25 }, {   4,  25 }, {   4,  25 }, {   4,  14 },
+	{   4,  17 }, {   4,  17 }, {   4,  17 }, {   4,  17 }, {   4,  17 }, {   4,  17 }, {   4,  17 }, {   4,  10 },
+	{   4,  25 }, {   4,  25 }, {   4,  25 }, {   4,  25 }, {   4,  25 }, {   4,  25 }, {   4,  25 }, {   4,  14 },
+// 0x120
+	{   2,  15 }, {   2,  15 }, {   2,  15 }, {   2,  15 }, {   2,  15 }, {   2,  15 }, {   2,  15 }, {   2,  15 },
+	{   2,  23 }, {   2,  23 }, {   2,  23 }, {   2,  23 }, {   2,  23 }, {   2,  23 }, {   2,  23 }, {   2,  23 },
+	{   8,  20 }, {   8,  20 }, {   8,  20 }, {   8,  20 }, {   8,  20 }, {   8,  20 }, {   8,  20 }, {   8,  20 },
+	{   8,  28 }, {   8,  28 }, {   8,  28 }, {   8,  28 }, {   8,  28 }, {   8,  28 }, {   8,  28 }, {   8,  28 },
+// 0x140
+	{   5,  11 }, {   5,  11 }, {   3,  16 }, {   3,  16 }, {  70,  76 }, {  80,  86 }, {  80,  86 }, { 101, 107 },
+	{   5,  15 }, {   5,  15 }, {   3,  24 }, {   3,  24 }, { 118, 128 }, { 128, 138 }, { 144, 154 }, { 165, 175 },
+	{   3,  15 }, {   3,  15 }, {   0,   0 }, {   0,   0 }, {   0,   0 }, {   0,   0 }, {   0,   0 }, {   0,   0 },
+	{   3,  23 }, {   3,  23 }, {  20,  29 }, {  53,  53 }, {  11,  22 }, {  32,  32 }, {  15,  24 }, {  15,  24 },
+// 0x160, 80186 timings
+	{   5,  17 }, {   5,  17 }, {   5,  17 }, {   5,  17 }, {   5,  17 }, {   5,  17 }, {   5,  17 }, {   5,  17 },
+	{   5,  17 }, {   5,  17 }, {   5,  17 }, {   5,  17 }, {   5,  17 }, {   5,  17 }, {   5,  17 }, {   5,  17 },
+	{   5,  17 }, {   5,  17 }, {   5,  17 }, {   5,  17 }, {   5,  17 }, {   5,  17 }, {   5,  17 }, {   5,  17 },
+	{   5,  17 }, {   5,  17 }, {   5,  17 }, {   5,  17 }, {   5,  17 }, {   5,  17 }, {   5,  17 }, {   5,  17 },
+
+// 80186 opcodes
+// 0x180
+	{  36,  36 }, {  51,  51 }, {   0,  33 }, {   0,   0 }, {   0,   0 }, {   0,   0 }, {   0,   0 }, {   0,   0 },
+	{  10,  10 }, {  22,  25 }, {  10,  10 }, {  22,  25 }, {   0,   0 }, {   0,   0 }, {   0,   0 }, {   0,   0 },
+	{   0,   0 }, {   8,   8 }, {   0,   0 }, {   0,   0 }, {   0,   0 }, {   0,   0 }, {   0,   0 }, {   0,   0 }
+
+};
+
+
+// 8088 EA calculation cycles by MOD/RM form, as indexed in demodrm
+static const u8 eacycles[24] = {
+	 7,  8,  8,  7,  5,  5,  6,  5,  // [BX + SI] [BX + DI] [BP + SI] [BP + DI] [SI] [DI] [DISP16] [BX]
+	11, 12, 12, 11,  9,  9,  9,  9,  // + DISP8
+	11, 12, 12, 11,  9,  9,  9,  9   // + DISP16
+};
+
+
+// Effective address forms, the displacement is zero where the form has none
+static u16 ea_disp(CPU, u16 disp) { return disp; }
+static u16 ea_bx(  CPU, u16 disp) { return cpu->regs.bx.w + disp; }
+static u16 ea_bp(  CPU, u16 disp) { return cpu->regs.bp.w + disp; }
+static u16 ea_si(  CPU, u16 disp) { return cpu->regs.si.w + disp; }
+static u16 ea_di(  CPU, u16 disp) { return cpu->regs.di.w + disp; }
+static u16 ea_bxsi(CPU, u16 disp) { return cpu->regs.bx.w + cpu->regs.si.w + disp; }
+static u16 ea_bxdi(CPU, u16 disp) { return cpu->regs.bx.w + cpu->regs.di.w + disp; }
+static u16 ea_bpsi(CPU, u16 disp) { return cpu->regs.bp.w + cpu->regs.si.w + disp; }
+static u16 ea_bpdi(CPU, u16 disp) { return cpu->regs.bp.w + cpu->regs.di.w + disp; }
+
+
+// Every MODRM byte, decoded. Registers are offsets into regs, so all CPUs share it
+static struct {
+
+	bool memory;
+	u8   disp;     // Displacement bytes that follow
+	u8   segment;  // Default segment, REG_ZERO for register operands
+	u8   cycles;   // EA calculation cycles
+
+	u8 regb, rmb;  // Register in REG, and in R/M for register operands
+	u8 regw, rmw;
+	u8 regs;       // REG as segment register
+
+	i8086_ea ea;   // Effective address routine, given the displacement
+
+} modrms[256];
+
+
+
+// Jcc half of a fused pair, charged and run as if it was fetched on its own. The
+// branch is picked here so that each of them sees the flags the first half left
+static inline void fused_jcc(CPU)
+{
+
+	CYCLES(opcycles[0x70][0]);
+
+	switch (LDIPUB() & 0x0f) {
+		case 0x0: op_jco(cpu);   break;
+		case 0x1: op_jcno(cpu);  break;
+		case 0x2: op_jcc(cpu);   break;
+		case 0x3: op_jcnc(cpu);  break;
+		case 0x4: op_jcz(cpu);   break;
+		case 0x5: op_jcnz(cpu);  break;
+		case 0x6: op_jcbe(cpu);  break;
+		case 0x7: op_jcnbe(cpu); break;
+		case 0x8: op_jcs(cpu);   break;
+		case 0x9: op_jcns(cpu);  break;
+		case 0xa: op_jcp(cpu);   break;
+		case 0xb: op_jcnp(cpu);  break;
+		case 0xc: op_jcl(cpu);   break;
+		case 0xd: op_jcnl(cpu);  break;
+		case 0xe: op_jcle(cpu);  break;
+		case 0xf: op_jcnle(cpu); break;
+	}
+
+}
+
+
+#define FUSION_HANDLER(fn, imm)  static void fn##_jcc(CPU) { fn(cpu); fused_jcc(cpu); }
+
+FUSIONS(FUSION_HANDLER)
+
+#undef FUSION_HANDLER
+
+
+
+#ifdef I8086_THREADED
+static uint threaded(CPU, uint budget);
+#endif
+
+// Tables shared by every CPU, built once as the program loads so that no two
+// instances can race to build them
+[[gnu::constructor]] static void tables(void)
+{
+
+	// Pair the opcode table with the memory forms of its handlers
+	#define RMHANDLER_PAIR(fn)  { &fn, &fn##_m },
+
+	static const i8086_opcode pairs[][2] = { RMHANDLERS(RMHANDLER_PAIR) };
+
+	for (int n=0; n < OPCODE_COUNT; n++) {
+
+		handlers[n] = handlers[n + OPCODE_MEM] = opcodes[n];
+
+		for (int k=0; k < sizeof(pairs) / sizeof(pairs[0]); k++)
+			if (opcodes[n] == pairs[k][0])
+				handlers[n + OPCODE_MEM] = pairs[k][1];
+
+	}
+
+	#undef RMHANDLER_PAIR
+
+	#define FUSION_FIRST(fn, imm)  { &fn, &fn##_jcc, imm },
+
+	static const struct { i8086_opcode first, fused; u8 imm; } fused[] = { FUSIONS(FUSION_FIRST) };
+
+	for (int k=0; k < FUSIONS_COUNT; k++) {
+
+		handlers[OPCODE_FUSED + k] = fused[k].fused;
+
+		for (int n=0; n < OPCODE_FUSED; n++)
+			if (handlers[n] == fused[k].first) {
+				fusions[n].opcode = OPCODE_FUSED + k;
+				fusions[n].imm    = fused[k].imm;
+			}
+
+	}
+
+	#undef FUSION_FIRST
+
+	// Decode of every opcode byte by model, the 80186 adds to the 8086 set
+	for (int n=0; n < 256; n++)
+		for (int m=0; m < I8086_MODEL_COUNT; m++) {
+			models[m].opcode[n] = n;
+			models[m].flags[n]  = opflags[n];
+		}
+
+	for (int k=0; k < sizeof(decode80186) / sizeof(decode80186[0]); k++) {
+		models[I8086_MODEL_80186].opcode[decode80186[k].op] = decode80186[k].opcode;
+		models[I8086_MODEL_80186].flags[decode80186[k].op]  = decode80186[k].flags;
+	}
+
+
+	// MOD/RM decoding table. Registers named by the REG field, and by R/M in register forms
+	u8 regb[8];
+	u8 regw[8];
+	u8 regs[8];
+
+	for (int n=0; n < 8; n++) {
+
+		const uint flags = demodrm[n + 24];
+
+		switch (flags & OP_MODRM_REG_GENERIC) {
+
+			case OP_MODRM_REG_AX_AL: regw[n] = REGOFS(ax.w); regb[n] = REGOFS(ax.l); break;
+			case OP_MODRM_REG_BX_BL: regw[n] = REGOFS(bx.w); regb[n] = REGOFS(bx.l); break;
+			case OP_MODRM_REG_CX_CL: regw[n] = REGOFS(cx.w); regb[n] = REGOFS(cx.l); break;
+			case OP_MODRM_REG_DX_DL: regw[n] = REGOFS(dx.w); regb[n] = REGOFS(dx.l); break;
+			case OP_MODRM_REG_SI_DH: regw[n] = REGOFS(si.w); regb[n] = REGOFS(dx.h); break;
+			case OP_MODRM_REG_DI_BH: regw[n] = REGOFS(di.w); regb[n] = REGOFS(bx.h); break;
+			case OP_MODRM_REG_SP_AH: regw[n] = REGOFS(sp.w); regb[n] = REGOFS(ax.h); break;
+			case OP_MODRM_REG_BP_CH: regw[n] = REGOFS(bp.w); regb[n] = REGOFS(cx.h); break;
+
+		}
+
+		switch (flags & OP_MODRM_REG_SEGMENT) {
+
+			case OP_MODRM_REG_CS: regs[n] = REG_CS; break;
+			case OP_MODRM_REG_DS: regs[n] = REG_DS; break;
+			case OP_MODRM_REG_ES: regs[n] = REG_ES; break;
+			case OP_MODRM_REG_SS: regs[n] = REG_SS; break;
+
+		}
+
+	}
+
+
+	// One entry for every MODRM byte
+	for (int n=0; n < 256; n++) {
+
+		const uint form  = ((n >> 6) & 3) * 8 + (n & 7);
+		const uint reg   = (n >> 3) & 7;
+		const uint flags = demodrm[form];
+		auto       modrm = &modrms[n];
+
+		modrm->regb = regb[reg];
+		modrm->regw = regw[reg];
+		modrm->regs = regs[reg];
+
+		if (flags & OP_MODRM_MEMORY) {
+
+			modrm->memory  = true;
+			modrm->disp    = (flags & OP_MODRM_EA_DISP16)? 2: (flags & OP_MODRM_EA_DISP8)? 1: 0;
+			modrm->segment = (flags & OP_MODRM_SEG_SS)? REG_SS: REG_DS;
+			modrm->cycles  = eacycles[form];
+			modrm->rmb     = 0;
+			modrm->rmw     = 0;
+
+			switch (flags & (OP_MODRM_EA_R0 | OP_MODRM_EA_R1)) {
+
+				case OP_MODRM_EA_R0_BX | OP_MODRM_EA_R1_SI: modrm->ea = &ea_bxsi; break;
+				case OP_MODRM_EA_R0_BX | OP_MODRM_EA_R1_DI: modrm->ea = &ea_bxdi; break;
+				case OP_MODRM_EA_R0_BP | OP_MODRM_EA_R1_SI: modrm->ea = &ea_bpsi; break;
+				case OP_MODRM_EA_R0_BP | OP_MODRM_EA_R1_DI: modrm->ea = &ea_bpdi; break;
+				case OP_MODRM_EA_R0_BX:                     modrm->ea = &ea_bx;   break;
+				case OP_MODRM_EA_R0_BP:                     modrm->ea = &ea_bp;   break;
+				case OP_MODRM_EA_R0_SI:                     modrm->ea = &ea_si;   break;
+				case OP_MODRM_EA_R0_DI:                     modrm->ea = &ea_di;   break;
+
+				default:
+					modrm->ea = &ea_disp;
+					break;
+
+			}
+
+		} else {
+
+			modrm->memory  = false;
+			modrm->disp    = 0;
+			modrm->segment = REG_ZERO;
+			modrm->cycles  = 0;
+			modrm->ea      = &ea_disp;
+			modrm->rmb     = regb[n & 7];
+			modrm->rmw     = regw[n & 7];
+
+		}
+
+	}
+
+#ifdef I8086_THREADED
+	threaded(NULL, 0);  // Labels of the handlers just paired up
+#endif
+
+}
+
+
+
+// Decode context, for the model and points the CPU has now
+static void decodesync(CPU)
+{
+
+	cpu->insn.context = cpu->model | (cpu->debug.count != 0) << 4;
+
+}
+
+
+
+// Returns false if the decode cache could not be allocated
+bool i8086_init(CPU)
+{
+
+	cpu->icache = aligned_alloc(64, sizeof(struct i8086_icache));
+
+	if (cpu->icache == NULL)
+		return false;
+
+	cpu->regs.zero = 0;
+
+	cpu->regs.ax.w = 0;
+	cpu->regs.bx.w = 0;
+	cpu->regs.cx.w = 0;
+	cpu->regs.dx.w = 0;
+	cpu->regs.si.w = 0;
+	cpu->regs.di.w = 0;
+	cpu->regs.bp.w = 0;
+	cpu->regs.sp.w = 0;
+
+	cpu->interrupt.irq     = 0;
+	cpu->interrupt.irq_act = false;
+	cpu->interrupt.nmi_act = false;
+	cpu->interrupt.delay   = false;
+	cpu->interrupt.pending = false;
+	cpu->interrupt.halt    = false;
+
+	cpu->cycles = 0;
+	cpu->fused  = 0;
+
+	cpu->memory.length = 0;  // No memory has length 0, descriptors are built on first use
+	cpu->memory.limit  = 65536;
+
+	cpu->undef = &op_nop;
+	cpu->model = I8086_MODEL_8088;
+	cpu->jit   = NULL;
+	cpu->hooks = NULL;
+
+	memset(&cpu->debug, 0, sizeof(cpu->debug));
+	cpu->debug.skip = ~0u;
+
+	memset(&cpu->ibreak, 0, sizeof(cpu->ibreak));
+	cpu->ibreak.opcode = OPCODE_BREAK;
+	cpu->ibreak.ea     = &ea_disp;
+
+	cpu->fpu.present = false;
+
+	for (int n=0; n < I8086_ICACHE_SIZE; n++)
+		cpu->icache->entry[n].addr = ~0u;
+
+	decodesync(cpu);
+
+	memory_init(&cpu->memory.mem);
+
+	io_init(&cpu->iob);
+	io_init(&cpu->iow);
+
+	i8086_reset(cpu);
+
+	return true;
+
+}
+
+
+
+// Releases the decode cache, of the CPU that i8086_init() was called for
+void i8086_free(CPU)
+{
+
+	free(cpu->icache);
+	cpu->icache = NULL;
+
+}
+
+
+
+void i8086_reset(CPU)
+{
+
+	cpu->memory.mask   = cpu->memory.mem.mask;
+	cpu->memory.length = cpu->memory.mem.length;
+
+	for (int seg=0; seg < 5; seg++)
+		memselect(cpu, seg, 0);
+
+	memselect(cpu, REG_CS, 0xffff);
+	cpu->regs.ip = 0x0000;
+
+	cpu->flags.c = false;
+	cpu->flags.p = false;
+	cpu->flags.a = false;
+	cpu->flags.z = false;
+	cpu->flags.s = false;
+	cpu->flags.v = false;
+	cpu->flags.d = false;
+	cpu->flags.t = false;
+	cpu->flags.i = false;
+
+	cpu->lazy.op = LAZY_NONE;
+
+	cpu->insn.fetch     = true;
+	cpu->insn.repeat_eq = false;
+	cpu->insn.repeat_ne = false;
+
+	cpu->insn.opcode  = 0;
+	cpu->insn.modrm   = 0;
+	cpu->insn.segment = REG_ZERO;
+
+	cpu->interrupt.halt = false;
+
+	cpu->regs.scs = SEGMENT(REG_CS);
+	cpu->regs.sip = cpu->regs.ip;
+
+	if (cpu->fpu.present)
+		i8087_reset(&cpu->fpu);
+
+}
+
+
+
+// Selects the instruction set, decodes cached for the previous one no longer match
+void i8086_model(CPU, uint model)
+{
+
+	cpu->model = (model < I8086_MODEL_COUNT)? model: I8086_MODEL_8088;
+	decodesync(cpu);
+
+}
+
+
+
+// Port hook, in front of the ports the CPU had. Block transfers are left out so
+// that string I/O comes through element by element
+static void hook_rd(void *data, u16 port, uint mode, uint *value)
+{
+
+	i8086 *cpu = data;
+	auto   io  = &cpu->ports[IO_16BIT(mode)];
+
+	io->rd(io->data, port, mode, value);
+	cpu->hooks->port(cpu->hooks->data, cpu, port, mode, *value);
+
+}
+
+
+static void hook_wr(void *data, u16 port, uint mode, uint *value)
+{
+
+	i8086 *cpu = data;
+	auto   io  = &cpu->ports[IO_16BIT(mode)];
+
+	io->wr(io->data, port, mode, value);
+	cpu->hooks->port(cpu->hooks->data, cpu, port, mode, *value);
+
+}
+
+
+// Points the port hook at the CPU it runs on. It is made with a pointer to the
+// CPU hooked, so a memcpy() copy would read, write and report through that one
+static inline void hookports(CPU)
+{
+
+	if (cpu->hooks->port != NULL)
+		cpu->iob.data = cpu->iow.data = cpu;
+
+}
+
+
+// Attaches observers, or detaches them with NULL. Only i8086_run() and
+// i8086_tick() look at them, and i8086_run() switches to an instrumented copy
+// of its loop, so a CPU without hooks runs as fast as before. Ports must be
+// connected first; a copy of a hooked CPU reports its ports through itself
+void i8086_hook(CPU, const struct i8086_hooks *hooks)
+{
+
+	if (cpu->hooks != NULL && cpu->hooks->port != NULL) {
+		cpu->iob = cpu->ports[0];
+		cpu->iow = cpu->ports[1];
+	}
+
+	cpu->hooks = hooks;
+
+	if (hooks != NULL && hooks->port != NULL) {
+		cpu->ports[0] = cpu->iob;
+		cpu->ports[1] = cpu->iow;
+		cpu->iob      = io_make(cpu, &hook_rd, &hook_wr);
+		cpu->iow      = io_make(cpu, &hook_rd, &hook_wr);
+	}
+
+	// Descriptors that cover nothing send every data access by the slow path
+	cpu->memory.limit = (hooks != NULL && hooks->memory != NULL)? 0: 65536;
+
+	for (int seg=0; seg < 5; seg++)
+		memselect(cpu, seg, cpu->memory.selector[seg]);
+
+}
+
+
+
+// Rebuilds the page bitmap and everything made from it after points changed
+static void debugsync(CPU)
+{
+
+	memset(cpu->debug.pages, 0, sizeof(cpu->debug.pages));
+
+	for (uint n=0; n < I8086_POINTS; n++) {
+
+		const auto pt = &cpu->debug.point[n];
+
+		if (pt->kind != 0)
+			for (u32 page = pt->addr >> 12; page <= (pt->addr + pt->length - 1) >> 12 && page < I8086_PAGES; page++)
+				cpu->debug.pages[page / 64] |= 1ull << (page % 64);
+
+	}
+
+	for (int seg=0; seg < 5; seg++)
+		memselect(cpu, seg, cpu->memory.selector[seg]);
+
+	// Cached decodes may have fused a Jcc with a breakpoint on it
+	decodesync(cpu);
+
+}
+
+
+
+// Sets a breakpoint or watchpoint on length bytes from the physical address
+// addr, kind is a mix of I8086_POINT_*. Returns the point, or -1 if all are in
+// use or the range runs past the 2MB physical address space. A hit ends
+// i8086_run() with I8086_STOP_BREAK before the instruction or I8086_STOP_WATCH
+// after it; debug.hit, addr and mode tell which one
+int i8086_point_add(CPU, u32 addr, u32 length, uint kind)
+{
+
+	kind &= I8086_POINT_EXEC | I8086_POINT_READ | I8086_POINT_WRITE;
+
+	if (kind == 0 || length == 0 || addr >= I8086_PAGES * 4096 || length > I8086_PAGES * 4096 - addr)
+		return -1;
+
+	for (uint n=0; n < I8086_POINTS; n++) {
+
+		const auto pt = &cpu->debug.point[n];
+
+		if (pt->kind == 0) {
+
+			pt->addr   = addr;
+			pt->length = length;
+			pt->kind   = kind;
+
+			cpu->debug.count++;
+			debugsync(cpu);
+
+			return n;
+
+		}
+
+	}
+
+	return -1;
+
+}
+
+
+
+void i8086_point_remove(CPU, int point)
+{
+
+	if (point < 0 || point >= I8086_POINTS || cpu->debug.point[point].kind == 0)
+		return;
+
+	cpu->debug.point[point].kind = 0;
+	cpu->debug.count--;
+
+	debugsync(cpu);
+
+}
+
+
+
+int i8086_intrq(CPU, uint nmi, uint irq)
+{
+
+	cpu->interrupt.irq     = irq;
+	cpu->interrupt.irq_act = nmi == 0;
+	cpu->interrupt.nmi_act = nmi != 0;
+	cpu->interrupt.pending = true;
+
+	return 0;
+
+}
+
+
+
+static inline bool ready(CPU)
+{
+
+	return cpu->interrupt.nmi_act || (cpu->interrupt.irq_act && cpu->flags.i);
+
+}
+
+
+
+static inline void service(CPU)
+{
+
+	if (!cpu->interrupt.delay) {
+
+		if (cpu->interrupt.nmi_act) {
+
+			CYCLES(CYCLES_INTR);
+			interrupt(cpu, I8086_VECTOR_NMI, cpu->regs.scs, cpu->regs.sip);
+
+			cpu->interrupt.nmi_act = false;
+			cpu->insn.fetch        = true;
+
+		} else if (cpu->flags.i && cpu->interrupt.irq_act) {
+
+			CYCLES(CYCLES_INTR);
+			interrupt(cpu, cpu->interrupt.irq, cpu->regs.scs, cpu->regs.sip);
+
+			cpu->interrupt.irq_act = false;
+			cpu->insn.fetch        = true;
+
+		} else if (cpu->flags.t) {
+
+			CYCLES(CYCLES_INTR);
+			interrupt(cpu, I8086_VECTOR_SSTEP, cpu->regs.scs, cpu->regs.sip);
+
+		}
+
+	} else
+		cpu->interrupt.delay = false;
+
+	cpu->interrupt.pending = cpu->interrupt.delay || cpu->flags.t || cpu->interrupt.halt || ready(cpu);
+
+}
+
+
+
+[[gnu::noinline, gnu::cold]] static void decode(CPU, struct i8086_decode *dc)
+{
+
+	const u16  ip  = cpu->regs.ip;
+	const auto mdl = &models[cpu->model];
+	uint       op  = LDIPUB();
+	uint       opf = mdl->flags[op];
+	uint       pre = 0;
+
+	dc->segment   = REG_ZERO;
+	dc->repeat_eq = false;
+	dc->repeat_ne = false;
+
+	// Prefixes become part of the instruction they modify, so that interrupts
+	// can only come in before the first one, like on the 8088
+	for (uint n=0; (opf & OP_OVRD) && n < DECODE_PREFIXES; n++) {
+
+		if ((op & 0xe7) == 0x26) // ES:, CS:, SS:, DS:
+			dc->segment = (op >> 3) & 3;
+
+		else if (op != 0xf0) { // REPNE, REP, LOCK is ignored
+			dc->repeat_eq = op == 0xf3;
+			dc->repeat_ne = op == 0xf2;
+		}
+
+		pre += opcycles[op][0];
+		op   = LDIPUB();
+		opf  = mdl->flags[op];
+
+	}
+
+	dc->opcode = mdl->opcode[op];
+	dc->modrm  = 0;
+	dc->disp   = 0;
+
+	dc->op_memory  = false;
+	dc->op_segment = opf & OP_RSEG;
+
+	dc->ea = &ea_disp;
+
+	dc->reg0b = 0;
+	dc->reg0w = 0;
+	dc->reg1b = 0;
+	dc->reg1w = 0;
+
+	if (opf & OP_R02) { // Same registers as R/M in a register form
+
+		const auto reg0 = &modrms[0xc0 | (op & 0x07)];
+
+		dc->reg0w = reg0->rmw;
+		dc->reg0b = reg0->rmb;
+
+	}
+
+
+	uint ea = 0;
+
+	if (opf & OP_MODRM) { // Fetch and decode MODRM
+
+		dc->modrm = LDIPUB();
+
+		const auto modrm = &modrms[dc->modrm];
+
+		if (opf & OP_GROUP)
+			dc->opcode = 256 + (opf & 0xff) * 8 + ((dc->modrm >> 3) & 7);
+
+		else {
+			dc->reg0w = dc->op_segment? modrm->regs: modrm->regw;
+			dc->reg0b = modrm->regb;
+		}
+
+		if      (modrm->disp == 1) dc->disp = LDIPSB();
+		else if (modrm->disp == 2) dc->disp = LDIPUW();
+
+		dc->ea        = modrm->ea;
+		dc->reg1b     = modrm->rmb;
+		dc->reg1w     = modrm->rmw;
+		dc->op_memory = modrm->memory;
+
+		if (dc->segment == REG_ZERO)
+			dc->segment = modrm->segment;
+
+		ea = modrm->cycles;
+
+	}
+
+	if (dc->segment == REG_ZERO)
+		dc->segment = REG_DS;
+
+	dc->length   = cpu->regs.ip - ip;
+	dc->mask     = (dc->length < 8)? (1ull << dc->length * 8) - 1: ~0ull;
+	dc->cycles   = opcycles[dc->opcode][dc->op_memory] + ea + pre;
+	cpu->regs.ip = ip;
+
+	if (dc->op_memory) // Dispatch to the memory form
+		dc->opcode += OPCODE_MEM;
+
+	// A Jcc right after a flag-setting instruction can run fused with it, its
+	// opcode byte is then part of the code the decode is validated against.
+	// Not with points set, a breakpoint could be on the Jcc
+	const auto fu  = &fusions[dc->opcode];
+	const uint end = dc->length + fu->imm;
+
+	dc->fused   = 0;
+	dc->context = cpu->insn.context;
+
+	if (fu->opcode != 0 && end + 1 < 8 && cpu->debug.count == 0 && (memloadb(cpu, REG_CS, ip + end, true) & 0xf0) == 0x70) {
+		dc->fused = fu->opcode;
+		dc->mask  = (1ull << (end + 1) * 8) - 1;
+	}
+
+}
+
+
+
+// Breakpoint at CS:IP. One just stopped at is passed over if nothing ran since
+[[gnu::noinline, gnu::cold]] static bool membreak(CPU)
+{
+
+	const u32 phys = memphys(cpu, REG_CS, cpu->regs.ip);
+
+	if (phys == ~0u || !pagewatched(cpu, phys))
+		return false;
+
+	if (phys == cpu->debug.skip && cpu->cycles == cpu->debug.when) {
+		cpu->debug.skip = ~0u;
+		return false;
+	}
+
+	for (uint n=0; n < I8086_POINTS; n++) {
+
+		const auto pt = &cpu->debug.point[n];
+
+		if ((pt->kind & I8086_POINT_EXEC) && phys >= pt->addr && phys < pt->addr + pt->length) {
+
+			debugstop(cpu, I8086_STOP_BREAK, n, phys, 0);
+
+			cpu->debug.skip = phys;
+			cpu->debug.when = cpu->cycles;
+
+			return true;
+
+		}
+
+	}
+
+	return false;
+
+}
+
+
+
+static inline struct i8086_decode *lookup(CPU)
+{
+
+	const u16 ip   = cpu->regs.ip;
+	const auto cd  = &cpu->memory.descriptor[REG_CS];
+	const u32 phys = cd->base + ip;
+	auto      dc   = &cpu->icache->entry[phys % I8086_ICACHE_SIZE];
+
+	// Instructions wrapping the segment or running off the end of memory are never
+	// cached, nor are those in pages with a point, where breakpoints are checked
+	if (ip + 8 > cd->length) {
+
+		if (cpu->debug.count != 0 && membreak(cpu))
+			return &cpu->ibreak;
+
+		decode(cpu, &cpu->idecode);
+		return &cpu->idecode;
+
+	}
+
+	// Entries are validated against the code bytes so that any write to them,
+	// from the CPU or from outside, invalidates the decode, and against the
+	// context of the CPU, which may share the cache with others
+	const u64 code = *(u64*)(cpu->memory.mem.base + phys);
+
+	if (dc->addr != phys || dc->code != (code & dc->mask) || dc->context != cpu->insn.context) {
+
+		decode(cpu, dc);
+
+		// Long prefix runs don't fit in the code bytes, use the entry only once
+		dc->addr = (dc->length <= 8)? phys: ~0u;
+		dc->code = code & dc->mask;
+
+	}
+
+	return dc;
+
+}
+
+
+
+static inline void fetch(CPU)
+{
+
+	if (cpu->insn.fetch) { // Fetch and decode opcode
+
+		const auto dc = lookup(cpu);
+
+		cpu->regs.ip += dc->length;
+		cpu->cycles  += dc->cycles;
+
+		cpu->insn.opcode = dc->opcode;
+		cpu->insn.fused  = dc->fused;
+		cpu->insn.modrm  = dc->modrm;
+		cpu->insn.addr   = dc->ea(cpu, dc->disp);
+
+		cpu->insn.op_segment = dc->op_segment;
+		cpu->insn.segment    = dc->segment;
+		cpu->insn.repeat_eq  = dc->repeat_eq;
+		cpu->insn.repeat_ne  = dc->repeat_ne;
+
+		cpu->insn.reg0b = dc->reg0b;
+		cpu->insn.reg0w = dc->reg0w;
+		cpu->insn.reg1b = dc->reg1b;
+		cpu->insn.reg1w = dc->reg1w;
+
+	}
+
+}
+
+
+
+static inline void retire(CPU)
+{
 
-};
+	if (cpu->insn.fetch) {
 
+		cpu->regs.scs = SEGMENT(REG_CS);
+		cpu->regs.sip = cpu->regs.ip;
 
-static const uint demodrm[32] = {
+	}
 
-	OP_MODRM_MEMORY | OP_MODRM_SEG_DS | OP_MODRM_EA_R0_BX | OP_MODRM_EA_R1_SI,  // 00: [BX + SI]
-	OP_MODRM_MEMORY | OP_MODRM_SEG_DS | OP_MODRM_EA_R0_BX | OP_MODRM_EA_R1_DI,  // 01: [BX + DI]
-	OP_MODRM_MEMORY | OP_MODRM_SEG_SS | OP_MODRM_EA_R0_BP | OP_MODRM_EA_R1_SI,  // 02: [BP + SI]
-	OP_MODRM_MEMORY | OP_MODRM_SEG_SS | OP_MODRM_EA_R0_BP | OP_MODRM_EA_R1_DI,  // 03: [BP + DI]
-	OP_MODRM_MEMORY | OP_MODRM_SEG_DS | OP_MODRM_EA_R0_SI,                      // 04: [SI]
-	OP_MODRM_MEMORY | OP_MODRM_SEG_DS | OP_MODRM_EA_R0_DI,                      // 05: [DI]
-	OP_MODRM_MEMORY | OP_MODRM_SEG_DS | OP_MODRM_EA_DISP16,                     // 06: [DISP16]
-	OP_MODRM_MEMORY | OP_MODRM_SEG_DS | OP_MODRM_EA_R0_BX,                      // 07: [BX]
+}
 
-	OP_MODRM_MEMORY | OP_MODRM_SEG_DS | OP_MODRM_EA_R0_BX | OP_MODRM_EA_R1_SI | OP_MODRM_EA_DISP8,   // 40: [BX + SI + DISP8]
-	OP_MODRM_MEMORY | OP_MODRM_SEG_DS | OP_MODRM_EA_R0_BX | OP_MODRM_EA_R1_DI | OP_MODRM_EA_DISP8,   // 41: [BX + DI + DISP8]
-	OP_MODRM_MEMORY | OP_MODRM_SEG_SS | OP_MODRM_EA_R0_BP | OP_MODRM_EA_R1_SI | OP_MODRM_EA_DISP8,   // 42: [BP + SI + DISP8]
-	OP_MODRM_MEMORY | OP_MODRM_SEG_SS | OP_MODRM_EA_R0_BP | OP_MODRM_EA_R1_DI | OP_MODRM_EA_DISP8,   // 43: [BP + DI + DISP8]
-	OP_MODRM_MEMORY | OP_MODRM_SEG_DS | OP_MODRM_EA_R0_SI                     | OP_MODRM_EA_DISP8,   // 44: [SI + DISP8]
-	OP_MODRM_MEMORY | OP_MODRM_SEG_DS | OP_MODRM_EA_R0_DI                     | OP_MODRM_EA_DISP8,   // 45: [DI + DISP8]
-	OP_MODRM_MEMORY | OP_MODRM_SEG_SS | OP_MODRM_EA_R0_BP                     | OP_MODRM_EA_DISP8,   // 46: [BP + DISP8]
-	OP_MODRM_MEMORY | OP_MODRM_SEG_DS | OP_MODRM_EA_R0_BX                     | OP_MODRM_EA_DISP8,   // 47: [BX + DISP8]
 
-	OP_MODRM_MEMORY | OP_MODRM_SEG_DS | OP_MODRM_EA_R0_BX | OP_MODRM_EA_R1_SI | OP_MODRM_EA_DISP16,  // 80: [BX + SI + DISP16]
-	OP_MODRM_MEMORY | OP_MODRM_SEG_DS | OP_MODRM_EA_R0_BX | OP_MODRM_EA_R1_DI | OP_MODRM_EA_DISP16,  // 81: [BX + DI + DISP16]
-	OP_MODRM_MEMORY | OP_MODRM_SEG_SS | OP_MODRM_EA_R0_BP | OP_MODRM_EA_R1_SI | OP_MODRM_EA_DISP16,  // 82: [BP + SI + DISP16]
-	OP_MODRM_MEMORY | OP_MODRM_SEG_SS | OP_MODRM_EA_R0_BP | OP_MODRM_EA_R1_DI | OP_MODRM_EA_DISP16,  // 83: [BP + DI + DISP16]
-	OP_MODRM_MEMORY | OP_MODRM_SEG_DS | OP_MODRM_EA_R0_SI                     | OP_MODRM_EA_DISP16,  // 84: [SI + DISP16]
-	OP_MODRM_MEMORY | OP_MODRM_SEG_DS | OP_MODRM_EA_R0_DI                     | OP_MODRM_EA_DISP16,  // 85: [DI + DISP16]
-	OP_MODRM_MEMORY | OP_MODRM_SEG_SS | OP_MODRM_EA_R0_BP                     | OP_MODRM_EA_DISP16,  // 86: [BP + DISP16]
-	OP_MODRM_MEMORY | OP_MODRM_SEG_DS | OP_MODRM_EA_R0_BX                     | OP_MODRM_EA_DISP16,  // 87: [BX + DISP16]
 
-	OP_MODRM_REGISTER | OP_MODRM_REG_AX_AL | OP_MODRM_REG_ES,  // C0: AX AL ES
-	OP_MODRM_REGISTER | OP_MODRM_REG_CX_CL | OP_MODRM_REG_CS,  // C1: CX CL CS
-	OP_MODRM_REGISTER | OP_MODRM_REG_DX_DL | OP_MODRM_REG_SS,  // C2: DX DL SS
-	OP_MODRM_REGISTER | OP_MODRM_REG_BX_BL | OP_MODRM_REG_DS,  // C3: BX BL DS
-	OP_MODRM_REGISTER | OP_MODRM_REG_SP_AH | OP_MODRM_REG_ES,  // C4: SP AH ES
-	OP_MODRM_REGISTER | OP_MODRM_REG_BP_CH | OP_MODRM_REG_CS,  // C5: BP CH CS
-	OP_MODRM_REGISTER | OP_MODRM_REG_SI_DH | OP_MODRM_REG_SS,  // C6: SI DH SS
-	OP_MODRM_REGISTER | OP_MODRM_REG_DI_BH | OP_MODRM_REG_DS   // C7: DI BH DS
+static inline void execute(CPU)
+{
 
-};
+	fetch(cpu);
+	handlers[cpu->insn.opcode](cpu);
+	retire(cpu);
 
+}
 
 
-void i8086_init(CPU)
+// Same as execute, but runs a fused pair as one when the budget has room for
+// both. Only for where interrupts are known not to be pending, none of the first
+// halves can raise one. Returns the instructions run
+static inline uint step(CPU, uint budget)
 {
 
-	cpu->regs.zero = 0;
+	fetch(cpu);
 
-	cpu->regs.ax.w = 0;
-	cpu->regs.bx.w = 0;
-	cpu->regs.cx.w = 0;
-	cpu->regs.dx.w = 0;
-	cpu->regs.si.w = 0;
-	cpu->regs.di.w = 0;
-	cpu->regs.bp.w = 0;
-	cpu->regs.sp.w = 0;
+	if (cpu->insn.fused != 0 && budget > 1) {
+		cpu->fused++;
+		handlers[cpu->insn.fused](cpu);
+		retire(cpu);
+		return 2;
+	}
 
-	cpu->interrupt.irq     = 0;
-	cpu->interrupt.irq_act = false;
-	cpu->interrupt.nmi_act = false;
-	cpu->interrupt.delay   = false;
+	handlers[cpu->insn.opcode](cpu);
+	retire(cpu);
+	return 1;
 
-	cpu->undef = &op_nop;
+}
 
-	memory_init(&cpu->memory.mem);
 
-	io_init(&cpu->iob);
-	io_init(&cpu->iow);
 
+// Stop reason of a breakpoint or watchpoint hit, which raised pending to get the
+// loops out. The hit itself stays in debug
+static uint stopped(CPU)
+{
+
+	const uint stop = cpu->debug.stop;
+
+	cpu->debug.stop = 0;
+	return stop;
 
-	// Calculate MOD/RM decoding table
-	for (int n=0; n < 32; n++) {
+}
 
-		const uint flags = demodrm[n];
-		auto       dmdrm = &cpu->microcode.demodrm[n];
 
-		dmdrm->memory = (flags & OP_MODRM_MEMORY) != 0;
 
-		dmdrm->ea_seg    = (flags & OP_MODRM_SEG_SS)? REG_SS: REG_DS;
-		dmdrm->ea_disp8  = (flags & OP_MODRM_EA_DISP8)  != 0;
-		dmdrm->ea_disp16 = (flags & OP_MODRM_EA_DISP16) != 0;
+// execute() followed by the retire hook
+static void observe(CPU)
+{
 
-		dmdrm->ea_reg0 =
-			((flags & OP_MODRM_EA_R0) == OP_MODRM_EA_R0_BX)? &cpu->regs.bx.w:
-			((flags & OP_MODRM_EA_R0) == OP_MODRM_EA_R0_BP)? &cpu->regs.bp.w:
-			((flags & OP_MODRM_EA_R0) == OP_MODRM_EA_R0_SI)? &cpu->regs.si.w:
-			((flags & OP_MODRM_EA_R0) == OP_MODRM_EA_R0_DI)? &cpu->regs.di.w: &cpu->regs.zero;
+	// In the middle of a REP string instruction IP is already past it
+	const bool start = cpu->insn.fetch;
+	const u16  cs    = (start)? SEGMENT(REG_CS): cpu->regs.scs;
+	const u16  ip    = (start)? cpu->regs.ip:    cpu->regs.sip;
 
-		dmdrm->ea_reg1 =
-			((flags & OP_MODRM_EA_R1) == OP_MODRM_EA_R1_BX)? &cpu->regs.bx.w:
-			((flags & OP_MODRM_EA_R1) == OP_MODRM_EA_R1_BP)? &cpu->regs.bp.w:
-			((flags & OP_MODRM_EA_R1) == OP_MODRM_EA_R1_SI)? &cpu->regs.si.w:
-			((flags & OP_MODRM_EA_R1) == OP_MODRM_EA_R1_DI)? &cpu->regs.di.w: &cpu->regs.zero;
+	fetch(cpu);
 
+	if (start) {
+		cpu->retired.slot   = cpu->insn.opcode % OPCODE_COUNT;
+		cpu->retired.memory = cpu->insn.opcode >= OPCODE_MEM;
+		cpu->retired.length = cpu->regs.ip - ip;
+	}
 
-		switch (flags & OP_MODRM_REG_GENERIC) {
+	handlers[cpu->insn.opcode](cpu);
+	retire(cpu);
 
-			case OP_MODRM_REG_AX_AL: dmdrm->regw = &cpu->regs.ax.w; dmdrm->regb = &cpu->regs.ax.l; break;
-			case OP_MODRM_REG_BX_BL: dmdrm->regw = &cpu->regs.bx.w; dmdrm->regb = &cpu->regs.bx.l; break;
-			case OP_MODRM_REG_CX_CL: dmdrm->regw = &cpu->regs.cx.w; dmdrm->regb = &cpu->regs.cx.l; break;
-			case OP_MODRM_REG_DX_DL: dmdrm->regw = &cpu->regs.dx.w; dmdrm->regb = &cpu->regs.dx.l; break;
-			case OP_MODRM_REG_SI_DH: dmdrm->regw = &cpu->regs.si.w; dmdrm->regb = &cpu->regs.dx.h; break;
-			case OP_MODRM_REG_DI_BH: dmdrm->regw = &cpu->regs.di.w; dmdrm->regb = &cpu->regs.bx.h; break;
-			case OP_MODRM_REG_SP_AH: dmdrm->regw = &cpu->regs.sp.w; dmdrm->regb = &cpu->regs.ax.h; break;
-			case OP_MODRM_REG_BP_CH: dmdrm->regw = &cpu->regs.bp.w; dmdrm->regb = &cpu->regs.cx.h; break;
+	// A breakpoint stops the CPU before the instruction it is on
+	if (cpu->insn.fetch && cpu->insn.opcode != OPCODE_BREAK && cpu->hooks->retire != NULL)
+		cpu->hooks->retire(cpu->hooks->data, cpu, cs, ip);
 
-			default:
-				dmdrm->regw = NULL;
-				dmdrm->regb = NULL;
-				break;
+}
 
-		}
 
 
-		switch (flags & OP_MODRM_REG_SEGMENT) {
+// A breakpoint or watchpoint hit by the instruction is left in debug.stop
+void i8086_tick(CPU)
+{
 
-			case OP_MODRM_REG_CS: dmdrm->regs = (void*)REG_CS; break;
-			case OP_MODRM_REG_DS: dmdrm->regs = (void*)REG_DS; break;
-			case OP_MODRM_REG_ES: dmdrm->regs = (void*)REG_ES; break;
-			case OP_MODRM_REG_SS: dmdrm->regs = (void*)REG_SS; break;
+	cpu->debug.stop = 0;
 
-			default:
-				dmdrm->regs = NULL;
-				break;
+	memsync(cpu);
+	service(cpu);
 
-		}
+	if (cpu->interrupt.halt)
+		return;
 
-	}
+	if (cpu->hooks == NULL)
+		execute(cpu);
 
-	i8086_reset(cpu);
+	else {
+		hookports(cpu);
+		observe(cpu);
+	}
 
 }
 
 
 
-void i8086_reset(CPU)
+// i8086_run() with observers: one instruction at a time through observe(), with
+// no fused pairs, threaded dispatch or translated code to hide any of them
+[[gnu::noinline]] static uint traced(CPU, uint budget)
 {
 
-	for (int seg=0; seg < 5; seg++)
-		memselect(cpu, seg, 0);
+	memsync(cpu);
+	hookports(cpu);
 
-	memselect(cpu, REG_CS, 0xffff);
-	cpu->regs.ip = 0x0000;
+	while (budget > 0) {
 
-	cpu->flags.c = false;
-	cpu->flags.p = false;
-	cpu->flags.a = false;
-	cpu->flags.z = false;
-	cpu->flags.s = false;
-	cpu->flags.v = false;
-	cpu->flags.d = false;
-	cpu->flags.t = false;
-	cpu->flags.i = false;
+		service(cpu);
 
-	cpu->insn.fetch     = true;
-	cpu->insn.repeat_eq = false;
-	cpu->insn.repeat_ne = false;
+		if (cpu->interrupt.halt)
+			return I8086_STOP_HALT;
 
-	cpu->insn.opcode  = 0;
-	cpu->insn.modrm   = 0;
-	cpu->insn.segment = REG_ZERO;
+		do {
+			observe(cpu);
+			budget--;
+		} while (budget > 0 && !cpu->interrupt.pending);
 
-	cpu->regs.scs = SEGMENT(REG_CS);
-	cpu->regs.sip = cpu->regs.ip;
+		if (cpu->debug.stop != 0)
+			return stopped(cpu);
+
+		if (cpu->interrupt.pending && ready(cpu))
+			return I8086_STOP_EVENT;
+
+	}
+
+	return I8086_STOP_BUDGET;
 
 }
 
 
 
-int i8086_intrq(CPU, uint nmi, uint irq)
+#ifdef I8086_THREADED
+
+// Threaded core: every handler is expanded in place and followed by its own
+// copy of retire, fetch and dispatch, so each opcode gets a separate indirect
+// jump for the branch predictor to learn. Returns the unused budget.
+[[gnu::flatten]] static uint threaded(CPU, uint budget)
 {
 
-	cpu->interrupt.irq     = irq;
-	cpu->interrupt.irq_act = nmi == 0;
-	cpu->interrupt.nmi_act = nmi != 0;
+	static const void *dispatch[2 * OPCODE_COUNT + FUSIONS_COUNT];
 
-	return 0;
+	if (cpu == NULL) { // Resolve the opcode table into handler labels, once from tables()
+
+		#define HANDLER_FN(fn)       &fn,
+		#define HANDLER_FN_M(fn)     &fn##_m,
+		#define HANDLER_LABEL(fn)    &&L_##fn,
+		#define HANDLER_LABEL_M(fn)  &&L_##fn##_m,
+		#define HANDLER_FN_F(fn, imm)     &fn##_jcc,
+		#define HANDLER_LABEL_F(fn, imm)  &&L_##fn##_jcc,
+
+		static const i8086_opcode fns[] = { HANDLERS(HANDLER_FN) RMHANDLERS(HANDLER_FN_M) FUSIONS(HANDLER_FN_F) };
+		const void *const         lbls[] = { HANDLERS(HANDLER_LABEL) RMHANDLERS(HANDLER_LABEL_M) FUSIONS(HANDLER_LABEL_F) };
+
+		for (int n=0; n < 2 * OPCODE_COUNT + FUSIONS_COUNT; n++)
+			for (int k=0; k < sizeof(fns) / sizeof(fns[0]); k++)
+				if (handlers[n] == fns[k])
+					dispatch[n] = lbls[k];
+
+		return 0;
+
+	}
+
+	#define NEXT() \
+		do { \
+			if (budget == 0 || cpu->interrupt.pending) \
+				return budget; \
+			budget--; \
+			fetch(cpu); \
+			if (cpu->insn.fused != 0 && budget > 0) { \
+				budget--; \
+				cpu->fused++; \
+				goto *dispatch[cpu->insn.fused]; \
+			} \
+			goto *dispatch[cpu->insn.opcode]; \
+		} while (0)
+
+	#define HANDLER_BODY(fn)         L_##fn: fn(cpu); retire(cpu); NEXT();
+	#define HANDLER_BODY_M(fn)       L_##fn##_m: fn##_m(cpu); retire(cpu); NEXT();
+	#define HANDLER_BODY_F(fn, imm)  L_##fn##_jcc: fn##_jcc(cpu); retire(cpu); NEXT();
+
+	NEXT();
+	HANDLERS(HANDLER_BODY)
+	RMHANDLERS(HANDLER_BODY_M)
+	FUSIONS(HANDLER_BODY_F)
+
+	#undef HANDLER_FN
+	#undef HANDLER_FN_M
+	#undef HANDLER_LABEL
+	#undef HANDLER_LABEL_M
+	#undef HANDLER_FN_F
+	#undef HANDLER_LABEL_F
+	#undef HANDLER_BODY
+	#undef HANDLER_BODY_M
+	#undef HANDLER_BODY_F
+	#undef NEXT
 
 }
 
+#endif
 
 
-void i8086_tick(CPU)
+
+#ifdef I8086_JIT
+
+// Runs translated code when CS:IP starts a hot block at an instruction
+// boundary, returns false to leave the instruction to the interpreter
+static inline bool jit(CPU, uint *budget)
 {
 
-	if (!cpu->interrupt.delay) {
+	// Translated code goes past breakpoints and watchpoints
+	if (cpu->jit == NULL || !cpu->insn.fetch || cpu->debug.count != 0)
+		return false;
 
-		if (cpu->interrupt.nmi_act) {
+	void *block = i8086_jit_lookup(cpu);
 
-			interrupt(cpu, I8086_VECTOR_NMI, cpu->regs.scs, cpu->regs.sip);
+	if (block == NULL)
+		return false;
 
-			cpu->interrupt.nmi_act = false;
-			cpu->insn.fetch        = true;
+	uint       flags = getf_w(cpu);
+	const uint left  = i8086_jit_run(cpu, block, *budget, &flags);
 
-		} else if (cpu->flags.i && cpu->interrupt.irq_act) {
+	if (left == *budget) // Budget too short for the block, nothing ran
+		return false;
 
-			interrupt(cpu, cpu->interrupt.irq, cpu->regs.scs, cpu->regs.sip);
+	*budget = left;
 
-			cpu->interrupt.irq_act = false;
-			cpu->insn.fetch        = true;
+	setf_lb(cpu, flags);
+	cpu->flags.v = bit(flags, 11);
 
-		} else if (cpu->flags.t)
-			interrupt(cpu, I8086_VECTOR_SSTEP, cpu->regs.scs, cpu->regs.sip);
+	cpu->regs.scs = SEGMENT(REG_CS);
+	cpu->regs.sip = cpu->regs.ip;
 
-	} else
-		cpu->interrupt.delay = false;
+	return true;
+
+}
+
+#endif
 
 
-	if (cpu->insn.fetch) { // Fetch and decode opcode
 
-		const uint op  = LDIPUB();
-		const uint opf = opflags[op];
+uint i8086_run(CPU, uint budget)
+{
 
-		cpu->insn.opcode = op;
-		cpu->insn.modrm  = 0;
-		cpu->insn.addr   = 0;
+	cpu->debug.stop = 0;  // Left over from i8086_tick()
 
-		cpu->insn.op_override = opf & OP_OVRD;
-		cpu->insn.op_memory   = false;
-		cpu->insn.op_segment  = opf & OP_RSEG;
+	if (cpu->hooks != NULL)
+		return traced(cpu, budget);
 
-		cpu->insn.reg0b = NULL;
-		cpu->insn.reg0w = NULL;
-		cpu->insn.reg1b = NULL;
-		cpu->insn.reg1w = NULL;
+	memsync(cpu);
 
-		if (opf & OP_R02) {
+	while (budget > 0) {
 
-			const auto reg0 = &cpu->microcode.demodrm[(op & 0x07) + 24];
+		// Take interrupts, traps and interrupt shadows the slow way
+		service(cpu);
 
-			cpu->insn.reg0w = reg0->regw;
-			cpu->insn.reg0b = reg0->regb;
+		if (cpu->interrupt.halt) // Nothing to run until an interrupt wakes it up
+			return I8086_STOP_HALT;
 
+#ifdef I8086_JIT
+		if (cpu->interrupt.pending || !jit(cpu, &budget)) {
+			execute(cpu);
+			budget--;
 		}
+#else
+		execute(cpu);
+		budget--;
+#endif
+
+		// Nothing can interrupt the instruction stream until pending is raised
+#if defined(I8086_JIT)
+		while (budget > 0 && !cpu->interrupt.pending)
+			if (!jit(cpu, &budget))
+				budget -= step(cpu, budget);
+#elif defined(I8086_THREADED)
+		budget = threaded(cpu, budget);
+#else
+		while (budget > 0 && !cpu->interrupt.pending)
+			budget -= step(cpu, budget);
+#endif
+
+		if (cpu->debug.stop != 0)
+			return stopped(cpu);
+
+		if (cpu->interrupt.pending && ready(cpu))
+			return I8086_STOP_EVENT;
+
+	}
+
+	return I8086_STOP_BUDGET;
 
+}
 
-		if (opf & OP_MODRM) { // Fetch and decode MODRM
 
-			cpu->insn.modrm = LDIPUB();
 
-			const uint mod = (cpu->insn.modrm >> 6) & 3;
-			const uint reg = (cpu->insn.modrm >> 3) & 7;
-			const uint rm  = (cpu->insn.modrm >> 0) & 7;
+// Shift or rotate kernel by the REG field of D0-D3, ROL ... SAR, on an 8 or 16
+// bit operand and the flags as they are. For tests to check the kernels alone
+uint i8086_shift(CPU, uint op, uint n, uint a, uint b)
+{
 
-			const auto demodrm = &cpu->microcode.demodrm[mod * 8 + rm];
+	typedef ureg kernel(i8086 *cpu, ureg a, uint b);
 
-			if (opf & OP_GROUP)
-				cpu->insn.opcode = 256 + (opf & 0xff) * 8 + reg;
+	static kernel *const kernels[2][8] = {
+		{ &rol8,  &ror8,  &rcl8,  &rcr8,  &shl8,  &shr8,  &sal8,  &sar8  },
+		{ &rol16, &ror16, &rcl16, &rcr16, &shl16, &shr16, &sal16, &sar16 }
+	};
 
-			else {
+	return mask(kernels[n == 16][op & 7](cpu, a, b), n);
 
-				const auto reg0 = &cpu->microcode.demodrm[reg + 24];
+}
 
-				cpu->insn.reg0w = cpu->insn.op_segment? reg0->regs: reg0->regw;
-				cpu->insn.reg0b = reg0->regb;
 
-			}
 
+// Cycles of the instruction at CS:IP when it runs once, branch not taken, for
+// engines that account for a run of instructions at a time
+uint i8086_cycles(CPU, u16 ip)
+{
 
-			if (demodrm->memory) {
+	struct i8086_decode dc;
+	const u16           save = cpu->regs.ip;
 
-				cpu->insn.addr = *demodrm->ea_reg0 + *demodrm->ea_reg1;
+	cpu->regs.ip = ip;
+	decode(cpu, &dc);
+	cpu->regs.ip = save;
 
-				if      (demodrm->ea_disp8)  cpu->insn.addr += LDIPSB();
-				else if (demodrm->ea_disp16) cpu->insn.addr += LDIPUW();
+	return dc.cycles;
 
-				if (cpu->insn.segment == REG_ZERO)
-					cpu->insn.segment = demodrm->ea_seg;
+}
 
-				cpu->insn.op_memory = true;
 
-			} else {
 
-				cpu->insn.reg1b = demodrm->regb;
-				cpu->insn.reg1w = demodrm->regw;
+// Cycles a taken branch adds to those of i8086_cycles(), for the CPU's model
+uint i8086_branch(CPU)
+{
 
-			}
+	return branchcycles[cpu->model];
 
-		}
+}
 
-		if (cpu->insn.segment == REG_ZERO)
-			cpu->insn.segment = REG_DS;
 
-	}
 
-	opcodes[cpu->insn.opcode](cpu);
+// Handler of an opcode table slot, and in code the opcode byte that decodes to
+// it, as 80/3 for group sub-opcodes, or -- if none does. For coverage reports
+const char *i8086_slot_name(uint slot, char code[8])
+{
+
+	#define HANDLER_NAME(fn)  { &fn, #fn },
 
-	if (cpu->insn.fetch && !cpu->insn.op_override) {
+	static const struct { i8086_opcode fn; const char *name; } names[] = { HANDLERS(HANDLER_NAME) RMHANDLERS(HANDLER_NAME) };
 
-		cpu->regs.scs = SEGMENT(REG_CS);
-		cpu->regs.sip = cpu->regs.ip;
+	#undef HANDLER_NAME
 
-		cpu->insn.repeat_eq = false;
-		cpu->insn.repeat_ne = false;
-		cpu->insn.segment   = REG_ZERO;
+	if (slot >= OPCODE_COUNT)
+		return NULL;
 
-	}
+	strcpy(code, "--");
+
+	for (int m=I8086_MODEL_COUNT - 1; m >= 0; m--)
+		for (int n=0; n < 256; n++) {
+
+			const uint flags = models[m].flags[n];
+
+			if (flags & OP_GROUP) {
+
+				if ((slot & ~7u) == 256 + (flags & 0xff) * 8)
+					sprintf(code, "%02x/%u", n, slot & 7);
+
+			} else if (models[m].opcode[n] == slot)
+				sprintf(code, "%02x", n);
+
+		}
+
+	for (int k=0; k < sizeof(names) / sizeof(names[0]); k++)
+		if (names[k].fn == opcodes[slot])
+			return names[k].name + 3;
+
+	return "?";
 
 }
 
@@ -1374,7 +3137,7 @@ void i8086_reg_set(i8086 *cpu, uint reg, uint value)
 
 
 
-static void op_divrmb(CPU)
+RMHANDLER(op_divrmb)
 {
 
 	const ureg tmp = LDEAR1MB();
@@ -1395,7 +3158,7 @@ static void op_divrmb(CPU)
 
 
 
-static void op_divrmw(CPU)
+RMHANDLER(op_divrmw)
 {
 
 	const ureg tmp = LDEAR1MW();
@@ -1417,109 +3180,244 @@ static void op_divrmw(CPU)
 
 
 
-static void op_mulrmb(CPU)
+RMHANDLER(op_mulrmb)
+{
+
+	setf_sync(cpu);
+
+	ureg tmp = LDEAR1MB();
+
+	cpu->regs.ax.w = cpu->regs.ax.l * tmp;
+
+	cpu->flags.c = (cpu->regs.ax.h != 0);
+	cpu->flags.v = cpu->flags.c;
+
+}
+
+
+
+RMHANDLER(op_mulrmw)
+{
+
+	setf_sync(cpu);
+
+	ureg tmp = LDEAR1MW();
+
+	tmp *= cpu->regs.ax.w;
+
+	cpu->regs.ax.w = (tmp >> 0)  & 0xffff;
+	cpu->regs.dx.w = (tmp >> 16) & 0xffff;
+
+	cpu->flags.c = (cpu->regs.dx.w != 0);
+	cpu->flags.v = cpu->flags.c;
+
+}
+
+
+
+RMHANDLER(op_idivrmb)
+{
+
+	const i8 tmp = (i8)LDEAR1MB();
+
+	if (tmp == 0)
+		return interrupt(cpu, I8086_VECTOR_DIVERR, SEGMENT(REG_CS), cpu->regs.ip);
+
+	const i16 num = (i16)cpu->regs.ax.w;
+	const i16 div = num / tmp;
+	const i16 mod = num % tmp;
+
+	if (div <= -128 || div > 127)
+		return interrupt(cpu, I8086_VECTOR_DIVERR, SEGMENT(REG_CS), cpu->regs.ip);
+
+	cpu->regs.ax.l = div;
+	cpu->regs.ax.h = mod;
+
+}
+
+
+
+RMHANDLER(op_idivrmw)
+{
+
+	const i16 tmp = (i16)LDEAR1MW();
+
+	if (tmp == 0)
+		return interrupt(cpu, I8086_VECTOR_DIVERR, SEGMENT(REG_CS), cpu->regs.ip);
+
+	const i32 num = (i32)((u32)(cpu->regs.dx.w << 16) + cpu->regs.ax.w);
+	const i32 div = num / tmp;
+	const i32 mod = num % tmp;
+
+	if (div <= -32768 || div > 32767)
+		return interrupt(cpu, I8086_VECTOR_DIVERR, SEGMENT(REG_CS), cpu->regs.ip);
+
+	cpu->regs.ax.w = div;
+	cpu->regs.dx.w = mod;
+
+}
+
+
+
+RMHANDLER(op_imulrmb)
+{
+
+	setf_sync(cpu);
+
+	ureg tmp = (i8)LDEAR1MB();
+
+	tmp *= (i8)cpu->regs.ax.l;
+
+	cpu->regs.ax.w = tmp;
+
+	cpu->flags.c = (i8)cpu->regs.ax.l != tmp;
+	cpu->flags.v = cpu->flags.c;
+
+}
+
+
+
+RMHANDLER(op_imulrmw)
 {
 
-	ureg tmp = LDEAR1MB();
+	setf_sync(cpu);
 
-	cpu->regs.ax.w = cpu->regs.ax.l * tmp;
+	ureg tmp = (i16)LDEAR1MW();
 
-	cpu->flags.c = (cpu->regs.ax.h != 0);
+	tmp *= (i16)cpu->regs.ax.w;
+
+	cpu->regs.ax.w = (tmp >> 0)  & 0xffff;
+	cpu->regs.dx.w = (tmp >> 16) & 0xffff;
+
+	cpu->flags.c = (i16)cpu->regs.ax.w != tmp;
 	cpu->flags.v = cpu->flags.c;
 
 }
 
 
 
-static void op_mulrmw(CPU)
+// IMUL r16, r/m16, imm of the 80186: the product goes to the REG operand and only
+// its low half is kept
+RMHANDLER(op_imulrmiw)
 {
 
-	ureg tmp = LDEAR1MW();
+	setf_sync(cpu);
 
-	tmp *= cpu->regs.ax.w;
+	const i16 imm = LDIPSW();
+	const i32 tmp = (i16)LDEAR1MW() * imm;
 
-	cpu->regs.ax.w = (tmp >> 0)  & 0xffff;
-	cpu->regs.dx.w = (tmp >> 16) & 0xffff;
+	REG0W = tmp;
 
-	cpu->flags.c = (cpu->regs.dx.w != 0);
+	cpu->flags.c = (i16)tmp != tmp;
 	cpu->flags.v = cpu->flags.c;
 
 }
 
 
 
-static void op_idivrmb(CPU)
+RMHANDLER(op_imulrmib)
 {
 
-	const i8 tmp = (i8)LDEAR1MB();
-
-	if (tmp == 0)
-		return interrupt(cpu, I8086_VECTOR_DIVERR, SEGMENT(REG_CS), cpu->regs.ip);
+	setf_sync(cpu);
 
-	const i16 num = (i16)cpu->regs.ax.w;
-	const i16 div = num / tmp;
-	const i16 mod = num % tmp;
+	const i16 imm = LDIPSB();
+	const i32 tmp = (i16)LDEAR1MW() * imm;
 
-	if (div <= -128 || div > 127)
-		return interrupt(cpu, I8086_VECTOR_DIVERR, SEGMENT(REG_CS), cpu->regs.ip);
+	REG0W = tmp;
 
-	cpu->regs.ax.l = div;
-	cpu->regs.ax.h = mod;
+	cpu->flags.c = (i16)tmp != tmp;
+	cpu->flags.v = cpu->flags.c;
 
 }
 
 
 
-static void op_idivrmw(CPU)
+// Out of range traps with the return address at the BOUND instruction, so the
+// handler can fix the index and run it again
+RMHANDLER(op_bound)
 {
 
-	const i16 tmp = (i16)LDEAR1MW();
-
-	if (tmp == 0)
-		return interrupt(cpu, I8086_VECTOR_DIVERR, SEGMENT(REG_CS), cpu->regs.ip);
-
-	const i32 num = (i32)((u32)(cpu->regs.dx.w << 16) + cpu->regs.ax.w);
-	const i32 div = num / tmp;
-	const i32 mod = num % tmp;
+	MEMONLY();
 
-	if (div <= -32768 || div > 32767)
-		return interrupt(cpu, I8086_VECTOR_DIVERR, SEGMENT(REG_CS), cpu->regs.ip);
+	const i16 lo  = LDEAMW(0);
+	const i16 hi  = LDEAMW(2);
+	const i16 idx = REG0W;
 
-	cpu->regs.ax.w = div;
-	cpu->regs.dx.w = mod;
+	if (idx < lo || idx > hi) {
+		CYCLES(15);
+		interrupt(cpu, I8086_VECTOR_BOUND, cpu->regs.scs, cpu->regs.sip);
+	}
 
 }
 
 
 
-static void op_imulrmb(CPU)
+static void op_pusha(CPU)
 {
 
-	ureg tmp = (i8)LDEAR1MB();
+	const u16 sp = cpu->regs.sp.w;
 
-	tmp *= (i8)cpu->regs.ax.l;
+	ADVSP(-16);
+	STSPW(14, cpu->regs.ax.w);
+	STSPW(12, cpu->regs.cx.w);
+	STSPW(10, cpu->regs.dx.w);
+	STSPW( 8, cpu->regs.bx.w);
+	STSPW( 6, sp);
+	STSPW( 4, cpu->regs.bp.w);
+	STSPW( 2, cpu->regs.si.w);
+	STSPW( 0, cpu->regs.di.w);
 
-	cpu->regs.ax.w = tmp;
+}
 
-	cpu->flags.c = (i8)cpu->regs.ax.l != tmp;
-	cpu->flags.v = cpu->flags.c;
+
+
+// The SP pushed by PUSHA is skipped
+static void op_popa(CPU)
+{
+
+	ADVSP(+16);
+	cpu->regs.di.w = LDSPW(-16);
+	cpu->regs.si.w = LDSPW(-14);
+	cpu->regs.bp.w = LDSPW(-12);
+	cpu->regs.bx.w = LDSPW( -8);
+	cpu->regs.dx.w = LDSPW( -6);
+	cpu->regs.cx.w = LDSPW( -4);
+	cpu->regs.ax.w = LDSPW( -2);
 
 }
 
 
 
-static void op_imulrmw(CPU)
+// Frame of size bytes, with level - 1 frame pointers copied from the enclosing
+// frame and its own pushed after them. Level is taken mod 32
+static void op_enter(CPU)
 {
 
-	ureg tmp = (i16)LDEAR1MW();
+	const u16 size  = LDIPUW();
+	const u8  level = LDIPUB() & 31;
 
-	tmp *= (i16)cpu->regs.ax.w;
+	ADVSP(-2);
+	STSPW(0, cpu->regs.bp.w);
 
-	cpu->regs.ax.w = (tmp >> 0)  & 0xffff;
-	cpu->regs.dx.w = (tmp >> 16) & 0xffff;
+	const u16 frame = cpu->regs.sp.w;
 
-	cpu->flags.c = (i16)cpu->regs.ax.w != tmp;
-	cpu->flags.v = cpu->flags.c;
+	if (level > 0) {
+
+		for (uint n=1; n < level; n++) {
+			cpu->regs.bp.w -= 2;
+			ADVSP(-2);
+			STSPW(0, LDMW(REG_SS, cpu->regs.bp.w));
+		}
+
+		ADVSP(-2);
+		STSPW(0, frame);
+
+	}
+
+	cpu->regs.bp.w = frame;
+	ADVSP(-size);
+
+	CYCLES((level == 0)? 15: (level == 1)? 25: 22 + 16 * (level - 1));
 
 }
 
@@ -1529,6 +3427,8 @@ static void op_imulrmw(CPU)
 static void op_aaa(CPU)
 {
 
+	setf_sync(cpu);
+
 	if (((cpu->regs.ax.l & 0x0f) > 9) || cpu->flags.a) {
 
 		cpu->flags.a = true;
@@ -1553,6 +3453,8 @@ static void op_aaa(CPU)
 static void op_aas(CPU)
 {
 
+	setf_sync(cpu);
+
 	if (((cpu->regs.ax.l & 0x0f) > 9) || cpu->flags.a) {
 
 		cpu->flags.a = true;
@@ -1614,6 +3516,8 @@ static void op_aam(CPU)
 static void op_daa(CPU)
 {
 
+	setf_sync(cpu);
+
 	const bool carry = cpu->regs.ax.l > (cpu->flags.a? 0x9f: 0x99);
 
 	if (((cpu->regs.ax.l & 0x0f) > 9) || cpu->flags.a) {
@@ -1638,6 +3542,8 @@ static void op_daa(CPU)
 static void op_das(CPU)
 {
 
+	setf_sync(cpu);
+
 	const bool carry = cpu->regs.ax.l > (cpu->flags.a? 0x9f: 0x99);
 
 	if (((cpu->regs.ax.l & 0x0f) > 9) || cpu->flags.a) {
@@ -1659,12 +3565,220 @@ static void op_das(CPU)
 
 
 
+// Bulk REP MOVS: moves up to a chunk with memmove and leaves the rest, if
+// any, to the next round so interrupts are taken in between. Returns false if
+// the spans wrap and the element-wise path has to do it. Bulk operations are
+// skipped under TF so that single-stepping still traps after every element
+static bool bulk_movs(CPU, uint size, uint cycles)
+{
+
+	const uint count = (cpu->regs.cx.w < REP_CHUNK)? cpu->regs.cx.w: REP_CHUNK;
+	const uint bytes = count * size;
+
+	u8 *src = memspan(cpu, cpu->insn.segment, cpu->regs.si.w, count, size);
+	u8 *dst = memspan(cpu, REG_ES,            cpu->regs.di.w, count, size);
+
+	if (src == NULL || dst == NULL)
+		return false;
+
+	// Overlapping the way an element-wise copy replicates data, as in the
+	// MOVSB fill idiom, so copy one element at a time in instruction order
+	if ((cpu->flags.d)? (dst < src && dst + bytes > src): (dst > src && dst < src + bytes)) {
+
+		for (uint n=0; n < count; n++) {
+
+			const uint k = (cpu->flags.d)? count - 1 - n: n;
+			u16 tmp;
+
+			memcpy(&tmp, src + k * size, size);
+			memcpy(dst + k * size, &tmp, size);
+
+		}
+
+	} else
+		memmove(dst, src, bytes);
+
+	const u16 delta = (cpu->flags.d)? -bytes: bytes;
+
+	cpu->regs.si.w += delta;
+	cpu->regs.di.w += delta;
+	cpu->regs.cx.w -= count;
+
+	CYCLES(count * cycles);
+
+	cpu->insn.fetch = cpu->regs.cx.w == 0;
+	return true;
+
+}
+
+
+
+// Bulk REP STOS, chunked the same way as bulk_movs
+static bool bulk_stos(CPU, uint size, uint cycles)
+{
+
+	const uint count = (cpu->regs.cx.w < REP_CHUNK)? cpu->regs.cx.w: REP_CHUNK;
+	const uint bytes = count * size;
+
+	u8 *dst = memspan(cpu, REG_ES, cpu->regs.di.w, count, size);
+
+	if (dst == NULL)
+		return false;
+
+	if (size == 1 || cpu->regs.ax.l == cpu->regs.ax.h)
+		memset(dst, cpu->regs.ax.l, bytes);
+
+	else
+		for (uint n=0; n < count; n++)
+			((u16*)dst)[n] = cpu->regs.ax.w;
+
+	cpu->regs.di.w += (cpu->flags.d)? -bytes: bytes;
+	cpu->regs.cx.w -= count;
+
+	CYCLES(count * cycles);
+
+	cpu->insn.fetch = cpu->regs.cx.w == 0;
+	return true;
+
+}
+
+
+
+// Bulk REP INS/OUTS: hands the port a whole chunk in one call, so that a device
+// with a string handler moves a disk sector per instruction. Chunked and skipped
+// like bulk_movs, and only done upwards
+static bool bulk_ins(CPU, uint size, uint cycles)
+{
+
+	const uint count = (cpu->regs.cx.w < REP_CHUNK)? cpu->regs.cx.w: REP_CHUNK;
+
+	u8 *dst = (cpu->flags.d)? NULL: memspan(cpu, REG_ES, cpu->regs.di.w, count, size);
+
+	if (dst == NULL)
+		return false;
+
+	if (size == 1) io_reads(&cpu->iob, cpu->regs.dx.w, IO_RD8,  dst, count);
+	else           io_reads(&cpu->iow, cpu->regs.dx.w, IO_RD16, dst, count);
+
+	cpu->regs.di.w += count * size;
+	cpu->regs.cx.w -= count;
+
+	CYCLES(count * cycles);
+
+	cpu->insn.fetch = cpu->regs.cx.w == 0;
+	return true;
+
+}
+
+
+
+static bool bulk_outs(CPU, uint size, uint cycles)
+{
+
+	const uint count = (cpu->regs.cx.w < REP_CHUNK)? cpu->regs.cx.w: REP_CHUNK;
+
+	const u8 *src = (cpu->flags.d)? NULL: memspan(cpu, cpu->insn.segment, cpu->regs.si.w, count, size);
+
+	if (src == NULL)
+		return false;
+
+	if (size == 1) io_writes(&cpu->iob, cpu->regs.dx.w, IO_WR8,  src, count);
+	else           io_writes(&cpu->iow, cpu->regs.dx.w, IO_WR16, src, count);
+
+	cpu->regs.si.w += count * size;
+	cpu->regs.cx.w -= count;
+
+	CYCLES(count * cycles);
+
+	cpu->insn.fetch = cpu->regs.cx.w == 0;
+	return true;
+
+}
+
+
+
+// Bulk REP LODS: only the last element loaded is visible, so a whole chunk is
+// done at once whatever the wrapping. Chunked like bulk_movs so interrupts are
+// taken in between, not when accesses are traced one by one
+static void bulk_lods(CPU, uint size, uint cycles)
+{
+
+	const uint count = (cpu->regs.cx.w < REP_CHUNK)? cpu->regs.cx.w: REP_CHUNK;
+	const u16  delta = (cpu->flags.d)? -size: size;
+	const u16  last  = cpu->regs.si.w + (count - 1) * delta;
+
+	if (size == 1) cpu->regs.ax.l = LDMB(cpu->insn.segment, last);
+	else           cpu->regs.ax.w = LDMW(cpu->insn.segment, last);
+
+	CYCLES(count * cycles);
+
+	cpu->regs.si.w  = last + delta;
+	cpu->regs.cx.w -= count;
+	cpu->insn.fetch = cpu->regs.cx.w == 0;
+
+}
+
+
+
+// Bulk REP SCASB/CMPSB: finds the element that ends the repeat with the
+// memscan kernels, then leaves CX, SI, DI and the flags of that last compare
+// as the element-wise path would. Chunked and skipped like bulk_movs
+static bool bulk_scmp(CPU, bool cmps, uint cycles)
+{
+
+	const uint count = (cpu->regs.cx.w < REP_CHUNK)? cpu->regs.cx.w: REP_CHUNK;
+
+	const u8 *src = (cmps)? memspan(cpu, cpu->insn.segment, cpu->regs.si.w, count, 1): NULL;
+	const u8 *dst =         memspan(cpu, REG_ES,            cpu->regs.di.w, count, 1);
+
+	if ((cmps && src == NULL) || dst == NULL)
+		return false;
+
+	// REPE ends on the first mismatch, REPNE on the first match; kernels
+	// index from the lowest byte, k counts in instruction order
+	const bool eq = cpu->insn.repeat_ne;
+	uint       k;
+
+	if (cpu->flags.d) {
+
+		const uint n = (cmps)? memrdiff(src, dst, count, eq): memrscan(dst, count, cpu->regs.ax.l, eq);
+		k = (n < count)? count - 1 - n: count;
+
+	} else
+		k = (cmps)? memdiff(src, dst, count, eq): memscan(dst, count, cpu->regs.ax.l, eq);
+
+	const uint steps = (k < count)? k + 1: count;
+	const uint last  = (cpu->flags.d)? count - steps: steps - 1;
+	const u16  delta = (cpu->flags.d)? -steps: steps;
+
+	sub8(cpu, (cmps)? src[last]: cpu->regs.ax.l, dst[last]);
+
+	if (cmps)
+		cpu->regs.si.w += delta;
+
+	cpu->regs.di.w += delta;
+	cpu->regs.cx.w -= steps;
+
+	CYCLES(steps * cycles);
+
+	cpu->insn.fetch = (cpu->regs.cx.w == 0) || (k < count);
+	return true;
+
+}
+
+
+
 static void op_cmpsb(CPU)
 {
 
 	if ((cpu->insn.repeat_eq || cpu->insn.repeat_ne) && (cpu->regs.cx.w == 0))
 		return;
 
+	if ((cpu->insn.repeat_eq || cpu->insn.repeat_ne) && !cpu->flags.t && bulk_scmp(cpu, true, 22))
+		return;
+
+	STRCYCLES(22, 22);
+
 	const ureg tmpa = LDMB(cpu->insn.segment, cpu->regs.si.w);
 	const ureg tmpb = LDMB(REG_ES,            cpu->regs.di.w);
 
@@ -1673,8 +3787,8 @@ static void op_cmpsb(CPU)
 	ADVDIB();
 
 	cpu->insn.fetch =
-		cpu->insn.repeat_eq? (--cpu->regs.cx.w == 0) || !cpu->flags.z:
-		cpu->insn.repeat_ne? (--cpu->regs.cx.w == 0) || cpu->flags.z:
+		cpu->insn.repeat_eq? (--cpu->regs.cx.w == 0) || !getf_z(cpu):
+		cpu->insn.repeat_ne? (--cpu->regs.cx.w == 0) || getf_z(cpu):
 		true;
 
 }
@@ -1687,6 +3801,8 @@ static void op_cmpsw(CPU)
 	if ((cpu->insn.repeat_eq || cpu->insn.repeat_ne) && (cpu->regs.cx.w == 0))
 		return;
 
+	STRCYCLES(30, 30);
+
 	const ureg tmpa = LDMW(cpu->insn.segment, cpu->regs.si.w);
 	const ureg tmpb = LDMW(REG_ES,            cpu->regs.di.w);
 
@@ -1695,20 +3811,69 @@ static void op_cmpsw(CPU)
 	ADVDIW();
 
 	cpu->insn.fetch =
-		cpu->insn.repeat_eq? (--cpu->regs.cx.w == 0) || !cpu->flags.z:
-		cpu->insn.repeat_ne? (--cpu->regs.cx.w == 0) || cpu->flags.z:
+		cpu->insn.repeat_eq? (--cpu->regs.cx.w == 0) || !getf_z(cpu):
+		cpu->insn.repeat_ne? (--cpu->regs.cx.w == 0) || getf_z(cpu):
 		true;
 
 }
 
 
 
+static void op_insb(CPU)
+{
+
+	if ((cpu->insn.repeat_eq || cpu->insn.repeat_ne) && (cpu->regs.cx.w == 0))
+		return;
+
+	if ((cpu->insn.repeat_eq || cpu->insn.repeat_ne) && !cpu->flags.t && bulk_ins(cpu, 1, 8))
+		return;
+
+	STRCYCLES(14, 8);
+
+	STMB(REG_ES, cpu->regs.di.w, io_readb(&cpu->iob, cpu->regs.dx.w));
+	ADVDIB();
+
+	cpu->insn.fetch = !(cpu->insn.repeat_eq || cpu->insn.repeat_ne) || (--cpu->regs.cx.w == 0);
+
+}
+
+
+
+static void op_insw(CPU)
+{
+
+	if ((cpu->insn.repeat_eq || cpu->insn.repeat_ne) && (cpu->regs.cx.w == 0))
+		return;
+
+	if ((cpu->insn.repeat_eq || cpu->insn.repeat_ne) && !cpu->flags.t && bulk_ins(cpu, 2, 8))
+		return;
+
+	STRCYCLES(14, 8);
+
+	STMW(REG_ES, cpu->regs.di.w, io_readw(&cpu->iow, cpu->regs.dx.w));
+	ADVDIW();
+
+	cpu->insn.fetch = !(cpu->insn.repeat_eq || cpu->insn.repeat_ne) || (--cpu->regs.cx.w == 0);
+
+}
+
+
+
 static void op_lodsb(CPU)
 {
 
 	if ((cpu->insn.repeat_eq || cpu->insn.repeat_ne) && (cpu->regs.cx.w == 0))
 		return;
 
+	if ((cpu->insn.repeat_eq || cpu->insn.repeat_ne) && !cpu->flags.t && !memtraced(cpu)) {
+
+		bulk_lods(cpu, 1, 13);
+		return;
+
+	}
+
+	STRCYCLES(12, 13);
+
 	cpu->regs.ax.l = LDMB(cpu->insn.segment, cpu->regs.si.w);
 	ADVSIB();
 
@@ -1724,6 +3889,15 @@ static void op_lodsw(CPU)
 	if ((cpu->insn.repeat_eq || cpu->insn.repeat_ne) && (cpu->regs.cx.w == 0))
 		return;
 
+	if ((cpu->insn.repeat_eq || cpu->insn.repeat_ne) && !cpu->flags.t && !memtraced(cpu)) {
+
+		bulk_lods(cpu, 2, 17);
+		return;
+
+	}
+
+	STRCYCLES(16, 17);
+
 	cpu->regs.ax.w = LDMW(cpu->insn.segment, cpu->regs.si.w);
 
 	ADVSIW();
@@ -1740,6 +3914,11 @@ static void op_movsb(CPU)
 	if ((cpu->insn.repeat_eq || cpu->insn.repeat_ne) && (cpu->regs.cx.w == 0))
 		return;
 
+	if ((cpu->insn.repeat_eq || cpu->insn.repeat_ne) && !cpu->flags.t && bulk_movs(cpu, 1, 17))
+		return;
+
+	STRCYCLES(18, 17);
+
 	STMB(REG_ES, cpu->regs.di.w, LDMB(cpu->insn.segment, cpu->regs.si.w));
 	ADVSIB();
 	ADVDIB();
@@ -1756,6 +3935,11 @@ static void op_movsw(CPU)
 	if ((cpu->insn.repeat_eq || cpu->insn.repeat_ne) && (cpu->regs.cx.w == 0))
 		return;
 
+	if ((cpu->insn.repeat_eq || cpu->insn.repeat_ne) && !cpu->flags.t && bulk_movs(cpu, 2, 25))
+		return;
+
+	STRCYCLES(26, 25);
+
 	STMW(REG_ES, cpu->regs.di.w, LDMW(cpu->insn.segment, cpu->regs.si.w));
 	ADVSIW();
 	ADVDIW();
@@ -1766,17 +3950,62 @@ static void op_movsw(CPU)
 
 
 
+static void op_outsb(CPU)
+{
+
+	if ((cpu->insn.repeat_eq || cpu->insn.repeat_ne) && (cpu->regs.cx.w == 0))
+		return;
+
+	if ((cpu->insn.repeat_eq || cpu->insn.repeat_ne) && !cpu->flags.t && bulk_outs(cpu, 1, 8))
+		return;
+
+	STRCYCLES(14, 8);
+
+	io_writeb(&cpu->iob, cpu->regs.dx.w, LDMB(cpu->insn.segment, cpu->regs.si.w));
+	ADVSIB();
+
+	cpu->insn.fetch = !(cpu->insn.repeat_eq || cpu->insn.repeat_ne) || (--cpu->regs.cx.w == 0);
+
+}
+
+
+
+static void op_outsw(CPU)
+{
+
+	if ((cpu->insn.repeat_eq || cpu->insn.repeat_ne) && (cpu->regs.cx.w == 0))
+		return;
+
+	if ((cpu->insn.repeat_eq || cpu->insn.repeat_ne) && !cpu->flags.t && bulk_outs(cpu, 2, 8))
+		return;
+
+	STRCYCLES(14, 8);
+
+	io_writew(&cpu->iow, cpu->regs.dx.w, LDMW(cpu->insn.segment, cpu->regs.si.w));
+	ADVSIW();
+
+	cpu->insn.fetch = !(cpu->insn.repeat_eq || cpu->insn.repeat_ne) || (--cpu->regs.cx.w == 0);
+
+}
+
+
+
 static void op_scasb(CPU)
 {
 
 	if ((cpu->insn.repeat_eq || cpu->insn.repeat_ne) && (cpu->regs.cx.w == 0))
 		return;
 
+	if ((cpu->insn.repeat_eq || cpu->insn.repeat_ne) && !cpu->flags.t && bulk_scmp(cpu, false, 15))
+		return;
+
+	STRCYCLES(15, 15);
+
 	sub8(cpu, cpu->regs.ax.l, LDMB(REG_ES, cpu->regs.di.w));
 	ADVDIB();
 
-	if      (cpu->insn.repeat_eq) { cpu->insn.fetch = (--cpu->regs.cx.w == 0) || !cpu->flags.z; }
-	else if (cpu->insn.repeat_ne) { cpu->insn.fetch = (--cpu->regs.cx.w == 0) ||  cpu->flags.z; }
+	if      (cpu->insn.repeat_eq) { cpu->insn.fetch = (--cpu->regs.cx.w == 0) || !getf_z(cpu); }
+	else if (cpu->insn.repeat_ne) { cpu->insn.fetch = (--cpu->regs.cx.w == 0) ||  getf_z(cpu); }
 
 }
 
@@ -1788,11 +4017,13 @@ static void op_scasw(CPU)
 	if ((cpu->insn.repeat_eq || cpu->insn.repeat_ne) && (cpu->regs.cx.w == 0))
 		return;
 
+	STRCYCLES(19, 19);
+
 	sub16(cpu, cpu->regs.ax.w, LDMW(REG_ES, cpu->regs.di.w));
 	ADVDIW();
 
-	if      (cpu->insn.repeat_eq) { cpu->insn.fetch = (--cpu->regs.cx.w == 0) || !cpu->flags.z; }
-	else if (cpu->insn.repeat_ne) { cpu->insn.fetch = (--cpu->regs.cx.w == 0) ||  cpu->flags.z; }
+	if      (cpu->insn.repeat_eq) { cpu->insn.fetch = (--cpu->regs.cx.w == 0) || !getf_z(cpu); }
+	else if (cpu->insn.repeat_ne) { cpu->insn.fetch = (--cpu->regs.cx.w == 0) ||  getf_z(cpu); }
 
 }
 
@@ -1804,6 +4035,11 @@ static void op_stosb(CPU)
 	if ((cpu->insn.repeat_eq || cpu->insn.repeat_ne) && (cpu->regs.cx.w == 0))
 		return;
 
+	if ((cpu->insn.repeat_eq || cpu->insn.repeat_ne) && !cpu->flags.t && bulk_stos(cpu, 1, 10))
+		return;
+
+	STRCYCLES(11, 10);
+
 	STMB(REG_ES, cpu->regs.di.w, cpu->regs.ax.l);
 	ADVDIB();
 
@@ -1819,6 +4055,11 @@ static void op_stosw(CPU)
 	if ((cpu->insn.repeat_eq || cpu->insn.repeat_ne) && (cpu->regs.cx.w == 0))
 		return;
 
+	if ((cpu->insn.repeat_eq || cpu->insn.repeat_ne) && !cpu->flags.t && bulk_stos(cpu, 2, 14))
+		return;
+
+	STRCYCLES(15, 14);
+
 	STMW(REG_ES, cpu->regs.di.w, cpu->regs.ax.w);
 	ADVDIW();
 
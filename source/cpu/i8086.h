@@ -31,7 +31,40 @@ enum {
 	I8086_VECTOR_SSTEP  = 1,
 	I8086_VECTOR_NMI    = 2,
 	I8086_VECTOR_BREAK  = 3,
-	I8086_VECTOR_VFLOW  = 4
+	I8086_VECTOR_VFLOW  = 4,
+	I8086_VECTOR_BOUND  = 5   // 80186 BOUND out of range
+};
+
+
+enum {
+	I8086_MODEL_8088  = 0,  // 8088 and 8086 instruction set
+	I8086_MODEL_80186 = 1,  // Adds the 80186 and V20 instructions, shift counts are taken mod 32
+	I8086_MODEL_COUNT
+};
+
+
+enum {
+	I8086_ICACHE_SIZE = 1024,
+	I8086_OPCODES     = 408    // Slots of the opcode table, group sub-opcodes apart
+};
+
+
+enum {
+	I8086_STOP_BUDGET = 0,  // Instruction budget exhausted
+	I8086_STOP_EVENT  = 1,  // Interrupt request ready to be taken
+	I8086_STOP_HALT   = 2,  // Halted, idle until the next interrupt request
+	I8086_STOP_BREAK  = 3,  // At a breakpoint, the instruction has not run
+	I8086_STOP_WATCH  = 4   // Instruction that hit a watchpoint has run
+};
+
+
+enum {
+	I8086_POINT_EXEC  = 1 << 0,  // Breakpoint
+	I8086_POINT_READ  = 1 << 1,  // Watchpoints
+	I8086_POINT_WRITE = 1 << 2,
+
+	I8086_POINTS = 16,          // Most points set at once
+	I8086_PAGES  = 512          // 4KB pages of the 2MB physical address space
 };
 
 
@@ -47,15 +80,76 @@ typedef union {
 
 
 struct i8086;
+struct i8086_jit;
 
 
 typedef void (*i8086_opcode)(struct i8086 *cpu);
+typedef u16  (*i8086_ea)(    struct i8086 *cpu, u16 disp);
+
+
+// Observers for tracers, profilers and debuggers, any of them may be NULL. Modes
+// are IO_RD8 ... IO_WR16, memory addresses are physical
+struct i8086_hooks {
+
+	void *data;
+
+	void (*retire)(   void *data, struct i8086 *cpu, u16 cs, u16 ip);  // Instruction at cs:ip completed
+	void (*memory)(   void *data, struct i8086 *cpu, u32 addr, uint mode, uint value);  // Data, not code
+	void (*port)(     void *data, struct i8086 *cpu, u16 port, uint mode, uint value);
+	void (*interrupt)(void *data, struct i8086 *cpu, uint vector);  // Taken, the handler is next
+
+};
+
+
+// Decoded instruction, everything up to and including the EA displacement
+struct i8086_decode {
 
+	u64 code;  // Instruction bytes the decode was made from
+	u64 mask;  // Bytes of code covered by the decode
+	u32 addr;  // Physical address of the first prefix or opcode byte
 
+	u16 opcode;
+	u16 disp;
+
+	u8  length;
+	u8  modrm;
+	u8  segment;
+	u8  cycles;  // Clock cycles, EA calculation included
+
+	bool op_memory;
+	bool op_segment;
+	bool repeat_eq;
+	bool repeat_ne;
+
+	u8 reg0b, reg1b;  // Register operands, as offsets into regs
+	u8 reg0w, reg1w;
+
+	u16 fused;    // Dispatch index of the pair with the Jcc after it, 0 if none
+	u8  context;  // insn.context of the CPU that made the decode
+
+	i8086_ea ea;
+
+};
+
+
+// Decoded instructions, indexed by physical address. Only the entries of the
+// code that runs are touched. Entries are checked against the code bytes and
+// the decode context, so CPUs that share a cache on one thread never take each
+// other's decodes
+struct i8086_icache {
+	_Alignas(64) struct i8086_decode entry[I8086_ICACHE_SIZE];
+};
+
+
+// CPU state is plain data with no pointers into itself, so a copy made with
+// memcpy() is a working CPU. The copy shares memory, I/O, translated code and
+// the decode cache with the original, which alone is passed to i8086_free()
 typedef struct i8086 {
 
+	// Hot state, used by every instruction, packed from the first cache line
+
 	// CPU register state
-	struct {
+	_Alignas(64) struct {
 
 		u16 zero;
 		u16 scs, sip;
@@ -85,29 +179,41 @@ typedef struct i8086 {
 	} flags;
 
 
-	// CPU microcode
+	// Last ALU operation, arithmetic flags are derived from it on demand
 	struct {
 
-		//i8086_opcode uops[352];
-		//uint         mods[352];
+		uint op;
+		uint n;
 
-		struct {
+		u32  x, a, b;
+		bool d;
 
-			bool memory;
+	} lazy;
 
-			uint  ea_seg;
-			u16  *ea_reg0;
-			u16  *ea_reg1;
-			bool  ea_disp8;
-			bool  ea_disp16;
 
-			u8  *regb;
-			u16 *regw;
-			u16 *regs;
+	// Instruction decoder state
+	struct {
 
-		} demodrm[32];
+		bool fetch;
+		bool repeat_eq;
+		bool repeat_ne;
 
-	} microcode;
+		bool op_segment;
+
+		uint opcode;
+		uint fused;
+		uint modrm;
+		uint segment;
+
+		u32 addr;
+
+		u8 reg0b, reg1b;  // Offsets into regs
+		u8 reg0w, reg1w;
+
+		u8 context;  // What decodes depend on besides the code bytes: the model,
+		             // and whether any points are set, which rules out fusion
+
+	} insn;
 
 
 	// Interrupt state
@@ -118,57 +224,129 @@ typedef struct i8086 {
 		bool irq_act;
 		bool nmi_act;
 		bool delay;
+		bool pending;  // Next instruction must go through the interrupt check
+		bool halt;     // HLT executed, waiting for NMI or an enabled IRQ
 
 	} interrupt;
 
 
-	// Instruction decoder state
+	// Memory interface
 	struct {
 
-		bool fetch;
-		bool repeat_eq;
-		bool repeat_ne;
+		struct memory mem;
+		u16           selector[5];
 
-		bool op_override;
-		bool op_memory;
-		bool op_segment;
+		// Segment descriptor cache, the physical address of each segment and how
+		// many bytes of it run on in host memory before it wraps
+		struct {
+			u32 base;
+			u32 length;
+		} descriptor[5];
 
-		uint opcode;
-		uint modrm;
-		uint segment;
+		u32 mask;    // mem.mask and mem.length the descriptors were made for
+		u32 length;
 
-		u32 addr;
+		u16 bounce;    // Word access split by a wrap, and where its bytes go
+		u32 split[2];
+		u8  open;      // Byte past the end of memory
 
-		u8  *reg0b, *reg1b;
-		u16 *reg0w, *reg1w;
+		u8  seg, len;  // Where the bounce came from, for the memory hook
+		u16 ofs;
 
-	} insn;
+		u32 limit;  // Longest run a descriptor covers, 0 under a memory hook
 
+	} memory;
 
-	// Memory interface
-	struct {
 
-		struct memory mem;
+	// Clock cycles executed, by 8088 timings and 80186 ones for what the 80186 adds
+	u64 cycles;
 
-		u16           selector[5];
-		struct memory descriptor[5];
+	// Instruction pairs run as one fused handler, each counts two instructions
+	u64 fused;
 
-	} memory;
 
+	// Cold state, from the next cache line on
 
-	struct io iob;
+	_Alignas(64) struct io iob;
 	struct io iow;
 
 	i8086_opcode undef;
 
+	// Instruction set, one of I8086_MODEL_*. Decode and the cost of taken
+	// branches look at it, other timings are the 8088's on every model
+	uint model;
+
+	// Numeric coprocessor, attached by i8087_init(&cpu->fpu) after i8086_init()
+	struct i8087 fpu;
+
+	// Translated code, NULL unless i8086_jit_init() was called
+	struct i8086_jit *jit;
+
+	// Observers set by i8086_hook(), and the ports the port hook stands in
+	// front of, for bytes and words
+	const struct i8086_hooks *hooks;
+	struct io                 ports[2];
+
+	// Instruction the retire hook is called for: its opcode table slot, whether
+	// its ModRM operand is in memory and its length, prefixes included
+	struct {
+		u16  slot;
+		bool memory;
+		u8   length;
+	} retired;
+
+	// Breakpoints and watchpoints, on physical addresses. Descriptors stop short
+	// of the pages that hold any, so only accesses to those leave the fast path
+	struct {
+
+		struct {
+			u32  addr;
+			u32  length;
+			uint kind;  // I8086_POINT_*, 0 if the slot is free
+		} point[I8086_POINTS];
+
+		uint count;                   // Slots in use
+		u64  pages[I8086_PAGES / 64];  // Pages holding a point
+
+		uint stop;  // I8086_STOP_BREAK or I8086_STOP_WATCH once hit, else 0
+		uint hit;   // Point hit, and the address and mode of the access,
+		u32  addr;  // IO_RD8 ... IO_WR16 for watchpoints
+		uint mode;
+
+		u32 skip;  // Breakpoint stopped at, passed over if the CPU resumes
+		u64 when;  // there at this cycle count
+
+	} debug;
+
+
+	// Decoded instruction cache, allocated by i8086_init() and shared by copies
+	struct i8086_icache *icache;
+
+	struct i8086_decode idecode;
+	struct i8086_decode ibreak;   // Stop at a breakpoint
+
 } i8086;
 
 
 
-void i8086_init( i8086 *cpu);
+bool i8086_init( i8086 *cpu);
+void i8086_free( i8086 *cpu);
 void i8086_reset(i8086 *cpu);
+void i8086_model(i8086 *cpu, uint model);
+void i8086_hook( i8086 *cpu, const struct i8086_hooks *hooks);
+
+int  i8086_point_add(   i8086 *cpu, u32 addr, u32 length, uint kind);
+void i8086_point_remove(i8086 *cpu, int point);
 int  i8086_intrq(i8086 *cpu, uint nmi, uint irq);
 void i8086_tick( i8086 *cpu);
+uint i8086_run(  i8086 *cpu, uint budget);
+
+uint i8086_cycles(i8086 *cpu, u16 ip);
+uint i8086_branch(i8086 *cpu);
+
+const char *i8086_slot_name(uint slot, char code[8]);
+
+uint i8086_shift(i8086 *cpu, uint op, uint n, uint a, uint b);
 
 uint i8086_reg_get(i8086 *cpu, uint reg);
 void i8086_reg_set(i8086 *cpu, uint reg, uint value);
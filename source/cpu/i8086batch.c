@@ -0,0 +1,743 @@
+
+
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "core/types.h"
+#include "core/debug.h"
+#include "core/io.h"
+#include "core/memory.h"
+#include "core/wire.h"
+
+#include "cpu/i8087.h"
+#include "cpu/i8086.h"
+#include "cpu/i8086batch.h"
+
+
+enum {
+
+	BATCH_SCALAR = 0xffff,  // Key of a lane that takes the scalar path
+	BATCH_DONE   = 0xfe00,  // and of one that has run all its steps, keys of the
+	                        // vector passes are all below
+
+	FLAG_C = 1 << 0,  FLAG_P = 1 << 2,  FLAG_A = 1 << 4,  FLAG_Z = 1 << 6,
+	FLAG_S = 1 << 7,  FLAG_T = 1 << 8,  FLAG_I = 1 << 9,  FLAG_V = 1 << 11,
+
+	FLAGS_ALU = FLAG_C | FLAG_P | FLAG_A | FLAG_Z | FLAG_S | FLAG_V
+
+};
+
+
+// Passes are built for AVX2 as well where the host has it, and picked at load
+#if defined(__x86_64__)
+#define BATCH_CLONES  gnu::target_clones("avx2", "default")
+#else
+#define BATCH_CLONES
+#endif
+
+
+#define B  struct i8086_batch *b
+
+// Lane arrays of a pass. Passed through restrict members, or the vectorizer
+// gives up on the run time overlap checks
+struct lanes {
+
+	uint                count;
+	const u16 *restrict key;
+	u16       *restrict imm;
+	u16       *restrict flags;
+	u16       *restrict ip;
+	u32       *restrict clock;
+
+};
+
+#define L  const struct lanes *restrict lanes
+
+#define LANES \
+	const uint          count = lanes->count;  \
+	const u16 *restrict key   = lanes->key;    \
+	u16       *restrict imm   = lanes->imm;    \
+	u16       *restrict flags = lanes->flags;  \
+	u16       *restrict ip    = lanes->ip;     \
+	u32       *restrict clock = lanes->clock;
+
+// Passes select with masks rather than ?:, which the vectorizer leaves as branches
+#define BLEND(on, x, y)  (((x) & (on)) | ((y) & ~(on)))
+
+
+
+static inline uint parity(uint x)
+{
+
+	x ^= x >> 4;
+	x ^= x >> 2;
+	x ^= x >> 1;
+
+	return ~x & 1;
+
+}
+
+
+// Zero, sign and parity of a result, the rest of FLAGS from the arguments
+static inline uint flags_pzs(uint r, uint w, uint rest)
+{
+
+	const uint m = w? 0xffff: 0xff;
+
+	return rest
+		| (parity(r & 0xff) << 2)
+		| (((r & m) == 0) << 6)
+		| (((r >> (w? 15: 7)) & 1) << 7);
+
+}
+
+
+
+// Source register or register byte into imm of the lanes at key k, so the pass
+// that follows reads it from there whether or not it is also the destination
+[[gnu::always_inline]] static inline void operand(L, u16 k, const u16 *restrict src, uint shift, u32 m)
+{
+
+	LANES
+
+	for (uint l=0; l < count; l++) {
+		const u32 on = -(u32)(key[l] == k);
+		imm[l] = BLEND(on, (src[l] >> shift) & m, (u32)imm[l]);
+	}
+
+}
+
+
+
+// ALU operation 0-7 (ADD OR ADC SBB AND SUB XOR CMP) on every lane at key k, of
+// a register or its high byte and the operand in imm
+[[gnu::always_inline]] static inline void alu(L, u16 k, uint op, uint w,
+	u16 *restrict dst, uint dsh, uint length, uint cycles)
+{
+
+	LANES
+
+	const u32  m     = w? 0xffff: 0xff;
+	const uint sign  = w? 15: 7;
+	const bool arith = op != 1 && op != 4 && op != 6;
+	const bool carry = op == 2 || op == 3;
+	const bool sub   = op == 3 || op == 5 || op == 7;
+
+	for (uint l=0; l < count; l++) {
+
+		const u32 on = -(u32)(key[l] == k);
+		const u32 f  = flags[l];
+		const u32 d  = dst[l];
+		const u32 a  = (d >> dsh) & m;
+		const u32 s  = imm[l] & m;
+		const u32 c  = carry? f & FLAG_C: 0;
+
+		u32 r;
+
+		switch (op) {
+			case 0: r = a + s;     break;
+			case 1: r = a | s;     break;
+			case 2: r = a + s + c; break;
+			case 3: r = a - s - c; break;
+			case 4: r = a & s;     break;
+			case 5: r = a - s;     break;
+			case 6: r = a ^ s;     break;
+			default: r = a - s;    break;
+		}
+
+		u32 rest = f & ~FLAGS_ALU;
+
+		if (arith) {
+			const u32 v = sub? (a ^ s) & (a ^ r): (a ^ r) & (s ^ r);
+			rest |= ((r >> (sign + 1)) & 1) | ((a ^ s ^ r) & FLAG_A) | (((v >> sign) & 1) << 11);
+		}
+
+		if (op != 7)
+			dst[l] = BLEND(on, (d & ~(m << dsh)) | ((r & m) << dsh), d);
+
+		flags[l]  = BLEND(on, flags_pzs(r, w, rest), f);
+		ip[l]    += length & on;
+		clock[l] += cycles & on;
+
+	}
+
+}
+
+
+
+// INC or DEC of a 16-bit register, carry is left as it was
+[[gnu::always_inline]] static inline void incdec(L, u16 k, bool dec, u16 *restrict dst, uint cycles)
+{
+
+	LANES
+
+	for (uint l=0; l < count; l++) {
+
+		const u32 on = -(u32)(key[l] == k);
+		const u32 f  = flags[l];
+		const u32 a  = dst[l];
+		const u32 r  = (dec? a - 1: a + 1) & 0xffff;
+
+		const u32 v    = dec? a == 0x8000: r == 0x8000;
+		const u32 rest = (f & ~FLAGS_ALU) | (f & FLAG_C) | ((a ^ r) & FLAG_A) | (v << 11);
+
+		dst[l]    = BLEND(on, r, a);
+		flags[l]  = BLEND(on, flags_pzs(r, 1, rest), f);
+		ip[l]    += 1 & on;
+		clock[l] += cycles & on;
+
+	}
+
+}
+
+
+
+// MOV of the operand in imm to a register or register byte
+[[gnu::always_inline]] static inline void move(L, u16 k, uint w, u16 *restrict dst, uint dsh, uint length, uint cycles)
+{
+
+	LANES
+
+	const u32 m = w? 0xffff: 0xff;
+
+	for (uint l=0; l < count; l++) {
+
+		const u32 on = -(u32)(key[l] == k);
+		const u32 d  = dst[l];
+
+		dst[l]    = BLEND(on, (d & ~(m << dsh)) | ((imm[l] & m) << dsh), d);
+		ip[l]    += length & on;
+		clock[l] += cycles & on;
+
+	}
+
+}
+
+
+
+// XCHG of AX with another register
+[[gnu::always_inline]] static inline void xchg(L, u16 k, u16 *restrict ax, u16 *restrict r, uint cycles)
+{
+
+	LANES
+
+	for (uint l=0; l < count; l++) {
+
+		const u32 on = -(u32)(key[l] == k);
+		const u32 a  = ax[l];
+		const u32 x  = r[l];
+
+		ax[l]     = BLEND(on, x, a);
+		r[l]      = BLEND(on, a, x);
+		ip[l]    += 1 & on;
+		clock[l] += cycles & on;
+
+	}
+
+}
+
+
+
+// Jcc with the condition 0-15 of its opcode, taken branches cost branch more
+[[gnu::always_inline]] static inline void jcc(L, u16 k, uint cc, uint cycles, uint branch)
+{
+
+	LANES
+
+	for (uint l=0; l < count; l++) {
+
+		const u32 on = -(u32)(key[l] == k);
+		const u32 f  = flags[l];
+
+		const u32 c = f & 1;
+		const u32 p = (f >> 2) & 1;
+		const u32 z = (f >> 6) & 1;
+		const u32 s = (f >> 7) & 1;
+		const u32 v = (f >> 11) & 1;
+
+		// All eight conditions, bit n is that of Jcc 70 + 2n
+		const u32 t = v | c << 1 | z << 2 | (c | z) << 3 | s << 4 | p << 5 | (s ^ v) << 6 | ((s ^ v) | z) << 7;
+
+		const u32 taken = -(((t >> (cc >> 1)) ^ cc) & 1) & on;
+
+		ip[l]    += (2 & on) + ((u32)(i8)imm[l] & taken);
+		clock[l] += (cycles & on) + (branch & taken);
+
+	}
+
+}
+
+
+
+// CLC, STC and CMC, and NOP which leaves the flags as they are
+[[gnu::always_inline]] static inline void flag(L, u16 k, uint op, uint cycles)
+{
+
+	LANES
+
+	for (uint l=0; l < count; l++) {
+
+		const u32 on = -(u32)(key[l] == k);
+		const u32 f  = flags[l];
+		const u32 c  = (op == 0xf8)? 0: (op == 0xf9)? 1: (op == 0xf5)? ~f & 1: f & 1;
+
+		flags[l]  = BLEND(on, (f & ~FLAG_C) | c, f);
+		ip[l]    += 1 & on;
+		clock[l] += cycles & on;
+
+	}
+
+}
+
+
+
+// Register or register byte r of a ModRM field, and the shift to its bits
+static inline u16 *reg(B, uint r, uint w, uint *shift)
+{
+
+	*shift = (!w && (r & 4))? 8: 0;
+	return b->reg[w? r: r & 3];
+
+}
+
+
+
+[[BATCH_CLONES]] static void pass_alu(B, u16 k, uint cycles)
+{
+
+	const struct lanes lanes = { b->count, b->key, b->imm, b->flags, b->ip, b->cycles };
+
+	const uint op    = k >> 8;
+	const uint modrm = k & 0xff;
+	const uint w     = op & 1;
+	const bool imm   = (op & 7) >= 4;
+
+	uint  dsh = 0;
+	u16  *dst = b->reg[0];
+
+	if (!imm) {
+
+		uint ssh;
+		auto r0 = reg(b, (modrm >> 3) & 7, w, &dsh);
+		auto r1 = reg(b, modrm & 7, w, &ssh);
+
+		if (!(op & 2)) {
+			operand(&lanes, k, r0, dsh, w? 0xffff: 0xff);
+			dst = r1;
+			dsh = ssh;
+		} else {
+			operand(&lanes, k, r1, ssh, w? 0xffff: 0xff);
+			dst = r0;
+		}
+
+	}
+
+	const uint length = imm? 2 + w: 2;
+
+	#define ALU(n) \
+		case n * 2 + 0: alu(&lanes, k, n, 0, dst, dsh, length, cycles); break; \
+		case n * 2 + 1: alu(&lanes, k, n, 1, dst, dsh, length, cycles); break;
+
+	switch ((op >> 3) * 2 + w) {
+		ALU(0) ALU(1) ALU(2) ALU(3) ALU(4) ALU(5) ALU(6) ALU(7)
+	}
+
+	#undef ALU
+
+}
+
+
+
+[[BATCH_CLONES]] static void pass_other(B, u16 k, uint cycles)
+{
+
+	const struct lanes lanes = { b->count, b->key, b->imm, b->flags, b->ip, b->cycles };
+
+	const uint op    = k >> 8;
+	const uint modrm = k & 0xff;
+
+	uint dsh, ssh;
+
+	if (op >= 0x40 && op <= 0x47)
+		incdec(&lanes, k, false, b->reg[op & 7], cycles);
+
+	else if (op >= 0x48 && op <= 0x4f)
+		incdec(&lanes, k, true, b->reg[op & 7], cycles);
+
+	else if (op >= 0x70 && op <= 0x7f)
+		jcc(&lanes, k, op & 15, cycles, b->branch);
+
+	else if (op >= 0x88 && op <= 0x8b) {
+
+		const uint w  = op & 1;
+		auto       r0 = reg(b, (modrm >> 3) & 7, w, &dsh);
+		auto       r1 = reg(b, modrm & 7, w, &ssh);
+
+		switch (op) {
+			case 0x88: operand(&lanes, k, r0, dsh, 0xff);   move(&lanes, k, 0, r1, ssh, 2, cycles); break;
+			case 0x89: operand(&lanes, k, r0, dsh, 0xffff); move(&lanes, k, 1, r1, ssh, 2, cycles); break;
+			case 0x8a: operand(&lanes, k, r1, ssh, 0xff);   move(&lanes, k, 0, r0, dsh, 2, cycles); break;
+			default:   operand(&lanes, k, r1, ssh, 0xffff); move(&lanes, k, 1, r0, dsh, 2, cycles); break;
+		}
+
+	} else if (op >= 0x91 && op <= 0x97)
+		xchg(&lanes, k, b->reg[0], b->reg[op & 7], cycles);
+
+	else if (op >= 0xb0 && op <= 0xb7) {
+
+		auto r = reg(b, op & 7, 0, &dsh);
+		move(&lanes, k, 0, r, dsh, 2, cycles);
+
+	} else if (op >= 0xb8 && op <= 0xbf)
+		move(&lanes, k, 1, b->reg[op & 7], 0, 3, cycles);
+
+	else
+		flag(&lanes, k, op, cycles);
+
+}
+
+
+
+// Code byte at CS:IP+n of a lane, open bus past the end of memory
+static inline uint code(i8086 *cpu, u16 ip, uint n)
+{
+
+	const u32 phys = (cpu->memory.selector[REG_CS] * 16 + (u16)(ip + n)) & cpu->memory.mem.mask;
+	return (phys < cpu->memory.mem.length)? cpu->memory.mem.base[phys]: 0xff;
+
+}
+
+
+
+// Key of the instruction a lane is at, BATCH_SCALAR unless the vector passes
+// cover it and nothing is waiting to interrupt it
+static u16 classify(B, uint l)
+{
+
+	if (!b->quiet[l] || b->cpus[l].model != b->model)
+		return BATCH_SCALAR;
+
+	const u16 ip = b->ip[l];
+	u8        p[3];
+
+	if (ip + 3 <= b->limit[l])
+		memcpy(p, b->text[l] + ip, 3);
+	else
+		for (uint n=0; n < 3; n++)
+			p[n] = code(&b->cpus[l], ip, n);
+
+	const uint op = p[0];
+
+	if (op < 0x40 && (op & 7) < 4)
+		return (p[1] >= 0xc0)? op << 8 | p[1]: BATCH_SCALAR;
+
+	if (op < 0x40 && (op & 7) < 6) {
+		b->imm[l] = p[1] | ((op & 1)? p[2] << 8: 0);
+		return op << 8;
+	}
+
+	if (op >= 0x88 && op <= 0x8b)
+		return (p[1] >= 0xc0)? op << 8 | p[1]: BATCH_SCALAR;
+
+	if ((op >= 0x70 && op <= 0x7f) || (op >= 0xb0 && op <= 0xb7)) {
+		b->imm[l] = p[1];
+		return op << 8;
+	}
+
+	if (op >= 0xb8 && op <= 0xbf) {
+		b->imm[l] = p[1] | p[2] << 8;
+		return op << 8;
+	}
+
+	if ((op >= 0x40 && op <= 0x4f) || (op >= 0x90 && op <= 0x97) || op == 0xf5 || op == 0xf8 || op == 0xf9)
+		return op << 8;
+
+	return BATCH_SCALAR;
+
+}
+
+
+
+static void gather(B, uint l)
+{
+
+	const i8086 *cpu = &b->cpus[l];
+
+	b->reg[0][l] = cpu->regs.ax.w;
+	b->reg[1][l] = cpu->regs.cx.w;
+	b->reg[2][l] = cpu->regs.dx.w;
+	b->reg[3][l] = cpu->regs.bx.w;
+	b->reg[4][l] = cpu->regs.sp.w;
+	b->reg[5][l] = cpu->regs.bp.w;
+	b->reg[6][l] = cpu->regs.si.w;
+	b->reg[7][l] = cpu->regs.di.w;
+
+	b->ip[l]     = cpu->regs.ip;
+	b->flags[l]  = i8086_reg_get(&b->cpus[l], REG_FLAGS);
+	b->cycles[l] = 0;
+
+	// Vector passes leave TF and IF alone, so only the scalar path changes this.
+	// Lanes with hooks or points stay on the scalar path, where i8086_tick() sees them
+	b->quiet[l] = cpu->insn.fetch && !cpu->interrupt.delay && !cpu->interrupt.halt && !cpu->interrupt.nmi_act
+		&& !cpu->flags.t && !(cpu->interrupt.irq_act && cpu->flags.i) && cpu->hooks == NULL && cpu->debug.count == 0;
+
+	const auto cs = &cpu->memory.descriptor[REG_CS];
+
+	b->text[l]  = cpu->memory.mem.base + cs->base;
+	b->limit[l] = cs->length;
+
+}
+
+
+
+static void scatter(B, uint l)
+{
+
+	i8086 *cpu = &b->cpus[l];
+
+	cpu->regs.ax.w = b->reg[0][l];
+	cpu->regs.cx.w = b->reg[1][l];
+	cpu->regs.dx.w = b->reg[2][l];
+	cpu->regs.bx.w = b->reg[3][l];
+	cpu->regs.sp.w = b->reg[4][l];
+	cpu->regs.bp.w = b->reg[5][l];
+	cpu->regs.si.w = b->reg[6][l];
+	cpu->regs.di.w = b->reg[7][l];
+
+	cpu->regs.ip = b->ip[l];
+	i8086_reg_set(cpu, REG_FLAGS, b->flags[l]);
+
+	if (cpu->insn.fetch) { // At an instruction boundary, where interrupts return to
+		cpu->regs.scs = cpu->memory.selector[REG_CS];
+		cpu->regs.sip = cpu->regs.ip;
+	}
+
+	cpu->cycles += b->cycles[l];
+	b->cycles[l] = 0;
+
+}
+
+
+
+bool i8086_batch_init(struct i8086_batch *batch, i8086 *cpus, uint count)
+{
+
+	memset(batch, 0, sizeof(*batch));
+
+	if (count > I8086_BATCH_LANES)
+		return false;
+
+	// Timings are kept by key alone, so every lane has to be the same model
+	for (uint l=1; l < count; l++)
+		if (cpus[l].model != cpus[0].model)
+			return false;
+
+	// Lane arrays are cache-line aligned and padded, so passes load whole vectors
+	const size_t lanes = (count + 63) & ~63u;
+
+	batch->count = count;
+	batch->cpus  = cpus;
+
+	batch->model  = (count > 0)? cpus[0].model: I8086_MODEL_8088;
+	batch->branch = (count > 0)? i8086_branch(&cpus[0]): 0;
+
+	for (int n=0; n < 8; n++)
+		batch->reg[n] = aligned_alloc(64, lanes * sizeof(u16));
+
+	batch->ip     = aligned_alloc(64, lanes * sizeof(u16));
+	batch->flags  = aligned_alloc(64, lanes * sizeof(u16));
+	batch->cycles = aligned_alloc(64, lanes * sizeof(u32));
+	batch->key    = aligned_alloc(64, lanes * sizeof(u16));
+	batch->imm    = aligned_alloc(64, lanes * sizeof(u16));
+	batch->left   = aligned_alloc(64, lanes * sizeof(u32));
+
+	batch->text  = aligned_alloc(64, lanes * sizeof(u8*));
+	batch->limit = aligned_alloc(64, lanes * sizeof(u32));
+	batch->quiet = aligned_alloc(64, lanes * sizeof(u8));
+
+	batch->timing = calloc(65536, sizeof(u8));
+
+	bool ok = batch->ip && batch->flags && batch->cycles && batch->key && batch->imm && batch->left;
+
+	ok = ok && batch->text && batch->limit && batch->quiet && batch->timing;
+
+	for (int n=0; n < 8; n++)
+		ok = ok && batch->reg[n];
+
+	if (!ok) {
+		i8086_batch_free(batch);
+		return false;
+	}
+
+	memset(batch->imm, 0, lanes * sizeof(u16));
+	return true;
+
+}
+
+
+
+void i8086_batch_free(struct i8086_batch *batch)
+{
+
+	for (int n=0; n < 8; n++)
+		free(batch->reg[n]);
+
+	free(batch->ip);
+	free(batch->flags);
+	free(batch->cycles);
+	free(batch->key);
+	free(batch->imm);
+	free(batch->left);
+	free(batch->text);
+	free(batch->limit);
+	free(batch->quiet);
+	free(batch->timing);
+
+	memset(batch, 0, sizeof(*batch));
+
+}
+
+
+
+// Lane with the lowest IP among those at a vector covered instruction, count if
+// there is none
+static uint lowest(B)
+{
+
+	const u16 *key  = b->key;
+	const u16 *ip   = b->ip;
+	u32        best = ~0u;
+
+	for (uint l=0; l < b->count; l++) {
+		const u32 on = -(u32)(key[l] < BATCH_DONE);
+		const u32 x  = BLEND(on, (u32)ip[l] << 16 | l, ~0u);
+		best = (x < best)? x: best;
+	}
+
+	return (best == ~0u)? b->count: best & 0xffff;
+
+}
+
+
+
+// Counts the step a lane made and finds its next instruction. True if that was
+// its last one
+static bool retire(B, uint l)
+{
+
+	if (--b->left[l] == 0) {
+		b->key[l] = BATCH_DONE;
+		return true;
+	}
+
+	b->key[l] = classify(b, l);
+	return false;
+
+}
+
+
+
+static bool scalar(B, uint l)
+{
+
+	scatter(b, l);
+	i8086_tick(&b->cpus[l]);
+	gather(b, l);
+
+	b->scalar++;
+	return retire(b, l);
+
+}
+
+
+
+// Runs steps instructions on every lane. Each round the instruction at the lowest
+// IP goes, as a vector pass over all lanes at it, so lanes a branch split up wait
+// there for the others and run together again. Instructions the passes don't
+// cover, and groups too small for a pass, go through i8086_tick() lane by lane
+void i8086_batch_run(struct i8086_batch *b, uint steps)
+{
+
+	for (uint l=0; l < b->count; l++) {
+		gather(b, l);
+		b->left[l] = steps;
+		b->key[l]  = steps? classify(b, l): BATCH_DONE;
+	}
+
+	for (uint active = steps? b->count: 0; active > 0;) {
+
+		for (uint l=0; l < b->count; l++)
+			if (b->key[l] == BATCH_SCALAR)
+				active -= scalar(b, l);
+
+		const uint first = lowest(b);
+
+		if (first == b->count)
+			continue;
+
+		const u16 k    = b->key[first];
+		uint      lane = 0;
+
+		for (uint l=0; l < b->count; l++)
+			lane += b->key[l] == k;
+
+		if (lane < I8086_BATCH_MIN) {
+
+			for (uint l=0; l < b->count; l++)
+				if (b->key[l] == k)
+					active -= scalar(b, l);
+
+			continue;
+
+		}
+
+		// Timing of register forms depends only on the key, any lane at it will do
+		if (b->timing[k] == 0)
+			b->timing[k] = i8086_cycles(&b->cpus[first], b->ip[first]);
+
+		if (k >> 8 < 0x40)
+			pass_alu(b, k, b->timing[k]);
+		else
+			pass_other(b, k, b->timing[k]);
+
+		b->vector += lane;
+
+		// Lanes that share their code mostly land on the same next instruction,
+		// which is then classified once
+		const u8 *same = NULL;
+		uint      last = 0;
+
+		for (uint l=0; l < b->count; l++) {
+
+			if (b->key[l] != k)
+				continue;
+
+			if (--b->left[l] == 0) {
+				b->key[l] = BATCH_DONE;
+				active--;
+				continue;
+			}
+
+			const u8 *at = b->text[l] + b->ip[l];
+
+			if (at == same && b->quiet[l]) {
+				b->key[l] = b->key[last];
+				b->imm[l] = b->imm[last];
+				continue;
+			}
+
+			b->key[l] = classify(b, l);
+			same      = (b->ip[l] + 3 <= b->limit[l])? at: NULL;
+			last      = l;
+
+		}
+
+	}
+
+	for (uint l=0; l < b->count; l++)
+		scatter(b, l);
+
+}
@@ -0,0 +1,48 @@
+#ifndef CPU_I8086BATCH_H
+#define CPU_I8086BATCH_H
+
+
+enum {
+	I8086_BATCH_MIN   = 4,     // Fewest lanes at one instruction for a vector pass
+	I8086_BATCH_LANES = 65536  // Most lanes in a batch
+};
+
+
+// Many independent CPUs stepped in lockstep. Register state is kept as one array
+// per register, so lanes at the same instruction run together in a loop the
+// compiler vectorizes. Anything else goes through i8086_tick() on its own CPU
+struct i8086_batch {
+
+	uint   count;
+	i8086 *cpus;  // One per lane, for memory, segments and the scalar path
+
+	u16 *reg[8];  // In ModRM order, AX CX DX BX SP BP SI DI
+	u16 *ip;
+	u16 *flags;   // As the FLAGS register
+	u32 *cycles;  // Not yet added to the lane's CPU
+
+	u16 *key;   // Instruction each lane is at, as opcode << 8 | ModRM
+	u16 *imm;   // and its immediate
+	u32 *left;  // Steps the lane has still to run
+
+	const u8 **text;   // Host address of each lane's code segment, and how much
+	u32       *limit;  // of it is in memory
+	u8        *quiet;  // Nothing waits to interrupt the lane
+
+	u8 *timing;  // Clock cycles of each key, 0 until first seen
+
+	uint model;   // Of every lane, as i8086_batch_init() requires. Lanes switched
+	uint branch;  // to another model since run scalar
+
+	u64 vector;  // Lane steps run by the vector and scalar paths
+	u64 scalar;
+
+};
+
+
+bool i8086_batch_init(struct i8086_batch *batch, i8086 *cpus, uint count);
+void i8086_batch_free(struct i8086_batch *batch);
+void i8086_batch_run( struct i8086_batch *batch, uint steps);
+
+
+#endif
@@ -16,14 +16,43 @@
 #include "core/memory.h"
 #include "core/wire.h"
 
+#include "cpu/i8087.h"
 #include "cpu/i8086.h"
 #include "cpu/i8086diag.h"
 
 
 
+#ifdef HAVE_ZYDIS
+
+// Instruction at cs:ip as text, ?? if it does not decode
+static void disasm(struct i8086 *cpu, u16 cs, u16 ip, char text[96])
+{
+
+	u8  buf[16];
+	u32 addr = cs * 16 + ip;
+
+	for (int n=0; n < 16; n++)
+		buf[n] = cpu->memory.mem.base[(addr + n) & cpu->memory.mem.mask];
+
+	ZydisDisassembledInstruction insn;
+
+	if (ZYAN_SUCCESS(ZydisDisassembleIntel(ZYDIS_MACHINE_MODE_REAL_16, addr, buf, sizeof(buf), &insn)))
+		snprintf(text, 96, "%s", insn.text);
+
+	else
+		strcpy(text, "??");
+
+}
+
+#endif
+
+
+
 void i8086_dump(i8086 *cpu)
 {
 
+	const uint flags = i8086_reg_get(cpu, REG_FLAGS);
+
 	printf( "\n\n"
 		"AX=%04x  BX=%04x  CX=%04x  DX=%04x  SP=%04x  BP=%04x  SI=%04x  DI=%04x\n"
 		"DS=%04x  ES=%04x  SS=%04x  CS=%04x  IP=%04x   %s %s %s %s %s %s %s %s \n"
@@ -36,32 +65,23 @@ void i8086_dump(i8086 *cpu)
 		i8086_reg_get(cpu, REG_SS), i8086_reg_get(cpu, REG_CS),
 		cpu->regs.ip,
 
-		cpu->flags.v? "OV": "NV",
-		cpu->flags.d? "DN": "UP",
-		cpu->flags.i? "EI": "DI",
-		cpu->flags.s? "NG": "PL",
-		cpu->flags.z? "ZR": "NZ",
-		cpu->flags.a? "AC": "NA",
-		cpu->flags.p? "PE": "PO",
-		cpu->flags.c? "CY": "NC"
+		(flags & (1 << 11))? "OV": "NV",
+		(flags & (1 << 10))? "DN": "UP",
+		(flags & (1 <<  9))? "EI": "DI",
+		(flags & (1 <<  7))? "NG": "PL",
+		(flags & (1 <<  6))? "ZR": "NZ",
+		(flags & (1 <<  4))? "AC": "NA",
+		(flags & (1 <<  2))? "PE": "PO",
+		(flags & (1 <<  0))? "CY": "NC"
 	);
 
 
 #ifdef HAVE_ZYDIS
 
-	u8  buf[16];
-	u32 addr = cpu->regs.scs * 16 + cpu->regs.sip;
+	char text[96];
 
-	for (int n=0; n < 16; n++)
-		buf[n] = cpu->memory.mem.base[(addr + n) & cpu->memory.mem.mask];
-
-	ZydisDisassembledInstruction insn;
-
-	if (ZYAN_SUCCESS(ZydisDisassembleIntel(ZYDIS_MACHINE_MODE_REAL_16, addr, buf, sizeof(buf), &insn)))
-		printf("%04x:%04x    %s\n\n", cpu->regs.scs, cpu->regs.sip, insn.text);
-
-	else
-		printf("%04x:%04x    ??\n\n", cpu->regs.scs, cpu->regs.sip);
+	disasm(cpu, cpu->regs.scs, cpu->regs.sip, text);
+	printf("%04x:%04x    %s\n\n", cpu->regs.scs, cpu->regs.sip, text);
 
 #endif
 
@@ -94,3 +114,388 @@ void i8086_stack(struct i8086 *cpu)
 
 }
 
+
+
+
+// Hooks of the diagnostic chained in front, data is its i8086_chain
+static void chain_retire(void *data, struct i8086 *cpu, u16 cs, u16 ip)
+{
+
+	const struct i8086_hooks *next = ((struct i8086_chain*)data)->next;
+
+	if (next != NULL && next->retire != NULL)
+		next->retire(next->data, cpu, cs, ip);
+
+}
+
+
+static void chain_memory(void *data, struct i8086 *cpu, u32 addr, uint mode, uint value)
+{
+
+	const struct i8086_hooks *next = ((struct i8086_chain*)data)->next;
+	next->memory(next->data, cpu, addr, mode, value);
+
+}
+
+
+static void chain_port(void *data, struct i8086 *cpu, u16 port, uint mode, uint value)
+{
+
+	const struct i8086_hooks *next = ((struct i8086_chain*)data)->next;
+	next->port(next->data, cpu, port, mode, value);
+
+}
+
+
+static void chain_interrupt(void *data, struct i8086 *cpu, uint vector)
+{
+
+	const struct i8086_hooks *next = ((struct i8086_chain*)data)->next;
+	next->interrupt(next->data, cpu, vector);
+
+}
+
+
+// Installs the hooks in front of those of the CPU, passing on only the kinds
+// they have so that the CPU keeps to the fast paths it can
+static void chain_start(struct i8086_chain *chain, struct i8086 *cpu)
+{
+
+	const auto next = cpu->hooks;
+
+	chain->next = next;
+
+	chain->hooks.memory    = (next != NULL && next->memory    != NULL)? &chain_memory:    NULL;
+	chain->hooks.port      = (next != NULL && next->port      != NULL)? &chain_port:      NULL;
+	chain->hooks.interrupt = (next != NULL && next->interrupt != NULL)? &chain_interrupt: NULL;
+
+	i8086_hook(cpu, &chain->hooks);
+
+}
+
+
+// Puts the hooks chained on back, unless others were installed since
+static void chain_stop(struct i8086_chain *chain, struct i8086 *cpu)
+{
+
+	if (cpu->hooks != &chain->hooks)
+		return;
+
+	i8086_hook(cpu, chain->next);
+	chain->next = NULL;
+
+}
+
+
+
+static void profile_retire(void *data, struct i8086 *cpu, u16 cs, u16 ip)
+{
+
+	struct i8086_profile *prof = data;
+
+	// Physical as the fetch sees it, so code past 1MB with the A20 gate off
+	// lands where it runs from
+	const u32 phys   = (cs * 16 + ip) & cpu->memory.mem.mask;
+	const u32 bucket = (phys >> prof->shift) & (prof->buckets - 1);
+
+	// Cycles since the last retire, the interrupt entries and REP iterations
+	// in between included
+	prof->cycles[bucket] += cpu->cycles - prof->last;
+	prof->last = cpu->cycles;
+
+	if (prof->insns[bucket]++ == 0)
+		prof->where[bucket] = cs << 16 | ip;
+
+	chain_retire(data, cpu, cs, ip);
+
+}
+
+
+
+bool i8086_profile_init(struct i8086_profile *prof, uint shift)
+{
+
+	memset(prof, 0, sizeof(*prof));
+
+	if (shift > 12)
+		return false;
+
+	prof->shift   = shift;
+	prof->buckets = (I8086_PAGES * 4096) >> shift;
+
+	prof->chain.hooks.data   = prof;
+	prof->chain.hooks.retire = &profile_retire;
+
+	prof->insns  = calloc(prof->buckets, sizeof(u64));
+	prof->cycles = calloc(prof->buckets, sizeof(u64));
+	prof->where  = calloc(prof->buckets, sizeof(u32));
+
+	if (!prof->insns || !prof->cycles || !prof->where) {
+		i8086_profile_free(prof);
+		return false;
+	}
+
+	return true;
+
+}
+
+
+
+void i8086_profile_free(struct i8086_profile *prof)
+{
+
+	free(prof->insns);
+	free(prof->cycles);
+	free(prof->where);
+
+	memset(prof, 0, sizeof(*prof));
+
+}
+
+
+
+// Runs in front of any other observers of the CPU until i8086_profile_stop()
+void i8086_profile_start(struct i8086_profile *prof, struct i8086 *cpu)
+{
+
+	prof->last = cpu->cycles;
+	chain_start(&prof->chain, cpu);
+
+}
+
+
+
+void i8086_profile_stop(struct i8086_profile *prof, struct i8086 *cpu)
+{
+
+	chain_stop(&prof->chain, cpu);
+
+}
+
+
+
+void i8086_profile_reset(struct i8086_profile *prof)
+{
+
+	memset(prof->insns,  0, prof->buckets * sizeof(u64));
+	memset(prof->cycles, 0, prof->buckets * sizeof(u64));
+	memset(prof->where,  0, prof->buckets * sizeof(u32));
+
+}
+
+
+
+struct hotspot {
+	u64 cycles;
+	u32 bucket;
+};
+
+
+
+static int hotter(const void *a, const void *b)
+{
+
+	const u64 x = ((const struct hotspot*)a)->cycles;
+	const u64 y = ((const struct hotspot*)b)->cycles;
+
+	return (x < y) - (x > y);
+
+}
+
+
+
+// The top buckets by cycles, hottest first. Each is shown by the first CS:IP
+// counted in it, the percentages are of all the cycles profiled
+void i8086_profile_report(struct i8086_profile *prof, struct i8086 *cpu, uint top)
+{
+
+	struct hotspot *order = malloc(prof->buckets * sizeof(*order));
+	u32             count = 0;
+
+	u64 insns  = 0;
+	u64 cycles = 0;
+
+	if (order == NULL)
+		return;
+
+	for (u32 n=0; n < prof->buckets; n++) {
+
+		if (prof->insns[n] == 0)
+			continue;
+
+		insns  += prof->insns[n];
+		cycles += prof->cycles[n];
+
+		order[count++] = (struct hotspot){ prof->cycles[n], n };
+
+	}
+
+	qsort(order, count, sizeof(*order), &hotter);
+
+	printf("%llu instructions, %llu cycles in %u buckets of %u bytes\n\n",
+		(unsigned long long)insns, (unsigned long long)cycles, count, 1u << prof->shift);
+
+	printf("  CS:IP        phys       insns     %%       cycles     %%\n");
+
+	for (u32 k=0; k < count && k < top; k++) {
+
+		const u32 n  = order[k].bucket;
+		const u16 cs = prof->where[n] >> 16;
+		const u16 ip = prof->where[n];
+
+		printf("%04x:%04x    %05x  %10llu  %5.2f  %11llu  %5.2f",
+			cs, ip, n << prof->shift,
+			(unsigned long long)prof->insns[n],  100.0 * prof->insns[n]  / insns,
+			(unsigned long long)prof->cycles[n], 100.0 * prof->cycles[n] / cycles);
+
+#ifdef HAVE_ZYDIS
+
+		char text[96];
+
+		disasm(cpu, cs, ip, text);
+		printf("    %s", text);
+
+#else
+
+		(void)cpu;
+
+#endif
+
+		printf("\n");
+
+	}
+
+	printf("\n");
+	free(order);
+
+}
+
+
+
+static void coverage_retire(void *data, struct i8086 *cpu, u16 cs, u16 ip)
+{
+
+	struct i8086_coverage *cov = data;
+
+	// The bytes wrap around the segment, and past 1MB with the A20 gate off,
+	// as the fetch does
+	for (uint n=0; n < cpu->retired.length; n++) {
+
+		const u32 addr = (cs * 16 + (u16)(ip + n)) & cpu->memory.mem.mask;
+
+		cov->bytes[addr / 64] |= 1ull << (addr % 64);
+
+	}
+
+	cov->slots[cpu->retired.slot][cpu->retired.memory]++;
+
+	chain_retire(data, cpu, cs, ip);
+
+}
+
+
+
+bool i8086_coverage_init(struct i8086_coverage *cov)
+{
+
+	memset(cov, 0, sizeof(*cov));
+
+	cov->chain.hooks.data   = cov;
+	cov->chain.hooks.retire = &coverage_retire;
+
+	cov->bytes = calloc(I8086_PAGES * 4096 / 64, sizeof(u64));
+
+	return cov->bytes != NULL;
+
+}
+
+
+
+void i8086_coverage_free(struct i8086_coverage *cov)
+{
+
+	free(cov->bytes);
+	memset(cov, 0, sizeof(*cov));
+
+}
+
+
+
+// Runs in front of any other observers of the CPU until i8086_coverage_stop().
+// Counts add up over any number of runs and CPUs
+void i8086_coverage_start(struct i8086_coverage *cov, struct i8086 *cpu)
+{
+
+	chain_start(&cov->chain, cpu);
+
+}
+
+
+
+void i8086_coverage_stop(struct i8086_coverage *cov, struct i8086 *cpu)
+{
+
+	chain_stop(&cov->chain, cpu);
+
+}
+
+
+
+static inline bool covered(struct i8086_coverage *cov, u32 addr)
+{
+
+	return (cov->bytes[addr / 64] >> (addr % 64)) & 1;
+
+}
+
+
+
+// Plain text, for diffing runs: the physical address ranges that ran, then
+// every opcode table slot with the byte that decodes to it, its handler and
+// the times its register and memory forms ran
+void i8086_coverage_export(struct i8086_coverage *cov, FILE *out)
+{
+
+	const u32 length = I8086_PAGES * 4096;
+
+	u32 bytes = 0;
+	u32 slots = 0;
+
+	for (u32 n=0; n < length / 64; n++)
+		bytes += __builtin_popcountll(cov->bytes[n]);
+
+	for (uint n=0; n < I8086_OPCODES; n++)
+		slots += (cov->slots[n][0] + cov->slots[n][1]) != 0;
+
+	fprintf(out, "# Bytes executed: %u\n", bytes);
+
+	for (u32 addr=0; addr < length;) {
+
+		if (!covered(cov, addr)) {
+			addr++;
+			continue;
+		}
+
+		const u32 first = addr;
+
+		while (addr < length && covered(cov, addr))
+			addr++;
+
+		fprintf(out, "%06x-%06x\n", first, addr - 1);
+
+	}
+
+	fprintf(out, "\n# Opcode slots run: %u of %u\n", slots, I8086_OPCODES);
+	fprintf(out, "# slot  code  handler       register        memory\n");
+
+	for (uint n=0; n < I8086_OPCODES; n++) {
+
+		char        code[8];
+		const char *name = i8086_slot_name(n, code);
+
+		fprintf(out, "%03x     %-5s %-12s %10llu    %10llu\n", n, code, name,
+			(unsigned long long)cov->slots[n][0], (unsigned long long)cov->slots[n][1]);
+
+	}
+
+}
@@ -4,9 +4,65 @@
 #define CPU_I8086_DIAG_H
 
 
+// Hooks a profile or coverage runs as, and those installed before it started.
+// These still see everything, after it, and are put back when it stops; with
+// several started on a CPU, stop them in the reverse order
+struct i8086_chain {
+
+	struct i8086_hooks        hooks;
+	const struct i8086_hooks *next;
+
+};
+
+
+// Instructions and clock cycles counted by physical address, in buckets of
+// 1 << shift bytes over the 2MB address space. It runs as the retire hook, so
+// a CPU that is not being profiled does not pay for it
+struct i8086_profile {
+
+	struct i8086_chain chain;  // First, hooks get the profile as their data
+
+	uint shift;
+	u32  buckets;
+
+	u64 *insns;
+	u64 *cycles;
+	u32 *where;   // CS:IP of the first instruction counted in each bucket
+
+	u64 last;     // CPU cycles when the previous instruction retired
+
+};
+
+
+// Bytes of the instructions that ran, one bit each over the 2MB address space,
+// and the times each opcode table slot ran, register and memory forms apart.
+// Runs as the retire hook like the profiler
+struct i8086_coverage {
+
+	struct i8086_chain chain;  // First, hooks get the coverage as their data
+
+	u64 *bytes;
+	u64  slots[I8086_OPCODES][2];
+
+};
+
+
 void i8086_stack(struct i8086 *cpu);
 void i8086_dump(struct i8086 *cpu);
 
+bool i8086_profile_init(  struct i8086_profile *prof, uint shift);
+void i8086_profile_free(  struct i8086_profile *prof);
+void i8086_profile_start( struct i8086_profile *prof, struct i8086 *cpu);
+void i8086_profile_stop(  struct i8086_profile *prof, struct i8086 *cpu);
+void i8086_profile_reset( struct i8086_profile *prof);
+void i8086_profile_report(struct i8086_profile *prof, struct i8086 *cpu, uint top);
+
+bool i8086_coverage_init(  struct i8086_coverage *cov);
+void i8086_coverage_free(  struct i8086_coverage *cov);
+void i8086_coverage_start( struct i8086_coverage *cov, struct i8086 *cpu);
+void i8086_coverage_stop(  struct i8086_coverage *cov, struct i8086 *cpu);
+void i8086_coverage_export(struct i8086_coverage *cov, FILE *out);
+
 
 #endif
 
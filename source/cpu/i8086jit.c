@@ -0,0 +1,1009 @@
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "core/types.h"
+#include "core/debug.h"
+#include "core/io.h"
+#include "core/memory.h"
+#include "core/wire.h"
+
+#include "cpu/i8087.h"
+#include "cpu/i8086.h"
+#include "cpu/i8086jit.h"
+
+
+#if defined(I8086_JIT) && defined(__x86_64__)
+
+
+enum {
+
+	JIT_CODE   = 4 << 20,  // Code buffer size
+	JIT_BLOCKS = 4096,     // Block table entries, indexed by linear address
+	JIT_INSN   = 128,      // Host bytes reserved per guest instruction
+	JIT_STUB   = 64,       // Host bytes reserved per exit stub
+	JIT_CHECK  = 32        // Host bytes reserved per 8 code bytes validated
+
+};
+
+
+// Host registers. Guest AX, CX, DX, BX, BP, SI and DI live in the host
+// register of the same encoding, so register forms translate verbatim
+enum {
+
+	H_AX = 0, H_CX = 1, H_DX = 2, H_BX = 3,
+	H_SP = 4, H_BP = 5, H_SI = 6, H_DI = 7,
+
+	H_JIT    = 8,   // struct i8086_jit
+	H_CPU    = 9,   // i8086
+	H_TARGET = 10,  // Block entry, only in the trampoline
+	H_LINK   = 11,  // Exit stub to patch, or LINK_NONE/LINK_INVALID
+	H_EA     = 12,  // Physical address of the memory operand
+	H_MEM    = 13,  // Guest memory base
+	H_BUDGET = 14,  // Instructions left
+	H_FLAGS  = 15   // Guest flags, whenever host EFLAGS don't hold them
+
+};
+
+
+enum {
+
+	LINK_NONE    = 0,  // Back to the interpreter
+	LINK_INVALID = 1,  // Code bytes changed, translate the block again
+	LINK_CHAIN   = 2   // Exit can be patched to jump to the next block
+
+};
+
+
+enum {
+
+	JF_NONE  = 0,       // Flags untouched
+	JF_ALL   = 1 << 0,  // Writes all arithmetic flags
+	JF_LOGIC = 1 << 1,  // Writes all arithmetic flags, AF clear
+	JF_CARRY = 1 << 2,  // Reads CF
+	JF_STORE = 1 << 3   // Writes memory
+
+};
+
+
+enum {
+
+	JI_RAW,     // Register or immediate operands, emitted as is
+	JI_MEM,     // Memory operand
+	JI_INCDEC,  // INC/DEC r16, the one byte forms are REX on the host
+	JI_FLAG,    // CLC, STC, CMC
+	JI_JCC,     // Block terminators from here on
+	JI_JMP,
+	JI_LOOP,
+	JI_JCXZ
+
+};
+
+
+typedef u64 jit_enter(struct i8086_jit *jit, i8086 *cpu, void *block, u64 budget);
+
+
+struct jit_block {
+
+	u16 cs, ip;
+	u32 count;  // Executions seen while untranslated
+	u8 *entry;
+
+};
+
+
+struct i8086_jit {
+
+	// Shared with translated code
+	u8  *base;
+	u64  link;
+	u32  flags;
+	u32  mask;
+	u32  length;
+	u32  lin[4];
+
+	// The code buffer is mapped twice, never writable and executable at once.
+	// Translation writes and keeps pointers in code, translated code runs in exec
+	u8   *code;
+	u8   *exec;
+	uint  start;
+	uint  used;
+	uint  flushes;
+
+	uint threshold;
+	uint limit;
+	uint model;  // Of the CPU the blocks were made for, taken branches cost by it
+
+	u8 *enter;
+	u8 *leave;
+
+	struct jit_block blocks[JIT_BLOCKS];
+
+};
+
+
+struct jit_insn {
+
+	const u8 *code;
+
+	u16  ip;
+	u16  target;
+	u8   length;
+	u8   kind;
+	u8   flags;
+	u8   opcode;  // Host opcode
+	u8   modrm;
+	u8   segment;
+	u8   imm;     // Immediate bytes, at the end of the instruction
+	u8   cycles;  // Clock cycles, branch not taken
+	u16  disp;
+	bool w;
+	bool xchg;    // Byte register is AH..BH, swapped into AL..BL around REX forms
+
+};
+
+
+struct jit_stub {
+
+	u8  *jump;  // rel32 that jumps here
+	u16  ip;
+	u8   link;
+	bool afc;
+	uint unused;
+	int  cycles;  // Added to the cycle counter on the way out
+
+};
+
+
+struct jit_emit {
+
+	struct i8086_jit *jit;
+	u8               *p;
+
+	bool ef;     // Host EFLAGS hold the guest flags
+	bool rf;     // H_FLAGS holds the guest flags
+	bool logic;  // Last producer was a logical operation
+	bool afc;    // AF in H_FLAGS still has to be cleared
+
+	struct jit_stub next;
+	struct jit_stub stubs[4 * I8086_JIT_LIMIT + 8];
+	uint            count;
+
+};
+
+
+#define EMIT(e, ...)  emit((e), (const u8[]){ __VA_ARGS__ }, sizeof((const u8[]){ __VA_ARGS__ }))
+
+
+
+static const size_t regs[8] = {
+	offsetof(i8086, regs.ax), offsetof(i8086, regs.cx), offsetof(i8086, regs.dx), offsetof(i8086, regs.bx),
+	offsetof(i8086, regs.sp), offsetof(i8086, regs.bp), offsetof(i8086, regs.si), offsetof(i8086, regs.di)
+};
+
+
+static const u8 alu_flags[8] = {
+	JF_ALL, JF_LOGIC, JF_ALL | JF_CARRY, JF_ALL | JF_CARRY, JF_LOGIC, JF_ALL, JF_LOGIC, JF_ALL
+};
+
+
+
+static inline void emit(struct jit_emit *e, const u8 *bytes, uint n) { memcpy(e->p, bytes, n); e->p += n; }
+static inline void e16(struct jit_emit *e, u16 x) { memcpy(e->p, &x, 2); e->p += 2; }
+static inline void e32(struct jit_emit *e, u32 x) { memcpy(e->p, &x, 4); e->p += 4; }
+static inline void e64(struct jit_emit *e, u64 x) { memcpy(e->p, &x, 8); e->p += 8; }
+
+static inline u8 *jit_jcc(struct jit_emit *e, uint cc) { EMIT(e, 0x0f, cc); e32(e, 0); return e->p - 4; }
+static inline u8 *jit_jmp(struct jit_emit *e)          { EMIT(e, 0xe9);     e32(e, 0); return e->p - 4; }
+
+
+
+static inline u8 *jit_exec( struct i8086_jit *jit, u8 *p) { return jit->exec + (p - jit->code); }
+static inline u8 *jit_write(struct i8086_jit *jit, u8 *p) { return jit->code + (p - jit->exec); }
+
+
+
+static void jit_flush(struct i8086_jit *jit)
+{
+
+	memset(jit->blocks, 0, sizeof(jit->blocks));
+
+	jit->used = jit->start;
+	jit->flushes++;
+
+}
+
+
+
+// Decodes the guest instruction at code, returns false if it is not translated
+static bool jit_decode(const u8 *code, u16 ip, struct jit_insn *in)
+{
+
+	const uint op = code[0];
+
+	bool modrm = false;  // MODRM follows
+	bool regop = false;  // REG of MODRM is a register operand
+	bool store = false;  // Memory operand is written
+
+	*in = (struct jit_insn){ .code = code, .ip = ip, .opcode = op, .segment = REG_DS };
+
+	if (op < 0x40 && (op & 7) < 6) { // ALU
+
+		in->flags = alu_flags[(op >> 3) & 7];
+		in->w     = op & 1;
+
+		if ((op & 7) >= 4) {
+			in->kind = JI_RAW;
+			in->imm  = (in->w)? 2: 1;
+		} else {
+			modrm = regop = true;
+			store = !(op & 2) && (op & 0x38) != 0x38;
+		}
+
+	} else if (op >= 0x40 && op < 0x50) { // INC/DEC r16
+
+		if ((op & 7) == H_SP)
+			return false;
+
+		in->kind  = JI_INCDEC;
+		in->flags = JF_ALL | JF_CARRY;
+
+	} else if (op >= 0x70 && op < 0x80) {
+
+		in->kind = JI_JCC;
+		in->imm  = 1;
+
+	} else if (op >= 0x80 && op < 0x84) { // ALU r/m, imm
+
+		const uint alu = (code[1] >> 3) & 7;
+
+		modrm     = true;
+		store     = alu != 7;
+		in->flags = alu_flags[alu];
+		in->w     = op & 1;
+		in->imm   = (op == 0x81)? 2: 1;
+
+		if (op == 0x82)
+			in->opcode = 0x80;
+
+	} else if (op == 0x84 || op == 0x85) { // TEST r/m, r
+
+		modrm = regop = true;
+		in->flags = JF_LOGIC;
+		in->w     = op & 1;
+
+	} else if (op >= 0x88 && op < 0x8c) { // MOV r/m, r and r, r/m
+
+		modrm = regop = true;
+		store = !(op & 2);
+		in->w = op & 1;
+
+	} else if (op >= 0x90 && op < 0x98) { // NOP, XCHG AX, r16
+
+		if (op == 0x90 + H_SP)
+			return false;
+
+		in->kind = JI_RAW;
+		in->w    = op != 0x90;
+
+	} else if (op == 0xa8 || op == 0xa9) { // TEST AL/AX, imm
+
+		in->kind  = JI_RAW;
+		in->flags = JF_LOGIC;
+		in->w     = op & 1;
+		in->imm   = (in->w)? 2: 1;
+
+	} else if (op >= 0xb0 && op < 0xc0) { // MOV r, imm
+
+		if (op == 0xb8 + H_SP)
+			return false;
+
+		in->kind = JI_RAW;
+		in->w    = op >= 0xb8;
+		in->imm  = (in->w)? 2: 1;
+
+	} else if ((op == 0xc6 || op == 0xc7) && (code[1] & 0x38) == 0) { // MOV r/m, imm
+
+		modrm   = true;
+		store   = true;
+		in->w   = op & 1;
+		in->imm = (in->w)? 2: 1;
+
+	} else if (op == 0xe2 || op == 0xe3 || op == 0xeb) { // LOOP, JCXZ, JMP rel8
+
+		in->kind = (op == 0xe2)? JI_LOOP: (op == 0xe3)? JI_JCXZ: JI_JMP;
+		in->imm  = 1;
+
+	} else if (op == 0xe9) { // JMP rel16
+
+		in->kind = JI_JMP;
+		in->imm  = 2;
+
+	} else if (op == 0xf5 || op == 0xf8 || op == 0xf9) {
+
+		in->kind = JI_FLAG;
+
+	} else if ((op == 0xfe || op == 0xff) && (code[1] & 0x30) == 0) { // INC/DEC r/m
+
+		modrm     = true;
+		store     = true;
+		in->flags = JF_ALL | JF_CARRY;
+		in->w     = op & 1;
+
+	} else
+		return false;
+
+
+	uint length = 1;
+
+	if (modrm) {
+
+		const uint mod = code[1] >> 6;
+		const uint reg = (code[1] >> 3) & 7;
+		const uint rm  = (code[1] >> 0) & 7;
+
+		in->modrm = code[1];
+		length++;
+
+		if (mod == 3) {
+
+			if (in->w && (rm == H_SP || (regop && reg == H_SP)))
+				return false;
+
+			in->kind = JI_RAW;
+
+		} else {
+
+			if (in->w && regop && reg == H_SP)
+				return false;
+
+			in->kind = JI_MEM;
+			in->xchg = !in->w && regop && reg >= 4;
+
+			// A word at offset FFFF wraps around the segment, left to the interpreter
+			if (mod == 0 && rm == 6 && in->w && code[2] == 0xff && code[3] == 0xff)
+				return false;
+
+			if (mod == 0 && rm == 6) { in->disp = code[2] | code[3] << 8; length += 2; }
+			else if (mod == 1)       { in->disp = (i8)code[2];            length += 1; }
+			else if (mod == 2)       { in->disp = code[2] | code[3] << 8; length += 2; }
+
+			if (rm == 2 || rm == 3 || (rm == 6 && mod != 0))
+				in->segment = REG_SS;
+
+			if (store)
+				in->flags |= JF_STORE;
+
+		}
+
+	}
+
+	in->length = length + in->imm;
+
+	if (op == 0xe9)
+		in->target = ip + in->length + (code[1] | code[2] << 8);
+
+	else if (in->kind >= JI_JCC)
+		in->target = ip + in->length + (i8)code[1];
+
+	return true;
+
+}
+
+
+
+// Saves the guest flags to H_FLAGS before host flags get clobbered
+static void jit_spill(struct jit_emit *e)
+{
+
+	if (!e->rf) {
+
+		EMIT(e, 0x9c, 0x41, 0x5f);  // pushfq; pop r15
+
+		e->rf  = true;
+		e->afc = e->logic;
+
+	}
+
+}
+
+
+
+static void jit_clobber(struct jit_emit *e)
+{
+
+	jit_spill(e);
+	e->ef = false;
+
+}
+
+
+
+static void jit_carry(struct jit_emit *e)
+{
+
+	if (!e->ef)
+		EMIT(e, 0x41, 0x0f, 0xba, 0xe7, 0x00);  // bt r15d, 0
+
+}
+
+
+
+static void jit_produce(struct jit_emit *e, uint flags)
+{
+
+	if (flags & (JF_ALL | JF_LOGIC)) {
+
+		e->ef    = true;
+		e->rf    = false;
+		e->logic = (flags & JF_LOGIC) != 0;
+
+	}
+
+}
+
+
+
+static void jit_stub(struct jit_emit *e, u8 *jump, u16 ip, uint link, uint unused, int cycles)
+{
+
+	const struct jit_stub stub = { .jump = jump, .ip = ip, .link = link, .afc = e->afc, .unused = unused, .cycles = cycles };
+
+	if (jump == NULL) e->next = stub;
+	else              e->stubs[e->count++] = stub;
+
+}
+
+
+
+static void jit_emit_stub(struct jit_emit *e, const struct jit_stub *s)
+{
+
+	if (s->jump != NULL) {
+		const i32 rel = e->p - (s->jump + 4);
+		memcpy(s->jump, &rel, 4);
+	}
+
+	if (s->afc)
+		EMIT(e, 0x41, 0x83, 0xe7, 0xef);  // and r15d, ~0x10
+
+	if (s->unused > 0) {
+		EMIT(e, 0x4d, 0x8d, 0xb6);  // lea r14, [r14 + unused]
+		e32(e, s->unused);
+	}
+
+	if (s->cycles != 0) {
+		EMIT(e, 0x49, 0x81, 0x81);  // add qword [r9 + cycles], imm32
+		e32(e, offsetof(i8086, cycles));
+		e32(e, s->cycles);
+	}
+
+	EMIT(e, 0x66, 0x41, 0xc7, 0x81);  // mov word [r9 + ip], imm16
+	e32(e, offsetof(i8086, regs.ip));
+	e16(e, s->ip);
+
+	switch (s->link) {
+		case LINK_NONE:    EMIT(e, 0x45, 0x31, 0xdb);                   break;  // xor r11d, r11d
+		case LINK_INVALID: EMIT(e, 0x41, 0xbb, 0x01, 0x00, 0x00, 0x00); break;  // mov r11d, 1
+		case LINK_CHAIN:   EMIT(e, 0x4c, 0x8d, 0x1d, 0x00, 0x00, 0x00, 0x00); break;  // lea r11, [rip]
+	}
+
+	EMIT(e, 0xe9);  // jmp leave
+	e32(e, e->jit->leave - (e->p + 4));
+
+}
+
+
+
+// Leaves the physical address of the memory operand in H_EA, the same way
+// memlock() computes it. Operands that wrap around the segment or run past
+// the end of memory exit to the interpreter before the instruction, with
+// unused instructions and cycles left
+static void jit_ea(struct jit_emit *e, const struct jit_insn *in, uint unused, uint cycles)
+{
+
+	static const u8 base[8]  = { H_BX, H_BX, H_BP, H_BP, H_SI, H_DI, H_BP, H_BX };
+	static const u8 index[8] = { H_SI, H_DI, H_SI, H_DI, H_SP, H_SP, H_SP, H_SP };
+
+	const uint mod = in->modrm >> 6;
+	const uint rm  = in->modrm & 7;
+
+	jit_clobber(e);
+
+	if (mod == 0 && rm == 6) {
+
+		EMIT(e, 0x41, 0xbc);  // mov r12d, disp
+		e32(e, in->disp);
+
+	} else {
+
+		EMIT(e, 0x44, 0x8d, 0xa4, index[rm] << 3 | base[rm]);  // lea r12d, [base + index + disp]
+		e32(e, in->disp);
+
+		EMIT(e, 0x45, 0x0f, 0xb7, 0xe4);  // movzx r12d, r12w
+
+		if (in->w) {
+
+			EMIT(e, 0x41, 0x81, 0xfc);  // cmp r12d, 0xffff
+			e32(e, 0xffff);
+
+			jit_stub(e, jit_jcc(e, 0x84), in->ip, LINK_NONE, unused, -(int)cycles);
+
+		}
+
+	}
+
+	EMIT(e, 0x45, 0x03, 0xa0);  // add r12d, [r8 + lin]
+	e32(e, offsetof(struct i8086_jit, lin) + 4 * in->segment);
+
+	EMIT(e, 0x45, 0x23, 0xa0);  // and r12d, [r8 + mask]
+	e32(e, offsetof(struct i8086_jit, mask));
+
+	EMIT(e, 0x45, 0x8d, 0x5c, 0x24, in->w);  // lea r11d, [r12 + w]
+
+	EMIT(e, 0x45, 0x3b, 0x98);  // cmp r11d, [r8 + length]
+	e32(e, offsetof(struct i8086_jit, length));
+
+	jit_stub(e, jit_jcc(e, 0x83), in->ip, LINK_NONE, unused, -(int)cycles);
+
+}
+
+
+
+static void jit_mem(struct jit_emit *e, const struct jit_insn *in, u32 lo, u32 span, uint unused, uint cycles)
+{
+
+	const uint reg  = (in->modrm >> 3) & 7;
+	const uint xchg = 0xc0 | reg << 3 | (reg - 4);  // xchg lo, hi
+
+	jit_ea(e, in, unused + 1, cycles + in->cycles);
+
+	if (in->flags & JF_CARRY)
+		jit_carry(e);
+
+	if (in->xchg)
+		EMIT(e, 0x86, xchg);
+
+	if (in->w)
+		EMIT(e, 0x66);
+
+	// op [r13 + r12], REX keeps AL..BL but turns AH..BH into SPL..DIL
+	EMIT(e, 0x43, in->opcode, 0x44 | ((in->xchg)? reg - 4: reg) << 3, 0x25, 0x00);
+	emit(e, in->code + in->length - in->imm, in->imm);
+
+	if (in->xchg)
+		EMIT(e, 0x86, xchg);
+
+	jit_produce(e, in->flags);
+
+	if (in->flags & JF_STORE) { // Writing its own code ends the block
+
+		jit_clobber(e);
+
+		EMIT(e, 0x45, 0x8d, 0x9c, 0x24);  // lea r11d, [r12 - lo]
+		e32(e, -lo);
+
+		EMIT(e, 0x41, 0x81, 0xfb);  // cmp r11d, span
+		e32(e, span);
+
+		jit_stub(e, jit_jcc(e, 0x82), in->ip + in->length, LINK_NONE, unused, -(int)cycles);
+
+	}
+
+}
+
+
+
+static u8 *jit_translate(i8086 *cpu, struct i8086_jit *jit, u16 cs, u16 ip)
+{
+
+	struct jit_insn insns[I8086_JIT_LIMIT];
+
+	const u32 lin  = cs * 16 + ip;
+	const u32 phys = lin & jit->mask;
+	const u8 *code = jit->base + phys;
+
+	uint count  = 0;
+	uint length = 0;
+	bool end    = false;
+
+	const uint branch = i8086_branch(cpu);
+
+	if (lin != phys)
+		return NULL;
+
+	while (count < jit->limit) {
+
+		const u16 at = ip + length;
+
+		if (at > 0xfff0 || phys + length + 16 > cpu->memory.mem.length)
+			break;
+
+		if (!jit_decode(code + length, at, &insns[count]))
+			break;
+
+		insns[count].cycles = i8086_cycles(cpu, at);
+
+		length += insns[count].length;
+
+		if (insns[count++].kind >= JI_JCC) {
+			end = true;
+			break;
+		}
+
+	}
+
+	if (count == 0)
+		return NULL;
+
+	uint tail[I8086_JIT_LIMIT];  // Cycles of the instructions after each one
+	uint total = 0;
+
+	for (uint n=count; n-- > 0;) {
+		tail[n] = total;
+		total  += insns[n].cycles;
+	}
+
+	const uint check = (length < 8)? 8: length;
+	const uint need  = count * JIT_INSN + (3 * count + 4) * JIT_STUB + (check / 8 + 1) * JIT_CHECK;
+
+	if (jit->used + need > JIT_CODE)
+		jit_flush(jit);
+
+
+	struct jit_emit e = { .jit = jit, .p = jit->code + jit->used, .rf = true };
+	u8             *entry = e.p;
+
+	EMIT(&e, 0x49, 0x81, 0xfe);  // cmp r14, count
+	e32(&e, count);
+	jit_stub(&e, jit_jcc(&e, 0x82), ip, LINK_NONE, 0, 0);
+
+	// Validate against the code bytes, like the decoded instruction cache
+	for (uint n=0; n < check; n += 8) {
+
+		const uint at = (n + 8 > check)? check - 8: n;
+		u64 bytes;
+
+		memcpy(&bytes, code + at, 8);
+
+		EMIT(&e, 0x49, 0xbb);  // mov r11, bytes
+		e64(&e, bytes);
+
+		EMIT(&e, 0x4d, 0x3b, 0x9d);  // cmp r11, [r13 + phys]
+		e32(&e, phys + at);
+
+		jit_stub(&e, jit_jcc(&e, 0x85), ip, LINK_INVALID, 0, 0);
+
+	}
+
+	EMIT(&e, 0x49, 0x81, 0xee);  // sub r14, count
+	e32(&e, count);
+
+	EMIT(&e, 0x49, 0x81, 0x81);  // add qword [r9 + cycles], total
+	e32(&e, offsetof(i8086, cycles));
+	e32(&e, total);
+
+
+	for (uint n=0; n < count; n++) {
+
+		const auto in   = &insns[n];
+		const u16  next = in->ip + in->length;
+
+		switch (in->kind) {
+
+			case JI_RAW:
+				if (in->flags & JF_CARRY)
+					jit_carry(&e);
+
+				if (in->w)
+					EMIT(&e, 0x66);
+
+				EMIT(&e, in->opcode);
+				emit(&e, in->code + 1, in->length - 1);
+
+				jit_produce(&e, in->flags);
+				break;
+
+			case JI_MEM:
+				jit_mem(&e, in, phys - 1, length + 1, count - n - 1, tail[n]);
+				break;
+
+			case JI_INCDEC:
+				jit_carry(&e);
+				EMIT(&e, 0x66, 0xff, ((in->opcode < 0x48)? 0xc0: 0xc8) | (in->opcode & 7));
+				jit_produce(&e, in->flags);
+				break;
+
+			case JI_FLAG:
+				jit_clobber(&e);
+
+				if      (in->opcode == 0xf8) EMIT(&e, 0x41, 0x83, 0xe7, 0xfe);  // and r15d, ~1
+				else if (in->opcode == 0xf9) EMIT(&e, 0x41, 0x83, 0xcf, 0x01);  // or  r15d, 1
+				else                         EMIT(&e, 0x41, 0x83, 0xf7, 0x01);  // xor r15d, 1
+				break;
+
+			case JI_JCC:
+				jit_spill(&e);
+
+				if (!e.ef) {
+					EMIT(&e, 0x41, 0x57, 0x9d);  // push r15; popfq
+					e.ef = true;
+				}
+
+				jit_stub(&e, jit_jcc(&e, 0x80 | (in->opcode & 15)), in->target, LINK_CHAIN, 0, branch);
+				jit_stub(&e, NULL, next, LINK_CHAIN, 0, 0);
+				break;
+
+			case JI_JMP:
+				jit_spill(&e);
+				jit_stub(&e, NULL, in->target, LINK_CHAIN, 0, 0);
+				break;
+
+			case JI_LOOP:
+				jit_spill(&e);
+
+				EMIT(&e, 0x8d, 0x49, 0xff);  // lea ecx, [rcx - 1]
+				EMIT(&e, 0x0f, 0xb7, 0xc9);  // movzx ecx, cx
+				EMIT(&e, 0xe3, 0x05);        // jrcxz over the jump
+
+				jit_stub(&e, jit_jmp(&e), in->target, LINK_CHAIN, 0, branch);
+				jit_stub(&e, NULL, next, LINK_CHAIN, 0, 0);
+				break;
+
+			case JI_JCXZ:
+				jit_spill(&e);
+
+				EMIT(&e, 0xe3, 0x05);  // jrcxz over the jump
+
+				jit_stub(&e, jit_jmp(&e), next, LINK_CHAIN, 0, 0);
+				jit_stub(&e, NULL, in->target, LINK_CHAIN, 0, branch);
+				break;
+
+		}
+
+	}
+
+	if (!end) { // Stopped at the limit, or at an instruction left to the interpreter
+
+		jit_spill(&e);
+		jit_stub(&e, NULL, ip + length, (count == jit->limit)? LINK_CHAIN: LINK_NONE, 0, 0);
+
+	}
+
+	jit_emit_stub(&e, &e.next);
+
+	for (uint n=0; n < e.count; n++)
+		jit_emit_stub(&e, &e.stubs[n]);
+
+	jit->used = e.p - jit->code;
+	return entry;
+
+}
+
+
+
+static void jit_trampolines(struct i8086_jit *jit)
+{
+
+	struct jit_emit e = { .jit = jit, .p = jit->code };
+
+	// enter(jit, cpu, block, budget)
+	jit->enter = e.p;
+
+	EMIT(&e, 0x53, 0x55, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57);  // push rbx, rbp, r12-r15
+
+	EMIT(&e, 0x49, 0x89, 0xf8);  // mov r8,  rdi
+	EMIT(&e, 0x49, 0x89, 0xf1);  // mov r9,  rsi
+	EMIT(&e, 0x49, 0x89, 0xd2);  // mov r10, rdx
+	EMIT(&e, 0x49, 0x89, 0xce);  // mov r14, rcx
+
+	EMIT(&e, 0x4d, 0x8b, 0xa8);  // mov r13, [r8 + base]
+	e32(&e, offsetof(struct i8086_jit, base));
+
+	EMIT(&e, 0x45, 0x8b, 0xb8);  // mov r15d, [r8 + flags]
+	e32(&e, offsetof(struct i8086_jit, flags));
+
+	for (uint r=0; r < 8; r++)
+		if (r != H_SP) {
+			EMIT(&e, 0x41, 0x0f, 0xb7, 0x81 | r << 3);  // movzx r32, word [r9 + reg]
+			e32(&e, regs[r]);
+		}
+
+	EMIT(&e, 0x41, 0xff, 0xe2);  // jmp r10
+
+
+	// Common exit, returns the budget left
+	jit->leave = e.p;
+
+	EMIT(&e, 0x4d, 0x89, 0x98);  // mov [r8 + link], r11
+	e32(&e, offsetof(struct i8086_jit, link));
+
+	EMIT(&e, 0x45, 0x89, 0xb8);  // mov [r8 + flags], r15d
+	e32(&e, offsetof(struct i8086_jit, flags));
+
+	for (uint r=0; r < 8; r++)
+		if (r != H_SP) {
+			EMIT(&e, 0x66, 0x41, 0x89, 0x81 | r << 3);  // mov [r9 + reg], r16
+			e32(&e, regs[r]);
+		}
+
+	EMIT(&e, 0x4c, 0x89, 0xf0);  // mov rax, r14
+
+	EMIT(&e, 0x41, 0x5f, 0x41, 0x5e, 0x41, 0x5d, 0x41, 0x5c, 0x5d, 0x5b, 0xc3);  // pop r15-r12, rbp, rbx; ret
+
+	jit->start = e.p - jit->code;
+
+}
+
+
+
+bool i8086_jit_init(i8086 *cpu, uint threshold, uint limit)
+{
+
+	struct i8086_jit *jit = calloc(1, sizeof(struct i8086_jit));
+
+	if (jit == NULL)
+		return false;
+
+	const int fd = memfd_create("rvx86-jit", 0);
+
+	if (fd < 0 || ftruncate(fd, JIT_CODE) != 0) {
+		if (fd >= 0) close(fd);
+		free(jit);
+		return false;
+	}
+
+	jit->code = mmap(NULL, JIT_CODE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	jit->exec = mmap(NULL, JIT_CODE, PROT_READ | PROT_EXEC,  MAP_SHARED, fd, 0);
+
+	close(fd);
+
+	if (jit->code == MAP_FAILED || jit->exec == MAP_FAILED) {
+		if (jit->code != MAP_FAILED) munmap(jit->code, JIT_CODE);
+		if (jit->exec != MAP_FAILED) munmap(jit->exec, JIT_CODE);
+		free(jit);
+		return false;
+	}
+
+	jit->threshold = threshold;
+	jit->limit     = (limit < 1)? 1: (limit > I8086_JIT_LIMIT)? I8086_JIT_LIMIT: limit;
+
+	jit_trampolines(jit);
+	jit_flush(jit);
+
+	cpu->jit = jit;
+	return true;
+
+}
+
+
+
+void i8086_jit_free(i8086 *cpu)
+{
+
+	if (cpu->jit == NULL)
+		return;
+
+	munmap(cpu->jit->code, JIT_CODE);
+	munmap(cpu->jit->exec, JIT_CODE);
+	free(cpu->jit);
+
+	cpu->jit = NULL;
+
+}
+
+
+
+// Translated block at CS:IP, or NULL if it is not hot yet or can't be translated
+void *i8086_jit_lookup(i8086 *cpu)
+{
+
+	auto jit = cpu->jit;
+
+	if (jit->base != cpu->memory.mem.base || jit->mask != cpu->memory.mem.mask || jit->length != cpu->memory.mem.length || jit->model != cpu->model) {
+
+		jit_flush(jit);
+
+		jit->base   = cpu->memory.mem.base;
+		jit->mask   = cpu->memory.mem.mask;
+		jit->length = cpu->memory.mem.length;
+		jit->model  = cpu->model;
+
+	}
+
+	const u16 cs = cpu->memory.selector[REG_CS];
+	const u16 ip = cpu->regs.ip;
+	auto      b  = &jit->blocks[(cs * 16 + ip) % JIT_BLOCKS];
+
+	if (b->cs != cs || b->ip != ip)
+		*b = (struct jit_block){ .cs = cs, .ip = ip };
+
+	if (b->entry != NULL)
+		return b->entry;
+
+	if (b->count < jit->threshold) {
+		b->count++;
+		return NULL;
+	}
+
+	const uint flushes = jit->flushes;
+	u8        *entry   = jit_translate(cpu, jit, cs, ip);
+
+	if (jit->flushes != flushes) // The table was cleared to make room
+		b = &jit->blocks[(cs * 16 + ip) % JIT_BLOCKS];
+
+	*b = (struct jit_block){ .cs = cs, .ip = ip, .entry = entry };
+	return entry;
+
+}
+
+
+
+// Runs translated code from block on, chaining exits to the blocks they lead
+// to, and returns the budget left
+uint i8086_jit_run(i8086 *cpu, void *block, uint budget, uint *flags)
+{
+
+	auto jit   = cpu->jit;
+	auto enter = (jit_enter*)jit_exec(jit, jit->enter);
+
+	jit->flags = *flags & 0x08d5;
+
+	for (int n=0; n < 4; n++)
+		jit->lin[n] = cpu->memory.selector[n] * 16;
+
+	while (block != NULL) {
+
+		const uint flushes = jit->flushes;
+
+		budget = enter(jit, cpu, jit_exec(jit, block), budget);
+
+		u8 *link = (u8*)jit->link;
+
+		if (jit->link == LINK_INVALID) {
+
+			const u16 cs = cpu->memory.selector[REG_CS];
+			const u16 ip = cpu->regs.ip;
+
+			jit->blocks[(cs * 16 + ip) % JIT_BLOCKS] = (struct jit_block){ .cs = cs, .ip = ip };
+
+		} else if (jit->link == LINK_NONE || budget == 0)
+			break;
+
+		block = i8086_jit_lookup(cpu);
+
+		// Patched through the writable mapping, link is where the code ran
+		if (block != NULL && jit->link > LINK_INVALID && jit->flushes == flushes) {
+
+			const auto jump = jit_write(jit, link);
+			const i32  rel  = (u8*)block - (jump + 5);
+
+			memcpy(jump + 1, &rel, 4);
+
+		}
+
+	}
+
+	*flags = (*flags & ~0x08d5) | (jit->flags & 0x08d5);
+	return budget;
+
+}
+
+
+#else
+
+
+bool i8086_jit_init(i8086 *cpu, uint threshold, uint limit) { return false; }
+void i8086_jit_free(i8086 *cpu) {}
+
+void *i8086_jit_lookup(i8086 *cpu) { return NULL; }
+uint  i8086_jit_run(i8086 *cpu, void *block, uint budget, uint *flags) { return budget; }
+
+
+#endif
+
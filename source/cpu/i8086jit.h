@@ -0,0 +1,21 @@
+#ifndef CPU_I8086JIT_H
+#define CPU_I8086JIT_H
+
+
+enum {
+	I8086_JIT_THRESHOLD = 32,  // Executions of a block head before it is translated
+	I8086_JIT_LIMIT     = 64   // Most guest instructions in a block
+};
+
+
+struct i8086_jit;
+
+
+bool  i8086_jit_init(i8086 *cpu, uint threshold, uint limit);
+void  i8086_jit_free(i8086 *cpu);
+void *i8086_jit_lookup(i8086 *cpu);
+uint  i8086_jit_run(i8086 *cpu, void *block, uint budget, uint *flags);
+
+
+#endif
+
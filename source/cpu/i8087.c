@@ -0,0 +1,896 @@
+
+
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <float.h>
+#include <math.h>
+#include <fenv.h>
+
+#include "core/types.h"
+#include "core/debug.h"
+
+#include "cpu/i8087.h"
+
+#include "util/bcd.h"
+
+
+enum {
+
+	SW_IE  = 1 << 0,   // Invalid operation
+	SW_DE  = 1 << 1,   // Denormal operand
+	SW_ZE  = 1 << 2,   // Zero divide
+	SW_OE  = 1 << 3,   // Overflow
+	SW_UE  = 1 << 4,   // Underflow
+	SW_PE  = 1 << 5,   // Precision
+	SW_IR  = 1 << 7,   // Unmasked exception pending
+	SW_C0  = 1 << 8,
+	SW_C1  = 1 << 9,
+	SW_C2  = 1 << 10,
+	SW_TOP = 7 << 11,
+	SW_C3  = 1 << 14,
+	SW_B   = 1 << 15,
+
+	SW_CC  = SW_C0 | SW_C1 | SW_C2 | SW_C3,
+
+	CW_EM  = 0x3f,     // Exception masks, as the status flags
+	CW_IEM = 1 << 7,   // Interrupts disabled, FDISI
+	CW_PC  = 3 << 8,   // Precision control, 3 is the full 64 bits
+	CW_RC  = 3 << 10   // Rounding control
+
+};
+
+
+// Value classes, as FXAM reports them in C3, C2 and C0
+enum {
+	CLASS_NAN      = SW_C0,
+	CLASS_NORMAL   = SW_C2,
+	CLASS_INF      = SW_C2 | SW_C0,
+	CLASS_ZERO     = SW_C3,
+	CLASS_EMPTY    = SW_C3 | SW_C0,
+	CLASS_DENORMAL = SW_C3 | SW_C2
+};
+
+
+enum {
+	L = I8087_LOAD,
+	S = I8087_STORE
+};
+
+
+// Memory operand of each ESC opcode by REG field of ModRM, bytes and direction
+static const u16 operands[8][8] = {
+	{ L|4,  L|4,  L|4,  L|4,  L|4,  L|4,  L|4,  L|4  },  // D8: arithmetic, m32 real
+	{ L|4,  0,    S|4,  S|4,  L|14, L|2,  S|14, S|2  },  // D9: FLD FST FSTP m32 real, FLDENV FLDCW FSTENV FSTCW
+	{ L|4,  L|4,  L|4,  L|4,  L|4,  L|4,  L|4,  L|4  },  // DA: arithmetic, m32 int
+	{ L|4,  0,    S|4,  S|4,  0,    L|10, 0,    S|10 },  // DB: FILD FIST FISTP m32 int, FLD FSTP m80 real
+	{ L|8,  L|8,  L|8,  L|8,  L|8,  L|8,  L|8,  L|8  },  // DC: arithmetic, m64 real
+	{ L|8,  0,    S|8,  S|8,  L|94, 0,    S|94, S|2  },  // DD: FLD FST FSTP m64 real, FRSTOR FSAVE FSTSW
+	{ L|2,  L|2,  L|2,  L|2,  L|2,  L|2,  L|2,  L|2  },  // DE: arithmetic, m16 int
+	{ L|2,  0,    S|2,  S|2,  L|10, L|8,  S|10, S|8  }   // DF: FILD FIST FISTP m16 int, FBLD, FILD m64, FBSTP, FISTP m64
+};
+
+
+static const f80 CONST_L2T = 3.32192809488736234787031942948939017586L;
+static const f80 CONST_L2E = 1.44269504088896340735992468100189213743L;
+static const f80 CONST_PI  = 3.14159265358979323846264338327950288420L;
+static const f80 CONST_LG2 = 0.301029995663981195213738894724493026768L;
+static const f80 CONST_LN2 = 0.693147180559945309417232121458176568076L;
+
+
+
+// Extended real as the 8087 stores it: 64-bit significand with the integer bit,
+// then sign and biased exponent. It is the host format on x86
+static void store80(f80 x, u8 *p)
+{
+
+#if LDBL_MANT_DIG == 64
+
+	memcpy(p, &x, 10);
+
+#else
+
+	const bool neg = signbit(x);
+	u64        sig = 0;
+	int        exp = 0;
+
+	if (isnan(x)) {
+		sig = 3ull << 62;
+		exp = 0x7fff;
+
+	} else if (isinf(x)) {
+		sig = 1ull << 63;
+		exp = 0x7fff;
+
+	} else if (x != 0) {
+
+		const f80 m = frexpl(fabsl(x), &exp);
+
+		exp += 16382;
+
+		if (exp >= 0x7fff) { sig = 1ull << 63;                       exp = 0x7fff; }
+		else if (exp <= 0) { sig = ldexpl(fabsl(x), 16382 + 63 - 1); exp = 0;      }
+		else                 sig = ldexpl(m, 64);
+
+	}
+
+	memcpy(p, &sig, 8);
+	p[8] = exp;
+	p[9] = exp >> 8 | neg << 7;
+
+#endif
+
+}
+
+
+
+static f80 load80(const u8 *p)
+{
+
+#if LDBL_MANT_DIG == 64
+
+	f80 x = 0;
+	memcpy(&x, p, 10);
+	return x;
+
+#else
+
+	u64 sig;
+	memcpy(&sig, p, 8);
+
+	const int exp = (p[8] | p[9] << 8) & 0x7fff;
+	const f80 x   = (exp == 0x7fff)? ((sig << 1)? NAN: INFINITY): ldexpl(sig, ((exp)? exp: 1) - 16383 - 63);
+
+	return (p[9] & 0x80)? -x: x;
+
+#endif
+
+}
+
+
+
+static uint classify(f80 x)
+{
+
+	switch (fpclassify(x)) {
+		case FP_NAN:       return CLASS_NAN;
+		case FP_INFINITE:  return CLASS_INF;
+		case FP_ZERO:      return CLASS_ZERO;
+		case FP_SUBNORMAL: return CLASS_DENORMAL;
+		default:           return CLASS_NORMAL;
+	}
+
+}
+
+
+
+static bool negative(f80 x)
+{
+
+	return signbit(x);
+
+}
+
+
+
+// Default NaN of masked invalid operations
+static f80 indefinite(void)
+{
+
+	static const u8 b[10] = { 0, 0, 0, 0, 0, 0, 0, 0xc0, 0xff, 0xff };
+	return load80(b);
+
+}
+
+
+
+#define FPU  struct i8087 *fpu
+
+#define ST(i)  (fpu->st[(fpu->top + (i)) & 7])
+
+
+// Exceptions always get the masked response. Unmasked ones are only flagged
+static void except(FPU, uint e)
+{
+
+	fpu->status |= e;
+
+	if (e & ~fpu->control & CW_EM)
+		fpu->status |= SW_IR | SW_B;
+
+}
+
+
+static bool empty(FPU, uint i) { return (fpu->empty >> ((fpu->top + i) & 7)) & 1; }
+
+
+// Reading an empty register is a stack underflow, and reads the indefinite
+static f80 get(FPU, uint i)
+{
+
+	if (empty(fpu, i)) {
+		except(fpu, SW_IE);
+		return indefinite();
+	}
+
+	return ST(i);
+
+}
+
+
+static void set(FPU, uint i, f80 x)
+{
+
+	ST(i) = x;
+	fpu->empty &= ~(1 << ((fpu->top + i) & 7));
+
+}
+
+
+// Pushing over a register in use is a stack overflow, and pushes the indefinite
+static void push(FPU, f80 x)
+{
+
+	fpu->top = (fpu->top - 1) & 7;
+
+	if (!empty(fpu, 0)) {
+		except(fpu, SW_IE);
+		x = indefinite();
+	}
+
+	set(fpu, 0, x);
+
+}
+
+
+static void pop(FPU)
+{
+
+	fpu->empty |= 1 << fpu->top;
+	fpu->top    = (fpu->top + 1) & 7;
+
+}
+
+
+
+static u16 status(FPU) { return (fpu->status & ~SW_TOP) | fpu->top << 11; }
+
+
+static u16 tags(FPU)
+{
+
+	uint tag = 0;
+
+	for (int r=0; r < 8; r++) {
+
+		const uint c = classify(fpu->st[r]);
+		const uint t = ((fpu->empty >> r) & 1)? 3: (c == CLASS_NORMAL)? 0: (c == CLASS_ZERO)? 1: 2;
+
+		tag |= t << (2 * r);
+
+	}
+
+	return tag;
+
+}
+
+
+
+static u16  ld16(const u8 *p)      { u16 x; memcpy(&x, p, 2); return x; }
+static void st16(u8 *p, u16 x)     { memcpy(p, &x, 2); }
+
+
+// Environment as FSTENV stores it, 7 words
+static void stenv(FPU, u8 *p)
+{
+
+	st16(p +  0, fpu->control);
+	st16(p +  2, status(fpu));
+	st16(p +  4, tags(fpu));
+	st16(p +  6, fpu->ip);
+	st16(p +  8, (fpu->ip >> 16) << 12 | (fpu->opcode & 0x7ff));
+	st16(p + 10, fpu->dp);
+	st16(p + 12, (fpu->dp >> 16) << 12);
+
+}
+
+
+static void ldenv(FPU, const u8 *p)
+{
+
+	const uint tag = ld16(p + 4);
+
+	fpu->control = ld16(p + 0);
+	fpu->status  = ld16(p + 2) & ~SW_TOP;
+	fpu->top     = (ld16(p + 2) >> 11) & 7;
+	fpu->ip      = ld16(p + 6) | (ld16(p +  8) >> 12) << 16;
+	fpu->opcode  = ld16(p + 8) & 0x7ff;
+	fpu->dp      = ld16(p + 10) | (ld16(p + 12) >> 12) << 16;
+	fpu->empty   = 0;
+
+	for (int r=0; r < 8; r++)
+		if (((tag >> (2 * r)) & 3) == 3)
+			fpu->empty |= 1 << r;
+
+}
+
+
+
+// Rounds to an integer as the rounding control says
+static f80 rounded(FPU, f80 x)
+{
+
+	switch (fpu->control & CW_RC) {
+		case 0 << 10: return nearbyintl(x);
+		case 1 << 10: return floorl(x);
+		case 2 << 10: return ceill(x);
+		default:      return truncl(x);
+	}
+
+}
+
+
+
+// Integer of bits size for FIST, or the integer indefinite when out of range
+static i64 integer(FPU, f80 x, uint bits)
+{
+
+	const f80 r   = rounded(fpu, x);
+	const f80 max = ldexpl(1, bits - 1);
+
+	if (classify(x) == CLASS_NAN || r >= max || r < -max) {
+		except(fpu, SW_IE);
+		return (i64)(~0ull << (bits - 1));
+	}
+
+	if (r != x)
+		except(fpu, SW_PE);
+
+	return (i64)r;
+
+}
+
+
+
+// Flags what the host made of an operation on a and b: a NaN out of numbers is
+// an invalid operation, an infinity out of finite numbers an overflow
+static f80 result(FPU, f80 x, f80 a, f80 b)
+{
+
+	const uint ca = classify(a);
+	const uint cb = classify(b);
+
+	switch (classify(x)) {
+
+		case CLASS_NAN:
+
+			if (ca != CLASS_NAN && cb != CLASS_NAN) {
+				except(fpu, SW_IE);
+				return indefinite();
+			}
+
+			break;
+
+		case CLASS_INF:
+
+			if (ca != CLASS_INF && cb != CLASS_INF)
+				except(fpu, SW_OE | SW_PE);
+
+			break;
+
+		case CLASS_DENORMAL:
+
+			except(fpu, SW_UE);
+			break;
+
+	}
+
+	return x;
+
+}
+
+
+
+// Host rounding modes by rounding control
+static const int roundings[4] = { FE_TONEAREST, FE_DOWNWARD, FE_UPWARD, FE_TOWARDZERO };
+
+
+
+// Rounds the significand to 24 or 53 bits as the precision control says, in the
+// current rounding mode. The exponent keeps its extended range
+static f80 precision(FPU, f80 x)
+{
+
+	const uint pc = fpu->control & CW_PC;
+
+	if (pc == CW_PC || !isfinite(x) || x == 0)
+		return x;
+
+	const int bits = (pc == 2 << 8)? 53: 24;  // 1 is reserved
+	int       exp;
+
+	const f80 m = frexpl(x, &exp);
+	return ldexpl(rintl(ldexpl(m, bits)), exp - bits);
+
+}
+
+
+
+// ADD MUL SUB SUBR DIV DIVR by REG field, 2 and 3 are the compares. Results are
+// rounded once on the host then to the precision control, which can differ from
+// the 8087 in the last bit of a reduced precision result
+static f80 arith(FPU, uint op, f80 a, f80 b)
+{
+
+	if (op == 2 || op == 3)
+		return a;
+
+	if (op == 7) {
+		const f80 t = a;
+		a  = b;
+		b  = t;
+		op = 6;
+	}
+
+	if (op == 6 && classify(b) == CLASS_ZERO && classify(a) != CLASS_ZERO && classify(a) != CLASS_NAN) {
+		except(fpu, SW_ZE);
+		return (negative(a) != negative(b))? -INFINITY: INFINITY;
+	}
+
+	// Round to nearest at full precision is the host default
+	const bool native = (fpu->control & (CW_RC | CW_PC)) == CW_PC;
+	const int  host   = fegetround();
+
+	if (!native)
+		fesetround(roundings[(fpu->control & CW_RC) >> 10]);
+
+	f80 x;
+
+	switch (op) {
+		case 0:  x = a + b; break;
+		case 1:  x = a * b; break;
+		case 4:  x = a - b; break;
+		case 5:  x = b - a; break;
+		default: x = a / b; break;
+	}
+
+	if (!native) {
+		x = precision(fpu, x);
+		fesetround(host);
+	}
+
+	return result(fpu, x, a, b);
+
+}
+
+
+
+static void compare(FPU, f80 a, f80 b)
+{
+
+	fpu->status &= ~SW_CC;
+
+	if (classify(a) == CLASS_NAN || classify(b) == CLASS_NAN) {
+		except(fpu, SW_IE);
+		fpu->status |= SW_C3 | SW_C2 | SW_C0;
+	}
+
+	else if (a < b)  fpu->status |= SW_C0;
+	else if (a == b) fpu->status |= SW_C3;
+
+}
+
+
+
+// Memory operand of the arithmetic opcodes D8, DA, DC and DE
+static f80 operand(uint esc, const u8 *mem)
+{
+
+	switch (esc) {
+
+		case 0: { f32 x; memcpy(&x, mem, 4); return x; }
+		case 2: { i32 x; memcpy(&x, mem, 4); return x; }
+		case 4: { f64 x; memcpy(&x, mem, 8); return x; }
+		default: return (i16)ld16(mem);
+
+	}
+
+}
+
+
+
+// Packed BCD: 18 digits, two per byte from the lowest, then the sign byte
+static f80 loadbcd(const u8 *p)
+{
+
+	i64 x = 0;
+
+	for (int n=8; n >= 0; n--)
+		x = x * 100 + bcd2dec(p[n]);
+
+	return (p[9] & 0x80)? -(f80)x: (f80)x;
+
+}
+
+
+static void storebcd(FPU, f80 x, u8 *p)
+{
+
+	const f80 r = rounded(fpu, x);
+
+	if (classify(x) == CLASS_NAN || fabsl(r) >= 1e18L) {
+
+		except(fpu, SW_IE);
+
+		memset(p, 0, 10);
+		p[7] = 0xc0;
+		p[8] = 0xff;
+		p[9] = 0xff;
+
+		return;
+
+	}
+
+	u64 v = fabsl(r);
+
+	for (int n=0; n < 9; n++, v /= 100)
+		p[n] = dec2bcd(v % 100);
+
+	p[9] = negative(r)? 0x80: 0x00;
+
+}
+
+
+
+// Partial remainder. fmodl is exact, so the remainder is always complete and C2
+// is left clear; the low quotient bits come from the remainder by 8 divisors
+static void fprem(FPU)
+{
+
+	const f80 a = get(fpu, 0);
+	const f80 b = get(fpu, 1);
+
+	fpu->status &= ~SW_CC;
+
+	if (classify(a) == CLASS_NAN || classify(b) == CLASS_NAN || classify(a) == CLASS_INF || classify(b) == CLASS_ZERO) {
+		except(fpu, SW_IE);
+		set(fpu, 0, indefinite());
+		return;
+	}
+
+	const f80  r  = fmodl(a, b);
+	const f80  r8 = fmodl(fabsl(a), ldexpl(fabsl(b), 3));
+	const uint q  = (uint)llrintl((r8 - fabsl(r)) / fabsl(b)) & 7;
+
+	if (q & 4) fpu->status |= SW_C0;
+	if (q & 2) fpu->status |= SW_C3;
+	if (q & 1) fpu->status |= SW_C1;
+
+	set(fpu, 0, r);
+
+}
+
+
+
+static void fxtract(FPU)
+{
+
+	const f80 x = get(fpu, 0);
+
+	if (classify(x) == CLASS_ZERO) {
+		except(fpu, SW_ZE);
+		set(fpu, 0, -INFINITY);
+		push(fpu, x);
+		return;
+	}
+
+	if (classify(x) == CLASS_NAN || classify(x) == CLASS_INF) {
+		push(fpu, x);
+		return;
+	}
+
+	int       e;
+	const f80 m = frexpl(x, &e);
+
+	set(fpu, 0, e - 1);
+	push(fpu, m * 2);
+
+}
+
+
+
+// D9 register forms other than FLD, FXCH and FSTP: constants, the transcendental
+// functions and the stack controls, by the low 5 bits of ModRM
+static void d9(FPU, uint op)
+{
+
+	const f80 x = (op < 0x08 || op >= 0x10)? ST(0): 0;
+
+	switch (op) {
+
+		case 0x10: break;  // FNOP
+
+		case 0x20: set(fpu, 0, -get(fpu, 0));       break;  // FCHS
+		case 0x21: set(fpu, 0, fabsl(get(fpu, 0))); break;  // FABS
+		case 0x24: compare(fpu, get(fpu, 0), 0);    break;  // FTST
+
+		case 0x25: // FXAM
+			fpu->status &= ~SW_CC;
+			fpu->status |= (empty(fpu, 0))? CLASS_EMPTY: classify(x);
+			fpu->status |= (negative(x))? SW_C1: 0;
+			break;
+
+		case 0x28: push(fpu, 1);         break;  // FLD1
+		case 0x29: push(fpu, CONST_L2T); break;  // FLDL2T
+		case 0x2a: push(fpu, CONST_L2E); break;  // FLDL2E
+		case 0x2b: push(fpu, CONST_PI);  break;  // FLDPI
+		case 0x2c: push(fpu, CONST_LG2); break;  // FLDLG2
+		case 0x2d: push(fpu, CONST_LN2); break;  // FLDLN2
+		case 0x2e: push(fpu, 0);         break;  // FLDZ
+
+		case 0x30: // F2XM1
+			set(fpu, 0, result(fpu, expm1l(get(fpu, 0) * CONST_LN2), x, 0));
+			break;
+
+		case 0x31: { // FYL2X
+			const f80 a = get(fpu, 0), b = get(fpu, 1);
+			if (classify(a) == CLASS_ZERO) except(fpu, SW_ZE);
+			set(fpu, 1, result(fpu, b * log2l(a), a, b));
+			pop(fpu);
+			break;
+		}
+
+		case 0x32: { // FPTAN, arguments beyond 2^63 are left for the program to reduce
+			const f80 a = get(fpu, 0);
+			fpu->status &= ~SW_C2;
+			if (fabsl(a) >= 0x1p63L) { fpu->status |= SW_C2; break; }
+			set(fpu, 0, result(fpu, tanl(a), a, 0));
+			push(fpu, 1);
+			break;
+		}
+
+		case 0x33: { // FPATAN
+			const f80 a = get(fpu, 0), b = get(fpu, 1);
+			set(fpu, 1, result(fpu, atan2l(b, a), a, b));
+			pop(fpu);
+			break;
+		}
+
+		case 0x34: fxtract(fpu); break;
+
+		case 0x36: fpu->top = (fpu->top - 1) & 7; break;  // FDECSTP
+		case 0x37: fpu->top = (fpu->top + 1) & 7; break;  // FINCSTP
+
+		case 0x38: fprem(fpu); break;
+
+		case 0x39: { // FYL2XP1
+			const f80 a = get(fpu, 0), b = get(fpu, 1);
+			set(fpu, 1, result(fpu, b * log1pl(a) / CONST_LN2, a, b));
+			pop(fpu);
+			break;
+		}
+
+		case 0x3a: { // FSQRT
+			const f80 a = get(fpu, 0);
+			if (negative(a) && classify(a) != CLASS_ZERO && classify(a) != CLASS_NAN) { except(fpu, SW_IE); set(fpu, 0, indefinite()); break; }
+			set(fpu, 0, sqrtl(a));
+			break;
+		}
+
+		case 0x3c: set(fpu, 0, rounded(fpu, get(fpu, 0))); break;  // FRNDINT
+
+		case 0x3d: { // FSCALE
+			const f80 a = get(fpu, 0), b = truncl(get(fpu, 1));
+			const int n = (b > 65536)? 65536: (b < -65536)? -65536: (int)b;
+			set(fpu, 0, result(fpu, ldexpl(a, n), a, 0));
+			break;
+		}
+
+		default: // Reserved
+			break;
+
+	}
+
+}
+
+
+
+void i8087_init(FPU)
+{
+
+	i8087_reset(fpu);
+	fpu->present = true;
+
+}
+
+
+
+// FNINIT
+void i8087_reset(FPU)
+{
+
+	for (int r=0; r < 8; r++)
+		fpu->st[r] = 0;
+
+	fpu->control = 0x03ff;
+	fpu->status  = 0;
+	fpu->top     = 0;
+	fpu->empty   = 0xff;
+
+	fpu->ip     = 0;
+	fpu->dp     = 0;
+	fpu->opcode = 0;
+
+}
+
+
+
+// Memory operand of an ESC instruction, bytes with I8087_LOAD and I8087_STORE
+// telling which way it goes. Register forms have none
+uint i8087_operand(uint esc, uint modrm)
+{
+
+	return (modrm >= 0xc0)? 0: operands[esc & 7][(modrm >> 3) & 7];
+
+}
+
+
+
+// Runs the ESC instruction esc (low 3 bits of the opcode) with modrm. mem holds
+// the memory operand, read before if i8087_operand() says so and written back
+// after; ip and dp are the linear addresses of the instruction and operand
+void i8087_exec(FPU, uint esc, uint modrm, u8 *mem, u32 ip, u32 dp)
+{
+
+	const bool memory = modrm < 0xc0;
+	const uint reg    = (modrm >> 3) & 7;
+	const uint rm     = modrm & 7;
+
+	esc &= 7;
+
+	// Control instructions leave the pointers to the last numeric one
+	const bool control =
+		(memory && (esc == 1 || esc == 5) && reg >= 4) ||
+		(!memory && esc == 3 && reg == 4);
+
+	if (!control) {
+		fpu->ip     = ip;
+		fpu->opcode = (esc << 8 | modrm) & 0x7ff;
+		if (memory) fpu->dp = dp;
+	}
+
+
+	if (!memory) switch (esc) {
+
+		case 0: // D8: ST = ST op ST(i)
+		case 4: // DC: ST(i) = ST(i) op ST, with SUB and SUBR, DIV and DIVR swapped
+		case 6: // DE: as DC, then pop
+
+			if (reg == 2 || reg == 3) { // FCOM, FCOMP, and FCOMPP at DE D9
+				if (esc == 6 && rm != 1) break;
+				compare(fpu, get(fpu, 0), get(fpu, rm));
+				if (reg == 3 || esc == 6) pop(fpu);
+				if (esc == 6)             pop(fpu);
+				break;
+			}
+
+			if (esc == 0)
+				set(fpu, 0, arith(fpu, reg, get(fpu, 0), get(fpu, rm)));
+
+			else {
+				set(fpu, rm, arith(fpu, (reg >= 4)? reg ^ 1: reg, get(fpu, rm), get(fpu, 0)));
+				if (esc == 6) pop(fpu);
+			}
+
+			break;
+
+		case 1: // D9
+
+			switch (reg) {
+
+				case 0: push(fpu, get(fpu, rm)); break;  // FLD ST(i)
+
+				case 1: { // FXCH
+					const f80 t = get(fpu, 0);
+					set(fpu, 0, get(fpu, rm));
+					set(fpu, rm, t);
+					break;
+				}
+
+				case 3: set(fpu, rm, get(fpu, 0)); pop(fpu); break;  // FSTP ST(i), reserved alias
+
+				default: d9(fpu, modrm & 0x3f); break;
+
+			}
+
+			break;
+
+		case 3: // DB
+
+			switch (modrm) {
+				case 0xe0: fpu->control &= ~CW_IEM;                                            break;  // FENI
+				case 0xe1: fpu->control |=  CW_IEM;                                            break;  // FDISI
+				case 0xe2: fpu->status  &= ~(SW_IE|SW_DE|SW_ZE|SW_OE|SW_UE|SW_PE|SW_IR|SW_B);  break;  // FCLEX
+				case 0xe3: i8087_reset(fpu);                                                   break;  // FINIT
+			}
+
+			break;
+
+		case 5: // DD
+
+			switch (reg) {
+				case 0: fpu->empty |= 1 << ((fpu->top + rm) & 7);  break;  // FFREE
+				case 2: set(fpu, rm, get(fpu, 0));                 break;  // FST ST(i)
+				case 3: set(fpu, rm, get(fpu, 0)); pop(fpu);       break;  // FSTP ST(i)
+			}
+
+			break;
+
+	}
+
+
+	else switch (esc << 3 | reg) {
+
+		case 0x00 ... 0x01: // Arithmetic
+		case 0x04 ... 0x07:
+		case 0x10 ... 0x11:
+		case 0x14 ... 0x17:
+		case 0x20 ... 0x21:
+		case 0x24 ... 0x27:
+		case 0x30 ... 0x31:
+		case 0x34 ... 0x37:
+			set(fpu, 0, arith(fpu, reg, get(fpu, 0), operand(esc, mem)));
+			break;
+
+		case 0x02: case 0x12: case 0x22: case 0x32: // FCOM
+		case 0x03: case 0x13: case 0x23: case 0x33: // FCOMP
+			compare(fpu, get(fpu, 0), operand(esc, mem));
+			if (reg == 3) pop(fpu);
+			break;
+
+		case 0x08: { f32 x; memcpy(&x, mem, 4); push(fpu, x); break; }  // FLD m32
+		case 0x28: { f64 x; memcpy(&x, mem, 8); push(fpu, x); break; }  // FLD m64
+		case 0x1d: push(fpu, load80(mem));                       break;  // FLD m80
+
+		case 0x0a: case 0x0b: { const f32 x = get(fpu, 0); memcpy(mem, &x, 4); if (reg == 3) pop(fpu); break; }  // FST(P) m32
+		case 0x2a: case 0x2b: { const f64 x = get(fpu, 0); memcpy(mem, &x, 8); if (reg == 3) pop(fpu); break; }  // FST(P) m64
+		case 0x1f: store80(get(fpu, 0), mem); pop(fpu); break;  // FSTP m80
+
+		case 0x18: { i32 x; memcpy(&x, mem, 4); push(fpu, x); break; }  // FILD m32
+		case 0x38: push(fpu, (i16)ld16(mem));                    break;  // FILD m16
+		case 0x3d: { i64 x; memcpy(&x, mem, 8); push(fpu, x); break; }  // FILD m64
+
+		case 0x1a: case 0x1b: { const i32 x = integer(fpu, get(fpu, 0), 32); memcpy(mem, &x, 4); if (reg == 3) pop(fpu); break; }  // FIST(P) m32
+		case 0x3a: case 0x3b: { const i16 x = integer(fpu, get(fpu, 0), 16); memcpy(mem, &x, 2); if (reg == 3) pop(fpu); break; }  // FIST(P) m16
+		case 0x3f:            { const i64 x = integer(fpu, get(fpu, 0), 64); memcpy(mem, &x, 8); pop(fpu);              break; }  // FISTP m64
+
+		case 0x3c: push(fpu, loadbcd(mem));                   break;  // FBLD
+		case 0x3e: storebcd(fpu, get(fpu, 0), mem); pop(fpu); break;  // FBSTP
+
+		case 0x0c: ldenv(fpu, mem);                break;  // FLDENV
+		case 0x0d: fpu->control = ld16(mem);       break;  // FLDCW
+		case 0x0e: stenv(fpu, mem);                break;  // FSTENV
+		case 0x0f: st16(mem, fpu->control);        break;  // FSTCW
+		case 0x2f: st16(mem, status(fpu));         break;  // FSTSW
+
+		case 0x2c: // FRSTOR
+			ldenv(fpu, mem);
+			for (int i=0; i < 8; i++)
+				ST(i) = load80(mem + 14 + 10 * i);
+			break;
+
+		case 0x2e: // FSAVE
+			stenv(fpu, mem);
+			for (int i=0; i < 8; i++)
+				store80(ST(i), mem + 14 + 10 * i);
+			i8087_reset(fpu);
+			break;
+
+		default: // Reserved
+			break;
+
+	}
+
+}
@@ -0,0 +1,48 @@
+
+
+#ifndef CPU_I8087_H
+#define CPU_I8087_H
+
+
+enum {
+	I8087_SIZE  = 0x7f,    // Bytes of the memory operand of an ESC instruction
+	I8087_LOAD  = 1 << 7,  // The instruction reads its memory operand
+	I8087_STORE = 1 << 8,  // The instruction writes its memory operand
+	I8087_STATE = 94       // Largest memory operand, the FSAVE image
+};
+
+
+// 8087 numeric coprocessor. Registers are host extended precision so that the
+// arithmetic runs natively. Rounding control applies to the four basic
+// operations, FRNDINT and integer stores, precision control to the four basic
+// operations only; the others round to nearest at full precision. Memory
+// operands are passed in and out as bytes by the CPU, the 8087 never accesses
+// memory itself
+struct i8087 {
+
+	f80 st[8];  // Physical registers, ST(i) is st[(top + i) & 7]
+
+	u16  control;
+	u16  status;  // Without TOP, that is kept in top
+	uint top;
+	u8   empty;   // Physical registers tagged empty, one bit each. The other
+	              // tags follow the values and are worked out when stored
+
+	u32 ip;      // Last instruction that was not a control one: its linear
+	u32 dp;      // address, that of its memory operand and its opcode without
+	u16 opcode;  // the ESC bits, as FSTENV stores them
+
+	bool present;  // Attached to the CPU, ESC instructions do nothing otherwise
+
+};
+
+
+void i8087_init( struct i8087 *fpu);
+void i8087_reset(struct i8087 *fpu);
+
+uint i8087_operand(uint esc, uint modrm);
+void i8087_exec(   struct i8087 *fpu, uint esc, uint modrm, u8 *mem, u32 ip, u32 dp);
+
+
+#endif
+
@@ -51,3 +51,36 @@ void iobridge_io_wr(struct iobridge *io, u16 port, uint mode, uint *value)
 
 }
 
+
+
+// Byte strings pass through to the port as they are, words are split into
+// their bytes like single accesses. All of them are moved here
+uint iobridge_io_str(struct iobridge *io, u16 port, uint mode, void *buf, uint count)
+{
+
+	u8 *p = buf;
+
+	switch (mode) {
+
+		case IO_RD8: io_reads( &io->port, port, IO_RD8, buf, count); break;
+		case IO_WR8: io_writes(&io->port, port, IO_WR8, buf, count); break;
+
+		case IO_RD16:
+			for (uint n=0; n < count; n++) {
+				p[2 * n + 0] = io_readb(&io->port, port + 0);
+				p[2 * n + 1] = io_readb(&io->port, port + 1);
+			}
+			break;
+
+		case IO_WR16:
+			for (uint n=0; n < count; n++) {
+				io_writeb(&io->port, port + 0, p[2 * n + 0]);
+				io_writeb(&io->port, port + 1, p[2 * n + 1]);
+			}
+			break;
+
+	}
+
+	return count;
+
+}
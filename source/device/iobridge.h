@@ -15,10 +15,13 @@ void iobridge_init(struct iobridge *io);
 
 void iobridge_io_rd(struct iobridge *io, u16 port, uint mode, uint *value);
 void iobridge_io_wr(struct iobridge *io, u16 port, uint mode, uint *value);
+uint iobridge_io_str(struct iobridge *io, u16 port, uint mode, void *buf, uint count);
 
 
 static inline struct io iobridge_mkport(struct iobridge *io) {
-	return io_make(io, (io_fn*)&iobridge_io_rd, (io_fn*)&iobridge_io_wr);
+	struct io p = io_make(io, (io_fn*)&iobridge_io_rd, (io_fn*)&iobridge_io_wr);
+	p.str = (io_str_fn*)&iobridge_io_str;
+	return p;
 }
 
 
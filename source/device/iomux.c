@@ -101,3 +101,19 @@ void iomux_io_wr(void *data, u16 port, uint mode, uint *value)
 
 }
 
+
+
+// Block transfers go to the port's own handler, if it has one. Otherwise nothing
+// is moved here and the caller falls back to iomux_io_rd and iomux_io_wr
+uint iomux_io_str(void *data, u16 port, uint mode, void *buf, uint count)
+{
+
+	struct io *p = iomux_lookup((struct iomux*)data, port);
+
+	if (p == NULL || p->str == NULL)
+		return 0;
+
+	return p->str(p->data, port, mode, buf, count);
+
+}
+
@@ -27,10 +27,13 @@ struct io    *iomux_lookup( struct iomux *io, u16 port);
 
 void iomux_io_rd(void *data, u16 port, uint mode, uint *value);
 void iomux_io_wr(void *data, u16 port, uint mode, uint *value);
+uint iomux_io_str(void *data, u16 port, uint mode, void *buf, uint count);
 
 
 static inline struct io iomux_mkport(struct iomux *io) {
-	return io_make(io, &iomux_io_rd, &iomux_io_wr);
+	struct io p = io_make(io, &iomux_io_rd, &iomux_io_wr);
+	p.str = &iomux_io_str;
+	return p;
 }
 
 
@@ -14,12 +14,18 @@
 #include "core/memory.h"
 #include "core/wire.h"
 
+#include "cpu/i8087.h"
 #include "cpu/i8086.h"
+#include "cpu/i8086jit.h"
+#include "cpu/i8086batch.h"
+#include "cpu/i8086diag.h"
 
 #include "util/fs.h"
+#include "util/memscan.h"
 #include "util/trim.h"
 
 #include "device/ram.h"
+#include "device/iobridge.h"
 
 
 #define COLOR_NONE       "\033[0m"
@@ -301,13 +307,9 @@ bool test_run_cases(struct test_report *tr, struct i8086 *cpu, const char *path)
 
 		} else if (line[0] == 'X') {
 
-			while (true) {
-
-				i8086_tick(cpu);
-
-				if (cpu->insn.fetch && !cpu->insn.op_override)
-					break;
-			}
+			do
+				i8086_run(cpu, 1);
+			while (!cpu->insn.fetch);
 
 			executed = true;
 
@@ -357,39 +359,2067 @@ void ioport_rdwr(void *data, u16 port, uint mode, uint *v)
 
 
 
-int main(int argc, char **argv)
+// Shift or rotate by the REG field of D0-D3 one bit at a time, as the 8088
+// does, on the flags word. The reference the closed-form kernels are checked
+// against: shifts by the width or more leave CF alone, OF follows the result
+// even for a count of zero and rotates leave PF, ZF and SF alone
+uint test_shift(uint op, uint n, uint a, uint b, uint *flags)
+{
+
+	const uint top = 1u << (n - 1);
+	const uint all = (1u << n) - 1;
+
+	uint f = *flags;
+	bool c = f & 1;
+	bool v;
+
+	a &= all;
+
+	switch (op & 7) {
+
+		case 0: // ROL
+			for (; b >= n; b -= n) c = a & 1;
+			for (; b > 0; b--) { c = a & top; a = (a << 1 | a >> (n - 1)) & all; }
+			break;
+
+		case 1: // ROR
+			for (; b >= n; b -= n) c = a & top;
+			for (; b > 0; b--) { c = a & 1; a = a >> 1 | (a & 1) << (n - 1); }
+			break;
+
+		case 2: // RCL
+			for (b %= n + 1; b > 0; b--) { const bool x = a & top; a = (a << 1 | c) & all; c = x; }
+			break;
+
+		case 3: // RCR
+			for (b %= n + 1; b > 0; b--) { const bool x = a & 1; a = a >> 1 | c << (n - 1); c = x; }
+			break;
+
+		case 4: // SHL
+		case 6: // SAL
+			if (b < n) for (uint k=0; k < b; k++) { c = a & top; a = (a << 1) & all; }
+			else       a = 0;
+			break;
+
+		case 5: // SHR
+			if (b < n) for (uint k=0; k < b; k++) { c = a & 1; a >>= 1; }
+			else       a = 0;
+			break;
+
+		case 7: // SAR
+			if (b < n) for (uint k=0; k < b; k++) { c = a & 1; a = a >> 1 | (a & top); }
+			else       a = (a & top)? all: 0;
+			break;
+
+	}
+
+	// OF from the top bit against CF for left shifts, the next bit for right ones
+	if ((op & 7) == 0 || (op & 7) == 2 || (op & 7) == 4 || (op & 7) == 6)
+		v = ((a & top) != 0) ^ c;
+	else
+		v = ((a & top) != 0) ^ ((a & top >> 1) != 0);
+
+	f = (f & ~0x0801u) | c | v << 11;
+
+	if ((op & 7) >= 4 && b > 0) { // Shifts set PF, ZF and SF by the result
+
+		f &= ~0x00c4u;
+
+		if (!__builtin_parity(a & 0xff)) f |= 1 << 2;
+		if (a == 0)                      f |= 1 << 6;
+		if (a & top)                     f |= 1 << 7;
+
+	}
+
+	*flags = f;
+	return a;
+
+}
+
+
+
+// Every shift and rotate kernel against test_shift(), for all counts and carry
+// inputs, on every 8-bit operand and a spread of 16-bit ones, or every 16-bit
+// one too when exhaustive. Returns the mismatches
+uint test_shifts(bool exhaustive)
+{
+
+	static i8086 cpu;
+
+	uint fails = 0;
+
+	for (uint n=8; n <= 16; n += 8)
+		for (uint op=0; op < 8; op++)
+			for (uint a=0; a < 1u << n; a += (n == 8 || exhaustive)? 1: 61)
+				for (uint b=0; b < 256; b++)
+					for (uint c=0; c < 2; c++) {
+
+						// PF, AF, ZF, SF and OF in, varied along with the operands
+						const uint f = a ^ b * 0x35;
+
+						uint flags = 0xf002 | c
+							| (f >> 1 & 1) << 2 | (f >> 2 & 1) << 4 | (f >> 3 & 1) << 6
+							| (f >> 4 & 1) << 7 | (f >> 5 & 1) << 11;
+
+						i8086_reg_set(&cpu, REG_FLAGS, flags);
+
+						const uint x = i8086_shift(&cpu, op, n, a, b);
+						const uint y = test_shift(op, n, a, b, &flags);
+
+						if (x != y || i8086_reg_get(&cpu, REG_FLAGS) != flags)
+							fails++;
+
+					}
+
+	return fails;
+
+}
+
+
+
+// Programs run at 0100:0000, each machine with its own 1MB of memory. A
+// program ends at HLT
+enum {
+	TEST_CODE   = 0x1000,
+	TEST_STEPS  = 200000, // Most instructions a program may run
+	TEST_FUZZ   = 2000,   // Random programs run both ways
+	TEST_FUSION = 64,     // Programs for each instruction that fuses
+	TEST_BATCH  = 32,     // Random programs run by a batch and lane by lane
+	TEST_LANES  = 8       // CPUs in the batch, each with its own registers
+};
+
+
+struct test_machine {
+
+	u16  regs[8];  // AX, CX, DX, BX, SP, BP, SI, DI
+	u16  ds;       // Also ES and SS
+	bool a20;
+	uint model;    // I8086_MODEL_*
+
+};
+
+
+i8086 test_cpus[2];
+
+
+
+void test_load(i8086 *cpu, const struct test_machine *tm, const u8 *code, uint length)
 {
 
+	static const uint regs[8] = { REG_AX, REG_CX, REG_DX, REG_BX, REG_SP, REG_BP, REG_SI, REG_DI };
+
 	RAM ram;
-	i8086 cpu;
 
 	ram_alloc(&ram, 1*1024*1024);
-	i8086_init(&cpu);
 
-	cpu.memory.mem = ram;
-	cpu.iob = io_make(NULL, &ioport_rdwr, ioport_rdwr);
-	cpu.iow = io_make(NULL, &ioport_rdwr, ioport_rdwr);
+	for (u32 n=0; n < ram.length; n++)
+		ram.base[n] = n * 7 + (n >> 8);
 
-	cpu.undef = &test_undef;
+	memcpy(&ram.base[TEST_CODE], code, length);
 
-	memory_a20gate(&cpu.memory.mem, false); // A20 gate disable
+	i8086_init(cpu);
 
+	cpu->memory.mem = ram;
+	cpu->iob = io_make(NULL, &ioport_rdwr, ioport_rdwr);
+	cpu->iow = io_make(NULL, &ioport_rdwr, ioport_rdwr);
 
-	struct test_report tr[argc];
+	memory_a20gate(&cpu->memory.mem, tm->a20);
 
-	test_init(&tr[0], "Total");
+	i8086_reset(cpu);
+	i8086_model(cpu, tm->model);
 
-	for (int n=1; n < argc; n++) {
+	for (int n=0; n < 8; n++)
+		i8086_reg_set(cpu, regs[n], tm->regs[n]);
 
-		test_init(&tr[n], argv[n]);
-		test_run_cases(&tr[n], &cpu, argv[n]);
-		test_aggregate(&tr[0], &tr[n]);
+	i8086_reg_set(cpu, REG_CS, TEST_CODE >> 4);
+	i8086_reg_set(cpu, REG_DS, tm->ds);
+	i8086_reg_set(cpu, REG_ES, tm->ds);
+	i8086_reg_set(cpu, REG_SS, tm->ds);
+	i8086_reg_set(cpu, REG_IP, 0);
+
+	cpu->regs.scs = TEST_CODE >> 4;
+	cpu->regs.sip = 0;
+
+}
+
+
+
+void test_unload(i8086 *cpu)
+{
+
+	ram_free(&cpu->memory.mem);
+	i8086_free(cpu);
+
+}
+
+
+
+// Runs the program with a large budget, by translated code, fused pairs or
+// threaded dispatch as the core has them, and again one instruction at a time
+// by the interpreter alone. Both have to end in the same state. Adds the pairs
+// that ran fused to fused
+bool test_diff(const struct test_machine *tm, const u8 *code, uint length, u64 *fused)
+{
+
+	static const uint regs[] = {
+		REG_AX, REG_BX, REG_CX, REG_DX, REG_SP, REG_BP, REG_SI, REG_DI,
+		REG_CS, REG_DS, REG_ES, REG_SS, REG_IP, REG_FLAGS
+	};
+
+	i8086 *run = &test_cpus[0];
+	i8086 *ref = &test_cpus[1];
+
+	test_load(run, tm, code, length);
+	test_load(ref, tm, code, length);
+
+#ifdef I8086_JIT
+	i8086_jit_init(run, 2, I8086_JIT_LIMIT);
+#endif
+
+	i8086_run(run, TEST_STEPS);
+
+	for (uint n=0; n < TEST_STEPS && !ref->interrupt.halt; n++)
+		i8086_run(ref, 1);
+
+	bool same = run->interrupt.halt && ref->interrupt.halt && run->cycles == ref->cycles;
+
+	for (int n=0; n < sizeof(regs) / sizeof(regs[0]); n++)
+		same = same && i8086_reg_get(run, regs[n]) == i8086_reg_get(ref, regs[n]);
+
+	same = same && memcmp(run->memory.mem.base, ref->memory.mem.base, run->memory.mem.length) == 0;
+
+	*fused += run->fused;
+
+#ifdef I8086_JIT
+	i8086_jit_free(run);
+#endif
+
+	test_unload(run);
+	test_unload(ref);
+
+	return same;
+
+}
+
+
+
+// Memory operands at the edges: words that wrap around the segment, at the
+// end of memory and past it with A20 enabled, where the bus reads open.
+// Each runs in a loop long enough to be translated
+bool test_edges(void)
+{
+
+	static const u8 wrap[] = {
+		0xb9, 0x40, 0x00,        //    mov  cx, 64
+		0xbe, 0xff, 0xff,        //    mov  si, 0xffff
+		0xb8, 0x34, 0x12,        // l: mov  ax, 0x1234
+		0x89, 0x04,              //    mov  [si], ax
+		0x8b, 0x1c,              //    mov  bx, [si]
+		0x01, 0x1c,              //    add  [si], bx
+		0x8b, 0x16, 0xff, 0xff,  //    mov  dx, [0xffff]
+		0x40,                    //    inc  ax
+		0xe2, 0xf0,              //    loop l
+		0xf4                     //    hlt
+	};
+
+	static const u8 edge[] = {
+		0xb9, 0x40, 0x00,        //    mov  cx, 64
+		0xb8, 0x34, 0x12,        // l: mov  ax, 0x1234
+		0x89, 0x47, 0x0f,        //    mov  [bx + 15], ax
+		0x8b, 0x57, 0x0f,        //    mov  dx, [bx + 15]
+		0x88, 0x67, 0x10,        //    mov  [bx + 16], ah
+		0x8a, 0x77, 0x10,        //    mov  dh, [bx + 16]
+		0x89, 0x47, 0x20,        //    mov  [bx + 32], ax
+		0x03, 0x57, 0x20,        //    add  dx, [bx + 32]
+		0xe2, 0xe8,              //    loop l
+		0xf4                     //    hlt
+	};
+
+	static const struct { struct test_machine tm; const u8 *code; uint length; } cases[] = {
+		{ { .ds = 0x1000 },                             wrap, sizeof(wrap) },
+		{ { .ds = 0x2000 },                             wrap, sizeof(wrap) },
+		{ { .ds = 0xf000, .regs[3] = 0xfff0 },          edge, sizeof(edge) },
+		{ { .ds = 0xffff, .regs[3] = 0x0000, .a20 = 1}, edge, sizeof(edge) },
+		{ { .ds = 0xffff, .regs[3] = 0x0000 },          edge, sizeof(edge) }
+	};
+
+	bool pass  = true;
+	u64  fused = 0;
+
+	for (int n=0; n < sizeof(cases) / sizeof(cases[0]); n++)
+		pass = test_diff(&cases[n].tm, cases[n].code, cases[n].length, &fused) && pass;
+
+	return pass;
+
+}
+
+
+
+// xorshift, so that the random programs are the same on every run
+uint test_random(u64 *seed)
+{
+
+	*seed ^= *seed << 13;
+	*seed ^= *seed >> 7;
+	*seed ^= *seed << 17;
+
+	return *seed >> 32;
+
+}
+
+
+
+// One random instruction that writes neither CX, which counts the loop, nor SP.
+// ALU, TEST, MOV, INC/DEC and shifts in register and memory forms, carry flag
+// instructions and Jcc over the instruction after it. Returns its length
+uint test_insn(u64 *seed, u8 *p)
+{
+
+	static const u8 reg[6] = { 0, 2, 3, 5, 6, 7 };  // AX DX BX BP SI DI
+	static const u8 rb[6]  = { 0, 2, 3, 4, 6, 7 };  // AL DL BL AH DH BH
+
+	const uint r   = test_random(seed);
+	const uint w   = r & 1;
+	const uint mod = (r >> 1) & 3;
+	const uint rm  = (r >> 3) & 7;
+	const uint alu = (r >> 6) & 7;
+	const uint pr  = (w)? reg[(r >> 9) % 6]: rb[(r >> 9) % 6];   // REG operand
+	const uint qr  = (w)? reg[(r >> 12) % 6]: rb[(r >> 12) % 6]; // R/M when mod is 3
+
+	uint n = 0;
+
+	// ModRM with a register or a memory operand and its displacement
+	#define MODRM(regf) do { \
+		if (mod == 3) p[n++] = 0xc0 | (regf) << 3 | qr; \
+		else { \
+			p[n++] = mod << 6 | (regf) << 3 | rm; \
+			if (mod == 1)                    p[n++] = test_random(seed); \
+			if (mod == 2 || (mod == 0 && rm == 6)) { p[n++] = test_random(seed); p[n++] = test_random(seed); } \
+		} \
+	} while (0)
+
+	switch ((r >> 16) % 12) {
+
+		case 0: case 1: case 2: // ALU r/m, r and r, r/m
+			p[n++] = alu << 3 | ((r >> 15) & 2) | w;
+			MODRM(pr);
+			break;
+
+		case 3: // ALU r/m, imm
+			p[n++] = 0x80 | ((w)? (r >> 20) % 2 * 2 + 1: 0);
+			MODRM(alu);
+			p[n++] = test_random(seed);
+			if (p[0] == 0x81) p[n++] = test_random(seed);
+			break;
+
+		case 4: // ALU AL/AX, imm
+			p[n++] = alu << 3 | 4 | w;
+			p[n++] = test_random(seed);
+			if (w) p[n++] = test_random(seed);
+			break;
+
+		case 5: // MOV r/m, r and r, r/m
+			p[n++] = 0x88 | ((r >> 15) & 2) | w;
+			MODRM(pr);
+			break;
+
+		case 6: // TEST r/m, r
+			p[n++] = 0x84 | w;
+			MODRM(pr);
+			break;
+
+		case 7: // INC/DEC r16 and r/m
+			if (mod == 3) p[n++] = 0x40 | ((r >> 20) & 8) | reg[(r >> 12) % 6];
+			else {
+				p[n++] = 0xfe | w;
+				MODRM((r >> 20) & 1);
+			}
+			break;
+
+		case 8: // MOV r, imm
+			p[n++] = 0xb0 | w << 3 | ((w)? reg[(r >> 9) % 6]: rb[(r >> 9) % 6]);
+			p[n++] = test_random(seed);
+			if (w) p[n++] = test_random(seed);
+			break;
+
+		case 9: // Shifts and rotates by one
+			p[n++] = 0xd0 | w;
+			MODRM((r >> 20) & 7);
+			break;
+
+		case 10: // CLC, STC, CMC
+			p[n++] = (const u8[]){ 0xf8, 0xf9, 0xf5, 0xf5 }[(r >> 20) & 3];
+			break;
+
+		case 11: // Jcc over the next instruction
+			p[n++] = 0x70 | ((r >> 20) & 15);
+			p[n++] = 0;
+			p[1]   = test_insn(seed, &p[2]);
+			n     += p[1];
+			break;
+
+	}
+
+	#undef MODRM
+
+	return n;
+
+}
+
+
+
+// Random program of straight-line code and forward Jcc in a counted loop, on
+// random registers and data segment, A20 enabled or not. Loops run long enough
+// to be translated, and flag-setting instructions end up next to Jcc to run as
+// fused pairs. Returns its length, code has room for 256 bytes
+uint test_program(u64 *seed, struct test_machine *tm, u8 *code)
+{
+
+	uint n = 0;
+
+	// Without A20 the data stays clear of the code, with it past the end
+	// of memory reads open bus and writes go nowhere
+	*tm = (struct test_machine){ .a20 = test_random(seed) & 1 };
+
+	tm->ds = 0x2000 + test_random(seed) % ((tm->a20)? 0xe000: 0xd000);
+
+	for (int r=0; r < 8; r++)
+		tm->regs[r] = test_random(seed);
+
+	tm->regs[4] = 0xfffe;
+
+	code[n++] = 0xb9;  // mov cx, iterations
+	code[n++] = 1 + test_random(seed) % 40;
+	code[n++] = 0;
+
+	while (n < 100)
+		n += test_insn(seed, &code[n]);
+
+	code[n++] = 0xe2;  // loop back to the body
+	code[n]   = 3 - (n + 1);
+	n++;
+
+	code[n++] = 0xf4;  // hlt
+
+	return n;
+
+}
+
+
+
+// Random programs run both ways by test_diff(). Adds the pairs that ran fused
+// to fused
+uint test_fuzz(uint count, u64 *fused)
+{
+
+	u64  seed   = 0x9e3779b97f4a7c15ull;
+	uint failed = 0;
+
+	for (uint k=0; k < count; k++) {
+
+		u8                  code[256];
+		struct test_machine tm;
+
+		const uint n = test_program(&seed, &tm, code);
+
+		// Either model runs the program the same, but for the cost of taken branches
+		tm.model = k & 1;
+
+		if (!test_diff(&tm, code, n, fused))
+			failed++;
+
+	}
+
+	return failed;
+
+}
+
+
+
+// Random programs on a batch of lanes that differ in AX, BX and DX, so they
+// split at Jcc and meet again, run in lockstep by i8086_batch_run() and lane by
+// lane by i8086_run(), in the same random slices of steps. Lanes have to agree
+// after every slice. Returns the programs that differ
+uint test_batch(uint count)
+{
+
+	static const uint regs[] = {
+		REG_AX, REG_BX, REG_CX, REG_DX, REG_SP, REG_BP, REG_SI, REG_DI,
+		REG_CS, REG_DS, REG_ES, REG_SS, REG_IP, REG_FLAGS
+	};
+
+	static i8086 lanes[TEST_LANES];
+	static i8086 serial[TEST_LANES];
+
+	u64  seed   = 0x2545f4914f6cdd1dull;
+	uint failed = 0;
+
+	for (uint k=0; k < count; k++) {
+
+		u8                  code[256];
+		struct test_machine tm;
+
+		const uint n = test_program(&seed, &tm, code);
+
+		tm.model = k & 1;
+
+		for (uint l=0; l < TEST_LANES; l++) {
+
+			struct test_machine lane = tm;
+
+			lane.regs[0] ^= l * 0x9e37;
+			lane.regs[3] ^= l * 0x7f4b;
+			lane.regs[2] ^= l;
+
+			test_load(&lanes[l],  &lane, code, n);
+			test_load(&serial[l], &lane, code, n);
+
+		}
+
+		struct i8086_batch batch;
+
+		// Lanes of different models are refused
+		i8086_model(&lanes[1], !tm.model);
+
+		if (i8086_batch_init(&batch, lanes, TEST_LANES))
+			return count;
+
+		i8086_model(&lanes[1], tm.model);
+
+		if (!i8086_batch_init(&batch, lanes, TEST_LANES))
+			return count;
+
+		bool same   = true;
+		bool halted = false;
+
+		for (uint steps=0; same && !halted && steps < TEST_STEPS;) {
+
+			const uint slice = 1 + test_random(&seed) % 64;
+
+			i8086_batch_run(&batch, slice);
+			steps += slice;
+
+			halted = true;
+
+			for (uint l=0; l < TEST_LANES; l++) {
+
+				const auto a = &lanes[l];
+				const auto b = &serial[l];
+
+				i8086_run(b, slice);
+
+				same = same && a->interrupt.halt == b->interrupt.halt && a->cycles == b->cycles;
+
+				for (int r=0; r < sizeof(regs) / sizeof(regs[0]); r++)
+					same = same && i8086_reg_get(a, regs[r]) == i8086_reg_get(b, regs[r]);
+
+				halted = halted && b->interrupt.halt;
+
+			}
+
+		}
+
+		for (uint l=0; l < TEST_LANES; l++) {
+
+			same = same && memcmp(lanes[l].memory.mem.base, serial[l].memory.mem.base, lanes[l].memory.mem.length) == 0;
+
+			test_unload(&lanes[l]);
+			test_unload(&serial[l]);
+
+		}
+
+		i8086_batch_free(&batch);
+
+		if (!same || !halted)
+			failed++;
+
+	}
+
+	return failed;
+
+}
+
+
+
+// Operand values near the edges where the flags change
+uint test_operand(u64 *seed)
+{
+
+	static const u16 edges[8] = { 0x0000, 0x0001, 0x007f, 0x0080, 0x00ff, 0x7fff, 0x8000, 0xffff };
+
+	const uint r = test_random(seed);
+
+	return (r & 8)? edges[r & 7]: r >> 16;
+
+}
+
+
+
+// Every instruction that can run fused with a Jcc, followed by each of the 16
+// Jcc over an INC DI, on operands near the flag edges in register and memory
+// forms. Fused runs have to end as the same instructions run one at a time.
+// Returns the programs that differ, and adds the pairs that ran fused to fused
+uint test_fusion(uint rounds, u64 *fused)
+{
+
+	enum { REG = 0xff, NONE = 0xfe };  // ModRM REG field random, no ModRM
+
+	static const struct { u8 op, ext, imm; } firsts[] = {
+		{ 0x38, REG,  0 }, { 0x39, REG,  0 }, { 0x3a, REG,  0 }, { 0x3b, REG,  0 },  // CMP
+		{ 0x80, 7,    1 }, { 0x81, 7,    2 }, { 0x83, 7,    1 },
+		{ 0x3c, NONE, 1 }, { 0x3d, NONE, 2 },
+		{ 0x84, REG,  0 }, { 0x85, REG,  0 }, { 0xf6, 0,    1 }, { 0xf7, 0,    2 },  // TEST
+		{ 0xa8, NONE, 1 }, { 0xa9, NONE, 2 },
+		{ 0x08, REG,  0 }, { 0x09, REG,  0 }, { 0x0a, REG,  0 }, { 0x0b, REG,  0 },  // OR
+		{ 0x48, NONE, 0 }                                                            // DEC r16
+	};
+
+	u64  seed   = 0x2545f4914f6cdd1dull;
+	uint failed = 0;
+
+	for (int f=0; f < sizeof(firsts) / sizeof(firsts[0]); f++)
+		for (uint k=0; k < rounds; k++) {
+
+			u8   code[256];
+			uint n = 0;
+
+			struct test_machine tm = { .ds = 0x2000 };
+
+			for (int r=0; r < 8; r++)
+				tm.regs[r] = test_operand(&seed);
+
+			for (uint cc=0; cc < 16; cc++) {
+
+				const uint r   = test_random(&seed);
+				const uint mod = r & 3;
+				const uint rm  = (r >> 2) & 7;
+
+				code[n++] = (firsts[f].op == 0x48)? 0x48 | ((r >> 8) & 7): firsts[f].op;
+
+				if (firsts[f].ext != NONE) {
+
+					const uint reg = (firsts[f].ext == REG)? (r >> 5) & 7: firsts[f].ext;
+
+					code[n++] = mod << 6 | reg << 3 | rm;
+
+					if (mod == 1)                          code[n++] = test_random(&seed);
+					if (mod == 2 || (mod == 0 && rm == 6)) { code[n++] = test_random(&seed); code[n++] = test_random(&seed); }
+
+				}
+
+				const uint imm = test_operand(&seed);
+
+				if (firsts[f].imm > 0) code[n++] = imm;
+				if (firsts[f].imm > 1) code[n++] = imm >> 8;
+
+				code[n++] = 0x70 | cc;  // jcc +1
+				code[n++] = 0x01;
+				code[n++] = 0x47;       // inc di
+
+			}
+
+			code[n++] = 0xf4;
+
+			if (!test_diff(&tm, code, n, fused))
+				failed++;
+
+		}
+
+	return failed;
+
+}
+
+
+
+// Scan and compare kernels against byte loops, each way, over every length up
+// to a few vector blocks and every position of the one byte that stops them
+bool test_memscan(void)
+{
+
+	u8 a[100], b[100];
+
+	for (uint len=0; len <= sizeof(a); len++)
+		for (uint at=0; at <= len; at++) {
+
+			memset(a, 0x55, sizeof(a));
+			memcpy(b, a, sizeof(b));
+
+			if (at < len) {
+				a[at] = 0xaa;
+				b[at] = 0x00;
+			}
+
+			const size_t none = len, first = (at < len)? at: len;
+
+			if (memscan(a, len, 0xaa, true) != first || memrscan(a, len, 0xaa, true) != first)
+				return false;
+
+			if (memscan(a, len, 0x55, false) != first || memrscan(a, len, 0x55, false) != first)
+				return false;
+
+			if (memdiff(a, b, len, false) != first || memrdiff(a, b, len, false) != first)
+				return false;
+
+			if (memscan(a, len, 0x00, true) != none || memrdiff(a, a, len, false) != none)
+				return false;
+
+			// The last equal byte is next to the one that differs, or the end
+			const size_t last = (at + 1 < len)? len - 1: (at > 0)? at - 1: none;
+
+			if (len > 0 && memrdiff(a, b, len, true) != last)
+				return false;
+
+		}
+
+	return true;
+
+}
+
+
+
+// Code that writes over its own immediate in a loop, so translated blocks have
+// to notice and run the new bytes
+bool test_selfmod(void)
+{
+
+	static const u8 code[] = {
+		0xb9, 0x40, 0x00,        //    mov  cx, 64
+		0x31, 0xc0,              //    xor  ax, ax
+		0x05, 0x01, 0x00,        // l: add  ax, 1
+		0x2e, 0x00, 0x0e, 0x06,  //    add  cs:[6], cl
+		0x00,
+		0x01, 0xc3,              //    add  bx, ax
+		0xe2, 0xf4,              //    loop l
+		0xf4                     //    hlt
+	};
+
+	const struct test_machine tm = { .ds = 0x2000 };
+
+	u64 fused = 0;
+
+	return test_diff(&tm, code, sizeof(code), &fused);
+
+}
+
+
+
+// Cycles of one instruction run from 0100:0000 with CX as given
+uint test_cycles(const u8 *code, uint length, u16 cx)
+{
+
+	const struct test_machine tm = { .regs = { [1] = cx }, .ds = 0x2000 };
+
+	i8086 *cpu = &test_cpus[0];
+
+	test_load(cpu, &tm, code, length);
+
+	const u64 start = cpu->cycles;
+
+	i8086_run(cpu, 1);
+	test_unload(cpu);
+
+	return cpu->cycles - start;
+
+}
+
+
+// Shifts and rotates by CL take 4 cycles a bit by the count before the
+// instruction, also when CL or CX is what they shift
+bool test_shiftcycles(void)
+{
+
+	bool good = true;
+
+	for (uint w=0; w < 2; w++)
+		for (uint op=0; op < 8; op++) {
+
+			const u8 cl[2] = { 0xd2 | w, 0xc1 | op << 3 };  // op cl, cl or op cx, cl
+			const u8 dl[2] = { 0xd2 | w, 0xc2 | op << 3 };  // op dl, cl or op dx, cl
+
+			const uint none = test_cycles(dl, 2, 0);
+
+			good = good && test_cycles(dl, 2, 3) == none + 4 * 3;
+			good = good && test_cycles(cl, 2, 3) == none + 4 * 3;
+
+		}
+
+	return good;
+
+}
+
+
+
+// Runs code as an 80186 from the machine's state, until HLT or 1000 steps
+i8086 *test_run186(const struct test_machine *tm, const u8 *code, uint length)
+{
+
+	struct test_machine m = *tm;
+
+	m.model = I8086_MODEL_80186;
+
+	i8086 *cpu = &test_cpus[0];
+
+	test_load(cpu, &m, code, length);
+	return cpu;
+
+}
+
+
+uint test_peekw(i8086 *cpu, u16 seg, u16 ofs)
+{
+
+	const u8 *p = &cpu->memory.mem.base[seg * 16 + ofs];
+	return p[0] | p[1] << 8;
+
+}
+
+
+
+// C0 and C1 against test_shift(), with the count taken mod 32, on AL and AX
+uint test_186shifts(void)
+{
+
+	static const u8  counts[] = { 0, 1, 3, 7, 8, 9, 15, 16, 17, 31, 32, 33, 255 };
+	static const u16 values[] = { 0x0000, 0x0001, 0x8000, 0x8421, 0x7fff, 0xa55a, 0xffff };
+
+	const struct test_machine tm = { .ds = 0x2000 };
+
+	uint fails = 0;
+
+	for (uint w=0; w < 2; w++)
+		for (uint op=0; op < 8; op++)
+			for (uint k=0; k < sizeof(counts); k++)
+				for (uint v=0; v < sizeof(values) / sizeof(values[0]); v++) {
+
+					const u8 code[] = {
+						0xb8, values[v] & 0xff, values[v] >> 8,  // mov  ax, value
+						0xc0 | w, 0xc0 | op << 3, counts[k],     // op   al or ax, count
+						0xf4                                     // hlt
+					};
+
+					i8086 *cpu = test_run186(&tm, code, sizeof(code));
+
+					uint flags = i8086_reg_get(cpu, REG_FLAGS);
+
+					i8086_run(cpu, 10);
+
+					const uint n = (w)? 16: 8;
+					const uint y = test_shift(op, n, values[v], counts[k] & 31, &flags);
+					const uint x = i8086_reg_get(cpu, REG_AX);
+
+					if (x != ((w)? y: (values[v] & 0xff00) | y) || i8086_reg_get(cpu, REG_FLAGS) != flags || !cpu->interrupt.halt)
+						fails++;
+
+					test_unload(cpu);
+
+				}
+
+	return fails;
+
+}
+
+
+
+// PUSHA, PUSH of sign-extended and word immediates, POPA; then ENTER with a
+// nesting level that copies frame pointers, and LEAVE
+bool test_186stack(void)
+{
+
+	static const u8 push[] = {
+		0x60,                    // pusha
+		0x6a, 0xfe,              // push -2
+		0x68, 0x78, 0x56,        // push 0x5678
+		0x5e,                    // pop  si
+		0x5f,                    // pop  di
+		0x89, 0x36, 0x00, 0x00,  // mov  [0], si
+		0x89, 0x3e, 0x02, 0x00,  // mov  [2], di
+		0x31, 0xc0,              // xor  ax, ax
+		0x31, 0xed,              // xor  bp, bp
+		0x61,                    // popa
+		0xf4                     // hlt
+	};
+
+	static const u8 frame[] = {
+		0xc8, 0x10, 0x00, 0x03,  // enter 16, 3
+		0x89, 0x26, 0x04, 0x00,  // mov  [4], sp
+		0x89, 0x2e, 0x06, 0x00,  // mov  [6], bp
+		0xc9,                    // leave
+		0xf4                     // hlt
+	};
+
+	static const uint regs[8] = { REG_AX, REG_CX, REG_DX, REG_BX, REG_SP, REG_BP, REG_SI, REG_DI };
+
+	const struct test_machine tm = {
+		.regs = { 0x1111, 0x2222, 0x3333, 0x4444, 0x0100, 0x0200, 0x7777, 0x8888 },
+		.ds   = 0x2000
+	};
+
+	i8086 *cpu = test_run186(&tm, push, sizeof(push));
+
+	i8086_run(cpu, 100);
+
+	bool good = cpu->interrupt.halt
+		&& test_peekw(cpu, tm.ds, 0) == 0x5678 && test_peekw(cpu, tm.ds, 2) == 0xfffe;
+
+	// PUSHA stores AX at the top down to DI, with SP as it was before
+	for (int r=0; r < 8; r++)
+		good = good && i8086_reg_get(cpu, regs[r]) == tm.regs[r]
+			&& test_peekw(cpu, tm.ds, 0xfe - 2 * r) == tm.regs[r];
+
+	test_unload(cpu);
+
+	// Level 3 copies the two frame pointers below the old BP, then pushes its own
+	cpu = test_run186(&tm, frame, sizeof(frame));
+
+	cpu->memory.mem.base[tm.ds * 16 + 0x1fe] = 0xaa;
+	cpu->memory.mem.base[tm.ds * 16 + 0x1ff] = 0xaa;
+	cpu->memory.mem.base[tm.ds * 16 + 0x1fc] = 0xbb;
+	cpu->memory.mem.base[tm.ds * 16 + 0x1fd] = 0xbb;
+
+	i8086_run(cpu, 100);
+
+	good = good && cpu->interrupt.halt
+		&& test_peekw(cpu, tm.ds, 4) == 0x00e8 && test_peekw(cpu, tm.ds, 6) == 0x00fe
+		&& test_peekw(cpu, tm.ds, 0xfe) == 0x0200 && test_peekw(cpu, tm.ds, 0xfc) == 0xaaaa
+		&& test_peekw(cpu, tm.ds, 0xfa) == 0xbbbb && test_peekw(cpu, tm.ds, 0xf8) == 0x00fe
+		&& i8086_reg_get(cpu, REG_SP) == 0x0100 && i8086_reg_get(cpu, REG_BP) == 0x0200;
+
+	test_unload(cpu);
+
+	return good;
+
+}
+
+
+
+// BOUND in range runs on, out of range raises INT 5 with the address of the
+// BOUND itself pushed, so the handler can run it again
+bool test_186bound(void)
+{
+
+	static const u8 code[] = {
+		0xbb, 0x15, 0x00,        // mov   bx, 0x15
+		0x62, 0x1e, 0x10, 0x00,  // bound bx, [0x10]
+		0xbb, 0x30, 0x00,        // mov   bx, 0x30
+		0x62, 0x1e, 0x10, 0x00,  // bound bx, [0x10]   at 000a
+		0xf4,                    // hlt
+		0, 0, 0, 0, 0, 0, 0, 0,
+		0, 0, 0, 0, 0, 0, 0, 0,
+		0,
+		0xf4                     // hlt                at 0020, INT 5
+	};
+
+	const struct test_machine tm = { .regs[4] = 0x0100, .ds = 0x2000 };
+
+	i8086 *cpu = test_run186(&tm, code, sizeof(code));
+	u8    *mem = cpu->memory.mem.base;
+
+	memcpy(&mem[I8086_VECTOR_BOUND * 4], (const u8[]){ 0x20, 0x00, (TEST_CODE >> 4) & 0xff, TEST_CODE >> 12 }, 4);
+	memcpy(&mem[tm.ds * 16 + 0x10],      (const u8[]){ 0x10, 0x00, 0x20, 0x00 }, 4);
+
+	i8086_run(cpu, 100);
+
+	const bool good = cpu->interrupt.halt
+		&& i8086_reg_get(cpu, REG_CS) == TEST_CODE >> 4 && i8086_reg_get(cpu, REG_IP) == 0x21
+		&& i8086_reg_get(cpu, REG_SP) == 0x00fa
+		&& test_peekw(cpu, tm.ds, 0xfa) == 0x000a && test_peekw(cpu, tm.ds, 0xfc) == TEST_CODE >> 4;
+
+	test_unload(cpu);
+
+	return good;
+
+}
+
+
+
+// IMUL r16, r/m16, imm keeps the low half, CF and OF tell if it did not fit
+bool test_186imul(void)
+{
+
+	static const u8 code[] = {
+		0xb9, 0x07, 0x00,              // mov  cx, 7
+		0x6b, 0xc1, 0xfd,              // imul ax, cx, -3
+		0x69, 0xd1, 0x00, 0x10,        // imul dx, cx, 0x1000
+		0x6b, 0x36, 0x20, 0x00, 0x05,  // imul si, [0x20], 5
+		0x9c,                          // pushf
+		0x69, 0xd9, 0x00, 0x40,        // imul bx, cx, 0x4000
+		0xf4                           // hlt
+	};
+
+	const struct test_machine tm = { .regs[4] = 0x0100, .ds = 0x2000 };
+
+	i8086 *cpu = test_run186(&tm, code, sizeof(code));
+
+	cpu->memory.mem.base[tm.ds * 16 + 0x20] = 0x01;
+	cpu->memory.mem.base[tm.ds * 16 + 0x21] = 0x01;
+
+	i8086_run(cpu, 100);
+
+	const uint fits = test_peekw(cpu, tm.ds, 0xfe);
+	const uint over = i8086_reg_get(cpu, REG_FLAGS);
+
+	const bool good = cpu->interrupt.halt
+		&& i8086_reg_get(cpu, REG_AX) == 0xffeb && i8086_reg_get(cpu, REG_DX) == 0x7000
+		&& i8086_reg_get(cpu, REG_SI) == 0x0505 && i8086_reg_get(cpu, REG_BX) == 0xc000
+		&& (fits & 0x0801) == 0 && (over & 0x0801) == 0x0801;
+
+	test_unload(cpu);
+
+	return good;
+
+}
+
+
+
+// Port that reads the bytes of a fixed sequence in turn and records those
+// written, element by element and with a string handler if it is given one
+struct test_stream {
+	u8   out[64];
+	uint in, written;
+	uint singles, blocks;
+};
+
+
+u8 test_stream_byte(uint n)
+{
+
+	return n * 7 + 3;
+
+}
+
+
+void test_stream_rd(void *data, u16 port, uint mode, uint *v)
+{
+
+	struct test_stream *ts = data;
+
+	*v = test_stream_byte(ts->in++);
+
+	if (IO_RD16(mode))
+		*v |= test_stream_byte(ts->in++) << 8;
+
+	ts->singles++;
+
+}
+
+
+void test_stream_wr(void *data, u16 port, uint mode, uint *v)
+{
+
+	struct test_stream *ts = data;
+
+	ts->out[ts->written++ % 64] = *v;
+
+	if (IO_WR16(mode))
+		ts->out[ts->written++ % 64] = *v >> 8;
+
+	ts->singles++;
+
+}
+
+
+uint test_stream_str(void *data, u16 port, uint mode, void *buf, uint count)
+{
+
+	struct test_stream *ts = data;
+
+	const uint bytes = (IO_8BIT(mode))? count: 2 * count;
+	u8        *p     = buf;
+
+	for (uint n=0; n < bytes; n++)
+		if (IO_RD(mode)) p[n] = test_stream_byte(ts->in++);
+		else             ts->out[ts->written++ % 64] = p[n];
+
+	ts->blocks++;
+	return count;
+
+}
+
+
+
+// REP INSB, OUTSB and INSW to odd addresses, through a port that takes them one
+// element at a time, one with a string handler, and a bridge that splits the
+// words of its string transfers for a byte port behind it
+bool test_186io(void)
+{
+
+	static const u8 code[] = {
+		0xfc,                    // cld
+		0xba, 0x80, 0x00,        // mov  dx, 0x80
+		0xb9, 0x10, 0x00,        // mov  cx, 16
+		0xbf, 0x01, 0x00,        // mov  di, 1
+		0xf3, 0x6c,              // rep  insb
+		0xb9, 0x10, 0x00,        // mov  cx, 16
+		0xbe, 0x01, 0x00,        // mov  si, 1
+		0xf3, 0x6e,              // rep  outsb
+		0xb9, 0x08, 0x00,        // mov  cx, 8
+		0xbf, 0x41, 0x00,        // mov  di, 0x41
+		0xf3, 0x6d,              // rep  insw
+		0xf4                     // hlt
+	};
+
+	const struct test_machine tm = { .ds = 0x2000 };
+
+	bool good = true;
+
+	for (uint kind=0; kind < 3; kind++) {
+
+		struct test_stream ts = { 0 };
+		struct iobridge    bridge;
+
+		i8086 *cpu = test_run186(&tm, code, sizeof(code));
+
+		const struct io port = io_make(&ts, &test_stream_rd, &test_stream_wr);
+
+		if (kind == 0) {
+
+			cpu->iob = cpu->iow = port;
+
+		} else if (kind == 1) {
+
+			cpu->iob = cpu->iow = port;
+			cpu->iob.str = cpu->iow.str = &test_stream_str;
+
+		} else {
+
+			iobridge_init(&bridge);
+			bridge.port = port;
+
+			cpu->iob = cpu->iow = iobridge_mkport(&bridge);
+
+		}
+
+		i8086_run(cpu, 100);
+
+		const u8 *data = &cpu->memory.mem.base[tm.ds * 16];
+
+		good = good && cpu->interrupt.halt && ts.in == 32 && ts.written == 16;
+
+		for (uint n=0; n < 16; n++)
+			good = good && data[1 + n] == test_stream_byte(n) && ts.out[n] == test_stream_byte(n)
+				&& data[0x41 + n] == test_stream_byte(16 + n);
+
+		// Element by element, in three block calls, or bytes behind the bridge
+		if (kind == 0) good = good && ts.blocks == 0 && ts.singles == 16 + 16 + 8;
+		if (kind == 1) good = good && ts.blocks == 3 && ts.singles == 0;
+		if (kind == 2) good = good && ts.blocks == 0 && ts.singles == 16 + 16 + 16;
+
+		test_unload(cpu);
+
+	}
+
+	return good;
+
+}
+
+
+
+// 1/3 under rounding and precision controls, stored as an extended real so that
+// the store adds no rounding of its own
+bool test_fpucontrol(void)
+{
+
+	static const u8 code[] = {
+		0xd9, 0x2e, 0x00, 0x00,  // fldcw  [0x00]
+		0xd9, 0xe8,              // fld1
+		0xde, 0x36, 0x02, 0x00,  // fidiv  word [0x02]
+		0xdb, 0x3e, 0x10, 0x00,  // fstp   tbyte [0x10]
+		0xf4                     // hlt
+	};
+
+	static const struct {
+		u16 control;
+		i16 divisor;
+		u64 sig;
+	} cases[] = {
+		{ 0x043f,  3, 0xaaaaaa0000000000ull },  // 24 bits, down
+		{ 0x083f, -3, 0xaaaaaa0000000000ull },  // 24 bits, up
+		{ 0x023f,  3, 0xaaaaaaaaaaaaa800ull },  // 53 bits, nearest
+		{ 0x0f3f,  3, 0xaaaaaaaaaaaaaaaaull },  // 64 bits, chop
+		{ 0x033f,  3, 0xaaaaaaaaaaaaaaabull }   // 64 bits, nearest
+	};
+
+	const struct test_machine tm = { .ds = 0x2000 };
+
+	bool good = true;
+
+	for (uint n=0; n < sizeof(cases) / sizeof(cases[0]); n++) {
+
+		i8086 *cpu = &test_cpus[0];
+
+		test_load(cpu, &tm, code, sizeof(code));
+		i8087_init(&cpu->fpu);
+
+		u8 *data = &cpu->memory.mem.base[tm.ds << 4];
+
+		memcpy(&data[0], &cases[n].control, 2);
+		memcpy(&data[2], &cases[n].divisor, 2);
+
+		i8086_run(cpu, 100);
+
+		u64 sig;
+		memcpy(&sig, &data[0x10], 8);
+
+		const uint exp = data[0x18] | data[0x19] << 8;
+
+		good = good && cpu->interrupt.halt && sig == cases[n].sig
+			&& exp == ((cases[n].divisor < 0)? 0xbffd: 0x3ffd);
+
+		test_unload(cpu);
+
+	}
+
+	return good;
+
+}
+
+
+
+// ESC sequences on an attached 8087, checked by what they leave in memory: each
+// memory format loaded and stored back, BCD, the FSAVE image and FRSTOR of it,
+// and the masked responses to an invalid operation and a divide by zero
+bool test_fpu(void)
+{
+
+	static const u8 code[] = {
+		0xdf, 0x06, 0x00, 0x00,  // fild   word  [0x00]
+		0xdf, 0x1e, 0x02, 0x00,  // fistp  word  [0x02]
+		0xdb, 0x06, 0x10, 0x00,  // fild   dword [0x10]
+		0xdb, 0x1e, 0x14, 0x00,  // fistp  dword [0x14]
+		0xdf, 0x2e, 0x20, 0x00,  // fild   qword [0x20]
+		0xdf, 0x3e, 0x28, 0x00,  // fistp  qword [0x28]
+		0xd9, 0x06, 0x30, 0x00,  // fld    dword [0x30]
+		0xd9, 0x1e, 0x34, 0x00,  // fstp   dword [0x34]
+		0xdd, 0x06, 0x40, 0x00,  // fld    qword [0x40]
+		0xdd, 0x1e, 0x48, 0x00,  // fstp   qword [0x48]
+		0xdb, 0x2e, 0x50, 0x00,  // fld    tbyte [0x50]
+		0xdb, 0x3e, 0x5a, 0x00,  // fstp   tbyte [0x5a]
+		0xdf, 0x26, 0x70, 0x00,  // fbld   [0x70]
+		0xdf, 0x36, 0x7a, 0x00,  // fbstp  [0x7a]
+		0xd9, 0x06, 0x90, 0x00,  // fld    dword [0x90]
+		0xdd, 0x1e, 0x98, 0x00,  // fstp   qword [0x98]
+		0xd9, 0xe8,              // fld1
+		0xd9, 0xe0,              // fchs
+		0xd9, 0xfa,              // fsqrt
+		0xdd, 0x3e, 0xa0, 0x00,  // fstsw  [0xa0]
+		0xdb, 0x3e, 0xb0, 0x00,  // fstp   tbyte [0xb0]
+		0xdb, 0xe2,              // fclex
+		0xd9, 0xe8,              // fld1
+		0xd9, 0xee,              // fldz
+		0xde, 0xf9,              // fdivp  st(1), st
+		0xdd, 0x3e, 0xa2, 0x00,  // fstsw  [0xa2]
+		0xdd, 0x1e, 0xc0, 0x00,  // fstp   qword [0xc0]
+		0xdb, 0xe2,              // fclex
+		0xdd, 0x3e, 0xa4, 0x00,  // fstsw  [0xa4]
+		0xd9, 0xeb,              // fldpi
+		0xd9, 0xe8,              // fld1
+		0xdd, 0x36, 0x00, 0x01,  // fsave  [0x100]
+		0xdd, 0x3e, 0xa6, 0x00,  // fstsw  [0xa6]
+		0xdd, 0x26, 0x00, 0x01,  // frstor [0x100]
+		0xdb, 0x3e, 0x60, 0x01,  // fstp   tbyte [0x160]
+		0xdb, 0x3e, 0x6a, 0x01,  // fstp   tbyte [0x16a]
+		0xf4                     // hlt
+	};
+
+	// Packed BCD, sign in the top byte
+	static const u8 bcd[10] = { 0x90, 0x78, 0x56, 0x34, 0x12, 0, 0, 0, 0, 0x80 };
+
+	// Extended precision one, pi and the indefinite the masked IE response gives
+	static const u8 one[10]   = { 0, 0, 0, 0, 0, 0, 0, 0x80, 0xff, 0x3f };
+	static const u8 pi[10]    = { 0x35, 0xc2, 0x68, 0x21, 0xa2, 0xda, 0x0f, 0xc9, 0x00, 0x40 };
+	static const u8 indef[10] = { 0, 0, 0, 0, 0, 0, 0, 0xc0, 0xff, 0xff };
+
+	const struct test_machine tm = { .ds = 0x2000 };
+
+	i8086 *cpu = &test_cpus[0];
+
+	test_load(cpu, &tm, code, sizeof(code));
+	i8087_init(&cpu->fpu);
+
+	u8 *data = &cpu->memory.mem.base[tm.ds << 4];
+
+	const i16         w = -12345;
+	const i32         d = -123456789;
+	const i64         q = -1234567890123456789ll;
+	const float       f = -1.5f;
+	const double      g = 3.141592653589793;
+	const long double x = 1.0L / 3;
+	const float       h = 1.5f;
+
+	memset(data, 0, 0x200);
+	memcpy(&data[0x00], &w, 2);
+	memcpy(&data[0x10], &d, 4);
+	memcpy(&data[0x20], &q, 8);
+	memcpy(&data[0x30], &f, 4);
+	memcpy(&data[0x40], &g, 8);
+	memcpy(&data[0x50], &x, 10);
+	memcpy(&data[0x70], bcd, 10);
+	memcpy(&data[0x90], &h, 4);
+
+	i8086_run(cpu, 1000);
+
+	const double widened = 1.5;
+	const u64    inf     = 0x7ff0000000000000ull;
+
+	u16 sw[4], cw, tag;
+
+	memcpy(sw,   &data[0xa0], 8);
+	memcpy(&cw,  &data[0x100], 2);
+	memcpy(&tag, &data[0x104], 2);
+
+	bool good = cpu->interrupt.halt;
+
+	// Every format stored back as it was loaded, m32 real widened to m64
+	good = good && memcmp(&data[0x02], &w, 2) == 0 && memcmp(&data[0x14], &d, 4) == 0;
+	good = good && memcmp(&data[0x28], &q, 8) == 0 && memcmp(&data[0x34], &f, 4) == 0;
+	good = good && memcmp(&data[0x48], &g, 8) == 0 && memcmp(&data[0x5a], &x, 10) == 0;
+	good = good && memcmp(&data[0x7a], bcd, 10) == 0 && memcmp(&data[0x98], &widened, 8) == 0;
+
+	// Masked IE gives the indefinite, masked ZE an infinity of the right sign,
+	// and FCLEX clears the exception flags only
+	good = good && (sw[0] & 0xff) == 0x01 && memcmp(&data[0xb0], indef, 10) == 0;
+	good = good && (sw[1] & 0xff) == 0x04 && memcmp(&data[0xc0], &inf, 8) == 0;
+	good = good && (sw[2] & 0x80ff) == 0;
+
+	// FSAVE: control, status with TOP 6, tags of ST(0) and ST(1) valid and the
+	// rest empty, then the registers from ST(0), and an 8087 reset after it
+	good = good && cw == 0x03ff && ((sw[3] >> 11) & 7) == 0 && (data[0x103] >> 3 & 7) == 6 && tag == 0x0fff;
+	good = good && memcmp(&data[0x10e], one, 10) == 0 && memcmp(&data[0x118], pi, 10) == 0;
+
+	// FRSTOR brought both back
+	good = good && memcmp(&data[0x160], one, 10) == 0 && memcmp(&data[0x16a], pi, 10) == 0;
+	good = good && cpu->fpu.empty == 0xff;
+
+	test_unload(cpu);
+
+	return good;
+
+}
+
+
+
+// Port accesses made by one CPU and by any other
+struct test_ports {
+
+	i8086 *cpu;
+	uint   seen, other;
+
+};
+
+
+// Port hook that counts them into a test_ports
+void test_port(void *data, i8086 *cpu, u16 port, uint mode, uint value)
+{
+
+	struct test_ports *tp = data;
+
+	if (cpu == tp->cpu) tp->seen++;
+	else                tp->other++;
+
+}
+
+
+// Ranges that run past the 2MB address space, wrapping u32 or not, are refused
+// rather than taken as points that can never hit. One ending on the last byte
+// is taken, and a breakpoint taken stops the run
+bool test_points(void)
+{
+
+	static const u8 code[] = {
+		0x90,                    // nop
+		0x90,                    // nop
+		0xf4                     // hlt
+	};
+
+	const struct test_machine tm = { .ds = 0x2000 };
+
+	i8086 *cpu = &test_cpus[0];
+
+	test_load(cpu, &tm, code, sizeof(code));
+
+	const u32 top = I8086_PAGES * 4096;
+
+	bool good = i8086_point_add(cpu, 0xfffffff0, 0x20, I8086_POINT_WRITE) < 0
+		&& i8086_point_add(cpu, top - 0x10, 0x20, I8086_POINT_WRITE) < 0
+		&& i8086_point_add(cpu, top - 1, 2, I8086_POINT_READ) < 0
+		&& i8086_point_add(cpu, top, 1, I8086_POINT_READ) < 0;
+
+	const int last = i8086_point_add(cpu, top - 1, 1, I8086_POINT_READ);
+
+	good = good && last >= 0;
+	i8086_point_remove(cpu, last);
+
+	good = good && i8086_point_add(cpu, TEST_CODE + 1, 1, I8086_POINT_EXEC) >= 0
+		&& i8086_run(cpu, 100) == I8086_STOP_BREAK && i8086_reg_get(cpu, REG_IP) == 1;
+
+	test_unload(cpu);
+
+	return good;
+
+}
+
+
+
+// Watchpoints stop the run after the access, with its address and mode: a byte
+// write next to a byte read that misses, a word read straddling into a watched
+// page, and a byte of a REP MOVSB that then resumes to the end
+bool test_watches(void)
+{
+
+	static const u8 code[] = {
+		0xa0, 0x11, 0x00,              // mov  al, [0x11]
+		0xc6, 0x06, 0x10, 0x00, 0x55,  // mov  byte [0x10], 0x55
+		0xa1, 0xff, 0x1f,              // mov  ax, [0x1fff]
+		0xbe, 0x00, 0x01,              // mov  si, 0x100
+		0xbf, 0x00, 0x02,              // mov  di, 0x200
+		0xb9, 0x10, 0x00,              // mov  cx, 16
+		0xfc,                          // cld
+		0xf3, 0xa4,                    // rep  movsb
+		0xf4                           // hlt
+	};
+
+	const struct test_machine tm = { .ds = 0x2000 };
+	const u32                 ds = tm.ds * 16;
+
+	i8086 *cpu = &test_cpus[0];
+
+	test_load(cpu, &tm, code, sizeof(code));
+
+	const int write = i8086_point_add(cpu, ds + 0x10,  1, I8086_POINT_WRITE);
+	const int page  = i8086_point_add(cpu, ds + 0x2000, 1, I8086_POINT_READ);
+	const int dest  = i8086_point_add(cpu, ds + 0x205, 1, I8086_POINT_WRITE);
+
+	bool good = write >= 0 && page >= 0 && dest >= 0;
+
+	good = good && i8086_run(cpu, 100) == I8086_STOP_WATCH && i8086_reg_get(cpu, REG_IP) == 8
+		&& cpu->debug.hit == write && cpu->debug.addr == ds + 0x10 && cpu->debug.mode == IO_WR8
+		&& cpu->memory.mem.base[ds + 0x10] == 0x55;
+
+	good = good && i8086_run(cpu, 100) == I8086_STOP_WATCH && i8086_reg_get(cpu, REG_IP) == 11
+		&& cpu->debug.hit == page && cpu->debug.addr == ds + 0x1fff && cpu->debug.mode == IO_RD16;
+
+	good = good && i8086_run(cpu, 100) == I8086_STOP_WATCH
+		&& cpu->debug.hit == dest && cpu->debug.addr == ds + 0x205 && cpu->debug.mode == IO_WR8
+		&& i8086_reg_get(cpu, REG_CX) == 10 && i8086_reg_get(cpu, REG_DI) == 0x206;
+
+	good = good && i8086_run(cpu, 100) == I8086_STOP_HALT && i8086_reg_get(cpu, REG_CX) == 0
+		&& !memcmp(&cpu->memory.mem.base[ds + 0x200], &cpu->memory.mem.base[ds + 0x100], 16);
+
+	test_unload(cpu);
+
+	return good;
+
+}
+
+
+
+// Code run from past 1MB with the A20 gate off is profiled and covered at the
+// physical address it wraps to, the one breakpoints take
+bool test_wrapdiag(void)
+{
+
+	static const u8 code[] = {
+		0x90,                    // nop
+		0x90,                    // nop
+		0xf4                     // hlt
+	};
+
+	const struct test_machine tm = { .ds = 0x2000 };
+
+	i8086 *cpu = &test_cpus[0];
+
+	struct i8086_profile  prof;
+	struct i8086_coverage cov;
+
+	if (!i8086_profile_init(&prof, 0))
+		return false;
+
+	if (!i8086_coverage_init(&cov)) {
+		i8086_profile_free(&prof);
+		return false;
+	}
+
+	test_load(cpu, &tm, code, sizeof(code));
+
+	// FFFF:1010 is TEST_CODE above 1MB
+	i8086_reg_set(cpu, REG_CS, 0xffff);
+	i8086_reg_set(cpu, REG_IP, TEST_CODE + 0x10);
+
+	i8086_profile_start(&prof, cpu);
+	i8086_run(cpu, 1);
+	i8086_profile_stop(&prof, cpu);
+
+	i8086_coverage_start(&cov, cpu);
+	i8086_run(cpu, 100);
+	i8086_coverage_stop(&cov, cpu);
+
+	const u32  next    = TEST_CODE + 1;
+	const bool covered = cov.bytes[next / 64] & 1ull << (next % 64);
+	const bool high    = cov.bytes[(next | 1 << 20) / 64] & 1ull << (next % 64);
+
+	const bool good = cpu->interrupt.halt
+		&& prof.insns[TEST_CODE] == 1 && prof.insns[TEST_CODE | 1 << 20] == 0
+		&& covered && !high;
+
+	i8086_coverage_free(&cov);
+	i8086_profile_free(&prof);
+	test_unload(cpu);
+
+	return good;
+
+}
+
+
+
+// A profile started over a port hook passes the ports on to it, and stopping
+// it puts the port hook back
+bool test_profilechain(void)
+{
+
+	static const u8 code[] = {
+		0xb0, 0x5a,              // mov  al, 0x5a
+		0xe6, 0x42,              // out  0x42, al
+		0xe5, 0x43,              // in   ax, 0x43
+		0xf4                     // hlt
+	};
+
+	struct test_ports    tp = { 0 };
+	struct i8086_profile prof;
+
+	const struct i8086_hooks  hooks = { .data = &tp, .port = &test_port };
+	const struct test_machine tm    = { .ds = 0x2000 };
+
+	i8086 *cpu = &test_cpus[0];
+
+	if (!i8086_profile_init(&prof, 0))
+		return false;
+
+	test_load(cpu, &tm, code, sizeof(code));
+
+	tp.cpu = cpu;
+
+	i8086_hook(cpu, &hooks);
+	i8086_profile_start(&prof, cpu);
+	i8086_run(cpu, 100);
+
+	bool good = cpu->interrupt.halt && tp.seen == 2 && i8086_reg_get(cpu, REG_AX) == 0xffff
+		&& prof.insns[TEST_CODE + 2] == 1 && prof.insns[TEST_CODE + 4] == 1;
+
+	i8086_profile_stop(&prof, cpu);
+
+	good = good && cpu->hooks == &hooks;
+
+	i8086_profile_free(&prof);
+	test_unload(cpu);
+
+	return good;
+
+}
+
+
+// Coverage started over a running profile: both count every instruction, and
+// stopping them in turn puts back first the profile, then no hooks at all
+bool test_coveragechain(void)
+{
+
+	static const u8 code[] = {
+		0x90,                    // nop
+		0x90,                    // nop
+		0xf4                     // hlt
+	};
+
+	struct i8086_profile  prof;
+	struct i8086_coverage cov;
+
+	const struct test_machine tm = { .ds = 0x2000 };
+
+	i8086 *cpu = &test_cpus[0];
+
+	if (!i8086_profile_init(&prof, 0))
+		return false;
+
+	if (!i8086_coverage_init(&cov)) {
+		i8086_profile_free(&prof);
+		return false;
+	}
+
+	test_load(cpu, &tm, code, sizeof(code));
+
+	i8086_profile_start(&prof, cpu);
+	i8086_coverage_start(&cov, cpu);
+	i8086_run(cpu, 100);
+
+	bool good = cpu->interrupt.halt
+		&& prof.insns[TEST_CODE] == 1 && prof.insns[TEST_CODE + 1] == 1
+		&& (cov.bytes[TEST_CODE / 64] >> (TEST_CODE % 64) & 3) == 3;
+
+	i8086_coverage_stop(&cov, cpu);
+	good = good && cpu->hooks == &prof.chain.hooks;
+
+	i8086_profile_stop(&prof, cpu);
+	good = good && cpu->hooks == NULL;
+
+	i8086_coverage_free(&cov);
+	i8086_profile_free(&prof);
+	test_unload(cpu);
+
+	return good;
+
+}
+
+
+// A copy shares the decode cache of the original. Switched to the 80186 it
+// takes C1 as a shift, where the 8088 that ran the same bytes first took it as
+// RET, so neither may use the other's decode
+bool test_sharedcache(void)
+{
+
+	static const u8 code[] = {
+		0xb8, 0x01, 0x00,        // mov  ax, 1
+		0xc1, 0xe0, 0x03,        // shl  ax, 3 on the 80186, ret on the 8088
+		0xf4                     // hlt
+	};
+
+	const struct test_machine tm = { .ds = 0x2000 };
+
+	i8086 *cpu  = &test_cpus[0];
+	i8086 *copy = &test_cpus[1];
+
+	test_load(cpu, &tm, code, sizeof(code));
+
+	memcpy(copy, cpu, sizeof(i8086));
+	i8086_model(copy, I8086_MODEL_80186);
+
+	i8086_run(cpu, 2);
+	i8086_run(copy, 3);
+
+	const bool good = copy->icache == cpu->icache
+		&& i8086_reg_get(cpu, REG_IP) != 6
+		&& copy->interrupt.halt && i8086_reg_get(copy, REG_AX) == 8;
+
+	test_unload(cpu);
+
+	return good;
+
+}
+
+
+
+// HLT stops the run past itself and the CPU stays halted until an interrupt
+// request it takes with IF set, whose handler returns after the HLT
+bool test_halt(void)
+{
+
+	static const u8 code[] = {
+		0xfb,                    // sti
+		0xf4,                    // hlt
+		0x43,                    // inc  bx
+		0xf4,                    // hlt
+		0, 0, 0, 0, 0, 0, 0, 0,
+		0, 0, 0, 0, 0, 0, 0, 0,
+		0, 0, 0, 0, 0, 0, 0, 0,
+		0, 0, 0, 0,
+		0x42,                    // inc  dx         at 0020, IRQ 8
+		0xcf                     // iret
+	};
+
+	const struct test_machine tm = { .regs[4] = 0x0100, .ds = 0x2000 };
+
+	i8086 *cpu = &test_cpus[0];
+
+	test_load(cpu, &tm, code, sizeof(code));
+
+	memcpy(&cpu->memory.mem.base[8 * 4], (const u8[]){ 0x20, 0x00, (TEST_CODE >> 4) & 0xff, TEST_CODE >> 12 }, 4);
+
+	bool good = i8086_run(cpu, 100) == I8086_STOP_HALT && i8086_reg_get(cpu, REG_IP) == 2;
+
+	const u64 cycles = cpu->cycles;
+
+	good = good && i8086_run(cpu, 100) == I8086_STOP_HALT && i8086_reg_get(cpu, REG_IP) == 2
+		&& cpu->interrupt.halt && cpu->cycles == cycles;
+
+	i8086_intrq(cpu, 0, 8);
+
+	good = good && i8086_run(cpu, 100) == I8086_STOP_HALT && i8086_reg_get(cpu, REG_IP) == 4
+		&& i8086_reg_get(cpu, REG_DX) == 1 && i8086_reg_get(cpu, REG_BX) == 1
+		&& i8086_reg_get(cpu, REG_SP) == 0x100
+		&& test_peekw(cpu, tm.ds, 0xfa) == 2 && test_peekw(cpu, tm.ds, 0xfc) == TEST_CODE >> 4;
+
+	test_unload(cpu);
+
+	return good;
+
+}
+
+
+// A memcpy() copy of a CPU with a port hook runs its IN and OUT through itself,
+// so the hook sees the copy and the original is left alone
+bool test_hookcopy(void)
+{
+
+	static const u8 code[] = {
+		0xb0, 0x5a,              // mov  al, 0x5a
+		0xe6, 0x42,              // out  0x42, al
+		0xe5, 0x43,              // in   ax, 0x43
+		0xf4                     // hlt
+	};
+
+	struct test_ports tp = { 0 };
+
+	const struct i8086_hooks  hooks = { .data = &tp, .port = &test_port };
+	const struct test_machine tm    = { .ds = 0x2000 };
+
+	i8086 *cpu  = &test_cpus[0];
+	i8086 *copy = &test_cpus[1];
+
+	test_load(cpu, &tm, code, sizeof(code));
+	i8086_hook(cpu, &hooks);
+
+	memcpy(copy, cpu, sizeof(i8086));
+
+	tp.cpu = copy;
+	i8086_run(copy, 100);
+
+	const bool good = copy->interrupt.halt && !cpu->interrupt.halt
+		&& i8086_reg_get(copy, REG_AX) == 0xffff && i8086_reg_get(cpu, REG_AX) == 0
+		&& tp.seen == 2 && tp.other == 0;
+
+	test_unload(cpu);
+
+	return good;
+
+}
+
+
+
+// Accesses or vectors a hook was called with, in order
+struct test_calls {
+
+	u32  addr[8];
+	uint mode[8];
+	uint value[8];
+	uint count;
+
+	u16 redirect;  // Handler offset in CS the interrupt hook sends INT 21h to
+
+};
+
+
+void test_memory(void *data, i8086 *cpu, u32 addr, uint mode, uint value)
+{
+
+	struct test_calls *tc = data;
+
+	if (tc->count < 8) {
+		tc->addr[tc->count]  = addr;
+		tc->mode[tc->count]  = mode;
+		tc->value[tc->count] = value;
+	}
+
+	tc->count++;
+
+}
+
+
+// Records the vector and points INT 21h elsewhere, the handler is read after
+void test_interrupt(void *data, i8086 *cpu, uint vector)
+{
+
+	struct test_calls *tc = data;
+
+	if (tc->count < 8)
+		tc->addr[tc->count] = vector;
+
+	if (vector == 0x21) {
+		cpu->memory.mem.base[0x21 * 4 + 0] = tc->redirect;
+		cpu->memory.mem.base[0x21 * 4 + 1] = tc->redirect >> 8;
+	}
+
+	tc->count++;
+
+}
+
+
+
+// A memory hook takes every data access off the fast path and sees each with
+// its value, code fetches aside. Removing it restores the fast path
+bool test_memoryhook(void)
+{
+
+	static const u8 code[] = {
+		0xa1, 0x10, 0x00,        // mov  ax, [0x10]
+		0x88, 0x06, 0x12, 0x00,  // mov  [0x12], al
+		0xf4                     // hlt
+	};
+
+	struct test_calls tc = { 0 };
+
+	const struct i8086_hooks  hooks = { .data = &tc, .memory = &test_memory };
+	const struct test_machine tm    = { .ds = 0x2000 };
+	const u32                 ds    = tm.ds * 16;
+
+	i8086 *cpu = &test_cpus[0];
+
+	test_load(cpu, &tm, code, sizeof(code));
+
+	cpu->memory.mem.base[ds + 0x10] = 0x34;
+	cpu->memory.mem.base[ds + 0x11] = 0x12;
+
+	i8086_hook(cpu, &hooks);
+
+	bool good = cpu->memory.limit == 0 && i8086_run(cpu, 2) == I8086_STOP_BUDGET
+		&& tc.count == 2
+		&& tc.addr[0] == ds + 0x10 && tc.mode[0] == IO_RD16 && tc.value[0] == 0x1234
+		&& tc.addr[1] == ds + 0x12 && tc.mode[1] == IO_WR8  && tc.value[1] == 0x34
+		&& cpu->memory.mem.base[ds + 0x12] == 0x34;
+
+	i8086_hook(cpu, NULL);
+
+	cpu->memory.mem.base[ds + 0x12] = 0;
+	i8086_reg_set(cpu, REG_IP, 0);
+
+	good = good && cpu->memory.limit == 65536 && i8086_run(cpu, 2) == I8086_STOP_BUDGET
+		&& tc.count == 2 && cpu->memory.mem.base[ds + 0x12] == 0x34;
+
+	test_unload(cpu);
+
+	return good;
+
+}
+
+
+
+// An interrupt hook sees the vector of each INT taken before the handler is
+// read, so it can change where it goes. Removed, INT goes by the table again
+bool test_interrupthook(void)
+{
+
+	static const u8 code[] = {
+		0xcd, 0x21,              // int  0x21
+		0xcc,                    // int3
+		0xf4,                    // hlt
+		0, 0, 0, 0, 0, 0, 0, 0,
+		0, 0, 0, 0, 0, 0, 0, 0,
+		0, 0, 0, 0, 0, 0, 0, 0,
+		0, 0, 0, 0,
+		0x43,                    // inc  bx         at 0020, the table's handler
+		0xcf,                    // iret
+		0, 0, 0, 0, 0, 0, 0, 0,
+		0, 0, 0, 0, 0, 0,
+		0x42,                    // inc  dx         at 0030, the hook's
+		0xcf                     // iret
+	};
+
+	struct test_calls tc = { .redirect = 0x30 };
+
+	const struct i8086_hooks  hooks = { .data = &tc, .interrupt = &test_interrupt };
+	const struct test_machine tm    = { .regs[4] = 0x0100, .ds = 0x2000 };
+
+	i8086 *cpu = &test_cpus[0];
+
+	test_load(cpu, &tm, code, sizeof(code));
+
+	u8 *ivt = cpu->memory.mem.base;
+
+	const u8 handler[4] = { 0x20, 0x00, (TEST_CODE >> 4) & 0xff, TEST_CODE >> 12 };
+
+	memcpy(&ivt[0x03 * 4], handler, 4);
+	memcpy(&ivt[0x21 * 4], handler, 4);
+
+	i8086_hook(cpu, &hooks);
+
+	bool good = i8086_run(cpu, 6) == I8086_STOP_BUDGET && i8086_reg_get(cpu, REG_IP) == 3
+		&& tc.count == 2 && tc.addr[0] == 0x21 && tc.addr[1] == 3
+		&& i8086_reg_get(cpu, REG_DX) == 1 && i8086_reg_get(cpu, REG_BX) == 1;
+
+	i8086_hook(cpu, NULL);
+
+	memcpy(&ivt[0x21 * 4], handler, 4);
+
+	i8086_reg_set(cpu, REG_IP, 0);
+	i8086_reg_set(cpu, REG_BX, 0);
+	i8086_reg_set(cpu, REG_DX, 0);
+
+	good = good && i8086_run(cpu, 3) == I8086_STOP_BUDGET && tc.count == 2
+		&& i8086_reg_get(cpu, REG_DX) == 0 && i8086_reg_get(cpu, REG_BX) == 1;
+
+	test_unload(cpu);
+
+	return good;
+
+}
+
+
+int main(int argc, char **argv)
+{
+
+	RAM ram;
+	i8086 cpu;
+
+	ram_alloc(&ram, 1*1024*1024);
+	i8086_init(&cpu);
+
+	cpu.memory.mem = ram;
+	cpu.iob = io_make(NULL, &ioport_rdwr, ioport_rdwr);
+	cpu.iow = io_make(NULL, &ioport_rdwr, ioport_rdwr);
+
+	cpu.undef = &test_undef;
+
+	memory_a20gate(&cpu.memory.mem, false); // A20 gate disable
+
+#ifdef I8086_JIT
+	i8086_jit_init(&cpu, 0, 1); // Translate every instruction on its own
+#endif
+
+
+	// Options come before the case files. --coverage=file writes out what the
+	// cases ran, see i8086_coverage_export(), --exhaustive checks the shift and
+	// rotate kernels on every 16-bit operand
+	struct i8086_coverage cov;
+
+	const char *coverage   = NULL;
+	bool        exhaustive = false;
+	int         first      = 1;
+
+	for (; first < argc && strncmp(argv[first], "--", 2) == 0; first++) {
+
+		if (strncmp(argv[first], "--coverage=", 11) == 0)
+			coverage = &argv[first][11];
+
+		else if (strcmp(argv[first], "--exhaustive") == 0)
+			exhaustive = true;
+
+	}
+
+
+	// Closed-form shift and rotate kernels against their bit-serial reference
+	const uint shifts = test_shifts(exhaustive);
+
+	if (shifts > 0) printf(TEXT_FAIL "Shift and rotate kernels: %u mismatches\n", shifts);
+	else            printf(TEXT_PASS "Shift and rotate kernels\n");
+
+	const uint shifts186 = test_186shifts();
+
+	if (shifts186 > 0) printf(TEXT_FAIL "80186 shifts by an immediate: %u mismatches\n", shifts186);
+	else               printf(TEXT_PASS "80186 shifts by an immediate\n");
+
+	if (test_186stack()) printf(TEXT_PASS "80186 PUSHA, POPA, PUSH immediate, ENTER and LEAVE\n");
+	else                 printf(TEXT_FAIL "80186 PUSHA, POPA, PUSH immediate, ENTER and LEAVE\n");
+
+	if (test_186bound()) printf(TEXT_PASS "80186 BOUND\n");
+	else                 printf(TEXT_FAIL "80186 BOUND\n");
+
+	if (test_186imul()) printf(TEXT_PASS "80186 IMUL by an immediate\n");
+	else                printf(TEXT_FAIL "80186 IMUL by an immediate\n");
+
+	if (test_186io()) printf(TEXT_PASS "80186 string port I/O\n");
+	else              printf(TEXT_FAIL "80186 string port I/O\n");
+
+	if (test_edges()) printf(TEXT_PASS "Memory operands at segment and memory ends\n");
+	else              printf(TEXT_FAIL "Memory operands at segment and memory ends\n");
+
+	if (test_memscan()) printf(TEXT_PASS "Scan and compare kernels\n");
+	else                printf(TEXT_FAIL "Scan and compare kernels\n");
+
+	if (test_selfmod()) printf(TEXT_PASS "Self-modifying code\n");
+	else                printf(TEXT_FAIL "Self-modifying code\n");
+
+	if (test_shiftcycles()) printf(TEXT_PASS "Cycles of shifts by CL\n");
+	else                    printf(TEXT_FAIL "Cycles of shifts by CL\n");
+
+	if (test_fpu()) printf(TEXT_PASS "ESC sequences on the 8087\n");
+	else            printf(TEXT_FAIL "ESC sequences on the 8087\n");
+
+	if (test_fpucontrol()) printf(TEXT_PASS "8087 rounding and precision control\n");
+	else                   printf(TEXT_FAIL "8087 rounding and precision control\n");
+
+	if (test_sharedcache()) printf(TEXT_PASS "Decode cache shared by two models\n");
+	else                    printf(TEXT_FAIL "Decode cache shared by two models\n");
+
+	if (test_halt()) printf(TEXT_PASS "HLT and the interrupt that resumes it\n");
+	else             printf(TEXT_FAIL "HLT and the interrupt that resumes it\n");
+
+	if (test_hookcopy()) printf(TEXT_PASS "Port hook on a copy of the CPU\n");
+	else                 printf(TEXT_FAIL "Port hook on a copy of the CPU\n");
+
+	if (test_memoryhook()) printf(TEXT_PASS "Memory hook\n");
+	else                   printf(TEXT_FAIL "Memory hook\n");
+
+	if (test_interrupthook()) printf(TEXT_PASS "Interrupt hook\n");
+	else                      printf(TEXT_FAIL "Interrupt hook\n");
+
+	if (test_points()) printf(TEXT_PASS "Breakpoint and watchpoint ranges\n");
+	else               printf(TEXT_FAIL "Breakpoint and watchpoint ranges\n");
+
+	if (test_watches()) printf(TEXT_PASS "Watchpoint hits\n");
+	else                printf(TEXT_FAIL "Watchpoint hits\n");
+
+	if (test_wrapdiag()) printf(TEXT_PASS "Profile and coverage of code past 1MB with A20 off\n");
+	else                 printf(TEXT_FAIL "Profile and coverage of code past 1MB with A20 off\n");
+
+	if (test_profilechain()) printf(TEXT_PASS "Profile chained on to a port hook\n");
+	else                     printf(TEXT_FAIL "Profile chained on to a port hook\n");
+
+	if (test_coveragechain()) printf(TEXT_PASS "Coverage chained on to a profile\n");
+	else                      printf(TEXT_FAIL "Coverage chained on to a profile\n");
+
+	u64        pairs   = 0;
+	const uint differ  = test_fusion(TEST_FUSION, &pairs);
+
+	if (differ > 0 || pairs == 0) printf(TEXT_FAIL "Fused pairs against single steps: %u programs differ, %llu pairs fused\n", differ, (unsigned long long)pairs);
+	else                          printf(TEXT_PASS "Fused pairs against single steps, %llu pairs fused\n", (unsigned long long)pairs);
+
+	u64        fused  = 0;
+	const uint failed = test_fuzz(TEST_FUZZ, &fused);
+
+	if (failed > 0) printf(TEXT_FAIL "Random programs against single steps: %u of %u differ\n", failed, TEST_FUZZ);
+	else            printf(TEXT_PASS "Random programs against single steps, %llu fused pairs\n", (unsigned long long)fused);
+
+	const uint batch = test_batch(TEST_BATCH);
+
+	if (batch > 0) printf(TEXT_FAIL "Batch lanes against serial runs: %u of %u differ\n", batch, TEST_BATCH);
+	else           printf(TEXT_PASS "Batch lanes against serial runs\n");
+
+
+	if (coverage != NULL) {
+
+		if (!i8086_coverage_init(&cov))
+			return 1;
+
+		i8086_coverage_start(&cov, &cpu);
+
+	}
+
+
+	struct test_report tr[argc];
+
+	test_init(&tr[0], "Total");
+
+	for (int n=first; n < argc; n++) {
+
+		test_init(&tr[n], argv[n]);
+		test_run_cases(&tr[n], &cpu, argv[n]);
+		test_aggregate(&tr[0], &tr[n]);
+
+	}
+
+	if (coverage != NULL) {
+
+		FILE *out = fopen(coverage, "w");
+
+		if (out != NULL) {
+			i8086_coverage_export(&cov, out);
+			fclose(out);
+		}
+
+		i8086_coverage_stop(&cov, &cpu);
+		i8086_coverage_free(&cov);
 
 	}
 
 	printf("\n");
 	printf("\n");
-	for (int n=1; n < argc; n++) {
+	for (int n=first; n < argc; n++) {
 
 		if (tr[n].tests_failed > 0)
 		test_summary(&tr[n]);
@@ -0,0 +1,259 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "core/types.h"
+
+#include "util/memscan.h"
+
+
+
+// The 32 byte steps are built for AVX2 on their own and only taken where the
+// host has it, the default build stops at SSE2. Each one moves *at over whole
+// blocks, forwards from it or backwards down to it, and leaves it on the byte
+// found or on the last block boundary reached
+#if defined(__x86_64__)
+
+[[gnu::target("avx2")]] static bool scan32(const u8 *p, size_t len, u8 v, bool eq, size_t *at)
+{
+
+	const __m256i vy   = _mm256_set1_epi8(v);
+	const u32     flip = eq? 0: 0xffffffff;
+
+	for (size_t n = *at; n + 32 <= len; n += 32, *at = n) {
+
+		const u32 m = (u32)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(p + n)), vy)) ^ flip;
+
+		if (m != 0) {
+			*at = n + __builtin_ctz(m);
+			return true;
+		}
+
+	}
+
+	return false;
+
+}
+
+
+[[gnu::target("avx2")]] static bool rscan32(const u8 *p, u8 v, bool eq, size_t *at)
+{
+
+	const __m256i vy   = _mm256_set1_epi8(v);
+	const u32     flip = eq? 0: 0xffffffff;
+
+	for (size_t n = *at; n >= 32; n -= 32, *at = n) {
+
+		const u32 m = (u32)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(p + n - 32)), vy)) ^ flip;
+
+		if (m != 0) {
+			*at = n - 1 - __builtin_clz(m);
+			return true;
+		}
+
+	}
+
+	return false;
+
+}
+
+
+[[gnu::target("avx2")]] static bool diff32(const u8 *pa, const u8 *pb, size_t len, bool eq, size_t *at)
+{
+
+	const u32 flip = eq? 0: 0xffffffff;
+
+	for (size_t n = *at; n + 32 <= len; n += 32, *at = n) {
+
+		const __m256i xa = _mm256_loadu_si256((const __m256i*)(pa + n));
+		const __m256i xb = _mm256_loadu_si256((const __m256i*)(pb + n));
+		const u32     m  = (u32)_mm256_movemask_epi8(_mm256_cmpeq_epi8(xa, xb)) ^ flip;
+
+		if (m != 0) {
+			*at = n + __builtin_ctz(m);
+			return true;
+		}
+
+	}
+
+	return false;
+
+}
+
+
+[[gnu::target("avx2")]] static bool rdiff32(const u8 *pa, const u8 *pb, bool eq, size_t *at)
+{
+
+	const u32 flip = eq? 0: 0xffffffff;
+
+	for (size_t n = *at; n >= 32; n -= 32, *at = n) {
+
+		const __m256i xa = _mm256_loadu_si256((const __m256i*)(pa + n - 32));
+		const __m256i xb = _mm256_loadu_si256((const __m256i*)(pb + n - 32));
+		const u32     m  = (u32)_mm256_movemask_epi8(_mm256_cmpeq_epi8(xa, xb)) ^ flip;
+
+		if (m != 0) {
+			*at = n - 1 - __builtin_clz(m);
+			return true;
+		}
+
+	}
+
+	return false;
+
+}
+
+#define HAVE_AVX2()  __builtin_cpu_supports("avx2")
+
+#else
+
+#define HAVE_AVX2()  false
+
+static bool scan32( const u8 *p, size_t len, u8 v, bool eq, size_t *at)            { return false; }
+static bool rscan32(const u8 *p, u8 v, bool eq, size_t *at)                        { return false; }
+static bool diff32( const u8 *pa, const u8 *pb, size_t len, bool eq, size_t *at)   { return false; }
+static bool rdiff32(const u8 *pa, const u8 *pb, bool eq, size_t *at)               { return false; }
+
+#endif
+
+
+
+size_t memscan(const void *buf, size_t len, u8 v, bool eq)
+{
+
+	const u8 *p = buf;
+	size_t    n = 0;
+
+	if (HAVE_AVX2() && scan32(p, len, v, eq, &n))
+		return n;
+
+#if defined(__SSE2__)
+	const __m128i vx   = _mm_set1_epi8(v);
+	const u32     flip = eq? 0: 0xffff;
+
+	for (; n + 16 <= len; n += 16) {
+
+		const u32 m = (u32)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(p + n)), vx)) ^ flip;
+
+		if (m != 0)
+			return n + __builtin_ctz(m);
+
+	}
+#endif
+
+	for (; n < len; n++)
+		if ((p[n] == v) == eq)
+			return n;
+
+	return len;
+
+}
+
+
+
+size_t memrscan(const void *buf, size_t len, u8 v, bool eq)
+{
+
+	const u8 *p = buf;
+	size_t    n = len;
+
+	if (HAVE_AVX2() && rscan32(p, v, eq, &n))
+		return n;
+
+#if defined(__SSE2__)
+	const __m128i vx   = _mm_set1_epi8(v);
+	const u32     flip = eq? 0: 0xffff;
+
+	for (; n >= 16; n -= 16) {
+
+		const u32 m = (u32)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(p + n - 16)), vx)) ^ flip;
+
+		if (m != 0)
+			return n - 16 + 31 - __builtin_clz(m);
+
+	}
+#endif
+
+	while (n-- > 0)
+		if ((p[n] == v) == eq)
+			return n;
+
+	return len;
+
+}
+
+
+
+size_t memdiff(const void *a, const void *b, size_t len, bool eq)
+{
+
+	const u8 *pa = a;
+	const u8 *pb = b;
+	size_t    n  = 0;
+
+	if (HAVE_AVX2() && diff32(pa, pb, len, eq, &n))
+		return n;
+
+#if defined(__SSE2__)
+	const u32 flip = eq? 0: 0xffff;
+
+	for (; n + 16 <= len; n += 16) {
+
+		const __m128i xa = _mm_loadu_si128((const __m128i*)(pa + n));
+		const __m128i xb = _mm_loadu_si128((const __m128i*)(pb + n));
+		const u32     m  = (u32)_mm_movemask_epi8(_mm_cmpeq_epi8(xa, xb)) ^ flip;
+
+		if (m != 0)
+			return n + __builtin_ctz(m);
+
+	}
+#endif
+
+	for (; n < len; n++)
+		if ((pa[n] == pb[n]) == eq)
+			return n;
+
+	return len;
+
+}
+
+
+
+size_t memrdiff(const void *a, const void *b, size_t len, bool eq)
+{
+
+	const u8 *pa = a;
+	const u8 *pb = b;
+	size_t    n  = len;
+
+	if (HAVE_AVX2() && rdiff32(pa, pb, eq, &n))
+		return n;
+
+#if defined(__SSE2__)
+	const u32 flip = eq? 0: 0xffff;
+
+	for (; n >= 16; n -= 16) {
+
+		const __m128i xa = _mm_loadu_si128((const __m128i*)(pa + n - 16));
+		const __m128i xb = _mm_loadu_si128((const __m128i*)(pb + n - 16));
+		const u32     m  = (u32)_mm_movemask_epi8(_mm_cmpeq_epi8(xa, xb)) ^ flip;
+
+		if (m != 0)
+			return n - 16 + 31 - __builtin_clz(m);
+
+	}
+#endif
+
+	while (n-- > 0)
+		if ((pa[n] == pb[n]) == eq)
+			return n;
+
+	return len;
+
+}
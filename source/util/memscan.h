@@ -0,0 +1,17 @@
+#ifndef UTIL_MEMSCAN_H
+#define UTIL_MEMSCAN_H
+
+
+// Index of the first (memscan) or last (memrscan) byte that is equal (eq) or
+// not equal (!eq) to v, or len if there is none
+size_t memscan( const void *buf, size_t len, u8 v, bool eq);
+size_t memrscan(const void *buf, size_t len, u8 v, bool eq);
+
+// Index of the first (memdiff) or last (memrdiff) position where a and b are
+// equal (eq) or differ (!eq), or len if there is none
+size_t memdiff( const void *a, const void *b, size_t len, bool eq);
+size_t memrdiff(const void *a, const void *b, size_t len, bool eq);
+
+
+#endif
+